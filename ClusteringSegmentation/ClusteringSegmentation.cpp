@@ -13,6 +13,8 @@
 #include "Util.h"
 #include "OpenCVUtil.h"
 #include "OpenCVIter.hpp"
+#include "Log.h"
+#include "Trace.h"
 #include "OpenCVHull.hpp"
 
 #include "Superpixel.h"
@@ -25,6 +27,7 @@
 #include "MergeSuperpixelImage.h"
 
 #include "srm.h"
+#include "SRMContext.hpp"
 
 #include "peakdetect.h"
 
@@ -33,6 +36,7 @@
 #include "RegionVectors.hpp"
 
 #include <stack>
+#include <thread>
 
 using namespace cv;
 using namespace std;
@@ -73,6 +77,8 @@ captureRegion(SuperpixelImage &spImage,
               int blockHeight,
               int superpixelDim,
               Mat &mask,
+              const cv::Rect &maskRect,
+              const cv::Rect &maskROI,
               const vector<Coord> &regionCoords,
               const vector<Coord> &srmRegionCoords,
               const Mat &blockBasedQuantMat);
@@ -155,7 +161,7 @@ Mat dumpQuantImage(string filename, const Mat &inputImg, uint32_t *pixels) {
     }
   }
   
-  imwrite(filename, quantOutputMat);
+  debugArtifactWrite(DebugArtifactBlocks, filename, quantOutputMat);
   cout << "wrote " << filename << endl;
   return quantOutputMat;
 }
@@ -164,6 +170,13 @@ Mat dumpQuantImage(string filename, const Mat &inputImg, uint32_t *pixels) {
 
 void dumpQuantTableImage(string filename, const Mat &inputImg, uint32_t *colortable, uint32_t numColortableEntries)
 {
+  // Quant tables are dumped while capturing regions, skip sorting and rendering
+  // the table when those images are not enabled.
+  
+  if (!debugArtifactEnabled(DebugArtifactCapture)) {
+    return;
+  }
+  
   // Write image that contains one color in each row in a N x 1 image
   
   Mat qtableOutputMat = Mat(numColortableEntries, 1, CV_8UC3);
@@ -215,7 +228,7 @@ void dumpQuantTableImage(string filename, const Mat &inputImg, uint32_t *colorta
     qtableOutputMat.at<Vec3b>(i, 0) = vec;
   }
   
-  imwrite(filename, qtableOutputMat);
+  debugArtifactWrite(DebugArtifactCapture, filename, qtableOutputMat);
   cout << "wrote " << filename << endl;
   return;
 }
@@ -224,76 +237,47 @@ void dumpQuantTableImage(string filename, const Mat &inputImg, uint32_t *colorta
 
 Mat generateSRM(const Mat &inputImg, double Q)
 {
+  SRMContext srmContext;
+  return generateSRM(srmContext, inputImg, Q);
+}
+
+Mat generateSRM(SRMContext &srmContext, const Mat &inputImg, double Q)
+{
+  TRACE_SPAN("generateSRM");
+  
   // SRM
   
   const bool debugOutput = false;
-  const bool debugDumpImage = true;
-  
-  int numPixels = inputImg.rows * inputImg.cols;
+  const bool debugDumpImage = debugArtifactEnabled(DebugArtifactSRM);
   
   assert(inputImg.channels() == 3);
   
-  const int channels = 3;
-  
-  uint8_t *in = new uint8_t[numPixels * channels]();
-  uint8_t *out = new uint8_t[numPixels * channels]();
-  
-  int i = 0;
-  for(int y = 0; y < inputImg.rows; y++) {
-    for(int x = 0; x < inputImg.cols; x++) {
-      Vec3b vec = inputImg.at<Vec3b>(y, x);
-      
-      uint8_t B = vec[0];
-      uint8_t G = vec[1];
-      uint8_t R = vec[2];
-      
-      if ((debugOutput)) {
-        char buffer[1024];
-        snprintf(buffer, sizeof(buffer), "for IN (%4d,%4d) pixel is 0x00%02X%02X%02X -> offset %d\n", x, y, R, G, B, i);
-        cout << buffer;
-      }
-      
-      in[(i*3)+0] = B;
-      in[(i*3)+1] = G;
-      in[(i*3)+2] = R;
-      i += 1;
-    }
-  }
-  
   //double Q = 512.0;
   //double Q = 255.0;
   
-  SRM(Q, inputImg.cols, inputImg.rows, channels, in, out, 0);
+  // SRM reads directly from the Mat pixels and writes the region means
+  // directly into outImg.
+  
+  Mat outImg;
   
-  Mat outImg = inputImg.clone();
-  outImg = (Scalar) 0;
+  srmContext.run(inputImg, Q, outImg);
   
   bool foundWhitePixel = false;
   uint32_t largestNonWhitePixel = 0x0;
   
-  i = 0;
   for(int y = 0; y < outImg.rows; y++) {
+    const Vec3b *outRow = outImg.ptr<Vec3b>(y);
     for(int x = 0; x < outImg.cols; x++) {
-      uint32_t B = out[(i*3)+0];
-      uint32_t G = out[(i*3)+1];
-      uint32_t R = out[(i*3)+2];
-      
-      i += 1;
+      uint32_t B = outRow[x][0];
+      uint32_t G = outRow[x][1];
+      uint32_t R = outRow[x][2];
       
       if ((debugOutput)) {
         char buffer[1024];
-        snprintf(buffer, sizeof(buffer), "for OUT (%4d,%4d) pixel is 0x00%02X%02X%02X -> offset %d\n", x, y, R, G, B, i);
+        snprintf(buffer, sizeof(buffer), "for OUT (%4d,%4d) pixel is 0x00%02X%02X%02X\n", x, y, R, G, B);
         cout << buffer;
       }
       
-      Vec3b vec;
-      
-      vec[0] = B;
-      vec[1] = G;
-      vec[2] = R;
-      
-      outImg.at<Vec3b>(y, x) = vec;
-      
       if (B == 0xFF && G == 0xFF && R == 0xFF) {
         foundWhitePixel = true;
       } else {
@@ -347,16 +331,115 @@ Mat generateSRM(const Mat &inputImg, double Q)
       fnameStream << "srm" << int(Q) << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, outImg);
+      debugArtifactWrite(DebugArtifactSRM, fname, outImg);
       cout << "wrote " << fname << endl;
   }
   
-  delete [] in;
-  delete [] out;
-  
   return outImg;
 }
 
+// Generate a SRM label Mat and the size and mean color of each label.
+
+Mat generateSRMLabels(const Mat &inputImg, double Q, vector<uint32_t> &labelSizes, vector<uint32_t> &labelColors)
+{
+  SRMContext srmContext;
+  return generateSRMLabels(srmContext, inputImg, Q, labelSizes, labelColors);
+}
+
+Mat generateSRMLabels(SRMContext &srmContext, const Mat &inputImg, double Q, vector<uint32_t> &labelSizes, vector<uint32_t> &labelColors)
+{
+  TRACE_SPAN("generateSRMLabels");
+  
+  const bool debugDumpImage = debugArtifactEnabled(DebugArtifactSRM);
+  
+  assert(inputImg.channels() == 3);
+  
+  Mat labels;
+  
+  vector<unsigned int> sizes;
+  vector<uint8_t> colors;
+  
+  int numLabels = srmContext.runLabels(inputImg, Q, labels, &sizes, &colors);
+  
+  labelSizes.resize(numLabels);
+  labelColors.resize(numLabels);
+  
+  for ( int i = 0; i < (int)numLabels; i++ ) {
+    uint32_t B = colors[(i*3)+0];
+    uint32_t G = colors[(i*3)+1];
+    uint32_t R = colors[(i*3)+2];
+    labelSizes[i] = sizes[i];
+    labelColors[i] = (R << 16) | (G << 8) | B;
+  }
+  
+  if (debugDumpImage) {
+    Mat outImg(inputImg.size(), CV_8UC3);
+    
+    for ( int y = 0; y < labels.rows; y++ ) {
+      const int32_t *labelsRow = labels.ptr<int32_t>(y);
+      Vec3b *outRow = outImg.ptr<Vec3b>(y);
+      for ( int x = 0; x < labels.cols; x++ ) {
+        outRow[x] = PixelToVec3b(labelColors[labelsRow[x]]);
+      }
+    }
+    
+    std::stringstream fnameStream;
+    fnameStream << "srm" << int(Q) << ".png";
+    string fname = fnameStream.str();
+    
+    debugArtifactWrite(DebugArtifactSRM, fname, outImg);
+    cout << "wrote " << fname << endl;
+  }
+  
+  return labels;
+}
+
+// Generate a SRM label Mat one tile at a time, memory use for the
+// segmentation is bounded by the tile size.
+
+Mat generateSRMTiled(const Mat &inputImg, double Q, int tileSize, int overlap, int &numLabels, unsigned int numThreads)
+{
+  TRACE_SPAN("generateSRMTiled");
+  
+  assert(inputImg.channels() == 3);
+  
+  const int channels = 3;
+  
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  
+  Mat labels(inputImg.rows, inputImg.cols, CV_32SC1);
+  
+  numLabels = (int) srm_run_tiled(Q, inputImg.cols, inputImg.rows, channels,
+                                  inputImg.step, inputImg.data,
+                                  labels.step, (int32_t*) labels.data,
+                                  tileSize, overlap, numThreads);
+  
+  return labels;
+}
+
+// Convert a label Mat to a tags Mat where each tag is the label plus 1
+
+Mat labelsToTags(const Mat &labels)
+{
+  assert(labels.type() == CV_32SC1);
+  
+  Mat tags(labels.size(), CV_8UC3);
+  
+  for ( int y = 0; y < labels.rows; y++ ) {
+    const int32_t *labelsRow = labels.ptr<int32_t>(y);
+    Vec3b *tagsRow = tags.ptr<Vec3b>(y);
+    for ( int x = 0; x < labels.cols; x++ ) {
+      int32_t tag = labelsRow[x] + 1;
+      assert(tag < 0x00FFFFFF);
+      tagsRow[x] = PixelToVec3b(tag);
+    }
+  }
+  
+  return tags;
+}
+
 // Generate a histogram for each block of 4x4 pixels in the input image.
 // This logic maps input pixels to an even quant division of the color cube
 // so that comparison based on the pixel frequency is easy on a region
@@ -368,8 +451,10 @@ Mat genHistogramsForBlocks(const Mat &inputImg,
                            int blockHeight,
                            int superpixelDim)
 {
+  TRACE_SPAN("genHistogramsForBlocks");
+  
   const bool debugOutput = false;
-  const bool dumpOutputImages = true;
+  const bool dumpOutputImages = debugArtifactEnabled(DebugArtifactBlocks);
   
   uint32_t width = inputImg.cols;
   uint32_t height = inputImg.rows;
@@ -564,7 +649,7 @@ Mat genHistogramsForBlocks(const Mat &inputImg,
   
   if (dumpOutputImages) {
     char *filename = (char*) "block_quant_output.png";
-    imwrite(filename, blockMat);
+    debugArtifactWrite(DebugArtifactBlocks, filename, blockMat);
     cout << "wrote " << filename << endl;
   }
   
@@ -585,13 +670,13 @@ estimateClusterCenters(const Mat & inputImg,
                        const vector<Coord> &regionCoords,
                        vector<uint32_t> &clusterCenters)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
   
   bool isVeryClose = false;
   
   if (debug) {
-    cout << "estimateClusterCenters" << endl;
+    LogLine() << "estimateClusterCenters";
   }
   
   // Quant to evenly spaced grid to get estimate for number of clusters N
@@ -642,7 +727,7 @@ estimateClusterCenters(const Mat & inputImg,
       uint32_t pixel = it->first;
       uint32_t count = it->second;
       
-      printf("count table[0x%08X] = %6d\n", pixel, count);
+      logPrintf("count table[0x%08X] = %6d\n", pixel, count);
     }
   }
   
@@ -665,8 +750,8 @@ estimateClusterCenters(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_quant_est_output" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
     }
 
     {
@@ -687,8 +772,8 @@ estimateClusterCenters(const Mat & inputImg,
         fnameStream << "srm" << "_tag_" << tag << "_quant_est_offsets" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, quantOffsetsMat);
-        cout << "wrote " << fname << endl;
+        debugArtifactWrite(DebugArtifactCapture, fname, quantOffsetsMat);
+        LogLine() << "wrote " << fname;
       }
     }
   }
@@ -721,19 +806,19 @@ estimateClusterCenters(const Mat & inputImg,
         uint32_t pixel = it->first;
         uint32_t count = it->second;
         
-        printf(" inUniqueTable[%5d] : 0x%08X -> %d\n", i, pixel, count);
+        logPrintf(" inUniqueTable[%5d] : 0x%08X -> %d\n", i, pixel, count);
       }
       for ( auto it = begin(outUniqueTable); it != end(outUniqueTable); ++it) {
         uint32_t pixel = it->first;
         uint32_t count = it->second;
         
-        printf("outUniqueTable[%5d] : 0x%08X -> %d\n", i, pixel, count);
+        logPrintf("outUniqueTable[%5d] : 0x%08X -> %d\n", i, pixel, count);
       }
     }
     
     if (inUniqueTable.size() == outUniqueTable.size()) {
       if (debug) {
-        cout << "estimateClusterCenters return since small num in pixels is exact maping for size " << inUniqueTable.size() << endl;
+        LogLine() << "estimateClusterCenters return since small num in pixels is exact maping for size " << inUniqueTable.size();
       }
 
       for ( auto &pair : inUniqueTable ) {
@@ -772,8 +857,8 @@ estimateClusterCenters(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_quant_est2_output" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -809,13 +894,13 @@ estimateClusterCenters(const Mat & inputImg,
       uint32_t deltaPixel = predict_trivial_component_sub(inPixel, outPixel);
       
       if (debug) {
-        printf("unique pixel delta 0x%08X -> 0x%08X = 0x%08X\n", inPixel, outPixel, deltaPixel);
+        logPrintf("unique pixel delta 0x%08X -> 0x%08X = 0x%08X\n", inPixel, outPixel, deltaPixel);
       }
       
       uint32_t absDeltaPixel = absPixel(deltaPixel);
       
       if (debug) {
-        printf("abs    pixel delta 0x%08X\n", absDeltaPixel);
+        logPrintf("abs    pixel delta 0x%08X\n", absDeltaPixel);
       }
       
       totalAbsComponentDeltas += absDeltaPixel;
@@ -843,26 +928,54 @@ estimateClusterCenters(const Mat & inputImg,
   return isVeryClose;
 }
 
+// Number of blocks the region is expanded by in morphRegionMask()
+
+static const int morphRegionExpandNum = 2;
+
+// Return a rectangle that contains every pixel that morphRegionMask() could return
+// for the region, this is the bounds of the blocks that coords touch expanded by
+// morphRegionExpandNum blocks on each side. Computing it is cheap since no blocks
+// are actually morphed.
+
+Rect morphRegionROI(const Mat & inputImg,
+                    const CoordSpans &coords,
+                    int superpixelDim)
+{
+  assert(coords.size() > 0);
+  
+  int32_t originX, originY, width, height;
+  bbox(originX, originY, width, height, coords);
+  
+  int minBlockX = originX / superpixelDim;
+  int minBlockY = originY / superpixelDim;
+  int maxBlockX = (originX + width - 1) / superpixelDim;
+  int maxBlockY = (originY + height - 1) / superpixelDim;
+  
+  int minX = maxi(0, (minBlockX - morphRegionExpandNum) * superpixelDim);
+  int minY = maxi(0, (minBlockY - morphRegionExpandNum) * superpixelDim);
+  int maxX = mini(inputImg.cols - 1, (maxBlockX + morphRegionExpandNum + 1) * superpixelDim - 1);
+  int maxY = mini(inputImg.rows - 1, (maxBlockY + morphRegionExpandNum + 1) * superpixelDim - 1);
+  
+  return Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+}
+
 // Morph the "region mask", this is basically a way to expand the 2D region around the shape
 // in a way that should capture pixels around the superpixel.
 
 void
 morphRegionMask(const Mat & inputImg,
                 int32_t tag,
-                const vector<Coord> &coords,
+                const CoordSpans &coords,
                 int blockWidth,
                 int blockHeight,
                 int superpixelDim,
                 vector<Coord> &regionCoords)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactBlocks);
   
-  if (debug) {
-    cout << "morphRegionMask" << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "morphRegionMask";
   
-  Mat expandedBlockMat = expandBlockRegion(tag, coords, 2, blockWidth, blockHeight, superpixelDim);
+  Mat expandedBlockMat = expandBlockRegion(tag, coords, morphRegionExpandNum, blockWidth, blockHeight, superpixelDim);
   
   // Map morph blocks back to rectangular ROI in original image and extract ROI
   
@@ -901,7 +1014,7 @@ morphRegionMask(const Mat & inputImg,
     fnameStream << "srm" << "_tag_" << tag << "_morph_block_input" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, roiInputMat);
+    debugArtifactWrite(DebugArtifactBlocks, fname, roiInputMat);
     cout << "wrote " << fname << endl;
   }
   
@@ -939,7 +1052,7 @@ morphRegionMask(const Mat & inputImg,
     fnameStream << "srm" << "_tag_" << tag << "_morph_block_bw" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, tmpExpandedBlockMat);
+    debugArtifactWrite(DebugArtifactBlocks, fname, tmpExpandedBlockMat);
     cout << "wrote " << fname << endl;
   }
   
@@ -992,7 +1105,7 @@ morphRegionMask(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_morph_masked_input" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
+      debugArtifactWrite(DebugArtifactBlocks, fname, tmpResultImg);
       cout << "wrote " << fname << endl;
     }
   }
@@ -1017,14 +1130,12 @@ morphRegionMask(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_morph_alpha_input" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
+      debugArtifactWrite(DebugArtifactBlocks, fname, tmpResultImg);
       cout << "wrote " << fname << endl;
     }
   }
   
-  if (debug) {
-    cout << "return morphRegionMask" << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "return morphRegionMask";
   
   return;
 }
@@ -1032,7 +1143,11 @@ morphRegionMask(const Mat & inputImg,
 // Given a tag indicating a superpixel generate a mask that captures the region in terms of
 // exact pixels. On input, the mask contains either 0x0 or 0xFF to indicate if a given
 // pixel was already consumed by a previous merge process. On return, the mask should contain
-// 0xFF for pixels that are known to be inside the region.
+// 0xFF for pixels that are known to be inside the region. The mask covers maskRect of
+// the image, this must contain morphRegionROI() for the region. Only pixels in
+// regionCoords are ever written, so only the bounding box of regionCoords is cleared
+// and it is returned in image coordinates in maskROI. Mask pixels outside of maskROI
+// are left as they were.
 
 bool
 captureRegionMask(SuperpixelImage &spImage,
@@ -1043,17 +1158,18 @@ captureRegionMask(SuperpixelImage &spImage,
                   int blockHeight,
                   int superpixelDim,
                   Mat &mask,
-                  const Mat &blockBasedQuantMat)
+                  const cv::Rect &maskRect,
+                  const Mat &blockBasedQuantMat,
+                  cv::Rect *maskROI)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  TRACE_SPAN("captureRegionMask", tag);
   
-  if (debug) {
-    cout << "captureRegionMask" << endl;
-  }
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
+  
+  LOG(LogModuleCapture, LogLevelDebug) << "captureRegionMask";
   
-  assert(mask.rows == inputImg.rows);
-  assert(mask.cols == inputImg.cols);
+  assert(mask.rows == maskRect.height);
+  assert(mask.cols == maskRect.width);
   assert(mask.channels() == 1);
   
   auto &coords = spImage.getSuperpixelPtr(tag)->coords;
@@ -1061,9 +1177,7 @@ captureRegionMask(SuperpixelImage &spImage,
   if (coords.size() <= ((superpixelDim*superpixelDim) >> 1)) {
     // A region contained in only a single block, don't process by itself
     
-    if (debug) {
-      cout << "captureRegionMask : region indicated by tag " << tag << " is too small to process with N coords " << coords.size() << endl;
-    }
+    LOG(LogModuleCapture, LogLevelDebug) << "captureRegionMask : region indicated by tag " << tag << " is too small to process with N coords " << coords.size();
     
     return false;
   }
@@ -1077,27 +1191,16 @@ captureRegionMask(SuperpixelImage &spImage,
   // be included in the regionCoords.
   
   if ((1)) {
-    unordered_map<Coord, bool> regionCoordsMap;
-    
-    for ( Coord c : regionCoords ) {
-      regionCoordsMap[c] = true;
-    }
-    
-    for ( int y = 0; y < mask.rows; y++ ) {
-      for ( int x = 0; x < mask.cols; x++ ) {
-        uint8_t bval = mask.at<uint8_t>(y, x);
-        if (bval != 0) {
-          // Do not consider this coord
-          Coord c(x, y);
-          regionCoordsMap.erase(c);
-        }
-      }
-    }
+    // Look up each region coord in the mask so that the cost depends on the
+    // region size and not on the image size.
     
     vector<Coord> trimRegionCoords;
+    trimRegionCoords.reserve(regionCoords.size());
     
     for ( Coord c : regionCoords ) {
-      if (regionCoordsMap.count(c) > 0) {
+      assert(maskRect.contains(Point(c.x, c.y)));
+      
+      if (mask.at<uint8_t>(c.y - maskRect.y, c.x - maskRect.x) == 0) {
         trimRegionCoords.push_back(c);
       }
     }
@@ -1126,16 +1229,43 @@ captureRegionMask(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_morph_minus_mask_alpha_input" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
         cout << "";
       }
     }
   }
   
+  // Only pixels in regionCoords are ever written, so only the bounding box
+  // of regionCoords is cleared and scanned instead of the whole mask.
+  
+  cv::Rect roi(0, 0, 0, 0);
+  
+  if (regionCoords.size() > 0) {
+    int minX = regionCoords[0].x;
+    int minY = regionCoords[0].y;
+    int maxX = minX;
+    int maxY = minY;
+    
+    for ( Coord c : regionCoords ) {
+      minX = mini(minX, c.x);
+      minY = mini(minY, c.y);
+      maxX = maxi(maxX, c.x);
+      maxY = maxi(maxY, c.y);
+    }
+    
+    roi = cv::Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+  }
+  
   // Init mask after possible early return
   
-  mask = (Scalar) 0;
+  if (roi.area() > 0) {
+    mask(roi - maskRect.tl()) = (Scalar) 0;
+  }
+  
+  if (maskROI != NULL) {
+    *maskROI = roi;
+  }
   
 //  vector<uint32_t> estClusterCenters;
 //  
@@ -1147,7 +1277,11 @@ captureRegionMask(SuperpixelImage &spImage,
 //    captureNotCloseRegion(spImage, inputImg, srmTags, tag, blockWidth, blockHeight, superpixelDim, mask, regionCoords, coords, (int)estClusterCenters.size(), blockBasedQuantMat);
 //  }
   
-  captureRegion(spImage, inputImg, srmTags, tag, blockWidth, blockHeight, superpixelDim, mask, regionCoords, coords, blockBasedQuantMat);
+  // The capture logic reads the region coords one by one, so they are expanded from row spans here
+  
+  vector<Coord> srmRegionCoords = coords.toVector();
+  
+  captureRegion(spImage, inputImg, srmTags, tag, blockWidth, blockHeight, superpixelDim, mask, maskRect, roi, regionCoords, srmRegionCoords, blockBasedQuantMat);
   
   // Capture mask output as alpha pixels
   
@@ -1155,9 +1289,9 @@ captureRegionMask(SuperpixelImage &spImage,
     Mat tmpResultImg(inputImg.rows, inputImg.cols, CV_8UC4);
     tmpResultImg = Scalar(0,0,0,0);
     
-    for ( int y = 0; y < tmpResultImg.rows; y++ ) {
-      for ( int x = 0; x < tmpResultImg.cols; x++ ) {
-        uint8_t isOn = mask.at<uint8_t>(y, x);
+    for ( int y = roi.y; y < (roi.y + roi.height); y++ ) {
+      for ( int x = roi.x; x < (roi.x + roi.width); x++ ) {
+        uint8_t isOn = mask.at<uint8_t>(y - maskRect.y, x - maskRect.x);
         
         if (isOn) {
           Vec3b vec = inputImg.at<Vec3b>(y, x);
@@ -1176,15 +1310,13 @@ captureRegionMask(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_morph_minus_mask_alpha_output" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
       cout << "wrote " << fname << endl;
       cout << "";
     }
   }
   
-  if (debug) {
-    cout << "return captureRegionMask" << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "return captureRegionMask";
   
   return true;
 }
@@ -1201,16 +1333,16 @@ captureRegion(SuperpixelImage &spImage,
               int blockHeight,
               int superpixelDim,
               Mat &mask,
+              const cv::Rect &maskRect,
+              const cv::Rect &maskROI,
               const vector<Coord> &regionCoords,
               const vector<Coord> &srmRegionCoords,
               const Mat &blockBasedQuantMat)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelDebug);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
   
-  if (debug) {
-    cout << "captureRegion " << tag << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "captureRegion " << tag;
   
   // Gather the tags associated with all the regions
   // indicated by regionCoords.
@@ -1228,12 +1360,11 @@ captureRegion(SuperpixelImage &spImage,
     allRegionTags.push_back(pair.first);
   }
   
-  if (debug) {
-    cout << "allRegionTags:" << endl;
+  if (logEnabled(LogModuleCapture, LogLevelTrace)) {
+    LogLine() << "allRegionTags:";
     for ( int32_t tag : allRegionTags ) {
-      cout << tag << endl;
+      LogLine() << tag;
     }
-    cout << "";
   }
   
   // How many edge would there be in the expanded regionCoords ?
@@ -1243,14 +1374,12 @@ captureRegion(SuperpixelImage &spImage,
   {
     vector<SuperpixelEdge> edges = getEdgesInRegion(spImage, srmTags, tag, regionCoords);
     
-    cout << "getEdgesInRegion returned " << edges.size() << " edges" << endl;
+    LOG(LogModuleCapture, LogLevelDebug) << "getEdgesInRegion returned " << edges.size() << " edges";
     
     for ( SuperpixelEdge edge : edges ) {
-      cout << "edge " << edge << endl;
+      LOG(LogModuleCapture, LogLevelTrace) << "edge " << edge;
     }
     
-    cout << "";
-    
     extendedRegionEdges = edges;
   }
   
@@ -1258,12 +1387,10 @@ captureRegion(SuperpixelImage &spImage,
     // No edges between regions, this would typically happen when a parent that contains
     // interior regions has already consumed all the interior region pixels.
     
-    if (debug) {
-      cout << "captureRegion returned region as mask since zero edges detected for tag " << tag << endl;
-    }
+    LOG(LogModuleCapture, LogLevelDebug) << "captureRegion returned region as mask since zero edges detected for tag " << tag;
     
     for ( Coord c : regionCoords ) {
-      mask.at<uint8_t>(c.y, c.x) = 0xFF;
+      mask.at<uint8_t>(c.y - maskRect.y, c.x - maskRect.x) = 0xFF;
     }
 
     return;
@@ -1516,7 +1643,7 @@ captureRegion(SuperpixelImage &spImage,
     fnameStream << "srm" << "_tag_" << tag << "_best_region_mask_blocks" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, blockMaskMat);
+    debugArtifactWrite(DebugArtifactCapture, fname, blockMaskMat);
     cout << "wrote " << fname << endl;
   }
   
@@ -1538,7 +1665,7 @@ captureRegion(SuperpixelImage &spImage,
     fnameStream << "srm" << "_tag_" << tag << "_best_region_alpha" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, tmpMat);
+    debugArtifactWrite(DebugArtifactCapture, fname, tmpMat);
     cout << "wrote " << fname << endl;
     cout << "";
   }
@@ -1584,7 +1711,7 @@ captureRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_tas_range" << tas.start << "_" << tas.end << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpMat);
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -1736,13 +1863,13 @@ captureRegion(SuperpixelImage &spImage,
     
     Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
     
-    vector<Coord> &insideCoords = spPtr->coords;
+    const CoordSpans &insideCoords = spPtr->coords;
     
     vector<Coord> combinedCoords;
     combinedCoords.reserve(outsideCoords.size() + insideCoords.size());
     
     append_to_vector(combinedCoords, outsideCoords);
-    append_to_vector(combinedCoords, insideCoords);
+    combinedCoords.insert(combinedCoords.end(), insideCoords.begin(), insideCoords.end());
     
     if (debugDumpImages) {
       Mat tmpMat(inputImg.size(), CV_8UC4);
@@ -1764,7 +1891,7 @@ captureRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_to_" << mostCommonOtherTag << "_combined" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpMat);
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -1827,7 +1954,7 @@ captureRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_to_" << mostCommonOtherTag << "_quant3_input" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
       }
       
@@ -1850,7 +1977,7 @@ captureRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_to_" << mostCommonOtherTag << "_quant3_output" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
       }
       
@@ -1951,7 +2078,7 @@ captureRegion(SuperpixelImage &spImage,
       string filename = fnameStream.str();
       
       char *outQuantTableFilename = (char*) filename.c_str();
-      imwrite(outQuantTableFilename, sortedQtableOutputMat);
+      debugArtifactWrite(DebugArtifactCapture, outQuantTableFilename, sortedQtableOutputMat);
       cout << "wrote " << outQuantTableFilename << endl;
     }
     
@@ -1999,7 +2126,7 @@ captureRegion(SuperpixelImage &spImage,
         string filename = fnameStream.str();
         
         char *outQuantFilename = (char*)filename.c_str();
-        imwrite(outQuantFilename, sortedQuantOutputMat);
+        debugArtifactWrite(DebugArtifactCapture, outQuantFilename, sortedQuantOutputMat);
         cout << "wrote " << outQuantFilename << endl;
       }
     }
@@ -2272,7 +2399,7 @@ captureRegion(SuperpixelImage &spImage,
         
         string fname = fnameStream.str();
         
-        imwrite(fname, qtableOutputMat);
+        debugArtifactWrite(DebugArtifactCapture, fname, qtableOutputMat);
         cout << "wrote " << fname << endl;
         cout << "";
       }
@@ -2307,7 +2434,7 @@ captureRegion(SuperpixelImage &spImage,
         
         string fname = fnameStream.str();
         
-        imwrite(fname, qtableOutputMat);
+        debugArtifactWrite(DebugArtifactCapture, fname, qtableOutputMat);
         cout << "wrote " << fname << endl;
         cout << "";
       }
@@ -2415,7 +2542,7 @@ captureRegion(SuperpixelImage &spImage,
       
       string fname = fnameStream.str();
       
-      imwrite(fname, qtableOutputMat);
+      debugArtifactWrite(DebugArtifactCapture, fname, qtableOutputMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -2453,7 +2580,7 @@ captureRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_to_" << mostCommonOtherTag << "_quant3_generated_output" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
       }
     }
@@ -2503,7 +2630,7 @@ captureRegion(SuperpixelImage &spImage,
         qtableOutputMat.at<Vec3b>(i, 1) = vec;
       }
       
-      imwrite(fname, qtableOutputMat);
+      debugArtifactWrite(DebugArtifactCapture, fname, qtableOutputMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -2520,7 +2647,7 @@ captureRegion(SuperpixelImage &spImage,
       bool isInside = pixelToInside[quantPixel].isInside;
       
       if (isInside) {
-        mask.at<uint8_t>(c.y, c.x) = 0xFF;
+        mask.at<uint8_t>(c.y - maskRect.y, c.x - maskRect.x) = 0xFF;
         
         if (debug && debugOnOff) {
           printf("pixel 0x%08X at (%5d,%5d) is marked on (inside)\n", quantPixel, c.x, c.y);
@@ -2540,13 +2667,18 @@ captureRegion(SuperpixelImage &spImage,
   // of the pixels.
   
   if ((1)) {
+    // Every pixel written to the mask is inside maskROI, the coords and
+    // roiRect below are relative to the mask and not to the image.
+    
+    Rect maskLocalROI = maskROI - maskRect.tl();
+    
     vector<Point> locations;
-    findNonZero(mask, locations);
+    findNonZero(mask(maskLocalROI), locations);
     
     vector<Coord> coords;
     
     for ( Point p : locations ) {
-      Coord c(p.x, p.y);
+      Coord c(maskLocalROI.x + p.x, maskLocalROI.y + p.y);
       coords.push_back(c);
     }
     
@@ -2555,25 +2687,27 @@ captureRegion(SuperpixelImage &spImage,
     Rect roiRect(originX, originY, regionWidth, regionHeight);
 
     Mat outDistMat;
-    outDistMat = Scalar(0);
     
     Coord roiCenter = findRegionCenter(mask, roiRect, outDistMat, tag);
-
-    Coord regionCenter(originX + roiCenter.x, originY + roiCenter.y);
     
-    Point2i center2i(regionCenter.x, regionCenter.y);
+    Point2i roiCenter2i(roiCenter.x, roiCenter.y);
+    
+    // The fill can only reach pixels that are on in the mask and these are
+    // all inside roiRect, so the scratch Mats only need to be ROI sized.
+    
+    Mat maskROIMat = mask(roiRect);
     
     if (debugDumpImages) {
       std::stringstream fnameStream;
       fnameStream << "srm" << "_tag_" << tag << "_pre_flood_region_mask" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, mask);
+      debugArtifactWrite(DebugArtifactCapture, fname, mask);
       cout << "wrote " << fname << endl;
       cout << "";
     }
     
-    Mat invMaskMat = mask.clone();
+    Mat invMaskMat = maskROIMat.clone();
     binMatInvert(invMaskMat);
 
     if (debugDumpImages) {
@@ -2581,31 +2715,18 @@ captureRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_pre_flood_inv_region_mask" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, invMaskMat);
+      debugArtifactWrite(DebugArtifactCapture, fname, invMaskMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
     
-    invMaskMat.at<uint8_t>(center2i.y, center2i.x) = 0xFF;
+    invMaskMat.at<uint8_t>(roiCenter2i.y, roiCenter2i.x) = 0xFF;
     
-    Mat outFloodMat = mask.clone();
-    outFloodMat = Scalar(0);
+    Mat outFloodMat(roiRect.size(), CV_8UC1, Scalar(0));
     
-    int numPixelsFilled = floodFillMask(invMaskMat, outFloodMat, center2i, 8);
+    int numPixelsFilled = floodFillMask(invMaskMat, outFloodMat, roiCenter2i, 8);
     assert(numPixelsFilled > 0);
     
-    if (debugDumpImages && false) {
-      Mat tmpResultImg = mask.clone();
-      
-      std::stringstream fnameStream;
-      fnameStream << "srm" << "_tag_" << tag << "_post_flood_region_mask" << ".png";
-      string fname = fnameStream.str();
-      
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
-      cout << "";
-    }
-    
     if (debugDumpImages) {
       Mat tmpResultImg = outFloodMat.clone();
       
@@ -2613,7 +2734,7 @@ captureRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_post_flood_out_mask" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -2621,7 +2742,7 @@ captureRegion(SuperpixelImage &spImage,
     // Any pixel that is on in mask but off in outFloodMat should be turned
     // off in mask since this pixel was not included in the flood fill.
     
-    assert(mask.size() == outFloodMat.size());
+    assert(maskROIMat.size() == outFloodMat.size());
     
     // Do dump that shows any pixels that should avtually be off because
     // they were not included in the flood mask.
@@ -2630,57 +2751,49 @@ captureRegion(SuperpixelImage &spImage,
       Mat tmpResultImg = outFloodMat.clone();
       int numRemoved = 0;
       
-      // Loop over each value in outFloodMat and set the output
-      // to 0xFF only in the case where the mask is on and the
+      // Set the output to 0xFF only in the case where the mask is on and the
       // flood mask is off.
       
-      for_each_byte(tmpResultImg, mask,
-                    [&numRemoved](uint8_t *floodBPtr, const uint8_t *maskBPtr)->void {
-                      uint8_t floodB = *floodBPtr;
-                      const uint8_t maskB = *maskBPtr;
-                      if (maskB && !floodB) {
-                        *floodBPtr = 0xFF;
-                        numRemoved++;
-                        //fprintf(stdout, "maskB %3d, floodB %3d -> %3d\n", maskB, floodB, *floodBPtr);
-                      } else {
-                        //fprintf(stdout, "maskB %3d, floodB %3d -> %3d\n", maskB, floodB, floodB);
-                      }
-                    });
+      for ( int y = 0; y < tmpResultImg.rows; y++ ) {
+        uint8_t *floodRowPtr = tmpResultImg.ptr<uint8_t>(y);
+        const uint8_t *maskRowPtr = maskROIMat.ptr<uint8_t>(y);
+        
+        for ( int x = 0; x < tmpResultImg.cols; x++ ) {
+          if (maskRowPtr[x] && !floodRowPtr[x]) {
+            floodRowPtr[x] = 0xFF;
+            numRemoved++;
+          }
+        }
+      }
       
       {
         std::stringstream fnameStream;
         fnameStream << "srm" << "_tag_" << tag << "_post_flood_out_mask_removed" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
         cout << "";
       }
       
-      if (debug) {
-        cout << "numRemoved " << numRemoved << endl;
-      }
+      LOG(LogModuleCapture, LogLevelDebug) << "numRemoved " << numRemoved;
     }
     
-    // Optimal impl that iterates over each Mat result and calls lambda with pointers
+    // maskROIMat is a view into mask so rows are not contiguous
     
-    for_each_byte(mask, outFloodMat,
-                     [](uint8_t *maskBPtr, const uint8_t *floodBPtr)->void {
-                       uint8_t maskB = *maskBPtr;
-                       uint8_t floodB = *floodBPtr;
-                       if (maskB && !floodB) {
-                         *maskBPtr = 0;
-                         //fprintf(stdout, "maskB %3d, floodB %3d -> %3d\n", maskB, floodB, *maskBPtr);
-                       } else {
-                         //fprintf(stdout, "maskB %3d, floodB %3d -> %3d\n", maskB, floodB, floodB);
-                       }
-                       return;
-                     });
+    for ( int y = 0; y < maskROIMat.rows; y++ ) {
+      uint8_t *maskRowPtr = maskROIMat.ptr<uint8_t>(y);
+      const uint8_t *floodRowPtr = outFloodMat.ptr<uint8_t>(y);
+      
+      for ( int x = 0; x < maskROIMat.cols; x++ ) {
+        if (maskRowPtr[x] && !floodRowPtr[x]) {
+          maskRowPtr[x] = 0;
+        }
+      }
+    }
   }
   
-  if (debug) {
-    cout << "return captureRegion" << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "return captureRegion";
   
   return;
 }
@@ -2705,11 +2818,12 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
                   const vector<Coord> &srmRegionCoords,
                   int estNumColors)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelDebug);
+  const bool trace = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
   
   if (debug) {
-    cout << "captureVeryCloseRegion" << endl;
+    LogLine() << "captureVeryCloseRegion";
   }
   
   int numPixels = (int)regionCoords.size();
@@ -2751,10 +2865,12 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
     mapSrcPixelToSRMTag[pixel] = srmTag;
   }
   
-  for ( auto &pair : mapSrcPixelToSRMTag ) {
-    uint32_t pixel = pair.first;
-    uint32_t srmTag = pair.second;
-    printf("pixel->srmTag table[0x%08X] = 0x%08X\n", pixel, srmTag);
+  if (trace) {
+    for ( auto &pair : mapSrcPixelToSRMTag ) {
+      uint32_t pixel = pair.first;
+      uint32_t srmTag = pair.second;
+      logPrintf("pixel->srmTag table[0x%08X] = 0x%08X\n", pixel, srmTag);
+    }
   }
   
   if (debugDumpImages) {
@@ -2776,8 +2892,8 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_srm_region_tags" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
   }
@@ -2807,8 +2923,8 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_quant_inside_output" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
     }
     
     {
@@ -2836,8 +2952,8 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_quant_inside_offsets" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, quantOffsetsMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, quantOffsetsMat);
+      LogLine() << "wrote " << fname;
     }
   }
   
@@ -2884,12 +3000,12 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
     if (isInside) {
       mask.at<uint8_t>(c.y, c.x) = 0xFF;
       
-      if (debug && debugOnOff) {
-        printf("pixel 0x%08X at (%5d,%5d) is marked on (inside)\n", quantPixel, c.x, c.y);
+      if (trace && debugOnOff) {
+        logPrintf("pixel 0x%08X at (%5d,%5d) is marked on (inside)\n", quantPixel, c.x, c.y);
       }
     } else {
-      if (debug && debugOnOff) {
-        printf("pixel 0x%08X at (%5d,%5d) is marked off (outside)\n", quantPixel, c.x, c.y);
+      if (trace && debugOnOff) {
+        logPrintf("pixel 0x%08X at (%5d,%5d) is marked off (outside)\n", quantPixel, c.x, c.y);
       }
     }
   }
@@ -2899,7 +3015,7 @@ captureVeryCloseRegion(SuperpixelImage &spImage,
   delete [] outPixels;
   
   if (debug) {
-    cout << "return captureVeryCloseRegion" << endl;
+    LogLine() << "return captureVeryCloseRegion";
   }
 }
 
@@ -2922,11 +3038,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
                        int estNumColors,
                       const Mat &blockBasedQuantMat)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelDebug);
+  const bool trace = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
   
   if (debug) {
-    cout << "captureNotCloseRegion " << tag << endl;
+    LogLine() << "captureNotCloseRegion " << tag;
   }
   
   int numPixels = (int)regionCoords.size();
@@ -2968,8 +3085,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     fnameStream << "srm" << "_tag_" << tag << "_block_mask" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, blockMaskMat);
-    cout << "wrote " << fname << endl;
+    debugArtifactWrite(DebugArtifactCapture, fname, blockMaskMat);
+    LogLine() << "wrote " << fname;
   }
   
   // Examine the region mask and check for the case of splay pixels
@@ -2984,12 +3101,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
   
   vector<uint32_t> sortedPixelKeys = sort_keys_by_count(pixelToNumVotesMap, true);
   
-  if (debug) {
+  if (trace) {
     for ( uint32_t pixel : sortedPixelKeys ) {
       uint32_t count = pixelToNumVotesMap[pixel];
-      fprintf(stdout, "0x%08X (%8d) -> %5d\n", pixel, pixel, count);
+      logPrintf("0x%08X (%8d) -> %5d\n", pixel, pixel, count);
     }
-    fprintf(stdout, "done\n");
+    logPrintf("done\n");
   }
   
   // Instead of a stddev type of approach, use peak logic to examine the counts
@@ -3013,12 +3130,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     sortedColortable.push_back(pixel);
   }
   
-  if (debug) {
+  if (trace) {
     for ( uint32_t pixel : sortedColortable ) {
       uint32_t count = pixelToNumVotesMap[pixel];
-      fprintf(stdout, "0x%08X (%8d) -> %5d\n", pixel, pixel, count);
+      logPrintf("0x%08X (%8d) -> %5d\n", pixel, pixel, count);
     }
-    fprintf(stdout, "done\n");
+    logPrintf("done\n");
   }
   
   // Dump sorted pixel data as a CSV file, with int value and hex rep of int value for readability
@@ -3028,7 +3145,7 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     fnameStream << "srm" << "_tag_" << tag << "_quant_table_sorted" << ".csv";
     string fname = fnameStream.str();
     
-    FILE *fout = fopen(fname.c_str(), "w+");
+    FILE *fout = fopen(debugArtifactPath(fname).c_str(), "w+");
     
     for ( uint32_t pixel : sortedColortable ) {
       uint32_t count = pixelToNumVotesMap[pixel];
@@ -3037,7 +3154,7 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     }
     
     fclose(fout);
-    cout << "wrote " << fname << endl;
+    LogLine() << "wrote " << fname;
   }
   
   if (debugDumpImages) {
@@ -3046,8 +3163,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     string filename = fnameStream.str();
     
     char *outQuantTableFilename = (char*) filename.c_str();
-    imwrite(outQuantTableFilename, sortedQtableOutputMat);
-    cout << "wrote " << outQuantTableFilename << endl;
+    debugArtifactWrite(DebugArtifactCapture, outQuantTableFilename, sortedQtableOutputMat);
+    LogLine() << "wrote " << outQuantTableFilename;
   }
   
   // Use peak detection logic to examine the 1D histogram in sorted order so as to find the
@@ -3140,7 +3257,7 @@ captureNotCloseRegion(SuperpixelImage &spImage,
   const int numClusters = N;
   
   if (debug) {
-    cout << "numClusters detected as " << numClusters << endl;
+    LogLine() << "numClusters detected as " << numClusters;
   }
   
   uint32_t *colortable = new uint32_t[numClusters];
@@ -3170,8 +3287,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_quant_output" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
     }
     
     // table
@@ -3217,8 +3334,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     }
 #endif // DEBUG
     
-    if (debug) {
-      fprintf(stdout, "numClusters %5d : numActualClusters %5d \n", numClusters, numActualClusters);
+    if (trace) {
+      logPrintf("numClusters %5d : numActualClusters %5d \n", numClusters, numActualClusters);
       
       unordered_map<uint32_t, uint32_t> seen;
       
@@ -3227,9 +3344,9 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         pixel = colortable[i];
         
         if (seen.count(pixel) > 0) {
-          fprintf(stdout, "cmap[%3d] = 0x%08X (DUP of %d)\n", i, pixel, seen[pixel]);
+          logPrintf("cmap[%3d] = 0x%08X (DUP of %d)\n", i, pixel, seen[pixel]);
         } else {
-          fprintf(stdout, "cmap[%3d] = 0x%08X\n", i, pixel);
+          logPrintf("cmap[%3d] = 0x%08X\n", i, pixel);
           
           // Note that only the first seen index is retained, this means that a repeated
           // pixel value is treated as a dup.
@@ -3238,7 +3355,7 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         }
       }
       
-      fprintf(stdout, "cmap contains %3d unique entries\n", (int)seen.size());
+      logPrintf("cmap contains %3d unique entries\n", (int)seen.size());
       
       int numQuantUnique = (int)seen.size();
       
@@ -3270,8 +3387,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       string filename = fnameStream.str();
       
       char *outQuantTableFilename = (char*) filename.c_str();
-      imwrite(outQuantTableFilename, sortedQtableOutputMat);
-      cout << "wrote " << outQuantTableFilename << endl;
+      debugArtifactWrite(DebugArtifactCapture, outQuantTableFilename, sortedQtableOutputMat);
+      LogLine() << "wrote " << outQuantTableFilename;
     }
     
     // Map pixels to sorted colortable offset
@@ -3296,10 +3413,10 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       assert(pixel_to_sorted_offset.count(pixel) > 0);
       uint32_t offset = pixel_to_sorted_offset[pixel];
       
-      if ((debug) && false) {
+      if ((trace) && false) {
         char buffer[1024];
         snprintf(buffer, sizeof(buffer), "for (%4d,%4d) pixel is %d -> offset %d\n", c.x, c.y, pixel, offset);
-        cout << buffer;
+        logPrintf("%s", buffer);
       }
       
       assert(offset <= 256);
@@ -3316,8 +3433,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       string filename = fnameStream.str();
       
       char *outQuantFilename = (char*)filename.c_str();
-      imwrite(outQuantFilename, sortedQuantOutputMat);
-      cout << "wrote " << outQuantFilename << endl;
+      debugArtifactWrite(DebugArtifactCapture, outQuantFilename, sortedQuantOutputMat);
+      LogLine() << "wrote " << outQuantFilename;
     }
   }
   
@@ -3353,8 +3470,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       
       for ( uint32_t pixel : peakPixels ) {
         pixel = pixel & 0x00FFFFFF;
-        if (debug) {
-          printf("peak[%5d] = 0x%08X\n", i, pixel);
+        if (trace) {
+          logPrintf("peak[%5d] = 0x%08X\n", i, pixel);
         }
         Vec3b vec = PixelToVec3b(pixel);
         outputMat.at<Vec3b>(i, 0) = vec;
@@ -3366,11 +3483,11 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       outputMat.at<Vec3b>(i, 0) = centerOfMass;
       
       if (debug) {
-        printf("peak com = 0x%02X%02X%02X\n", centerOfMass[0], centerOfMass[1], centerOfMass[2]);
+        logPrintf("peak com = 0x%02X%02X%02X\n", centerOfMass[0], centerOfMass[1], centerOfMass[2]);
       }
       
-      imwrite(fname, outputMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, outputMat);
+      LogLine() << "wrote " << fname;
     }
   }
   
@@ -3419,12 +3536,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     Vec3b comMinusUnit(round(comMinusUnitF[0]), round(comMinusUnitF[1]), round(comMinusUnitF[2]));
     
     if (debug) {
-      cout << "centerOfMassF " << centerOfMassF << endl;
-      cout << "colinearF " << colinearF << endl;
-      cout << "comPlusUnitF " << comPlusUnitF << endl;
-      cout << "comMinusUnitF " << comMinusUnitF << endl;
-      cout << "comPlusUnit " << comPlusUnit << endl;
-      cout << "comMinusUnit " << comMinusUnit << endl;
+      LogLine() << "centerOfMassF " << centerOfMassF;
+      LogLine() << "colinearF " << colinearF;
+      LogLine() << "comPlusUnitF " << comPlusUnitF;
+      LogLine() << "comMinusUnitF " << comMinusUnitF;
+      LogLine() << "comPlusUnit " << comPlusUnit;
+      LogLine() << "comMinusUnit " << comMinusUnit;
     }
     
     for (int i = 0; i < 300; i++) {
@@ -3450,8 +3567,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       for ( Vec3b vec : allRegionPoints ) {
         uint32_t pixel = Vec3BToUID(vec);
         pixel = pixel & 0x00FFFFFF;
-        if (debug) {
-          printf("peak[%5d] = 0x%08X\n", i, pixel);
+        if (trace) {
+          logPrintf("peak[%5d] = 0x%08X\n", i, pixel);
         }
         //Vec3b vec = PixelToVec3b(pixel);
         outputMat.at<Vec3b>(i, 0) = vec;
@@ -3463,15 +3580,15 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       for ( Vec3b vec : linePoints ) {
         outputMat.at<Vec3b>(i, 0) = vec;
         
-        if (debug) {
-          printf("line point %5d = 0x%02X%02X%02X\n", i, vec[0], vec[1], vec[2]);
+        if (trace) {
+          logPrintf("line point %5d = 0x%02X%02X%02X\n", i, vec[0], vec[1], vec[2]);
         }
         
         i += 1;
       }
       
-      imwrite(fname, outputMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, outputMat);
+      LogLine() << "wrote " << fname;
     }
   }
   
@@ -3527,12 +3644,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     Vec3b comMinusUnit(round(comMinusUnitF[0]), round(comMinusUnitF[1]), round(comMinusUnitF[2]));
     
     if (debug) {
-      cout << "centerOfMassF " << centerOfMassF << endl;
-      cout << "colinearF " << colinearF << endl;
-      cout << "comPlusUnitF " << comPlusUnitF << endl;
-      cout << "comMinusUnitF " << comMinusUnitF << endl;
-      cout << "comPlusUnit " << comPlusUnit << endl;
-      cout << "comMinusUnit " << comMinusUnit << endl;
+      LogLine() << "centerOfMassF " << centerOfMassF;
+      LogLine() << "colinearF " << colinearF;
+      LogLine() << "comPlusUnitF " << comPlusUnitF;
+      LogLine() << "comMinusUnitF " << comMinusUnitF;
+      LogLine() << "comPlusUnit " << comPlusUnit;
+      LogLine() << "comMinusUnit " << comMinusUnit;
     }
     
     if (onlyLineOutput == false) {
@@ -3554,16 +3671,16 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         if (comPlusUnitF[0] <= 255 && comPlusUnitF[1] <= 255 && comPlusUnitF[0] <= 255) {
           linePoints.push_back(comPlusUnit);
           
-          if (debug) {
-            cout << "comPlusUnit " << comPlusUnit << endl;
+          if (trace) {
+            LogLine() << "comPlusUnit " << comPlusUnit;
           }
         }
         
         if (comMinusUnitF[0] >= 0 && comMinusUnitF[1] >= 0 && comMinusUnitF[0] >= 0) {
           linePoints.push_back(comMinusUnit);
           
-          if (debug) {
-            cout << "comMinusUnit " << comMinusUnit << endl;
+          if (trace) {
+            LogLine() << "comMinusUnit " << comMinusUnit;
           }
         }
       }
@@ -3595,8 +3712,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         for ( Vec3b vec : quantPoints ) {
           uint32_t pixel = Vec3BToUID(vec);
           pixel = pixel & 0x00FFFFFF;
-          if (debug) {
-            printf("quant[%5d] = 0x%08X\n", i, pixel);
+          if (trace) {
+            logPrintf("quant[%5d] = 0x%08X\n", i, pixel);
           }
           //Vec3b vec = PixelToVec3b(pixel);
           outputMat.at<Vec3b>(i, 0) = vec;
@@ -3610,15 +3727,15 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       for ( Vec3b vec : linePoints ) {
         outputMat.at<Vec3b>(i, 0) = vec;
         
-        if (debug) {
-          printf("line point %5d = 0x%02X%02X%02X\n", i, vec[0], vec[1], vec[2]);
+        if (trace) {
+          logPrintf("line point %5d = 0x%02X%02X%02X\n", i, vec[0], vec[1], vec[2]);
         }
         
         i += 1;
       }
       
-      imwrite(fname, outputMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, outputMat);
+      LogLine() << "wrote " << fname;
     }
   }
   
@@ -3641,8 +3758,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       
       for ( uint32_t pixel : peakPixels ) {
         pixel = pixel & 0x00FFFFFF;
-        if (debug) {
-          printf("peak[%5d] = 0x%08X\n", i, pixel);
+        if (trace) {
+          logPrintf("peak[%5d] = 0x%08X\n", i, pixel);
         }
         i += 1;
       }
@@ -3658,12 +3775,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         if (pixelToQuantCountTable.count(pixel) == 0) {
           pixelToQuantCountTable[pixel] = 0;
           
-          if (debug) {
-            printf("added peak pixel 0x%08X\n", pixel);
+          if (trace) {
+            logPrintf("added peak pixel 0x%08X\n", pixel);
           }
         } else {
-          if (debug) {
-            printf("colortable already contains peak pixel 0x%08X\n", pixel);
+          if (trace) {
+            logPrintf("colortable already contains peak pixel 0x%08X\n", pixel);
           }
         }
         
@@ -3671,14 +3788,14 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         
         xyzDelta(prevPeak, pixel, sR, sG, sB);
         
-        if (debug) {
-          printf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", prevPeak, pixel, sR, sG, sB);
+        if (trace) {
+          logPrintf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", prevPeak, pixel, sR, sG, sB);
         }
         
         xyzDeltaToUnitVector(sR, sG, sB);
         
-        if (debug) {
-          printf("unit vector (%5d %5d %5d)\n", sR, sG, sB);
+        if (trace) {
+          logPrintf("unit vector (%5d %5d %5d)\n", sR, sG, sB);
         }
         
         if (1) {
@@ -3701,14 +3818,14 @@ captureNotCloseRegion(SuperpixelImage &spImage,
             
             xyzDelta(pixel, nextPeak, sR, sG, sB);
             
-            if (debug) {
-              printf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", pixel, nextPeak, sR, sG, sB);
+            if (trace) {
+              logPrintf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", pixel, nextPeak, sR, sG, sB);
             }
             
             xyzDeltaToUnitVector(sR, sG, sB);
             
-            if (debug) {
-              printf("unit vector (%5d %5d %5d)\n", sR, sG, sB);
+            if (trace) {
+              logPrintf("unit vector (%5d %5d %5d)\n", sR, sG, sB);
             }
             
             // Add vector to current pixel
@@ -3717,8 +3834,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
             Vec3f deltaVec(sB, sG, sR);
             Vec3f sumVec = curVec + deltaVec;
             
-            if (debug) {
-              cout << "cur + delta = booekend : " << curVec << " + " << deltaVec << " = " << sumVec << endl;
+            if (trace) {
+              LogLine() << "cur + delta = booekend : " << curVec << " + " << deltaVec << " = " << sumVec;
             }
             
             uint32_t B = round(sumVec[0]);
@@ -3730,12 +3847,12 @@ captureNotCloseRegion(SuperpixelImage &spImage,
             if (pixelToQuantCountTable.count(bePixel) == 0) {
               pixelToQuantCountTable[bePixel] = 0;
               
-              if (debug) {
-                printf("added bookend pixel 0x%08X\n", bePixel);
+              if (trace) {
+                logPrintf("added bookend pixel 0x%08X\n", bePixel);
               }
             } else {
-              if (debug) {
-                printf("colortable already contains bookend pixel 0x%08X\n", bePixel);
+              if (trace) {
+                logPrintf("colortable already contains bookend pixel 0x%08X\n", bePixel);
               }
             }
             
@@ -3762,7 +3879,7 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     }
     
     if (debug) {
-      cout << "numActualClusters was " << numActualClusters << " while output numColors is " << numColors << endl;
+      LogLine() << "numActualClusters was " << numActualClusters << " while output numColors is " << numColors;
     }
     
     // Resort cluster centers
@@ -3801,10 +3918,10 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       dumpQuantTableImage(fname, inputImg, colortable, numColors);
     }
   
-  if (debug) {
+  if (trace) {
     for ( int i = 0; i < numColors; i++) {
       uint32_t pixel = colortable[i];
-      fprintf(stdout, "colortable[%5d] = 0x%08X\n", i, pixel);
+      logPrintf("colortable[%5d] = 0x%08X\n", i, pixel);
     }
   }
     
@@ -3833,8 +3950,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_quant_output2" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
-        cout << "wrote " << fname << endl;
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+        LogLine() << "wrote " << fname;
       }
     }
     
@@ -3875,8 +3992,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         qtableOutputMat.at<Vec3b>(i, 1) = vec;
       }
       
-      imwrite(fname, qtableOutputMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, qtableOutputMat);
+      LogLine() << "wrote " << fname;
     }
   
   // Determine the dominate vector(s) as we iterate through the colortable
@@ -3896,7 +4013,10 @@ captureNotCloseRegion(SuperpixelImage &spImage,
   
   for ( int i = 0; i < numColors; i++) {
     uint32_t pixel = resortedColortable[i];
-    fprintf(stdout, "resorted colortable[%5d] = 0x%08X\n", i, pixel);
+    
+    if (trace) {
+      logPrintf("resorted colortable[%5d] = 0x%08X\n", i, pixel);
+    }
     
     int prevSize = (int) currentVecPtr->size();
     currentVecPtr->push_back(pixel);
@@ -3912,14 +4032,14 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       
       xyzDelta(prevPixel, pixel, sR, sG, sB);
       
-      if (debug) {
-        printf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", prevPixel, pixel, sR, sG, sB);
+      if (trace) {
+        logPrintf("peakToPeakDelta 0x%08X -> 0x%08X = (%d %d %d)\n", prevPixel, pixel, sR, sG, sB);
       }
       
       Vec3f unitVec = xyzDeltaToUnitVec3f(sR, sG, sB);
       
-      if (debug) {
-        cout << "unit vector " << unitVec << endl;
+      if (trace) {
+        LogLine() << "unit vector " << unitVec;
       }
 
       currentVecOfVec3bPtr->push_back(unitVec);
@@ -3928,12 +4048,14 @@ captureNotCloseRegion(SuperpixelImage &spImage,
     prevPixel = pixel;
   }
 
-  for ( uint32_t pixel : *currentVecPtr ) {
-    printf("0x%08X\n", pixel);
-  }
-  
-  for ( Vec3f vec : *currentVecOfVec3bPtr ) {
-    cout << "vec " << vec << endl;
+  if (trace) {
+    for ( uint32_t pixel : *currentVecPtr ) {
+      logPrintf("0x%08X\n", pixel);
+    }
+    
+    for ( Vec3f vec : *currentVecOfVec3bPtr ) {
+      LogLine() << "vec " << vec;
+    }
   }
   
 //  Should see this set of vectors as shifting from one
@@ -3985,8 +4107,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       fnameStream << "srm" << "_tag_" << tag << "_srm_region_decrease_mask" << "1" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4009,8 +4131,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_srm_region_decrease_alpha_mask" << "1" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, alphaMaskResultImg);
-        cout << "wrote " << fname << endl;
+        debugArtifactWrite(DebugArtifactCapture, fname, alphaMaskResultImg);
+        LogLine() << "wrote " << fname;
         cout << "";
       }
     }
@@ -4049,8 +4171,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_srm_region_decrease_mask" << i << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
-        cout << "wrote " << fname << endl;
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+        LogLine() << "wrote " << fname;
         cout << "";
       }
       
@@ -4075,15 +4197,15 @@ captureNotCloseRegion(SuperpixelImage &spImage,
           fnameStream << "srm" << "_tag_" << tag << "_srm_region_decrease_alpha_mask" << i << ".png";
           string fname = fnameStream.str();
           
-          imwrite(fname, alphaMaskResultImg);
-          cout << "wrote " << fname << endl;
+          debugArtifactWrite(DebugArtifactCapture, fname, alphaMaskResultImg);
+          LogLine() << "wrote " << fname;
           cout << "";
         }
       }
 
     }
     
-    cout << "done" << endl;
+    LogLine() << "done";
     
     
     // Call decrease white logic over and over until no more white area is left.
@@ -4120,8 +4242,8 @@ captureNotCloseRegion(SuperpixelImage &spImage,
         fnameStream << "srm" << "_tag_" << tag << "_srm_region_increase_mask" << i << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
-        cout << "wrote " << fname << endl;
+        debugArtifactWrite(DebugArtifactCapture, fname, tmpResultImg);
+        LogLine() << "wrote " << fname;
         cout << "";
       }
       
@@ -4146,15 +4268,15 @@ captureNotCloseRegion(SuperpixelImage &spImage,
           fnameStream << "srm" << "_tag_" << tag << "_srm_region_increase_alpha_mask" << i << ".png";
           string fname = fnameStream.str();
           
-          imwrite(fname, alphaMaskResultImg);
-          cout << "wrote " << fname << endl;
+          debugArtifactWrite(DebugArtifactCapture, fname, alphaMaskResultImg);
+          LogLine() << "wrote " << fname;
           cout << "";
         }
       }
       
     }
     
-    cout << "done" << endl;
+    LogLine() << "done";
 
   }
   
@@ -4200,18 +4322,18 @@ captureNotCloseRegion(SuperpixelImage &spImage,
       if (isInside) {
         mask.at<uint8_t>(c.y, c.x) = 0xFF;
         
-        if (debug && debugOnOff) {
-          printf("pixel 0x%08X at (%5d,%5d) is marked on (inside)\n", quantPixel, c.x, c.y);
+        if (trace && debugOnOff) {
+          logPrintf("pixel 0x%08X at (%5d,%5d) is marked on (inside)\n", quantPixel, c.x, c.y);
         }
       } else {
-        if (debug && debugOnOff) {
-          printf("pixel 0x%08X at (%5d,%5d) is marked off (outside)\n", quantPixel, c.x, c.y);
+        if (trace && debugOnOff) {
+          logPrintf("pixel 0x%08X at (%5d,%5d) is marked off (outside)\n", quantPixel, c.x, c.y);
         }
       }
     }
     
     if (debug) {
-      cout << "return captureNotCloseRegion" << endl;
+      LogLine() << "return captureNotCloseRegion";
     }
   
   delete [] colortable;
@@ -4234,8 +4356,8 @@ void insideOutsideTest(int32_t width,
                        const vector<uint32_t> &sortedColortable,
                        unordered_map<uint32_t, InsideOutsideRecord> &pixelToInsideMap)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleInsideOutside, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactInsideOutside);
   
   // Create region mask as byte mask
   
@@ -4251,7 +4373,7 @@ void insideOutsideTest(int32_t width,
     fnameStream << "srm" << "_tag_" << tag << "_srm_region_mask" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, isInsideMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, fname, isInsideMask);
     cout << "wrote " << fname << endl;
     cout << "";
   }
@@ -4265,7 +4387,7 @@ void insideOutsideTest(int32_t width,
     uint32_t quantPixel = outPixels[i];
     
     if (debug && 0) {
-      printf("quantPixel 0x%08X\n", quantPixel);
+      logPrintf("quantPixel 0x%08X\n", quantPixel);
     }
     
     InsideOutsideRecord &inOut = pixelToInsideMap[quantPixel];
@@ -4300,7 +4422,7 @@ void insideOutsideTest(int32_t width,
     InsideOutsideRecord &inOut = pixelToInsideMap[pixel];
     
     if (debug) {
-      printf("inout table[0x%08X] = (in out) (%5d %5d)\n", pixel, inOut.inside, inOut.outside);
+      logPrintf("inout table[0x%08X] = (in out) (%5d %5d)\n", pixel, inOut.inside, inOut.outside);
     }
     
     float percentOn = (float)inOut.inside / (inOut.inside + inOut.outside);
@@ -4308,7 +4430,7 @@ void insideOutsideTest(int32_t width,
     inOut.confidence = percentOn;
     
     if (debug) {
-      printf("percent on [0x%08X] = %0.3f\n", pixel, percentOn);
+      logPrintf("percent on [0x%08X] = %0.3f\n", pixel, percentOn);
     }
     
     if (percentOn > 0.5f) {
@@ -4318,12 +4440,12 @@ void insideOutsideTest(int32_t width,
     }
     
     if (debug) {
-      printf("pixelToInsideMap[0x%08X].isInside = %d\n", pixel, inOut.isInside);
+      logPrintf("pixelToInsideMap[0x%08X].isInside = %d\n", pixel, inOut.isInside);
     }
   }
   
   if (debug) {
-    printf("done voting\n");
+    logPrintf("done voting\n");
   }
   
   // Dump the colortable in sorted order
@@ -4334,26 +4456,26 @@ void insideOutsideTest(int32_t width,
     uint32_t pixel = sortedColortable[i];
     
     if (debug) {
-      printf("colortable[%5d] = 0x%08X\n", i, pixel);
+      logPrintf("colortable[%5d] = 0x%08X\n", i, pixel);
     }
     
     uint32_t deltaPixel = predict_trivial_component_sub(prevPixel, pixel);
     
     if (debug) {
-      printf("pixel delta 0x%08X -> 0x%08X = 0x%08X\n", prevPixel, pixel, deltaPixel);
+      logPrintf("pixel delta 0x%08X -> 0x%08X = 0x%08X\n", prevPixel, pixel, deltaPixel);
     }
     
     uint32_t absDeltaPixel = absPixel(deltaPixel);
     
     if (debug) {
-      printf("abs    pixel delta 0x%08X : %d %d %d\n", absDeltaPixel, (int)((absDeltaPixel >> 16)&0xFF), (int)((absDeltaPixel >> 8)&0xFF), (int)((absDeltaPixel >> 0)&0xFF));
+      logPrintf("abs    pixel delta 0x%08X : %d %d %d\n", absDeltaPixel, (int)((absDeltaPixel >> 16)&0xFF), (int)((absDeltaPixel >> 8)&0xFF), (int)((absDeltaPixel >> 0)&0xFF));
     }
     
     prevPixel = pixel;
   }
   
   if (debug) {
-    printf("done measure table diff\n");
+    logPrintf("done measure table diff\n");
   }
   
   // Print in/out state for each ordered table pixel
@@ -4368,7 +4490,7 @@ void insideOutsideTest(int32_t width,
     bool isInside = pixelToInsideMap[pixel].isInside;
     
     if (debug) {
-      printf("colortable[%5d] = 0x%08X : isInside %d\n", i, pixel, isInside);
+      logPrintf("colortable[%5d] = 0x%08X : isInside %d\n", i, pixel, isInside);
     }
   }
   
@@ -4404,7 +4526,7 @@ void insideOutsideTest(int32_t width,
 //  percent on [0x00178000] = 1.000
   
   if (debug) {
-    printf("done in out boolean\n");
+    logPrintf("done in out boolean\n");
   }
   
   return;
@@ -4416,7 +4538,7 @@ void insideOutsideTest(int32_t width,
 vector<uint32_t> gatherPeakPixels(const vector<uint32_t> & pixels,
                                   unordered_map<uint32_t, uint32_t> & pixelToNumVotesMap)
 {
-  const bool debug = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
   
   vector<uint32_t> peakPixels;
   
@@ -4488,13 +4610,13 @@ vector<uint32_t> gatherPeakPixels(const vector<uint32_t> & pixels,
   }
   
   if (debug) {
-    fprintf(stdout, "num emi_peaks %d\n", emi_count);
+    logPrintf("num emi_peaks %d\n", emi_count);
   }
   
   for(i = 0; i < emi_count; ++i) {
     int offset = emi_peaks[i];
     if (debug) {
-      fprintf(stdout, "%5d : %5d,%5d\n", offset, (int)data[0][offset], (int)data[1][offset]);
+      logPrintf("%5d : %5d,%5d\n", offset, (int)data[0][offset], (int)data[1][offset]);
     }
     
     uint32_t pixel = (uint32_t) round(data[0][offset]);
@@ -4502,13 +4624,13 @@ vector<uint32_t> gatherPeakPixels(const vector<uint32_t> & pixels,
   }
   
   if (debug) {
-    fprintf(stdout, "num absorp_peaks %d\n", absorp_count);
+    logPrintf("num absorp_peaks %d\n", absorp_count);
   }
   
   for(i = 0; i < absorp_count; ++i) {
     int offset = absorp_peaks[i];
     if (debug) {
-      fprintf(stdout, "%5d : %5d,%5d\n", offset, (int)data[0][offset],(int)data[1][offset]);
+      logPrintf("%5d : %5d,%5d\n", offset, (int)data[0][offset],(int)data[1][offset]);
     }
   }
   
@@ -4528,12 +4650,12 @@ clockwiseScanForTagsAroundShape(
                                 const vector<Coord> &regionCoords,
                                 vector<TagsAroundShape> &tagsAroundVec)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   const bool debugDumpStepImages = false;
   
   if (debug) {
-    cout << "clockwiseScanForTagsAroundShape " << tag << endl;
+    LogLine() << "clockwiseScanForTagsAroundShape " << tag;
   }
   
   // The tagsImg mat contains tags, so generate lines around the 360 degrees
@@ -4567,8 +4689,8 @@ clockwiseScanForTagsAroundShape(
     fnameStream << "srm" << "_tag_" << tag << "_region_outline_coords" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, renderMat);
-    cout << "wrote " << fname << endl;
+    debugArtifactWrite(DebugArtifactShape, fname, renderMat);
+    LogLine() << "wrote " << fname;
     cout << "";
   }
   
@@ -4586,7 +4708,7 @@ clockwiseScanForTagsAroundShape(
     }
     tagMap[c] = inRegionTag;
     if (debug) {
-      cout << "add mapping for " << c << " -> " << vec << endl;
+      LogLine() << "add mapping for " << c << " -> " << vec;
     }
   }
   
@@ -4651,7 +4773,7 @@ clockwiseScanForTagsAroundShape(
     line(renderMat, center, edgePoint, Scalar(0xFF));
     
     if (debug) {
-      cout << "render center line from " << center << " to " << edgePoint << endl;
+      LogLine() << "render center line from " << center << " to " << edgePoint;
     }
     
     if (debugDumpImages && debugDumpStepImages) {
@@ -4659,8 +4781,8 @@ clockwiseScanForTagsAroundShape(
       fnameStream << "srm" << "_tag_" << tag << "_step" << stepi << "_region_vec" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, renderMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, renderMat);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4687,8 +4809,8 @@ clockwiseScanForTagsAroundShape(
       fnameStream << "srm" << "_tag_" << tag << "_step" << stepi << "_region_input_tags_roi" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, regionRoiMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, regionRoiMat);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4706,8 +4828,8 @@ clockwiseScanForTagsAroundShape(
       fnameStream << "srm" << "_tag_" << tag << "_step" << stepi << "_region_input_tags" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, allTagsOn);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, allTagsOn);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4727,8 +4849,8 @@ clockwiseScanForTagsAroundShape(
       fnameStream << "srm" << "_tag_" << tag << "_step" << stepi << "_hits_for_tag_vec" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, renderMat);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, renderMat);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4750,8 +4872,8 @@ clockwiseScanForTagsAroundShape(
       fnameStream << "srm" << "_tag_" << tag << "_step" << stepi << "_hit_tags_for_tag_vec" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, allTagsHit);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, allTagsHit);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
     
@@ -4768,11 +4890,11 @@ clockwiseScanForTagsAroundShape(
   }
   
   if (debug) {
-    cout << "all tags found around region" << endl;
+    LogLine() << "all tags found around region";
     
     for ( auto & pair : allTagsCombined ) {
       int32_t regionTag = pair.first;
-      printf("tag = 0x%08X aka %d\n", regionTag, regionTag);
+      logPrintf("tag = 0x%08X aka %d\n", regionTag, regionTag);
     }
   }
   
@@ -4790,7 +4912,7 @@ clockwiseScanForTagsAroundShape(
         allTagsHit.at<Vec3b>(c.y, c.x) = vec;
         
         if (debug) {
-          printf("found region tag %9d at coord (%5d, %5d)\n", regionTag, c.x, c.y);
+          logPrintf("found region tag %9d at coord (%5d, %5d)\n", regionTag, c.x, c.y);
         }
       }
     }
@@ -4799,8 +4921,8 @@ clockwiseScanForTagsAroundShape(
     fnameStream << "srm" << "_tag_" << tag << "_hit_tags_in_scan_region" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, allTagsHit);
-    cout << "wrote " << fname << endl;
+    debugArtifactWrite(DebugArtifactShape, fname, allTagsHit);
+    LogLine() << "wrote " << fname;
     cout << "";
   }
   
@@ -4811,7 +4933,7 @@ clockwiseScanForTagsAroundShape(
   
   for ( stepi = 0 ; stepi < stepMax; ) {
     if (debug) {
-      cout << "consider stepi " << stepi << endl;
+      LogLine() << "consider stepi " << stepi;
     }
     
     set<int32_t> &currentSet = allTagSetsForVectors[stepi];
@@ -4825,16 +4947,16 @@ clockwiseScanForTagsAroundShape(
       
       if (currentSet == nextSet) {
         if (debug && true) {
-          cout << "same set for step " << nextStepi << endl;
+          LogLine() << "same set for step " << nextStepi;
         }
         if (debug && false) {
-          cout << "set 1" << endl;
+          LogLine() << "set 1";
           for ( int32_t tag : currentSet ) {
-            cout << tag << endl;
+            LogLine() << tag;
           }
-          cout << "set 2" << endl;
+          LogLine() << "set 2";
           for ( int32_t tag : nextSet ) {
-            cout << tag << endl;
+            LogLine() << tag;
           }
         }
       } else {
@@ -4846,7 +4968,7 @@ clockwiseScanForTagsAroundShape(
     // Range is (stepi, nextStepi)
     
     if (debug) {
-      cout << "step same range (" << stepi << "," << nextStepi << ")" << endl;
+      LogLine() << "step same range (" << stepi << "," << nextStepi << ")";
     }
     
     tagsAroundVec.push_back(TagsAroundShape());
@@ -4885,7 +5007,7 @@ clockwiseScanForTagsAroundShape(
 #endif // DEBUG
       
       if (debug) {
-        cout << "allCoordForVectors[" << i << "] num coords " << allCoordForVectors[i].size() << endl;
+        LogLine() << "allCoordForVectors[" << i << "] num coords " << allCoordForVectors[i].size();
       }
       
       for ( Coord c : allCoordForVectors[i] ) {
@@ -4928,7 +5050,7 @@ clockwiseScanForTagsAroundShape(
       
       if (firstSet == lastSet) {
         if (debug) {
-          cout << "first and last range sets are the same" << endl;
+          LogLine() << "first and last range sets are the same";
         }
         
         assert(tagsAroundVec.size() > 0);
@@ -5006,7 +5128,7 @@ clockwiseScanForTagsAroundShape(
   } // end if more than 1 segment block
   
   if (debug) {
-    cout << "return clockwiseScanForTagsAroundShape " << tag << " with N = " << tagsAroundVec.size() << " ranges" << endl;
+    LogLine() << "return clockwiseScanForTagsAroundShape " << tag << " with N = " << tagsAroundVec.size() << " ranges";
   }
   
   return;
@@ -5016,7 +5138,7 @@ clockwiseScanForTagsAroundShape(
 
 vector<Coord> genRectangleOutline(int regionWidth, int regionHeight)
 {
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   vector<Coord> outlineCoords;
   
@@ -5115,11 +5237,11 @@ void calcNormalsOnContour(CvSize size,
                           vector<Point2f> &contourNormals,
                           vector<vector<Point2f> > &contourNormalCoords)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
-    cout << "calcNormalsOnContour " << tag << endl;
+    LogLine() << "calcNormalsOnContour " << tag;
   }
   
   contourNormals.clear();
@@ -5136,7 +5258,7 @@ void calcNormalsOnContour(CvSize size,
     assert(contourNormals.size() == contour.size());
     
     if (debug) {
-      cout << "zero out " << contourNormals.size() << " contourNormals" << endl;
+      LogLine() << "zero out " << contourNormals.size() << " contourNormals";
     }
   }
   
@@ -5191,10 +5313,10 @@ void calcNormalsOnContour(CvSize size,
   // Util lambda that will determine the slope for a position by ave of L and R slopes
   
   auto aveSlope = [&normalUnitVecTable, &contour, &contourNormals](int offset)->Point2f {
-    const bool debug = true;
+    const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
     
     if (debug) {
-      cout << "aveSlope starting at offset " << offset << endl;
+      LogLine() << "aveSlope starting at offset " << offset;
     }
     
     // Walk backwards until a normal is found
@@ -5260,23 +5382,23 @@ void calcNormalsOnContour(CvSize size,
       const Point2i pL = contour[actualOffsetL];
       const Point2i pR = contour[actualOffsetR];
       
-      printf("Coord on Left  (%d,%d) from offset %d\n", pL.x, pL.y, actualOffsetL);
-      printf("Coord on Right (%d,%d) from offset %d\n", pR.x, pR.y, actualOffsetR);
+      logPrintf("Coord on Left  (%d,%d) from offset %d\n", pL.x, pL.y, actualOffsetL);
+      logPrintf("Coord on Right (%d,%d) from offset %d\n", pR.x, pR.y, actualOffsetR);
       
-      printf("Norm on Left  (%0.3f,%0.3f)\n", pF1.x, pF1.y);
-      printf("Norm on Right (%0.3f,%0.3f)\n", pF2.x, pF2.y);
+      logPrintf("Norm on Left  (%0.3f,%0.3f)\n", pF1.x, pF1.y);
+      logPrintf("Norm on Right (%0.3f,%0.3f)\n", pF2.x, pF2.y);
     }
     
     Point2f sumF = pF1 + pF2;
     
     if (debug) {
-      printf("Sum of directional vectors (%0.3f,%0.3f)\n", sumF.x, sumF.y);
+      logPrintf("Sum of directional vectors (%0.3f,%0.3f)\n", sumF.x, sumF.y);
     }
     
     makeUnitVector(sumF);
     
     if (debug) {
-      printf("normal unit vector (%0.3f,%0.3f)\n", sumF.x, sumF.y);
+      logPrintf("normal unit vector (%0.3f,%0.3f)\n", sumF.x, sumF.y);
     }
     
     return sumF;
@@ -5291,7 +5413,7 @@ void calcNormalsOnContour(CvSize size,
   
   const int lastContourOffset = (int)contour.size() - 1;
   
-  const bool debugOffsetOutput = true;
+  const bool debugOffsetOutput = logEnabled(LogModuleCapture, LogLevelTrace);
   
   for ( HullLineOrCurveSegment & locSeg : vecOfSeg ) {
     if (locSeg.isLine) {
@@ -5308,7 +5430,7 @@ void calcNormalsOnContour(CvSize size,
         contourOffsetVec[i] = locContourOffset;
         
         if (debugOffsetOutput) {
-          cout << "contourOffsetVec[" << i << "] = " << locContourOffset << endl;
+          LogLine() << "contourOffsetVec[" << i << "] = " << locContourOffset;
         }
         
         if (locContourOffset == lastContourOffset) {
@@ -5355,7 +5477,7 @@ void calcNormalsOnContour(CvSize size,
         Point2i p = pointsVec[insideOutOffset];
         
         if (debugOffsetOutput) {
-          cout << "loop i = " << i << " : insideOutOffset " << insideOutOffset << " point " << p << endl;
+          LogLine() << "loop i = " << i << " : insideOutOffset " << insideOutOffset << " point " << p;
         }
         
 #if defined(DEBUG)
@@ -5365,7 +5487,7 @@ void calcNormalsOnContour(CvSize size,
         int originalContourOffset = contourOffsetVec[insideOutOffset];
         
         if (debugOffsetOutput) {
-          cout << "slope calc " << i << " : originalContourOffset " << originalContourOffset << endl;
+          LogLine() << "slope calc " << i << " : originalContourOffset " << originalContourOffset;
         }
         
         if (i >= (numPoints - startEndN)) {
@@ -5387,7 +5509,7 @@ void calcNormalsOnContour(CvSize size,
           contourNormals[originalContourOffset] = normal;
           
           if (debugOffsetOutput) {
-            cout << "set contourNormals[" << originalContourOffset << "] = " << normal << endl;
+            LogLine() << "set contourNormals[" << originalContourOffset << "] = " << normal;
           }
         }
       }
@@ -5429,7 +5551,7 @@ void calcNormalsOnContour(CvSize size,
     Coord c = pair.second;
     
     if (debug) {
-      cout << "pendingLineEdge coord " << c << " at offset " << contourOffset << endl;
+      LogLine() << "pendingLineEdge coord " << c << " at offset " << contourOffset;
     }
     
 #if defined(DEBUG)
@@ -5512,7 +5634,7 @@ void calcNormalsOnContour(CvSize size,
     string fname = fnameStream.str();
     
     writeWroteImg(fname, binMat);
-    cout << "" << endl;
+    LogLine() << "";
   }
   
   // This dump image will enlarge the original image multiple times so that vectors
@@ -5574,11 +5696,11 @@ void calcNormalsOnContour(CvSize size,
     string fname = fnameStream.str();
     
     writeWroteImg(fname, colorMat);
-    cout << "" << endl;
+    LogLine() << "";
   }
   
   if (debug) {
-    cout << "calcNormalsOnContour return " << allNormalVectors.size() << " normals" << endl;
+    LogLine() << "calcNormalsOnContour return " << allNormalVectors.size() << " normals";
   }
 
   assert(contourNormals.size() == contour.size());
@@ -5597,28 +5719,28 @@ generateVectorsThroughPoints(const CvSize &matSize,
                              const vector<Coord> &innerCoords,
                              const vector<Coord> &outerCoords)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
     int N1 = (int) innerCoords.size();
     int N2 = (int) outerCoords.size();
-    cout << "generateVectorsThroughPoints " << tag << " with N = " << N1 << " inner coords and N = " << N2 << " outer coords" << endl;
+    LogLine() << "generateVectorsThroughPoints " << tag << " with N = " << N1 << " inner coords and N = " << N2 << " outer coords";
   }
 
   int largerN = 0;
   
   if (debug) {
-    cout << "innerCoords:" << endl;
+    LogLine() << "innerCoords:";
     for ( Coord c : innerCoords ) {
-      cout << c << endl;
+      LogLine() << c;
     }
   }
   
   if (debug) {
-    cout << "outerCoords:" << endl;
+    LogLine() << "outerCoords:";
     for ( Coord c : outerCoords ) {
-      cout << c << endl;
+      LogLine() << c;
     }
   }
   
@@ -5655,16 +5777,16 @@ generateVectorsThroughPoints(const CvSize &matSize,
       }
       
       if (debug) {
-        printf("i %d : p %0.3f -> inner offset %d of (0 -> %d)\n", i, p, innerOffset, innerN-1);
-        printf("i %d : p %0.3f -> outer offset %d of (0 -> %d)\n", i, p, outerOffset, outerN-1);
+        logPrintf("i %d : p %0.3f -> inner offset %d of (0 -> %d)\n", i, p, innerOffset, innerN-1);
+        logPrintf("i %d : p %0.3f -> outer offset %d of (0 -> %d)\n", i, p, outerOffset, outerN-1);
       }
       
       Point2i p1 = coordToPoint(innerCoords[innerOffset]);
       Point2i p2 = coordToPoint(outerCoords[outerOffset]);
       
       if (debug) {
-        printf("inner coord (%d,%d)\n", p1.x, p1.y);
-        printf("outer coord (%d,%d)\n", p2.x, p2.y);
+        logPrintf("inner coord (%d,%d)\n", p1.x, p1.y);
+        logPrintf("outer coord (%d,%d)\n", p2.x, p2.y);
       }
       
       vector<Point2i> generatedPoints = generatePointsOnLine(p1, p2);
@@ -5705,9 +5827,9 @@ generateVectorsThroughPoints(const CvSize &matSize,
       int outerOffset = round(outerOffsetNotRounded);
       
       if (debug) {
-        printf("i %d : percent %0.2f\n", i, percent);
-        printf("inner offset %0.2f : %d of (0 -> %d)\n", innerOffsetNotRounded, innerOffset, innerN-1);
-        printf("outer offset %0.2f : %d of (0 -> %d)\n", outerOffsetNotRounded, outerOffset, outerN-1);
+        logPrintf("i %d : percent %0.2f\n", i, percent);
+        logPrintf("inner offset %0.2f : %d of (0 -> %d)\n", innerOffsetNotRounded, innerOffset, innerN-1);
+        logPrintf("outer offset %0.2f : %d of (0 -> %d)\n", outerOffsetNotRounded, outerOffset, outerN-1);
       }
       
       // Note that innerOffset and outerOffset are adjusted back to end-1
@@ -5717,14 +5839,14 @@ generateVectorsThroughPoints(const CvSize &matSize,
         innerOffset--;
         
         if (debug) {
-          printf("adjust inner offset back to %d\n", innerOffset);
+          logPrintf("adjust inner offset back to %d\n", innerOffset);
         }
       }
       if (outerOffset == (outerN-1)) {
         outerOffset--;
         
         if (debug) {
-          printf("adjust outer offset back to %d\n", outerOffset);
+          logPrintf("adjust outer offset back to %d\n", outerOffset);
         }
       }
       
@@ -5734,8 +5856,8 @@ generateVectorsThroughPoints(const CvSize &matSize,
       Point2f innerP2 = coordToPoint(innerCoords[innerOffset+1]);
       
       if (debug) {
-        printf("inner coord p1 (%d,%d)\n", (int)innerP1.x, (int)innerP1.y);
-        printf("inner coord p2 (%d,%d)\n", (int)innerP2.x, (int)innerP2.y);
+        logPrintf("inner coord p1 (%d,%d)\n", (int)innerP1.x, (int)innerP1.y);
+        logPrintf("inner coord p2 (%d,%d)\n", (int)innerP2.x, (int)innerP2.y);
       }
       
       assert(outerOffset < outerCoords.size());
@@ -5744,8 +5866,8 @@ generateVectorsThroughPoints(const CvSize &matSize,
       Point2f outerP2 = coordToPoint(outerCoords[outerOffset+1]);
       
       if (debug) {
-        printf("outer coord p1 (%d,%d)\n", (int)outerP1.x, (int)outerP1.y);
-        printf("outer coord p2 (%d,%d)\n", (int)outerP2.x, (int)outerP2.y);
+        logPrintf("outer coord p1 (%d,%d)\n", (int)outerP1.x, (int)outerP1.y);
+        logPrintf("outer coord p2 (%d,%d)\n", (int)outerP2.x, (int)outerP2.y);
       }
       
       // Generate float point 1/2 way between these input points
@@ -5753,13 +5875,13 @@ generateVectorsThroughPoints(const CvSize &matSize,
       Point2f innerHalf = innerP1 + ((innerP2 - innerP1) * 0.5f);
 
       if (debug) {
-        printf("inner halfway coord (%0.3f,%0.3f)\n", innerHalf.x, innerHalf.y);
+        logPrintf("inner halfway coord (%0.3f,%0.3f)\n", innerHalf.x, innerHalf.y);
       }
       
       Point2f outerHalf = outerP1 + ((outerP2 - outerP1) * 0.5f);
       
       if (debug) {
-        printf("outer halfway coord (%0.3f,%0.3f)\n", outerHalf.x, outerHalf.y);
+        logPrintf("outer halfway coord (%0.3f,%0.3f)\n", outerHalf.x, outerHalf.y);
       }
       
       vector<Point2f> generatedPoints = generateFloatPointsOnLine(innerHalf, outerHalf);
@@ -5805,7 +5927,7 @@ generateVectorsThroughPoints(const CvSize &matSize,
       vector<Coord> coordsInVec = vecOfVecs[i];
       
       if (debug) {
-        cout << "render vec " << i << endl;
+        LogLine() << "render vec " << i;
       }
       
       Vec3b colorVec((rand() % 256), (rand() % 256), (rand() % 256));
@@ -5814,7 +5936,7 @@ generateVectorsThroughPoints(const CvSize &matSize,
         segmentMat.at<Vec3b>(c.y, c.x) = colorVec;
         
         if (debug) {
-          cout << "render coord " << c << endl;
+          LogLine() << "render coord " << c;
         }
       }
     }
@@ -5824,7 +5946,7 @@ generateVectorsThroughPoints(const CvSize &matSize,
     string fname = fnameStream.str();
     
     writeWroteImg(fname, segmentMat);
-    cout << "" << endl;
+    LogLine() << "";
   }
   
   return std::move(vecOfVecs);
@@ -5839,14 +5961,14 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
                             const vector<Coord> &regionCoords,
                             Mat & mask)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
-  const bool debugDumpInsideOutsiteExpandStepImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
+  const bool debugDumpInsideOutsiteExpandStepImages = debugArtifactEnabled(DebugArtifactShape);
   const bool debugDumpInsideOutsiteStepImages = false;
-  const bool debugDumpPolygonSegmentStepImages = true;
+  const bool debugDumpPolygonSegmentStepImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
-    cout << "clockwiseScanForShapeBounds " << tag << endl;
+    LogLine() << "clockwiseScanForShapeBounds " << tag;
   }
   
   // If the shape is convex then wrap it in a convex hull and simplify the shape with
@@ -5976,7 +6098,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
     fnameStream << "srm" << "_tag_" << tag << "_hull_near_points" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -6298,9 +6420,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
   
   */
    
-  // Dump skel generated from region bin Mat
+  // Dump skel generated from region bin Mat, the skel is only used for the dump
   
-  if ((1)) {
+  if (debugDumpImages) {
     Mat binMat(tagsImg.size(), CV_8UC1, Scalar(0));
     
     for ( Coord c : regionCoords ) {
@@ -6314,9 +6436,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_region_skel" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, binMat);
-      cout << "wrote " << fname << endl;
-      cout << "" << endl;
+      debugArtifactWrite(DebugArtifactShape, fname, binMat);
+      LogLine() << "wrote " << fname;
+      LogLine() << "";
     }
   }
   
@@ -6337,7 +6459,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
   
   calcNormalsOnContour(tagsImg.size(), tag, contour, contourNormals, allNormalVectors);
   
-  if (1) {
+  if (debugDumpImages) {
     int maxWidth = 0;
     
     for ( auto &vec : allNormalVectors ) {
@@ -6367,7 +6489,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
     string fname = fnameStream.str();
     
     writeWroteImg(fname, colorMat);
-    cout << "" << endl;
+    LogLine() << "";
   }
   
   // Calculate region center
@@ -6375,10 +6497,17 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
   Point2i regionCenterP;
   
   {
-    Mat renderMat(tagsImg.size(), CV_8UC1, Scalar(0));
+    // Render only the bounding box of the region, the distance to the
+    // nearest off pixel is the same as in a full size Mat since
+    // findRegionCenter() adds an off border around the ROI.
+    
+    int32_t originX, originY, regionWidth, regionHeight;
+    bbox(originX, originY, regionWidth, regionHeight, regionCoords);
+    
+    Mat renderMat(regionHeight, regionWidth, CV_8UC1, Scalar(0));
     
     for ( Coord c : regionCoords ) {
-      renderMat.at<uint8_t>(c.y, c.x) = 0xFF;
+      renderMat.at<uint8_t>(c.y - originY, c.x - originX) = 0xFF;
     }
   
     if (debugDumpImages) {
@@ -6387,15 +6516,15 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
       string fname = fnameStream.str();
       
       writeWroteImg(fname, renderMat);
-      cout << "" << endl;
+      LogLine() << "";
     }
   
     Mat outDistMat;
-    Coord regionCenter = findRegionCenter(renderMat, Rect2d(0,0,tagsImg.cols,tagsImg.rows), outDistMat, tag);
-
-    // FIXME: if roi is used, account for origin
+    Coord roiCenter = findRegionCenter(renderMat, Rect(0,0,regionWidth,regionHeight), outDistMat, tag);
     
-    regionCenterP = coordToPoint(regionCenter);
+    Coord regionCenter(originX + roiCenter.x, originY + roiCenter.y);
+    
+    regionCenterP = coordToPoint(regionCenter);
   
     if (debugDumpImages) {
       std::stringstream fnameStream;
@@ -6466,7 +6595,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
     // if found to not be in the mask then terminate the inward iteration at that point.
     
     if (debug) {
-      cout << "generated " << edgesInsideMap.size() << " entries for edge to center vectors" << endl;
+      LogLine() << "generated " << edgesInsideMap.size() << " entries for edge to center vectors";
     }
     
     // Util lambda to determine if a set of coordinates "converges"
@@ -6474,7 +6603,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
     // are the same.
     
     auto doCoordsConvergeToSamePixel = [](const Mat & pixelMat, const vector<Coord> &coords, uint32_t *pixelPtr)->bool {
-      const bool debug = true;
+      const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
       const bool debugPrintPixels = false;
       
       if (coords.size() == 0) {
@@ -6491,7 +6620,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         prevPixel = Vec3BToUID(vec3);
         
         if (debugPrintPixels) {
-          printf("prevPixel 0x%08X\n", prevPixel);
+          logPrintf("prevPixel 0x%08X\n", prevPixel);
         }
       }
       
@@ -6503,7 +6632,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         uint32_t pixel = Vec3BToUID(vec3);
         
         if (debugPrintPixels) {
-          printf("pixel 0x%08X\n", pixel);
+          logPrintf("pixel 0x%08X\n", pixel);
         }
         
         if (pixel == prevPixel) {
@@ -6517,7 +6646,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
       if (debug && doPixelsConverge) {
         // All pixels inside are the same
         
-        printf("all inside pixels converge to 0x%08X\n", prevPixel);
+        logPrintf("all inside pixels converge to 0x%08X\n", prevPixel);
       }
       
       if (doPixelsConverge) {
@@ -6630,7 +6759,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           int numPixels = (int) insideVecEndOffsetMap[contouri];
           assert(numPixels > 0);
           
-          printf("for contouri %4d : numPixels inside %d\n", contouri, numPixels);
+          logPrintf("for contouri %4d : numPixels inside %d\n", contouri, numPixels);
           
           maxInsideWidth = maxi(maxInsideWidth, numPixels);
         }
@@ -6677,7 +6806,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, colorPixelsMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         colorPixelsMat = Scalar(0,0,0,0);
@@ -6718,7 +6847,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, colorPixelsMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
       }
       
@@ -6741,7 +6870,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         for ( int trimi = (int) vecInside.size() - 1 ; trimi > 0; trimi-- ) {
           if (trimi >= endOffset) {
             if (debug) {
-              printf("quick trim at index %d\n", trimi);
+              logPrintf("quick trim at index %d\n", trimi);
             }
             
             vecInside.pop_back();
@@ -6756,13 +6885,13 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             // Continue to trim from right
             
             if (debug) {
-              printf("trim at index %d\n", trimi);
+              logPrintf("trim at index %d\n", trimi);
             }
             
             vecInside.pop_back();
           } else {
             if (debug) {
-              printf("found non same pixel 0x%08X at index %d compared to convergedFromPixel 0x%08X\n", pixel, trimi, convergedFromPixel);
+              logPrintf("found non same pixel 0x%08X at index %d compared to convergedFromPixel 0x%08X\n", pixel, trimi, convergedFromPixel);
             }
             
             break;
@@ -6770,7 +6899,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         }
         
         if (debug) {
-          printf("after trim steps, vec contains of %d coords\n", (int)vecInside.size());
+          logPrintf("after trim steps, vec contains of %d coords\n", (int)vecInside.size());
         }
         
       }
@@ -6796,7 +6925,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
       string fname = fnameStream.str();
       
       writeWroteImg(fname, regionBinMat);
-      cout << "" << endl;
+      LogLine() << "";
     }
     
     regionVecs.setContour(contourCoords);
@@ -6980,7 +7109,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         int pOffset2 = pair.second;
         
         if (debug) {
-        cout << "contour pair " << pOffset1 << "," << pOffset2 << endl;
+        LogLine() << "contour pair " << pOffset1 << "," << pOffset2;
         }
         
         vector<Point2i> &vec1 = vecOfGeneratedPoints[pOffset1];
@@ -6998,11 +7127,11 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         append_to_vector(contour, vec1);
         
         if (debug) {
-          cout << "contour vec1:" << endl;
+          LogLine() << "contour vec1:";
+          LogLine pointsLine;
           for ( Point2i p : vec1 ) {
-            cout << p << " ";
+            pointsLine << p << " ";
           }
-          cout << endl;
         }
         
         // Iterate vec2 backwards so that the end of the first vector
@@ -7024,7 +7153,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           Point2i p2 = vec2[0];
           
           if (debug) {
-            printf("gen inside line from (%5d,%5d) to (%5d,%5d)\n", p1.x, p1.y, p2.x, p2.y);
+            logPrintf("gen inside line from (%5d,%5d) to (%5d,%5d)\n", p1.x, p1.y, p2.x, p2.y);
           }
           
           vector<Point2i> generatedPoints = generatePointsOnLine(p1, p2);
@@ -7043,9 +7172,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         Point2i delta = p2 - p1;
         
         if (debug) {
-          printf("p1 (%5d,%5d)\n", p1.x, p1.y);
-          printf("p2 (%5d,%5d)\n", p2.x, p2.y);
-          printf("d  (%5d,%5d)\n", delta.x, delta.y);
+          logPrintf("p1 (%5d,%5d)\n", p1.x, p1.y);
+          logPrintf("p2 (%5d,%5d)\n", p2.x, p2.y);
+          logPrintf("d  (%5d,%5d)\n", delta.x, delta.y);
         }
         
         bool arePointsOnEasyHorizontal;
@@ -7087,7 +7216,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             Coord edgeCoord = coordsAroundEdges[i];
             
             if (debug) {
-              cout << "checking edge coord " << edgeCoord << endl;
+              LogLine() << "checking edge coord " << edgeCoord;
             }
             
             if (edgeCoord == c1) {
@@ -7121,7 +7250,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             }
             
             if (debug) {
-              printf("add edge point (%5d,%5d)\n", edgeCoord.x, edgeCoord.y);
+              logPrintf("add edge point (%5d,%5d)\n", edgeCoord.x, edgeCoord.y);
             }
             
             contour.push_back(coordToPoint(edgeCoord));
@@ -7133,11 +7262,11 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         append_to_vector(contour, vec2Backwards);
         
         if (debug) {
-          cout << "contour vec2:" << endl;
+          LogLine() << "contour vec2:";
+          LogLine pointsLine;
           for ( Point2i p : vec2Backwards ) {
-            cout << p << " ";
+            pointsLine << p << " ";
           }
-          cout << endl;
         }
         
         // Emit Vec3b
@@ -7159,7 +7288,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, segmentMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         if (debugDumpPolygonSegmentStepImages) {
@@ -7187,7 +7316,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, segmentMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
 #if defined(DEBUG)
@@ -7283,7 +7412,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           auto &pair = contourPairs[contouri];
           int nextContouri = pair.second;
           
-          printf("contouri %5d to %5d contains %5d in between pixels\n", contouri, nextContouri, count);
+          if (debug) {
+            logPrintf("contouri %5d to %5d contains %5d in between pixels\n", contouri, nextContouri, count);
+          }
           
           InBetweenRegionEdges & inbetweenEdges = contourInBetweenPaths[contouri];
           
@@ -7340,8 +7471,8 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
               Vec3b currentVec = segmentMat.at<Vec3b>(c.y, c.x);
               if ((0)) {
                 uint32_t pixel = Vec3BToUID(currentVec);
-                printf("pixel 0x%06X\n", pixel);
-                printf("isBlue %d\n", isBlue(pixel));
+                logPrintf("pixel 0x%06X\n", pixel);
+                logPrintf("isBlue %d\n", isBlue(pixel));
               }
               if (currentVec[0] == 0 && currentVec[1] == 0 && currentVec[1] == 0) {
                 segmentMat.at<Vec3b>(c.y, c.x) = whiteVec;
@@ -7355,7 +7486,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             string fname = fnameStream.str();
             
             writeWroteImg(fname, segmentMat);
-            cout << "" << endl;
+            LogLine() << "";
           }
           
           // Render lines going from the inside points to the outside points that
@@ -7416,49 +7547,50 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
               // No in between coords on this vector
               
               if (debug) {
-                cout << "skip vector where all points were filtered out because none hit an inbetween pixel" << endl;
+                LogLine() << "skip vector where all points were filtered out because none hit an inbetween pixel";
+                
+                LogLine coordsLine;
                 
                 for ( Coord c : vec ) {
-                  cout << c << " ";
+                  coordsLine << c << " ";
                 }
-                
-                cout << endl;
-                cout << "";
               }
             } else {
               
               if (filteredCoordsSet.size() < vec.size()) {
                 if (debug) {
-                  cout << "trimmed coords from " << vec.size() << " down to " << filteredCoordsSet.size() << endl;
+                  LogLine() << "trimmed coords from " << vec.size() << " down to " << filteredCoordsSet.size();
                   
-                  cout << "original ordered vector " << endl;
-                  
-                  for ( Coord c : vec ) {
-                    cout << c << " ";
+                  {
+                    LogLine coordsLine;
+                    coordsLine << "original ordered vector ";
+                    
+                    for ( Coord c : vec ) {
+                      coordsLine << c << " ";
+                    }
                   }
                   
-                  cout << endl;
-                  
-                  cout << "filtered as ordered vector " << endl;
-                  
-                  for ( Coord c : vec ) {
-                    if (filteredCoordsSet.count(c) > 0) {
-                      cout << c << "  ";
-                    } else {
-                      cout << "!" << c << "! ";
+                  {
+                    LogLine coordsLine;
+                    coordsLine << "filtered as ordered vector ";
+                    
+                    for ( Coord c : vec ) {
+                      if (filteredCoordsSet.count(c) > 0) {
+                        coordsLine << c << "  ";
+                      } else {
+                        coordsLine << "!" << c << "! ";
+                      }
                     }
                   }
                   
-                  cout << endl;
-                  
-                  cout << "filtered set " << endl;
-                  
-                  for ( Coord c : filteredCoordsSet ) {
-                    cout << c << " ";
+                  {
+                    LogLine coordsLine;
+                    coordsLine << "filtered set ";
+                    
+                    for ( Coord c : filteredCoordsSet ) {
+                      coordsLine << c << " ";
+                    }
                   }
-                  
-                  cout << endl;
-                  cout << "";
                 }
               }
               
@@ -7482,7 +7614,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             
             vector<int32_t> vecUids = regionVecs.makeVectorsBetween(leftUid, rightUid, N);
             
-            cout << "create N = " << N << " in between (" << leftContouri << ", " << rightContouri << ")" << endl;
+            if (debug) {
+              LogLine() << "create N = " << N << " in between (" << leftContouri << ", " << rightContouri << ")";
+            }
             
             //int i = 0;
             for ( int32_t vecUid : vecUids ) {
@@ -7509,7 +7643,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
       string fname = fnameStream.str();
       
       writeWroteImg(fname, regionTypeMat);
-      cout << "" << endl;
+      LogLine() << "";
     }
     
     bool convergedToPixelSet = false;
@@ -7551,7 +7685,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         vector<Coord> outExpandedCoords;
         
         if (debug) {
-          cout << "expand by 1 pixel at outsideStep " << outsideStep << endl;
+          LogLine() << "expand by 1 pixel at outsideStep " << outsideStep;
           cout << "";
         }
         
@@ -7580,7 +7714,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, binMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         if (debugDumpInsideOutsiteExpandStepImages) {
@@ -7598,7 +7732,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, mat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         // Filter expanded coords to keep the pixels that were activated by the expansion.
@@ -7634,7 +7768,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, binMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         // Scan activated coords and split into different vectors by type
@@ -7649,7 +7783,9 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           Vec3b typeVec = regionTypeMat.at<Vec3b>(c.y, c.x) ;
           uint32_t pixel = Vec3BToUID(typeVec);
           
-          printf("regionTypeMat 0x%06X\n", pixel);
+          if (debug) {
+            logPrintf("regionTypeMat 0x%06X\n", pixel);
+          }
           
           if (pixel == 0xFFFFFF) {
             // Should not activate contour pixel
@@ -7680,11 +7816,11 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         }
         
         if (debug) {
-          cout << "found " << activatedNormalVectorCoords.size() << " activatedNormalVectorCoords" << endl;
-          cout << "found " << activatedInBetweenCoords.size() << " activatedInBetweenCoords" << endl;
+          LogLine() << "found " << activatedNormalVectorCoords.size() << " activatedNormalVectorCoords";
+          LogLine() << "found " << activatedInBetweenCoords.size() << " activatedInBetweenCoords";
           
-          cout << "activatedNormalVectorMap contains " << activatedNormalVectorMap.size() << " keys" << endl;
-          cout << "activatedInBetweenMap " << activatedInBetweenMap.size() << " keys" << endl;
+          LogLine() << "activatedNormalVectorMap contains " << activatedNormalVectorMap.size() << " keys";
+          LogLine() << "activatedInBetweenMap " << activatedInBetweenMap.size() << " keys";
         }
         
         if (debugDumpInsideOutsiteExpandStepImages) {
@@ -7699,7 +7835,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, binMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         if (debugDumpInsideOutsiteExpandStepImages) {
@@ -7714,7 +7850,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, binMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
         
         for ( int contouri = 0; contouri < maxContouri; contouri++ ) {
@@ -7743,13 +7879,13 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
               int32_t rightUid = regionVecs.getUidForContour(rightContouri);
               
               if (debug) {
-                cout << "in between (" << leftContouri << "," << rightContouri << ")" << endl;
+                LogLine() << "in between (" << leftContouri << "," << rightContouri << ")";
               }
               
               InBetweenRegionEdges & inbetweenEdges = contourInBetweenPaths[contouri];
               
               if (debug) {
-                cout << "found N = " << N << " in between coords and " << inbetweenEdges.vecInnerToOuter.size() << " vectors " << endl;
+                LogLine() << "found N = " << N << " in between coords and " << inbetweenEdges.vecInnerToOuter.size() << " vectors ";
               }
               
               // Map Coord -> (vecUid, vecUid, ...)
@@ -7775,7 +7911,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
               
               for ( Coord c : inbetweenCoords ) {
                 if (debug) {
-                  cout << "c " << c << endl;
+                  LogLine() << "c " << c;
                 }
                 
                 int vecSetOffset = 0;
@@ -7785,11 +7921,11 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
                     vector<Coord> &vecOfCoords = regionVecs.getOutsideVector(vecUid);
                     
                     if (debug) {
-                      cout << "coord found in set " << c << " " << vecUid << " ( " << vecSetOffset << " of " << inbetweenEdges.vecInnerToOuter.size() << ")" << endl;
+                      LogLine() << "coord found in set " << c << " " << vecUid << " ( " << vecSetOffset << " of " << inbetweenEdges.vecInnerToOuter.size() << ")";
                     }
                     
                     if (debug) {
-                      cout << "append inbetween coord c " << c << " to uid " << vecUid << endl;
+                      LogLine() << "append inbetween coord c " << c << " to uid " << vecUid;
                     }
                     
                     vecOfCoords.push_back(c);
@@ -7798,8 +7934,6 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
                   vecSetOffset++;
                 }
               }
-              
-              cout << endl;
             }
           }
           
@@ -7892,7 +8026,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           int numPixels = (int) vecOutside.size();
           //assert(numPixels > 0);
           
-          printf("for contouri %4d : numPixels %d\n", contouri, numPixels);
+          logPrintf("for contouri %4d : numPixels %d\n", contouri, numPixels);
           
           maxWidth = maxi(maxWidth, numPixels);
           
@@ -7911,7 +8045,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
             int numPixels = (int) vecOutside.size();
             
             if (numPixels > 0) {
-              printf("for contouri %4d between : numPixels %d\n", contouri, numPixels);
+              logPrintf("for contouri %4d between : numPixels %d\n", contouri, numPixels);
               
               maxWidth = maxi(maxWidth, numPixels);
             }
@@ -7980,7 +8114,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, colorPixelsMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
       }
       
@@ -8007,7 +8141,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           vector<int32_t> vecUids = regionVecs.getVectorsBetween(leftUid, rightUid);
           
           if (debug) {
-          cout << "(leftUid, rightUid) " << leftUid << " " << rightUid << " contains " << vecUids.size() << " in between vectors" << endl;
+          LogLine() << "(leftUid, rightUid) " << leftUid << " " << rightUid << " contains " << vecUids.size() << " in between vectors";
           }
           
           for ( int32_t vecUid : vecUids ) {
@@ -8025,7 +8159,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
           string fname = fnameStream.str();
           
           writeWroteImg(fname, binMat);
-          cout << "" << endl;
+          LogLine() << "";
         }
       }
       
@@ -8089,8 +8223,8 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
     */
     
     if (debug) {
-      cout << "generated " << edgesInsideMap.size() << " entries for edge to inside vectors" << endl;
-      cout << "generated " << regionVecs.outsideVectorsMap.size() << " entries for edge to outside vectors" << endl;
+      LogLine() << "generated " << edgesInsideMap.size() << " entries for edge to inside vectors";
+      LogLine() << "generated " << regionVecs.outsideVectorsMap.size() << " entries for edge to outside vectors";
     }
     
     // Dump image showing the both inside and outside vector contents
@@ -8181,7 +8315,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         string fname = fnameStream.str();
         
         writeWroteImg(fname, typesBinMat);
-        cout << "" << endl;
+        LogLine() << "";
       }
       
       {
@@ -8190,7 +8324,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
         string fname = fnameStream.str();
         
         writeWroteImg(fname, colorPixelsMat);
-        cout << "" << endl;
+        LogLine() << "";
       }
     }
 
@@ -8228,7 +8362,7 @@ clockwiseScanForShapeBounds(const Mat & inputImg,
   */
   
   if (debug) {
-    cout << "return clockwiseScanForShapeBounds " << tag << " with N = " << 0 << " ranges" << endl;
+    LogLine() << "return clockwiseScanForShapeBounds " << tag << " with N = " << 0 << " ranges";
   }
   
   return;
@@ -8243,7 +8377,7 @@ getEdgesInRegion(SuperpixelImage &spImage,
                  int32_t tag,
                  const vector<Coord> &coords)
 {
-  const bool debug = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
   
   // Generate vectors that determine how different colors that are nearby each other
   // in 2D space map to other nearby colors. It is only possible to determine that
@@ -8274,7 +8408,7 @@ getEdgesInRegion(SuperpixelImage &spImage,
     // Cannot possibly find an edge if there are not at least 2 tags
     
     if (debug) {
-      cout << "did not find at least 2 tags, so no edges are inside region" << endl;
+      LogLine() << "did not find at least 2 tags, so no edges are inside region";
     }
     
     return vector<SuperpixelEdge>();
@@ -8287,9 +8421,9 @@ getEdgesInRegion(SuperpixelImage &spImage,
   }
   
   if (debug) {
-    cout << "allUniqueRegionTags:" << endl;
+    LogLine() << "allUniqueRegionTags:";
     for ( int32_t tag : allUniqueRegionTags ) {
-      cout << tag << endl;
+      LogLine() << tag;
     }
     cout << "";
   }
@@ -8307,7 +8441,7 @@ getEdgesInRegion(SuperpixelImage &spImage,
   // Save all pairs where both sides appear in neighborsSet.
   
   for ( int32_t neighborTag : neighborsSet ) {
-    auto &neighborsOfNeighborSet = spImage.edgeTable.getNeighborsSet(neighborTag);
+    SuperpixelNeighbors neighborsOfNeighborSet = spImage.edgeTable.getNeighborsSpan(neighborTag);
     
     for ( int32_t neighborOfNeighborTag : neighborsOfNeighborSet ) {
       if (neighborsSet.count(neighborOfNeighborTag) > 0) {
@@ -8319,10 +8453,10 @@ getEdgesInRegion(SuperpixelImage &spImage,
   }
   
   if (debug) {
-    cout << "all neighbor pairs: " << endl;
+    LogLine() << "all neighbor pairs: ";
     
     for ( auto & pair : allNeighborsPairsMap ) {
-      cout << pair.first << " -> " << pair.second << endl;
+      LogLine() << pair.first << " -> " << pair.second;
     }
   }
   
@@ -8333,13 +8467,13 @@ getEdgesInRegion(SuperpixelImage &spImage,
   }
   
   if (debug) {
-    cout << "neighborsVecOfPairs: " << endl;
+    LogLine() << "neighborsVecOfPairs: ";
     
     for ( auto & edge : neighborsVecOfPairs ) {
-      cout << edge << endl;
+      LogLine() << edge;
     }
     
-    cout << "done" << endl;
+    LogLine() << "done";
   }
   
   return neighborsVecOfPairs;
@@ -8357,12 +8491,12 @@ contractOrExpandRegion(const Mat & inputImg,
                        int numPixels,
                        vector<Coord> &outCoords)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
-  const bool debugDumpInputStateImages = true;
+  const bool debug = logEnabled(LogModuleCapture, LogLevelTrace);
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactCapture);
+  const bool debugDumpInputStateImages = debugArtifactEnabled(DebugArtifactCapture);
   
   if (debug) {
-    cout << "contractOrExpandRegion " << tag << " with N = " << coords.size() << " and isExpand " << isExpand << endl;
+    LogLine() << "contractOrExpandRegion " << tag << " with N = " << coords.size() << " and isExpand " << isExpand;
   }
   
   outCoords.clear();
@@ -8371,7 +8505,7 @@ contractOrExpandRegion(const Mat & inputImg,
   bbox(originX, originY, regionWidth, regionHeight, coords);
   
   if (debug) {
-    cout << "bbox " << originX << "," << originY << " with " << regionWidth << " x " << regionHeight << endl;
+    LogLine() << "bbox " << originX << "," << originY << " with " << regionWidth << " x " << regionHeight;
   }
   
   if (isExpand) {
@@ -8393,7 +8527,7 @@ contractOrExpandRegion(const Mat & inputImg,
     }
     
     if (debug) {
-      cout << "expanded bbox " << originX << "," << originY << " with " << regionWidth << " x " << regionHeight << endl;
+      LogLine() << "expanded bbox " << originX << "," << originY << " with " << regionWidth << " x " << regionHeight;
     }
   }
   
@@ -8424,8 +8558,8 @@ contractOrExpandRegion(const Mat & inputImg,
     fnameStream << "srm" << "_tag_" << tag << "_srm_region_" << expandStr << "_input" << numPixels << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, inBoolMat);
-    cout << "wrote " << fname << endl;
+    debugArtifactWrite(DebugArtifactCapture, fname, inBoolMat);
+    LogLine() << "wrote " << fname;
     cout << "";
   }
   
@@ -8444,11 +8578,11 @@ contractOrExpandRegion(const Mat & inputImg,
       outCoords.push_back(c);
       
       if (debug) {
-        cout << "keep coord " << c << endl;
+        LogLine() << "keep coord " << c;
       }
     } else {
       if (debug) {
-        cout << "skip coord " << c << endl;
+        LogLine() << "skip coord " << c;
       }
     }
   }
@@ -8486,8 +8620,8 @@ contractOrExpandRegion(const Mat & inputImg,
       tmpMat.at<uint8_t>(c.y, c.x) = 0xFF;
     }
     
-    imwrite(fname, tmpMat);
-    cout << "wrote " << fname << endl;
+    debugArtifactWrite(DebugArtifactCapture, fname, tmpMat);
+    LogLine() << "wrote " << fname;
     cout << "";
   }
   
@@ -8515,8 +8649,8 @@ contractOrExpandRegion(const Mat & inputImg,
       fnameStream << "srm" << "_tag_" << tag << "_srm_region_" << expandStr << "_alpha_mask" << numPixels << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, alphaMaskResultImg);
-      cout << "wrote " << fname << endl;
+      debugArtifactWrite(DebugArtifactCapture, fname, alphaMaskResultImg);
+      LogLine() << "wrote " << fname;
       cout << "";
     }
   }
@@ -8533,172 +8667,33 @@ contractOrExpandRegion(const Mat & inputImg,
 #endif // DEBUG
   
   if (debug) {
-    cout << "return contractOrExpandRegion with retval " << retval << endl;
+    LogLine() << "return contractOrExpandRegion with retval " << retval;
   }
   
   return retval;
 }
 
-// Invoked for each child of a container, returns the tags that are direct children of tag
+// Build the containment tree with an explicit stack. A superpixel is claimed
+// by the first superpixel that is expanded next to it, when a superpixel is
+// expanded all of its unclaimed neighbors become its children and are claimed
+// at once so that they cannot be claimed inside the subtree of an earlier
+// sibling. Roots are claimed before anything is expanded. Each superpixel is
+// expanded once and each edge is checked once, so this is O(V+E).
 
-void
-recurseSuperpixelContainmentImpl(SuperpixelImage &spImage,
-                                 unordered_map<int32_t, std::vector<int32_t> > &map,
-                                 int32_t tag,
-                                unordered_map<int32_t, int32_t> &superpixelTagToOffsetMap)
+void buildSuperpixelContainmentTree(SuperpixelImage &spImage,
+                                    const Mat &tagsImg,
+                                    SuperpixelContainmentTree &tree)
 {
-  const bool debug = true;
-  
-  Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
-  
-  if (debug) {
-    cout << "recurseSuperpixelContainmentImpl for tag " << tag << " with N = " << spPtr->coords.size() << endl;
-  }
-  
-#if defined(DEBUG)
-  if (map.count(tag) > 0) {
-    cout << " already processed tag " << tag << endl;
-    assert(0);
-  }
-#endif // DEBUG
-  
-  // Before processing neightbors, mark this superpixel as processed
-  
-  vector<int32_t> &children = map[tag];
-  
-  auto &neighborsSet = spImage.edgeTable.getNeighborsSet(tag);
-
-  if (debug) {
-    cout << "neighbors: " << endl;
-    
-    for ( int32_t neighborTag : neighborsSet ) {
-      cout << neighborTag << endl;
-    }
-  }
-  
-  // Order neighborsSet by the offset in superpixelTagToOffsetMap
-  
-  // Filter neighborsSet into a set of siblings by removing
-  // the neighbors that are known to already be processed.
-  
-  vector<int32_t> siblings;
-  
-  for ( int32_t neighborTag : neighborsSet ) {
-    if (debug) {
-      cout << "check for unprocessed neighbor " << neighborTag << endl;
-    }
-    
-    if (map.count(neighborTag) > 0) {
-      if (debug) {
-        cout << "already processed neighbor tag " << neighborTag << endl;
-      }
-    } else {
-      siblings.push_back(neighborTag);
-    }
-  }
+  TRACE_SPAN("buildSuperpixelContainmentTree");
   
-  // order siblings by superpixelTagToOffsetMap
-  sort(begin(siblings), end(siblings),
-       [&](int tag1, int tag2) {
-         int32_t offset1 = superpixelTagToOffsetMap[tag1];
-         int32_t offset2 = superpixelTagToOffsetMap[tag2];
-         return offset1 < offset2;
-       });
-  
-  if (debug) {
-    int offset = 0;
-    
-    for ( int32_t siblingTag : siblings ) {
-      Superpixel *spPtr = spImage.getSuperpixelPtr(siblingTag);
-      
-      printf("sibling[%5d] : %d contains N = %d coords\n", offset, siblingTag, (int)spPtr->coords.size());
-      
-      offset += 1;
-    }
-  }
-  
-  // FIXME: might be better to impl siblings as a stack instead of a vector if N is large
-  
-  // Iterate over neighbors and recursively process, note that any
-  // other siblings are inserted into the processed map in order
-  // to properly handle recursion WRT siblings.
-
-  while ( 1 ) {
-    int32_t neighborTag;
-    
-    {
-      // Scope ensures that iterators are released before loop body
-      auto it = begin(siblings);
-      auto itEnd = end(siblings);
-      
-      if (it == itEnd) {
-        break;
-      }
-      
-      neighborTag = *it;
-      
-      siblings.erase(it);
-    }
-    
-    if (debug) {
-      cout << "process neighbor " << neighborTag << endl;
-    }
-    
-    children.push_back(neighborTag);
-    
-    for ( int32_t sibling : siblings ) {
-#if defined(DEBUG)
-      assert(sibling != neighborTag);
-      assert(map.count(sibling) == 0);
-#endif // DEBUG
-      map[sibling] = vector<int32_t>();
-    }
-    
-    // Recurse into neighbors of neighbor at this point
-    
-    recurseSuperpixelContainmentImpl(spImage, map, neighborTag, superpixelTagToOffsetMap);
-    
-    for ( int32_t sibling : siblings ) {
-#if defined(DEBUG)
-      assert(sibling != neighborTag);
-      assert(map.count(sibling) > 0);
-      assert(map[sibling].size() == 0);
-#endif // DEBUG
-      map.erase(sibling);
-    }
-  }
-
-#if defined(DEBUG)
-  assert(siblings.size() == 0);
-#endif // DEBUG
-
-  if (debug) {
-    cout << "recurseSuperpixelContainmentImpl for " << tag << " finished with children: " << endl;
-    
-    for ( int32_t childTag : children ) {
-      cout << childTag << endl;
-    }
-  }
-  
-  return;
-}
-
-// Recurse into each superpixel and determine the children of each superpixel.
-
-std::vector<int32_t>
-recurseSuperpixelContainment(SuperpixelImage &spImage,
-                             const Mat &tagsImg,
-                             unordered_map<int32_t, std::vector<int32_t> > &map)
-{
-  const bool debug = false;
-
-  set<int32_t> rootSet;
-  vector<int32_t> rootTags;
+  const bool debugRoots = false;
   
   // Determine the outermost set of tags by gathering all the tags along the edges of the image. In the
   // tricky case where more than 1 superpixel is a sibling at the toplevel this logic figures out where
   // to being with the recursion.
   
+  set<int32_t> rootSet;
+  
   int width = tagsImg.cols;
   int height = tagsImg.rows;
   
@@ -8715,19 +8710,19 @@ recurseSuperpixelContainment(SuperpixelImage &spImage,
       if (isFirstRow || isLastRow) {
         // All pixels in first and last row processed
         
-        if (debug) {
+        if (debugRoots) {
           cout << "check " << x << "," << y << endl;
         }
       } else if (isFirstCol || isLastCol) {
         // All pixels in first and last col processed
         
-        if (debug) {
+        if (debugRoots) {
           cout << "check " << x << "," << y << endl;
         }
       } else {
         // Not on the edges
         
-        if (debug) {
+        if (debugRoots) {
           cout << "skip " << x << "," << y << endl;
         }
         
@@ -8738,7 +8733,7 @@ recurseSuperpixelContainment(SuperpixelImage &spImage,
       int32_t tag = Vec3BToUID(vec);
       
       if (tag != lastTag) {
-        if (debug) {
+        if (debugRoots) {
           cout << "check " << x << "," << y << " with tag " << tag << endl;
         }
         
@@ -8748,66 +8743,153 @@ recurseSuperpixelContainment(SuperpixelImage &spImage,
     }
   }
   
-  // Sort by superpixel size and then determine order by decreasing size
+  // Dense index of each tag in ascending tag order, the neighbor sets are
+  // also in ascending order so neighbor indexes are ascending too.
   
-  vector<int32_t> sortedSuperpixelTags = spImage.sortSuperpixelsBySize();
-
-  // Map superpixel UID to the offset in the sorted list, smaller offset
-  // means that the superpixel is larger.
+  const int numSuperpixels = (int) spImage.superpixels.size();
   
-  unordered_map<int32_t, int32_t> superpixelTagToOffsetMap;
+  tree.tags.assign(begin(spImage.superpixels), end(spImage.superpixels));
+  tree.childOffsets.assign(numSuperpixels, 0);
+  tree.numChildren.assign(numSuperpixels, 0);
+  tree.children.clear();
+  tree.children.reserve(numSuperpixels);
+  tree.roots.clear();
   
-//  unordered_map<int32_t,int32_t> rootTagToSize;
+  // Tree index of each tag, looked up with the arena index instead of a hash.
+  // The arena also has slots for merged away superpixels, so the tree index
+  // is not the same as the arena index once superpixels have been merged.
   
-  {
-    int offset = 0;
-    
-    for ( int32_t tag : rootSet ) {
-      superpixelTagToOffsetMap[tag] = offset;
-      offset += 1;
-    }
+  SuperpixelSideArray<int32_t> tagToIndex(spImage.superpixelArena, -1);
+  
+  for ( int32_t i = 0; i < numSuperpixels; i++ ) {
+    tagToIndex[tree.tags[i]] = i;
   }
   
-  for ( int32_t tag : sortedSuperpixelTags ) {
-    if (superpixelTagToOffsetMap.count(tag) > 0) {
-      // This superpixel is in rootSet
-      rootTags.push_back(tag);
+  // Roots in order of decreasing size
+  
+  vector<uint8_t> claimed(numSuperpixels, 0);
+  
+  for ( int32_t tag : spImage.sortSuperpixelsBySize() ) {
+    if (rootSet.count(tag) > 0) {
+      int32_t index = tagToIndex[tag];
+      tree.roots.push_back(index);
+      claimed[index] = 1;
     }
   }
   
-  sortedSuperpixelTags = vector<int32_t>(); // Dealloc possibly large list
+  assert(tree.roots.size() == rootSet.size());
   
-  assert(rootTags.size() == rootSet.size());
-
-  set<int32_t> siblings;
-  for ( int32_t tag : rootTags ) {
-    siblings.insert(tag);
-  }
+  // Roots are claimed up front and every sibling list is built from the
+  // unclaimed neighbors, so siblings are never roots and keep the neighbor
+  // order. This is the order the recursive version used since only roots
+  // had a sort offset.
   
-  for ( int32_t tag : rootTags ) {
-    siblings.erase(tag);
+  auto expand = [&](int32_t index) {
+    tree.childOffsets[index] = (int32_t) tree.children.size();
     
-    for ( int32_t sibling : siblings ) {
-      if (debug) {
-        cout << "sibling " << sibling << endl;
+    for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSpan(tree.tags[index]) ) {
+      int32_t neighborIndex = tagToIndex[neighborTag];
+      
+      if (!claimed[neighborIndex]) {
+        claimed[neighborIndex] = 1;
+        tree.children.push_back(neighborIndex);
       }
-#if defined(DEBUG)
-      assert(map.count(sibling) == 0);
-#endif
-      map[sibling] = vector<int32_t>();
     }
     
-    recurseSuperpixelContainmentImpl(spImage, map, tag, superpixelTagToOffsetMap);
+    tree.numChildren[index] = (int32_t) tree.children.size() - tree.childOffsets[index];
     
-    for ( int32_t sibling : siblings ) {
-#if defined(DEBUG)
-      assert(map.count(sibling) > 0);
-      assert(map[sibling].size() == 0);
-#endif
-
-      map.erase(sibling);
+    LOG(LogModuleContainment, LogLevelTrace) << "expand tag " << tree.tags[index] << " with " << tree.numChildren[index] << " children";
+  };
+  
+  // Each stack entry is a superpixel and the offset of its next child to visit
+  
+  vector<pair<int32_t, int32_t> > stack;
+  
+  for ( int32_t rootIndex : tree.roots ) {
+    expand(rootIndex);
+    stack.push_back(make_pair(rootIndex, 0));
+    
+    while (!stack.empty()) {
+      pair<int32_t, int32_t> &top = stack.back();
+      
+      if (top.second == tree.numChildren[top.first]) {
+        stack.pop_back();
+        continue;
+      }
+      
+      int32_t childIndex = tree.children[tree.childOffsets[top.first] + top.second];
+      top.second += 1;
+      
+      expand(childIndex);
+      stack.push_back(make_pair(childIndex, 0));
     }
+  }
+}
 
+// Superpixel indexes in the order recurseSuperpixelIterate() visits them,
+// every superpixel comes before the superpixels it contains.
+
+static vector<int32_t> containmentPreorder(const SuperpixelContainmentTree &tree)
+{
+  vector<int32_t> order;
+  order.reserve(tree.tags.size());
+  
+  vector<int32_t> stack(tree.roots);
+  
+  while (!stack.empty()) {
+    int32_t index = stack.back();
+    stack.pop_back();
+    
+    order.push_back(index);
+    
+    const int32_t *childPtr = tree.children.data() + tree.childOffsets[index];
+    stack.insert(end(stack), childPtr, childPtr + tree.numChildren[index]);
+  }
+  
+  return order;
+}
+
+vector<int32_t> superpixelContainmentInsideOutOrder(const SuperpixelContainmentTree &tree)
+{
+  vector<int32_t> order = containmentPreorder(tree);
+  
+  vector<int32_t> tags;
+  tags.reserve(order.size());
+  
+  for ( auto it = order.rbegin(); it != order.rend(); ++it ) {
+    tags.push_back(tree.tags[*it]);
+  }
+  
+  return tags;
+}
+
+// Recurse into each superpixel and determine the children of each superpixel.
+
+std::vector<int32_t>
+recurseSuperpixelContainment(SuperpixelImage &spImage,
+                             const Mat &tagsImg,
+                             unordered_map<int32_t, std::vector<int32_t> > &map)
+{
+  TRACE_SPAN("recurseSuperpixelContainment");
+  
+  SuperpixelContainmentTree tree;
+  
+  buildSuperpixelContainmentTree(spImage, tagsImg, tree);
+  
+  for ( int32_t index : containmentPreorder(tree) ) {
+    vector<int32_t> &children = map[tree.tags[index]];
+    
+    const int32_t *childPtr = tree.children.data() + tree.childOffsets[index];
+    
+    for ( int32_t i = 0; i < tree.numChildren[index]; i++ ) {
+      children.push_back(tree.tags[childPtr[i]]);
+    }
+  }
+  
+  vector<int32_t> rootTags;
+  
+  for ( int32_t rootIndex : tree.roots ) {
+    rootTags.push_back(tree.tags[rootIndex]);
   }
   
   return rootTags;
@@ -8817,6 +8899,13 @@ recurseSuperpixelContainment(SuperpixelImage &spImage,
 // result tags in tagsMat.
 
 bool srmMultiSegment(const Mat & inputImg, Mat & tagsMat) {
+  SRMContext srmContext;
+  return srmMultiSegment(srmContext, inputImg, tagsMat);
+}
+
+bool srmMultiSegment(SRMContext &srmContext, const Mat & inputImg, Mat & tagsMat) {
+  TRACE_SPAN("srmMultiSegment");
+  
   // Run SRM logic to generate initial segmentation based on statistical "alikeness".
   // Very large regions are likely to be very alike or even contain many pixels that
   // are identical.
@@ -8833,119 +8922,63 @@ bool srmMultiSegment(const Mat & inputImg, Mat & tagsMat) {
   //double Qmore = Q + 128.0; // break up into more regions
   //double Qmore = 512.0; // break up into more regions
   
-  Mat srmTags1 = generateSRM(inputImg, Q);
+  // SRM labels are 4 connected since regions only ever merge with a neighbor,
+  // and the tiled path splits a region that is only connected through a tile
+  // margin into one label for each connected piece of the tile core. Unlike
+  // tags converted from the mean color output two regions that are not
+  // connected are never assigned the same tag and no connected components
+  // pass is needed.
   
-//  Mat srmTags2 = generateSRM(inputImg, Qmore);
+  // Images with more pixels than this are segmented in overlapping tiles, so
+  // that the SRM memory is bounded by the tile size instead of the image size
   
-  // Collect the more precise segmentations into groups
+  const size_t srmTiledMinPixels = 8192 * 8192;
   
-  // Alloc object on stack
-  SuperpixelImage spImage;
+  // Tiling bounds the SRM memory but the superpixels still store 16 bit
+  // coordinates and 24 bit tags, so larger inputs are rejected here instead
+  // of asserting later in the parse.
   
-  bool worked = SuperpixelImage::parse(srmTags1, spImage);
-  
-  if (!worked) {
+  if (inputImg.cols > 0xFFFF || inputImg.rows > 0xFFFF) {
+    cerr << "image size " << inputImg.cols << " x " << inputImg.rows << " is larger than the 65535 x 65535 limit" << endl;
     return false;
   }
   
-  if ((1)) {
-    // Bypass second stage SRM
+  Mat srmLabels;
+  int numLabels;
+  
+  if (inputImg.total() > srmTiledMinPixels) {
+    srmLabels = generateSRMTiled(inputImg, Q, 0, 0, numLabels, srmContext.getThreads());
+  } else {
+    vector<uint32_t> labelSizes;
+    vector<uint32_t> labelColors;
     
-    tagsMat = srmTags1;
-
+    srmLabels = generateSRMLabels(srmContext, inputImg, Q, labelSizes, labelColors);
+    numLabels = (int) labelSizes.size();
   }
   
-  // Check input coming from the SRM process for the difficult to deal with condition
-  // where two regions that are not 8 connected are assigned the same tag. This
-  // makes it impossible to process correctly so each superpixel region needs to
-  // be test via a flood fill to make sure that no disconnected pixels are found.
-  
-  if (1) {
-    
-    RegionRemerger remerger(inputImg);
-    
-    vector<int32_t> sortedSuperpixelTags = spImage.sortSuperpixelsBySize();
-    
-    Mat floodMask = remerger.maskMat.clone();
-    
-    //Mat outMask = remerger.maskMat.clone();
-    
-    for ( auto it = begin(sortedSuperpixelTags); it != end(sortedSuperpixelTags); ) {
-      int32_t tag = *it;
-      
-      if (1) {
-        cout << "iter tag " << tag << endl;
-      }
-
-      floodMask = Scalar(0);
-      
-      // FIXME: not strictly needed since floodFillMask() clears
-      //outMask = Scalar(0);
-      
-      // Find bbox for this superpixel region
-      
-      Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
-      
-//      int32_t originX, originY, regionWidth, regionHeight;
-//      bbox(originX, originY, regionWidth, regionHeight, spPtr->coords);
-//      Rect roiRect(originX, originY, regionWidth, regionHeight);
-
-      // Generate flood fill in mask based on input
-      
-      for (Coord c : spPtr->coords) {
-        floodMask.at<uint8_t>(c.y, c.x) = 0xFF;
-      }
-      
-      // Set remerger.maskMat for any already merged superpixels
-      
-      remerger.mergeMatToMask();
-      
-      for_each_byte(floodMask, remerger.maskMat, [](uint8_t* bytePtr1, const uint8_t* bytePtr2) {
-        if (*bytePtr2) {
-          *bytePtr1 = 0x0;
-        }
-      });
-      
-      // FIXME: could make faster with int count on, instead of findNonZero.
-      // Could also manintain a count of pixels consumed for each superpixel.
-      
-//      Point2i startPoint = coordToPoint(spPtr->coords[0]);
-      
-      vector<Point> locations;
-      findNonZero(floodMask, locations);
-      if (locations.size() == 0) {
-        // All pixels in specific superpixel now consumed
-        ++it;
-        continue;
-      }
-      Point2i startPoint = locations[0];
-      
-      // Invert so that black pixels get filled, white means do not expand
-      
-      binMatInvert(floodMask);
-      
-      floodMask.at<uint8_t>(startPoint.y, startPoint.x) = 0xFF;
-      
-      // FIXME: what about pixels that were not merged from same superpixel ?
-      
-      int numFilled = floodFillMask(floodMask, remerger.maskMat, startPoint, 8);
-      
-      if (numFilled == 0) {
-        // When no more pixels can be filled from this superpixel, advance to next one
-        ++it;
-      } else {
-        remerger.mergeFromMask();
-      }
-    }
-    
-    remerger.mergeLeftovers(tagsMat);
-    
-    // State of remerged Mat should now be ready to use
-    
-    tagsMat = remerger.mergeMat;
+  // Each tag is the label plus 1 and 0xFFFFFF is not a valid tag
   
+  if (numLabels >= 0x00FFFFFF) {
+    cerr << "srm generated " << numLabels << " regions, more than the " << (0x00FFFFFF - 1) << " tag limit" << endl;
+    return false;
   }
-    
+  
+  tagsMat = labelsToTags(srmLabels);
+  
+  LOG(LogModuleSRM, LogLevelInfo) << "srm generated " << numLabels << " regions";
+  
+  // The disabled grouping pass below reads the SRM tags as srmTags1
+  
+  Mat srmTags1 = tagsMat;
+  
+  // A second segmentation at Qmore can be generated in the same pass
+  // with srm_run_multi() and Qs {Q, Qmore}.
+  
+  // Collect the more precise segmentations into groups
+  
+  // Alloc object on stack
+  SuperpixelImage spImage;
+  
   // -----------------------------------------------------------------------------
   
   if ((0)) {
@@ -8982,7 +9015,7 @@ bool srmMultiSegment(const Mat & inputImg, Mat & tagsMat) {
       fnameStream << "srm_multi" << "_tag_" << tag << "_check_region_bbox" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, roiInputMat);
+      debugArtifactWrite(DebugArtifactSRM, fname, roiInputMat);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -9008,7 +9041,7 @@ bool srmMultiSegment(const Mat & inputImg, Mat & tagsMat) {
       fnameStream << "srm_multi" << "_tag_" << tag << "_check_region_alpha_input" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, alphaMaskedRegionPixels);
+      debugArtifactWrite(DebugArtifactSRM, fname, alphaMaskedRegionPixels);
       cout << "wrote " << fname << endl;
       cout << "";
     }
@@ -14,9 +14,13 @@
 #include <string>
 #include <unordered_map>
 
+#include "DebugArtifacts.h"
+
 class SuperpixelImage;
 class Coord;
+class CoordSpans;
 class LineOrCurveSegment;
+class SRMContext;
 
 using cv::Mat;
 using std::string;
@@ -51,9 +55,43 @@ Mat genHistogramsForBlocks(const Mat &inputImg,
 
 Mat generateSRM(const Mat &inputImg, double Q);
 
+// Generate SRM output with a SRMContext that is kept between calls so that
+// same sized frames reuse the SRM buffers.
+
+Mat generateSRM(SRMContext &srmContext, const Mat &inputImg, double Q);
+
+// Generate a CV_32SC1 Mat of consecutive SRM region labels, this avoids the round trip
+// through mean colors where two regions with the same mean would share a tag. The
+// pixel count and mean color (as 0x00RRGGBB) of each label are also returned.
+
+Mat generateSRMLabels(const Mat &inputImg, double Q, vector<uint32_t> &labelSizes, vector<uint32_t> &labelColors);
+
+Mat generateSRMLabels(SRMContext &srmContext, const Mat &inputImg, double Q, vector<uint32_t> &labelSizes, vector<uint32_t> &labelColors);
+
+// Generate a CV_32SC1 Mat of SRM region labels by segmenting overlapping tiles
+// in parallel and joining regions across tile seams, for images too large to
+// segment in one piece. A tileSize of 0 uses the default tile size and
+// numThreads of 0 uses one thread for each core.
+
+Mat generateSRMTiled(const Mat &inputImg, double Q, int tileSize, int overlap, int &numLabels, unsigned int numThreads = 0);
+
+// Convert a label Mat to a tags Mat where each tag is the label plus 1
+
+Mat labelsToTags(const Mat &labels);
+
+// Return a rectangle that contains every pixel captureRegionMask() can read from
+// or write to the mask for the region defined by coords.
+
+cv::Rect morphRegionROI(const Mat & inputImg,
+                        const CoordSpans &coords,
+                        int superpixelDim);
+
 // Given a tag indicating a superpixel generate a mask that captures the region in terms of
 // exact pixels. This method returns a Mat that indicate a boolean region mask where 0xFF
-// means that the pixel is inside the indicated region.
+// means that the pixel is inside the indicated region. The mask covers maskRect of the
+// image and maskRect must contain morphRegionROI() for the region. Only the mask pixels
+// inside the bounding box of the written pixels are cleared, when maskROI is not NULL
+// it is set to that bounding box in image coordinates.
 
 bool
 captureRegionMask(SuperpixelImage &spImage,
@@ -64,7 +102,9 @@ captureRegionMask(SuperpixelImage &spImage,
                   int blockHeight,
                   int superpixelDim,
                   Mat &mask,
-                  const Mat &blockBasedQuantMat);
+                  const cv::Rect &maskRect,
+                  const Mat &blockBasedQuantMat,
+                  cv::Rect *maskROI = NULL);
 
 // Foreach pixel in a colortable determine the "inside/outside" status of that
 // pixel based on a stats test as compared to the current known region.
@@ -85,6 +125,30 @@ void insideOutsideTest(int32_t width,
                        const vector<uint32_t> &sortedColortable,
                        unordered_map<uint32_t, InsideOutsideRecord> &pixelToInsideMap);
 
+// Containment tree stored in flat arrays indexed by the dense index of each
+// superpixel, tags holds the tag of each index in ascending tag order. The
+// children of index i are children[childOffsets[i]] to
+// children[childOffsets[i] + numChildren[i] - 1].
+
+typedef struct {
+  vector<int32_t> tags;
+  vector<int32_t> childOffsets;
+  vector<int32_t> numChildren;
+  vector<int32_t> children;
+  vector<int32_t> roots;
+} SuperpixelContainmentTree;
+
+// Determine the children of each superpixel without recursion, roots are the
+// superpixels that touch the image edges in order of decreasing size.
+
+void buildSuperpixelContainmentTree(SuperpixelImage &spImage,
+                                    const Mat &tagsImg,
+                                    SuperpixelContainmentTree &tree);
+
+// Tags ordered so that each tag comes after all the tags it contains
+
+vector<int32_t> superpixelContainmentInsideOutOrder(const SuperpixelContainmentTree &tree);
+
 // Recurse into each superpixel and determine the children of each superpixel.
 
 std::vector<int32_t>
@@ -92,21 +156,31 @@ recurseSuperpixelContainment(SuperpixelImage &spImage,
                              const Mat &tagsImg,
                              unordered_map<int32_t, std::vector<int32_t> > &map);
 
-// Inlined typed recursion method to iterate over tree structure contained
-// in root tags and a map that maps the tag to a vector of children.
+// Iterate over tree structure contained in root tags and a map that maps the
+// tag to a vector of children. Each tag is visited before its children and
+// the tags in each list are visited in reverse order, an explicit stack is
+// used so that deep nesting cannot overflow the call stack.
 
+template <typename F>
 static inline
 void recurseSuperpixelIterate(const vector<int32_t> &tags,
-                              unordered_map<int32_t, vector<int32_t> > &map,
-                              std::function<void(int32_t, const vector<int32_t> &)> f)
+                              const unordered_map<int32_t, vector<int32_t> > &map,
+                              F f)
 {
-  for (auto it = tags.rbegin(); it != tags.rend(); ++it) {
-    int32_t tag = *it;
-    vector<int32_t> &children = map[tag];
+  static const vector<int32_t> noChildren;
+  
+  vector<int32_t> stack(tags);
+  
+  while (!stack.empty()) {
+    int32_t tag = stack.back();
+    stack.pop_back();
+    
+    auto it = map.find(tag);
+    const vector<int32_t> &children = (it == map.end()) ? noChildren : it->second;
     
     f(tag, children);
     
-    recurseSuperpixelIterate(children, map, f);
+    stack.insert(end(stack), begin(children), end(children));
   }
 }
 
@@ -114,6 +188,10 @@ void recurseSuperpixelIterate(const vector<int32_t> &tags,
 
 bool srmMultiSegment(const Mat & inputImg, Mat & tagsMat);
 
+// Multi segmenting approach with a SRMContext that is kept between calls
+
+bool srmMultiSegment(SRMContext &srmContext, const Mat & inputImg, Mat & tagsMat);
+
 // Implement merge of superpixels based on coordinates gather from SRM process
 
 #import "SuperpixelMergeManager.h"
@@ -139,7 +217,7 @@ public:
   int32_t mergedIntoTag;
   
   // Set to true to enable debug global step dump
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactMerge);
   
   // Set to true to enable debug step dump
   const bool debugDumpEachStepImages = false;
@@ -215,7 +293,7 @@ public:
         fnameStream << "merge_global_step_" << mergeStep << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, tmpResultImg);
+        debugArtifactWrite(DebugArtifactMerge, fname, tmpResultImg);
         cout << "wrote " << fname << endl;
       }
     }
@@ -261,7 +339,7 @@ public:
       fnameStream << "merge_step_" << mergeStep << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, tmpResultImg);
+      debugArtifactWrite(DebugArtifactMerge, fname, tmpResultImg);
       cout << "wrote " << fname << endl;
     }
     
@@ -7,12 +7,21 @@
 //
 
 // clusteringsegmentation IMAGE TAGS_IMAGE
+// clusteringsegmentation -batch MANIFEST|DIR OUTDIR ?JOBS?
+// clusteringsegmentation -server SOCKET ?JOBS?
 //
 // This logic reads input pixels from an image and segments the image into different connected
 // areas based on growing area of alike pixels. A set of pixels is determined to be alike
 // if the pixels are near to each other in terms of 3D space via a fast clustering method.
 // The TAGS_IMAGE output file is written with alike pixels being defined as having the same
 // tag color.
+//
+// In batch mode every image listed in MANIFEST (one path per line) or found in DIR is
+// segmented by a pool of JOBS worker threads. The tags image and debug images for each
+// input are written to OUTDIR/NAME/ where NAME is the input filename without extension.
+//
+// In server mode requests are read from the Unix domain socket SOCKET and handled by
+// JOBS worker threads, see SegmentationServer.hpp for the protocol.
 
 #include <opencv2/opencv.hpp>
 
@@ -23,6 +32,10 @@
 #include "SuperpixelImage.h"
 
 #include "OpenCVUtil.h"
+#include "DebugArtifacts.h"
+#include "Log.h"
+#include "Trace.h"
+#include "MemoryStats.h"
 #include "Util.h"
 
 #include "quant_util.h"
@@ -37,18 +50,76 @@
 #include "Util.h"
 
 #include "RegionRemerger.hpp"
+#include "RegionCaptureScheduler.hpp"
+#include "SegmentationServer.hpp"
+#include "SRMContext.hpp"
 
 #include <stack>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 using namespace cv;
 using namespace std;
 
-bool clusteringCombine(Mat &inputImg, Mat &resultImg);
+bool clusteringCombine(Mat &inputImg, Mat &resultImg, unsigned int captureThreads, SRMContext &srmContext);
+
+int batchMain(int argc, const char** argv);
+
+int serverMain(int argc, const char** argv);
 
 int main(int argc, const char** argv) {
   const char *inputImgFilename = NULL;
   const char *outputTagsImgFilename = NULL;
 
+  // Debug images are enabled with a comma separated list of categories
+  // like CLUSTERING_DEBUG_ARTIFACTS=capture,shape or "all"
+  
+  if (!debugArtifactEnableNames(getenv("CLUSTERING_DEBUG_ARTIFACTS"))) {
+    exit(1);
+  }
+  
+  // Log levels for each module like CLUSTERING_LOG=merge=debug,containment=trace
+  
+  if (!logSetLevels(getenv("CLUSTERING_LOG"))) {
+    exit(1);
+  }
+  
+  // Write a Chrome trace of the processing stages to CLUSTERING_TRACE=trace.json
+  // and print a summary of the time spent in each stage at exit
+  
+  traceEnable(getenv("CLUSTERING_TRACE"));
+  
+  // Print the Mat and resident memory high water marks of each stage at exit
+  // when CLUSTERING_MEMORY=1
+  
+  const char *memoryEnv = getenv("CLUSTERING_MEMORY");
+  
+  if (memoryEnv != NULL && *memoryEnv != '\0') {
+    memoryStatsEnable();
+  }
+  
+  // CLUSTERING_LOW_MEMORY=1 lowers the peak memory use at the cost of speed
+  
+  const char *lowMemoryEnv = getenv("CLUSTERING_LOW_MEMORY");
+  
+  if (lowMemoryEnv != NULL && *lowMemoryEnv != '\0') {
+    memorySetLowMode(true);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "-batch") == 0) {
+    exit(batchMain(argc, argv));
+  }
+  
+  if (argc >= 2 && strcmp(argv[1], "-server") == 0) {
+    exit(serverMain(argc, argv));
+  }
+  
   if (argc == 2) {
     inputImgFilename = argv[1];
     // Default to "outtags.png"
@@ -83,6 +154,8 @@ int main(int argc, const char** argv) {
     }
   } else if (argc != 3) {
     cerr << "usage : " << argv[0] << " IMAGE ?TAGS_IMAGE?" << endl;
+    cerr << "usage : " << argv[0] << " -batch MANIFEST|DIR OUTDIR ?JOBS?" << endl;
+    cerr << "usage : " << argv[0] << " -server SOCKET ?JOBS?" << endl;
     exit(1);
   } else if (argc == 3) {
     inputImgFilename = argv[1];
@@ -105,8 +178,9 @@ int main(int argc, const char** argv) {
   }
   
   Mat resultImg;
+  SRMContext srmContext;
   
-  bool worked = clusteringCombine(inputImg, resultImg);
+  bool worked = clusteringCombine(inputImg, resultImg, 0, srmContext);
   if (!worked) {
     cerr << "cluster combine operation failed " << endl;
     exit(1);
@@ -116,15 +190,403 @@ int main(int argc, const char** argv) {
   
   cout << "wrote " << outputTagsImgFilename << endl;
   
+  debugArtifactFlush();
+  logFlush();
+  
   exit(0);
 }
 
-// Main method that implements the cluster combine logic
+// True if filename ends with an image extension that imread() can decode
+
+static bool hasImageExtension(const string &filename)
+{
+  static const char *extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".ppm", NULL };
+  
+  size_t dot = filename.rfind('.');
+  if (dot == string::npos) {
+    return false;
+  }
+  
+  string ext = filename.substr(dot);
+  for ( char &c : ext ) {
+    c = tolower(c);
+  }
+  
+  for ( int i = 0; extensions[i] != NULL; i++ ) {
+    if (ext == extensions[i]) {
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+// Read input image paths from a directory (sorted by name) or from a manifest
+// file with one path per line, empty lines and lines starting with # are skipped.
+// Relative manifest paths are relative to the manifest's directory.
+
+static bool batchInputPaths(const char *manifestOrDir, vector<string> &paths)
+{
+  string base(manifestOrDir);
+  
+  struct stat st;
+  if (stat(manifestOrDir, &st) != 0) {
+    cerr << "could not stat \"" << manifestOrDir << "\"" << endl;
+    return false;
+  }
+  
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(manifestOrDir);
+    if (dir == NULL) {
+      cerr << "could not open directory \"" << manifestOrDir << "\"" << endl;
+      return false;
+    }
+    
+    vector<string> names;
+    
+    for ( struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir) ) {
+      string name(entry->d_name);
+      if (name[0] != '.' && hasImageExtension(name)) {
+        names.push_back(name);
+      }
+    }
+    
+    closedir(dir);
+    
+    sort(begin(names), end(names));
+    
+    for ( const string &name : names ) {
+      paths.push_back(base + "/" + name);
+    }
+    
+    return true;
+  }
+  
+  FILE *fp = fopen(manifestOrDir, "r");
+  if (fp == NULL) {
+    cerr << "could not open manifest \"" << manifestOrDir << "\"" << endl;
+    return false;
+  }
+  
+  size_t lastSlash = base.rfind('/');
+  string manifestDir = (lastSlash == string::npos) ? "" : base.substr(0, lastSlash + 1);
+  
+  char line[4096];
+  
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    string path(line);
+    
+    while (path.size() > 0 && isspace(path[path.size() - 1])) {
+      path.erase(path.size() - 1);
+    }
+    
+    if (path.size() == 0 || path[0] == '#') {
+      continue;
+    }
+    
+    if (path[0] != '/') {
+      path = manifestDir + path;
+    }
+    
+    paths.push_back(path);
+  }
+  
+  fclose(fp);
+  
+  return true;
+}
+
+static bool makeDirectory(const string &dirname)
+{
+  if (mkdir(dirname.c_str(), 0755) != 0 && errno != EEXIST) {
+    cerr << "could not create directory \"" << dirname << "\"" << endl;
+    return false;
+  }
+  return true;
+}
+
+typedef struct {
+  string inputPath;
+  string outputDir;
+  bool worked;
+  double megapixels;
+  double latencyMillis;
+} BatchImage;
+
+// Segment one image, this depends only on the paths in batchImage and not on
+// the process working directory so that any number can run at the same time.
 
-bool clusteringCombine(Mat &inputImg, Mat &resultImg)
+static void batchProcessImage(BatchImage &batchImage, unsigned int captureThreads, SRMContext &srmContext)
 {
-  const bool debug = true;
-  const bool debugWriteIntermediateFiles = true;
+  auto startTime = chrono::steady_clock::now();
+  
+  batchImage.worked = false;
+  batchImage.megapixels = 0.0;
+  
+  debugArtifactSetDirectory(batchImage.outputDir);
+  
+  Mat inputImg = imread(batchImage.inputPath, CV_LOAD_IMAGE_COLOR);
+  
+  if (inputImg.empty() || inputImg.rows == 0 || inputImg.cols == 0) {
+    cerr << "could not read \"" << batchImage.inputPath << "\" as image data" << endl;
+  } else {
+    batchImage.megapixels = (inputImg.cols * inputImg.rows) / 1000000.0;
+    
+    Mat resultImg;
+    
+    if (!clusteringCombine(inputImg, resultImg, captureThreads, srmContext)) {
+      cerr << "cluster combine operation failed for \"" << batchImage.inputPath << "\"" << endl;
+    } else {
+      string outputTagsImgFilename = batchImage.outputDir + "/outtags.png";
+      batchImage.worked = imwrite(outputTagsImgFilename, resultImg);
+      
+      if (batchImage.worked) {
+        cout << "wrote " << outputTagsImgFilename << endl;
+      } else {
+        cerr << "could not write \"" << outputTagsImgFilename << "\"" << endl;
+      }
+    }
+  }
+  
+  debugArtifactSetDirectory("");
+  
+  auto elapsed = chrono::steady_clock::now() - startTime;
+  batchImage.latencyMillis = chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1000.0;
+}
+
+// Nearest rank percentile of sorted values
+
+static double percentile(const vector<double> &sortedValues, double p)
+{
+  if (sortedValues.size() == 0) {
+    return 0.0;
+  }
+  
+  int rank = (int) ceil(p / 100.0 * sortedValues.size());
+  rank = maxi(1, mini(rank, (int) sortedValues.size()));
+  return sortedValues[rank - 1];
+}
+
+// clusteringsegmentation -batch MANIFEST|DIR OUTDIR ?JOBS?
+//
+// JOBS defaults to one for each core, the capture threads of each image are
+// divided between the jobs so that the total number of threads stays the same.
+
+int batchMain(int argc, const char** argv)
+{
+  if (argc != 4 && argc != 5) {
+    cerr << "usage : " << argv[0] << " -batch MANIFEST|DIR OUTDIR ?JOBS?" << endl;
+    return 1;
+  }
+  
+  const char *manifestOrDir = argv[2];
+  string outputDir(argv[3]);
+  
+  unsigned int numCores = thread::hardware_concurrency();
+  if (numCores == 0) {
+    numCores = 1;
+  }
+  
+  unsigned int numJobs = numCores;
+  
+  if (argc == 5) {
+    int jobs = atoi(argv[4]);
+    if (jobs <= 0) {
+      cerr << "invalid number of jobs \"" << argv[4] << "\"" << endl;
+      return 1;
+    }
+    numJobs = (unsigned int) jobs;
+  }
+  
+  vector<string> inputPaths;
+  
+  if (!batchInputPaths(manifestOrDir, inputPaths)) {
+    return 1;
+  }
+  
+  if (inputPaths.size() == 0) {
+    cerr << "no input images in \"" << manifestOrDir << "\"" << endl;
+    return 1;
+  }
+  
+  if (!makeDirectory(outputDir)) {
+    return 1;
+  }
+  
+  // Each image gets an output directory named after the input file, inputs
+  // with the same name in different directories get a numeric suffix.
+  
+  vector<BatchImage> batchImages(inputPaths.size());
+  unordered_map<string, int> nameCounts;
+  
+  for ( int i = 0; i < (int)inputPaths.size(); i++ ) {
+    BatchImage &batchImage = batchImages[i];
+    batchImage.inputPath = inputPaths[i];
+    
+    size_t lastSlash = inputPaths[i].rfind('/');
+    string name = (lastSlash == string::npos) ? inputPaths[i] : inputPaths[i].substr(lastSlash + 1);
+    size_t dot = name.rfind('.');
+    if (dot != string::npos && dot > 0) {
+      name = name.substr(0, dot);
+    }
+    
+    int count = nameCounts[name]++;
+    if (count > 0) {
+      name += "_" + to_string(count);
+    }
+    
+    batchImage.outputDir = outputDir + "/" + name;
+    
+    if (!makeDirectory(batchImage.outputDir)) {
+      return 1;
+    }
+  }
+  
+  if (numJobs > batchImages.size()) {
+    numJobs = (unsigned int) batchImages.size();
+  }
+  
+  unsigned int captureThreads = maxi(1, (int)(numCores / numJobs));
+  
+  cout << "batch of " << batchImages.size() << " images with " << numJobs << " jobs" << endl;
+  
+  atomic<int> nextImage(0);
+  
+  // Each job keeps its SRM buffers for all of its images, SRM runs on the
+  // same share of the cores as the capture
+  
+  auto worker = [&]() {
+    SRMContext srmContext(captureThreads);
+    
+    while (1) {
+      int i = nextImage++;
+      if (i >= (int)batchImages.size()) {
+        break;
+      }
+      batchProcessImage(batchImages[i], captureThreads, srmContext);
+    }
+  };
+  
+  auto startTime = chrono::steady_clock::now();
+  
+  vector<thread> threads;
+  
+  for ( unsigned int i = 1; i < numJobs; i++ ) {
+    threads.push_back(thread(worker));
+  }
+  
+  worker();
+  
+  for ( thread &t : threads ) {
+    t.join();
+  }
+  
+  auto elapsed = chrono::steady_clock::now() - startTime;
+  double elapsedSeconds = chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1000000.0;
+  
+  debugArtifactFlush();
+  logFlush();
+  
+  // Throughput counts only the images that worked, latency counts all of them
+  
+  int numWorked = 0;
+  double totalMegapixels = 0.0;
+  vector<double> latencies;
+  
+  for ( BatchImage &batchImage : batchImages ) {
+    if (batchImage.worked) {
+      numWorked += 1;
+      totalMegapixels += batchImage.megapixels;
+    }
+    latencies.push_back(batchImage.latencyMillis);
+  }
+  
+  sort(begin(latencies), end(latencies));
+  
+  int numFailed = (int)batchImages.size() - numWorked;
+  
+  fprintf(stdout, "batch done : %d ok, %d failed in %.3f s\n", numWorked, numFailed, elapsedSeconds);
+  fprintf(stdout, "throughput : %.3f images/s, %.3f MP/s\n",
+          numWorked / elapsedSeconds,
+          totalMegapixels / elapsedSeconds);
+  fprintf(stdout, "latency    : p50 %.1f ms, p99 %.1f ms\n",
+          percentile(latencies, 50.0),
+          percentile(latencies, 99.0));
+  fflush(stdout);
+  
+  return (numFailed == 0) ? 0 : 1;
+}
+
+// clusteringsegmentation -server SOCKET ?JOBS?
+//
+// JOBS defaults to one for each core. Each worker keeps a SRMContext so that
+// the SRM buffers are allocated once for a series of same sized images, SRM
+// and capture run on the threads= of the request or on the job's share of
+// the cores.
+// Requests can only read PATH images and write out= and debug= paths inside
+// the directory named by CLUSTERING_SERVER_ROOT.
+
+int serverMain(int argc, const char** argv)
+{
+  if (argc != 3 && argc != 4) {
+    cerr << "usage : " << argv[0] << " -server SOCKET ?JOBS?" << endl;
+    return 1;
+  }
+  
+  const char *socketPath = argv[2];
+  
+  unsigned int numCores = thread::hardware_concurrency();
+  if (numCores == 0) {
+    numCores = 1;
+  }
+  
+  unsigned int numJobs = numCores;
+  
+  if (argc == 4) {
+    int jobs = atoi(argv[3]);
+    if (jobs <= 0) {
+      cerr << "invalid number of jobs \"" << argv[3] << "\"" << endl;
+      return 1;
+    }
+    numJobs = (unsigned int) jobs;
+  }
+  
+  // Requests that do not set threads= split the cores between the jobs
+  
+  unsigned int defaultCaptureThreads = maxi(1, (int)(numCores / numJobs));
+  
+  vector<SRMContext> srmContexts(numJobs);
+  
+  auto segment = [&](int workerIndex, Mat &inputImg, const SegmentationRequestParams &params, Mat &tagsImg) -> bool {
+    unsigned int captureThreads = params.captureThreads;
+    if (captureThreads == 0) {
+      captureThreads = defaultCaptureThreads;
+    }
+    
+    // SRM runs on the same number of threads as the capture
+    
+    srmContexts[workerIndex].setThreads(captureThreads);
+    
+    return clusteringCombine(inputImg, tagsImg, captureThreads, srmContexts[workerIndex]);
+  };
+  
+  return runSegmentationServer(socketPath, getenv("CLUSTERING_SERVER_ROOT"), numJobs, segment);
+}
+
+// The static colortable used for the result image is shared by batch and server jobs
+
+static mutex staticColortableLock;
+
+// Main method that implements the cluster combine logic,
+// captureThreads is the number of threads used to parse and capture regions, 0 means
+// one thread for each core. srmContext keeps SRM buffers between images.
+
+bool clusteringCombine(Mat &inputImg, Mat &resultImg, unsigned int captureThreads, SRMContext &srmContext)
+{
+  TRACE_SPAN("clusteringCombine");
+  MEMORY_STAGE("clusteringCombine");
+  
+  const bool debugWriteIntermediateFiles = debugArtifactEnabled(DebugArtifactMerge);
   
   // Alloc object on stack
   SuperpixelImage spImage;
@@ -156,7 +618,17 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
   
   Mat srmTags;
   
-  worked = srmMultiSegment(inputImg, srmTags);
+  {
+    MEMORY_STAGE("srmMultiSegment");
+    
+    worked = srmMultiSegment(srmContext, inputImg, srmTags);
+    
+    // Low memory mode does not keep the SRM buffers for the next image
+    
+    if (memoryLowMode()) {
+      srmContext.release();
+    }
+  }
   
   if (!worked) {
     return false;
@@ -168,35 +640,43 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     
   // Scan the tags generated by SRM and create superpixels of vario
   
-  worked = SuperpixelImage::parse(srmTags, spImage);
+  {
+    MEMORY_STAGE("parse");
+    
+    // Stats of the input pixels in each superpixel are computed with the parse
+    // and kept up to date by merges, so superpixel checks need not read pixels
+    
+    worked = SuperpixelImage::parse(srmTags, inputImg, spImage, captureThreads);
+  }
   
   if (!worked) {
     return false;
   }
   
-  // Dump image that shows the input superpixels written with a colortable
-  
-  resultImg = inputImg.clone();
-  resultImg = (Scalar) 0;
+  // Dump image that shows the input superpixels written with a colortable,
+  // resultImg is not allocated until the end so that it does not add to the
+  // peak of the stages in between.
   
   sranddev();
   
   if (debugWriteIntermediateFiles) {
+    Mat tagsInitImg(inputImg.size(), CV_8UC3, Scalar(0,0,0));
+    
+    lock_guard<mutex> lock(staticColortableLock);
     generateStaticColortable(inputImg, spImage);
+    writeTagsWithStaticColortable(spImage, tagsInitImg);
+    debugArtifactWrite(DebugArtifactMerge, "tags_init.png", tagsInitImg);
   }
   
-  if (debugWriteIntermediateFiles) {
-    writeTagsWithStaticColortable(spImage, resultImg);
-    imwrite("tags_init.png", resultImg);
-  }
-  
-  cout << "started with " << spImage.superpixels.size() << " superpixels" << endl;
+  LOG(LogModuleMerge, LogLevelInfo) << "started with " << spImage.superpixels.size() << " superpixels";
   
   // Scan superpixels to determine containment tree
   
   vector<int32_t> srmInsideOutOrder;
   
   {
+    MEMORY_STAGE("containment");
+    
     // Fill with UID+1
     
     spImage.fillMatrixWithSuperpixelTags(srmTags);
@@ -204,53 +684,33 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     // Scan SRM superpixel regions in terms of containment, this generates a tree
     // where each UID can contain 1 to N children.
     
-    unordered_map<int32_t, vector<int32_t> > containsTreeMap;
+    SuperpixelContainmentTree containsTree;
     
     // FIXME: If just 1 interior shape touches edge, do not conside as sigblings
     
-    vector<int32_t> rootTags = recurseSuperpixelContainment(spImage, srmTags, containsTreeMap);
+    buildSuperpixelContainmentTree(spImage, srmTags, containsTree);
     
-    for ( auto &pair : containsTreeMap ) {
-      uint32_t tag = pair.first;
-      vector<int32_t> children = pair.second;
-      
-      cout << "for srm superpixels tag " << tag << " num children are " << children.size() << endl;
-      for ( int32_t childTag : children ) {
-        cout << childTag << endl;
+    if (logEnabled(LogModuleContainment, LogLevelDebug)) {
+      for ( int i = 0; i < (int)containsTree.tags.size(); i++ ) {
+        LogLine() << "for srm superpixels tag " << containsTree.tags[i] << " num children are " << containsTree.numChildren[i];
       }
     }
     
-    stack<int32_t> insideOutStack;
+    // Process the most deeply contained superpixels first
     
-    // Lambda
-    auto lambdaFunc = [&](int32_t tag, const vector<int32_t> &children)->void {
-      fprintf(stdout, "tag %9d has %5d children\n", tag, (int)children.size());
-      
-      insideOutStack.push(tag);
-    };
-    
-    recurseSuperpixelIterate(rootTags, containsTreeMap, lambdaFunc);
-    
-    // Print in stack order
-
-    if (debug) {
-    fprintf(stdout, "inside out order\n");
-    }
+    srmInsideOutOrder = superpixelContainmentInsideOutOrder(containsTree);
     
-    while (!insideOutStack.empty())
-    {
-      int32_t tag = insideOutStack.top();
-      if (debug) {
+    if (logEnabled(LogModuleContainment, LogLevelDebug)) {
+      LogLine() << "inside out order";
+      
+      for ( int32_t tag : srmInsideOutOrder ) {
         Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
-        fprintf(stdout, "tag %5d has %5d children and N = %d\n", tag, (int)containsTreeMap[tag].size(), (int)spPtr->coords.size());
+        float mean[3], variance[3];
+        spPtr->statsMeanAndVariance(mean, variance);
+        LogLine() << "tag " << tag << " has N = " << spPtr->coords.size() << " with mean (" << (int)mean[0] << " " << (int)mean[1] << " " << (int)mean[2] << ")";
       }
-      insideOutStack.pop();
       
-      srmInsideOutOrder.push_back(tag);
-    }
-    
-    if (debug) {
-    fprintf(stdout, "done\n");
+      LogLine() << "done";
     }
   }
   
@@ -263,64 +723,68 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     // for each block. The histogram data can be scanned significantly faster
     // that rereading all the original pixel info.
     
-    unordered_map<Coord, HistogramForBlock> coordToBlockHistogramMap;
+    Mat blockBasedQuantMat;
     
-    Mat blockBasedQuantMat = genHistogramsForBlocks(inputImg, coordToBlockHistogramMap, blockWidth, blockHeight, superpixelDim);
+    {
+      MEMORY_STAGE("genHistogramsForBlocks");
+      
+      unordered_map<Coord, HistogramForBlock> coordToBlockHistogramMap;
+      
+      blockBasedQuantMat = genHistogramsForBlocks(inputImg, coordToBlockHistogramMap, blockWidth, blockHeight, superpixelDim);
+    }
     
-    // Loop over superpixels starting at the most contained and working outwards
+    // Capture superpixels starting at the most contained and working outwards, regions
+    // whose pixels cannot overlap are captured at the same time on different threads.
     
-    bool maskWritten;
+    LOG(LogModuleCapture, LogLevelDebug) << "process " << srmInsideOutOrder.size() << " tags";
     
-    for ( int32_t tag : srmInsideOutOrder ) {
-      if (debug) {
-        Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
-        cout << "process tag " << tag << " containing " << spPtr->coords.size() << endl;
-      }
-      
-      remerger.mergeMatToMask();
-      
-      maskWritten = captureRegionMask(spImage, inputImg, srmTags, tag, blockWidth, blockHeight, superpixelDim, remerger.maskMat, blockBasedQuantMat);
-      
-      if (maskWritten)
-      {
-        std::stringstream fnameStream;
-        fnameStream << "srm" << "_tag_" << tag << "_region_mask" << ".png";
-        string fname = fnameStream.str();
-        
-        imwrite(fname, remerger.maskMat);
-        cout << "wrote " << fname << endl;
-        cout << "";
-      }
+    // Each capture thread holds ROI sized masks until they are merged in
+    // order, low memory mode uses just one thread.
+    
+    if (memoryLowMode()) {
+      captureThreads = 1;
+    }
+    
+    {
+      MEMORY_STAGE("captureRegionMasks");
       
-      if (maskWritten) {
-        remerger.mergeFromMask();
-        
-        if (debugWriteIntermediateFiles) {
-          std::stringstream fnameStream;
-          fnameStream << "srm" << "_tag_" << tag << "_merge_region" << ".png";
-          string fname = fnameStream.str();
-          
-          imwrite(fname, remerger.mergeMat);
-          cout << "wrote " << fname << endl;
-          cout << "" << endl;
-        }
-      } // if maskWritten
+      captureRegionMasks(spImage, inputImg, srmTags, srmInsideOutOrder, blockWidth, blockHeight, superpixelDim, blockBasedQuantMat, remerger, captureThreads);
+    }
+    
+    blockBasedQuantMat.release();
+    
+    if (debugWriteIntermediateFiles) {
+      std::stringstream fnameStream;
+      fnameStream << "srm_merged_captured_regions" << ".png";
+      string fname = fnameStream.str();
       
-    } // foreach tag in sorted superpixels
+      debugArtifactWrite(DebugArtifactMerge, fname, remerger.mergeMat);
+      LogLine() << "wrote " << fname;
+    }
     
     // Gather any remaining tags that have not been merged
     // and add these as new sets of pixels.
     
-    remerger.mergeLeftovers(srmTags);
+    {
+      TRACE_SPAN("mergeLeftovers");
+      MEMORY_STAGE("mergeLeftovers");
+      remerger.mergeLeftovers(srmTags);
+    }
+    
+    // Only mergeMat is used from here on, the SRM superpixels are dropped
+    // now so that they are not held while the split and reparse allocate.
+    
+    remerger.releaseMasks();
+    srmTags.release();
+    spImage = SuperpixelImage();
     
     if (debugWriteIntermediateFiles) {
       std::stringstream fnameStream;
       fnameStream << "srm_merged_all_regions" << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, remerger.mergeMat);
-      cout << "wrote " << fname << endl;
-      cout << "" << endl;
+      debugArtifactWrite(DebugArtifactMerge, fname, remerger.mergeMat);
+      LogLine() << "wrote " << fname;
     }
     
     /*
@@ -338,13 +802,11 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     // Don't do expensive reparsing if merge resulted in the exact same thing
 
     if (tagsAdlerBeforeMerge == tagsAdlerAfterMerge) {
-      if (debug) {
-        cout << "merge operation did not change any tags" << endl;
-      }
+      LOG(LogModuleMerge, LogLevelDebug) << "merge operation did not change any tags";
     } else {
       spImage = SuperpixelImage();
       
-      worked = SuperpixelImage::parse(mergeMat, spImage);
+      worked = SuperpixelImage::parse(mergeMat, spImage, captureThreads);
       
       if (!worked) {
         return false;
@@ -355,9 +817,20 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     
     */
     
-    spImage = SuperpixelImage();
+    // The leftover pixels of a SRM region that was partly captured by other
+    // regions all get one merge tag even when they are not connected, so those
+    // pieces are split into their own tags before the reparse.
+    
+    if (!Superpixel::splitSplayPixels(remerger.mergeMat)) {
+      cerr << "splitting regions needs more than " << (0x00FFFFFF - 1) << " tags" << endl;
+      return false;
+    }
     
-    worked = SuperpixelImage::parse(remerger.mergeMat, spImage);
+    {
+      MEMORY_STAGE("reparse");
+      
+      worked = SuperpixelImage::parse(remerger.mergeMat, spImage, captureThreads);
+    }
     
     if (!worked) {
       return false;
@@ -367,17 +840,25 @@ bool clusteringCombine(Mat &inputImg, Mat &resultImg)
     
   }
   
-  // Generate result image after region based merging
+  // Generate result image after region based merging, this is the output
+  // so it is written even when debug images are disabled.
   
-  if (debugWriteIntermediateFiles) {
+  {
+    MEMORY_STAGE("resultImage");
+    
+    resultImg.create(inputImg.size(), CV_8UC3);
+    resultImg = Scalar(0,0,0);
+    
+    lock_guard<mutex> lock(staticColortableLock);
     generateStaticColortable(inputImg, spImage);
     writeTagsWithStaticColortable(spImage, resultImg);
-    imwrite("tags_after_region_merge.png", resultImg);
   }
   
+  debugArtifactWrite(DebugArtifactMerge, "tags_after_region_merge.png", resultImg);
+  
   // Done
   
-  cout << "ended with " << spImage.superpixels.size() << " superpixels" << endl;
+  LOG(LogModuleMerge, LogLevelInfo) << "ended with " << spImage.superpixels.size() << " superpixels";
   
   return true;
 }
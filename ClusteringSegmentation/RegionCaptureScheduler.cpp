@@ -0,0 +1,317 @@
+//
+//  RegionCaptureScheduler.cpp
+//  ClusteringSegmentation
+//
+//  Each worker thread has its own queue of ready tasks, a worker pops from
+//  the back of its own queue and steals from the front of the other queues
+//  when its own queue is empty. A task is ready once the last earlier task
+//  whose ROI overlaps its ROI has been merged. Since merges are done in task
+//  order this means every earlier overlapping task has been merged, so the
+//  merged pixels captureRegionMask() reads are the same as in a serial run.
+//  Tasks with disjoint ROIs never read or write the same mask pixels.
+
+#include "RegionCaptureScheduler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "ClusteringSegmentation.hpp"
+
+#include "Superpixel.h"
+#include "SuperpixelImage.h"
+
+#include "OpenCVUtil.h"
+#include "DebugArtifacts.h"
+#include "Trace.h"
+#include "Util.h"
+
+#include "RegionRemerger.hpp"
+
+using namespace cv;
+using namespace std;
+
+typedef struct {
+  int32_t tag;
+
+  // Bounds of every mask pixel that capture can read or write
+
+  Rect roi;
+
+  // Tasks that become ready once this task has been merged
+
+  vector<int> waiters;
+
+  // Results, these are written by the worker and read when merging
+
+  bool done;
+  bool maskWritten;
+  Rect maskROI;
+  Mat roiMask;
+} RegionCaptureTask;
+
+typedef struct {
+  mutex lock;
+  deque<int> tasks;
+} RegionCaptureQueue;
+
+class RegionCaptureScheduler {
+public:
+  RegionCaptureScheduler(SuperpixelImage &_spImage,
+                         const Mat & _inputImg,
+                         const Mat & _srmTags,
+                         int _blockWidth,
+                         int _blockHeight,
+                         int _superpixelDim,
+                         const Mat &_blockBasedQuantMat,
+                         RegionRemerger &_remerger,
+                         unsigned int numThreads)
+  : spImage(_spImage), inputImg(_inputImg), srmTags(_srmTags),
+  blockWidth(_blockWidth), blockHeight(_blockHeight), superpixelDim(_superpixelDim),
+  blockBasedQuantMat(_blockBasedQuantMat), remerger(_remerger),
+  queues(numThreads), numReady(0), numMerged(0),
+  debugArtifactDir(debugArtifactDirectory())
+  {
+  }
+
+  void run(const vector<int32_t> &tagsInOrder) {
+    if (tagsInOrder.size() == 0) {
+      return;
+    }
+
+    initTasks(tagsInOrder);
+
+    vector<thread> threads;
+
+    for ( int i = 1; i < (int)queues.size(); i++ ) {
+      threads.push_back(thread(&RegionCaptureScheduler::worker, this, i));
+    }
+
+    worker(0);
+
+    for ( thread &t : threads ) {
+      t.join();
+    }
+
+    assert(numMerged == tasks.size());
+  }
+
+private:
+  SuperpixelImage &spImage;
+  const Mat &inputImg;
+  const Mat &srmTags;
+  int blockWidth;
+  int blockHeight;
+  int superpixelDim;
+  const Mat &blockBasedQuantMat;
+  RegionRemerger &remerger;
+
+  vector<RegionCaptureTask> tasks;
+  vector<RegionCaptureQueue> queues;
+
+  // numReady is the number of tasks in all queues, it is only incremented
+  // while holding stateLock so that an idle worker cannot miss a wakeup.
+
+  atomic<int> numReady;
+
+  mutex stateLock;
+  condition_variable stateCond;
+  size_t numMerged;
+
+  // Debug images from worker threads go to the calling thread's directory
+
+  string debugArtifactDir;
+
+  // Find the last earlier task that overlaps each ROI with a grid of blocks
+  // that records the last task to touch each block. Waiting only for that task
+  // is enough since all earlier tasks are merged before it.
+
+  void initTasks(const vector<int32_t> &tagsInOrder) {
+    int gridWidth = (inputImg.cols + superpixelDim - 1) / superpixelDim;
+    int gridHeight = (inputImg.rows + superpixelDim - 1) / superpixelDim;
+
+    vector<int> lastTaskForBlock(gridWidth * gridHeight, -1);
+
+    tasks.resize(tagsInOrder.size());
+
+    int nextQueue = 0;
+
+    for ( int i = 0; i < (int)tagsInOrder.size(); i++ ) {
+      RegionCaptureTask &task = tasks[i];
+      task.tag = tagsInOrder[i];
+      task.done = false;
+      task.maskWritten = false;
+
+      auto &coords = spImage.getSuperpixelPtr(task.tag)->coords;
+      task.roi = morphRegionROI(inputImg, coords, superpixelDim);
+
+      int minBlockX = task.roi.x / superpixelDim;
+      int minBlockY = task.roi.y / superpixelDim;
+      int maxBlockX = (task.roi.x + task.roi.width - 1) / superpixelDim;
+      int maxBlockY = (task.roi.y + task.roi.height - 1) / superpixelDim;
+
+      int waitFor = -1;
+
+      for ( int blockY = minBlockY; blockY <= maxBlockY; blockY++ ) {
+        int *rowPtr = &lastTaskForBlock[blockY * gridWidth];
+
+        for ( int blockX = minBlockX; blockX <= maxBlockX; blockX++ ) {
+          waitFor = maxi(waitFor, rowPtr[blockX]);
+          rowPtr[blockX] = i;
+        }
+      }
+
+      if (waitFor == -1) {
+        queues[nextQueue].tasks.push_back(i);
+        numReady += 1;
+        nextQueue = (nextQueue + 1) % queues.size();
+      } else {
+        tasks[waitFor].waiters.push_back(i);
+      }
+    }
+  }
+
+  // Pop from the back of this worker's queue, otherwise steal from the front
+  // of another queue. Returns -1 when all queues are empty.
+
+  int popTask(int workerIndex) {
+    int numQueues = (int) queues.size();
+
+    for ( int i = 0; i < numQueues; i++ ) {
+      RegionCaptureQueue &queue = queues[(workerIndex + i) % numQueues];
+      lock_guard<mutex> lock(queue.lock);
+
+      if (queue.tasks.empty()) {
+        continue;
+      }
+
+      int taskIndex;
+
+      if (i == 0) {
+        taskIndex = queue.tasks.back();
+        queue.tasks.pop_back();
+      } else {
+        taskIndex = queue.tasks.front();
+        queue.tasks.pop_front();
+      }
+
+      numReady -= 1;
+      return taskIndex;
+    }
+
+    return -1;
+  }
+
+  void worker(int workerIndex) {
+    if (workerIndex > 0) {
+      debugArtifactSetDirectory(debugArtifactDir);
+    }
+
+    // The scratch mask only covers the ROI of the current task, it is reused
+    // by the next task when the ROI is the same size.
+
+    Mat mask;
+
+    while (1) {
+      int taskIndex = popTask(workerIndex);
+
+      if (taskIndex == -1) {
+        unique_lock<mutex> lock(stateLock);
+
+        while (numReady <= 0 && numMerged < tasks.size()) {
+          stateCond.wait(lock);
+        }
+
+        if (numMerged == tasks.size()) {
+          break;
+        }
+
+        continue;
+      }
+
+      captureTask(tasks[taskIndex], mask);
+      finishTask(taskIndex, workerIndex);
+    }
+  }
+
+  void captureTask(RegionCaptureTask &task, Mat &mask) {
+    // Copy merged state only inside the ROI, this is the only part of the
+    // mask that captureRegionMask() reads.
+
+    remerger.mergedMask(task.roi).copyTo(mask);
+
+    task.maskWritten = captureRegionMask(spImage, inputImg, srmTags, task.tag, blockWidth, blockHeight, superpixelDim, mask, task.roi, blockBasedQuantMat, &task.maskROI);
+
+    if (task.maskWritten) {
+      assert((task.maskROI & task.roi) == task.maskROI);
+
+      task.roiMask = mask(task.maskROI - task.roi.tl()).clone();
+    }
+
+    if (task.maskWritten && debugArtifactEnabled(DebugArtifactCapture)) {
+      std::stringstream fnameStream;
+      fnameStream << "srm" << "_tag_" << task.tag << "_region_mask" << ".png";
+      string fname = fnameStream.str();
+
+      debugArtifactWrite(DebugArtifactCapture, fname, task.roiMask);
+      cout << "wrote " << fname << endl;
+      cout << "";
+    }
+  }
+
+  // Merge every task that is done and follows the last merged task, then
+  // queue the tasks that were waiting on the merged tasks.
+
+  void finishTask(int taskIndex, int workerIndex) {
+    lock_guard<mutex> lock(stateLock);
+
+    tasks[taskIndex].done = true;
+
+    while (numMerged < tasks.size() && tasks[numMerged].done) {
+      RegionCaptureTask &task = tasks[numMerged];
+
+      if (task.maskWritten) {
+        remerger.mergeFromMask(task.roiMask, task.maskROI);
+        task.roiMask.release();
+      }
+
+      for ( int waiter : task.waiters ) {
+        RegionCaptureQueue &queue = queues[workerIndex];
+        lock_guard<mutex> queueLock(queue.lock);
+        queue.tasks.push_back(waiter);
+        numReady += 1;
+      }
+
+      numMerged += 1;
+    }
+
+    stateCond.notify_all();
+  }
+};
+
+void captureRegionMasks(SuperpixelImage &spImage,
+                        const Mat & inputImg,
+                        const Mat & srmTags,
+                        const vector<int32_t> &tagsInOrder,
+                        int blockWidth,
+                        int blockHeight,
+                        int superpixelDim,
+                        const Mat &blockBasedQuantMat,
+                        RegionRemerger &remerger,
+                        unsigned int numThreads)
+{
+  TRACE_SPAN("captureRegionMasks");
+  
+  if (numThreads == 0) {
+    numThreads = thread::hardware_concurrency();
+  }
+  if (numThreads == 0) {
+    numThreads = 1;
+  }
+
+  RegionCaptureScheduler scheduler(spImage, inputImg, srmTags, blockWidth, blockHeight, superpixelDim, blockBasedQuantMat, remerger, numThreads);
+
+  scheduler.run(tagsInOrder);
+}
@@ -0,0 +1,39 @@
+//
+//  RegionCaptureScheduler.hpp
+//  ClusteringSegmentation
+//
+//  Run captureRegionMask() for a list of tags on multiple threads. Each tag is
+//  processed in a task that waits only for earlier tags whose ROI overlaps its
+//  own ROI, so regions that are far apart are captured at the same time while
+//  contained regions are still captured before the regions that contain them.
+//  Masks are merged into the RegionRemerger in the original tag order so the
+//  result is exactly the same as processing the tags one at a time.
+
+#ifndef RegionCaptureScheduler_hpp
+#define RegionCaptureScheduler_hpp
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+class SuperpixelImage;
+class RegionRemerger;
+
+using cv::Mat;
+using std::vector;
+
+// Capture and merge each tag in tagsInOrder with up to numThreads threads,
+// 0 means one thread for each core.
+
+void captureRegionMasks(SuperpixelImage &spImage,
+                        const Mat & inputImg,
+                        const Mat & srmTags,
+                        const vector<int32_t> &tagsInOrder,
+                        int blockWidth,
+                        int blockHeight,
+                        int superpixelDim,
+                        const Mat &blockBasedQuantMat,
+                        RegionRemerger &remerger,
+                        unsigned int numThreads);
+
+#endif // RegionCaptureScheduler_hpp
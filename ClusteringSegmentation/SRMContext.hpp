@@ -0,0 +1,143 @@
+//
+//  SRMContext.hpp
+//  ClusteringSegmentation
+//
+//  Persistent SRM state that is reused for each frame of the same size.
+//  Pixels are read directly from the Mat data pointer and step and results
+//  are written directly into the output Mat, so no image sized copies are
+//  made and a series of same sized frames allocates only once.
+
+#ifndef SRMContext_hpp
+#define SRMContext_hpp
+
+#include <opencv2/opencv.hpp>
+
+#include <thread>
+#include <vector>
+
+#include "srm.h"
+
+using cv::Mat;
+using std::vector;
+
+class SRMContext {
+public:
+  // threads is the number of threads SRM runs on, 0 means one for each core
+  
+  SRMContext(unsigned int threads = 0)
+  : srm(NULL), width(0), height(0), channels(0), threads(threads)
+  {
+  }
+
+  ~SRMContext()
+  {
+    if (srm != NULL) {
+      srm_delete(srm);
+    }
+  }
+
+  // Segment inputImg and write the mean color of each region into outImg,
+  // outImg is only reallocated when it does not already match inputImg.
+
+  void run(const Mat &inputImg, double Q, Mat &outImg) {
+    prepare(inputImg, Q);
+    outImg.create(inputImg.size(), inputImg.type());
+    srm_run(srm, (size_t) inputImg.step, inputImg.data, (size_t) outImg.step, outImg.data);
+  }
+
+  // Segment inputImg and write consecutive region labels into the CV_32SC1
+  // labels Mat. When not NULL the pixel count and BGR mean (3 bytes) of
+  // each label are also returned. Returns the number of labels.
+
+  int runLabels(const Mat &inputImg, double Q, Mat &labels,
+                vector<unsigned int> *labelSizes = NULL,
+                vector<uint8_t> *labelColors = NULL) {
+    prepare(inputImg, Q);
+    labels.create(inputImg.size(), CV_32SC1);
+    srm_run(srm, (size_t) inputImg.step, inputImg.data, 0, NULL);
+
+    unsigned int numRegions = srm_regions_count(srm);
+
+    if (labelSizes != NULL) {
+      labelSizes->resize(numRegions);
+    }
+    if (labelColors != NULL) {
+      labelColors->resize(numRegions * 3);
+    }
+
+    return (int) srm_labels(srm, (int32_t*) labels.data, (size_t) labels.step,
+                            (labelSizes != NULL) ? labelSizes->data() : NULL,
+                            (labelColors != NULL) ? labelColors->data() : NULL);
+  }
+
+  // Set the number of threads for the next run, 0 means one for each core.
+  // Jobs that run in parallel each pass their share of the cores.
+
+  void setThreads(unsigned int numThreads) {
+    threads = numThreads;
+
+    if (srm != NULL) {
+      srm_set_threads(srm, getThreads());
+    }
+  }
+
+  unsigned int getThreads() const {
+    if (threads == 0) {
+      return std::thread::hardware_concurrency();
+    }
+    return threads;
+  }
+
+  // Free the SRM buffers, the next run allocates them again
+
+  void release() {
+    if (srm != NULL) {
+      srm_delete(srm);
+      srm = NULL;
+    }
+
+    width = 0;
+    height = 0;
+    channels = 0;
+  }
+
+private:
+  struct srm *srm;
+  int width;
+  int height;
+  int channels;
+  unsigned int threads;
+
+  SRMContext(const SRMContext &);
+  SRMContext& operator=(const SRMContext &);
+
+  // Reset the existing srm when the frame size is unchanged, otherwise
+  // replace it with one for the new size.
+
+  void prepare(const Mat &inputImg, double Q) {
+    assert(inputImg.depth() == CV_8U);
+
+    if (srm != NULL && inputImg.cols == width && inputImg.rows == height && inputImg.channels() == channels) {
+      srm_reset(srm, Q);
+      return;
+    }
+
+    if (srm != NULL) {
+      srm_delete(srm);
+    }
+
+    width = inputImg.cols;
+    height = inputImg.rows;
+    channels = inputImg.channels();
+
+    // Pair construction and sorting is split into row bands, one per thread.
+    // Compact edges produce the same result with 1/6 of the edge memory and
+    // the deterministic parallel merge gives the same result as a serial merge.
+
+    srm = srm_new(Q, width, height, channels, 0);
+    srm_set_threads(srm, getThreads());
+    srm_set_flags(srm, SRM_COMPACT_EDGES | SRM_PARALLEL_MERGE | SRM_DETERMINISTIC_MERGE);
+  }
+};
+
+#endif // SRMContext_hpp
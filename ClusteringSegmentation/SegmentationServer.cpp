@@ -0,0 +1,683 @@
+//
+//  SegmentationServer.cpp
+//  ClusteringSegmentation
+//
+//  The main thread accepts connections and each connection gets a thread that
+//  only reads requests and writes responses. Each request is queued for the
+//  pool of worker threads, so a connection holds a worker only while one of
+//  its images is being segmented and an idle connection holds none. The
+//  request payload, decoded input image and tags image of a connection are
+//  reused for each request so that same sized images do not allocate.
+
+#include "SegmentationServer.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "DebugArtifacts.h"
+#include "Log.h"
+
+using namespace cv;
+using namespace std;
+
+// Longest request header line that is accepted
+
+static const size_t segmentationServerMaxLine = 4096;
+
+// Largest payload that is accepted, 256 MB
+
+static const size_t segmentationServerMaxPayload = 256 * 1024 * 1024;
+
+// Connections that are served at the same time, accept() waits once this
+// many are open
+
+static const int segmentationServerMaxConnections = 256;
+
+// Buffered reads from a connection, header lines and payloads can arrive
+// split across any number of reads.
+
+class SegmentationConnection {
+public:
+  SegmentationConnection(int _fd)
+  : fd(_fd), bufferOffset(0), bufferLength(0)
+  {
+  }
+
+  // Read one line without the trailing newline, false on EOF or error
+
+  bool readLine(string &line) {
+    line.clear();
+
+    while (1) {
+      if (bufferOffset == bufferLength && !fill()) {
+        return false;
+      }
+
+      char c = buffer[bufferOffset++];
+
+      if (c == '\n') {
+        if (line.size() > 0 && line[line.size() - 1] == '\r') {
+          line.erase(line.size() - 1);
+        }
+        return true;
+      }
+
+      if (line.size() >= segmentationServerMaxLine) {
+        return false;
+      }
+
+      line.push_back(c);
+    }
+  }
+
+  bool readExact(uint8_t *ptr, size_t numBytes) {
+    while (numBytes > 0) {
+      if (bufferOffset == bufferLength && !fill()) {
+        return false;
+      }
+
+      size_t n = min(bufferLength - bufferOffset, numBytes);
+      memcpy(ptr, &buffer[bufferOffset], n);
+      bufferOffset += n;
+      ptr += n;
+      numBytes -= n;
+    }
+
+    return true;
+  }
+
+  bool writeExact(const uint8_t *ptr, size_t numBytes) {
+    while (numBytes > 0) {
+      ssize_t n = write(fd, ptr, numBytes);
+
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+
+      ptr += n;
+      numBytes -= n;
+    }
+
+    return true;
+  }
+
+  bool writeString(const string &str) {
+    return writeExact((const uint8_t *) str.data(), str.size());
+  }
+
+private:
+  int fd;
+  uint8_t buffer[64 * 1024];
+  size_t bufferOffset;
+  size_t bufferLength;
+
+  bool fill() {
+    while (1) {
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+
+      bufferOffset = 0;
+      bufferLength = (size_t) n;
+      return true;
+    }
+  }
+};
+
+// Buffers that are kept by a connection between requests
+
+typedef struct {
+  vector<uint8_t> payload;
+  Mat inputImg;
+  Mat tagsImg;
+} SegmentationConnectionBuffers;
+
+// One request waiting for or running on a worker
+
+typedef struct {
+  Mat *inputImg;
+  const SegmentationRequestParams *params;
+  Mat *tagsImg;
+  bool worked;
+  bool done;
+} SegmentationJob;
+
+// Workers take jobs in the order they were queued. A worker sets the debug
+// directory for each job since a job can run on any worker.
+
+class SegmentationJobQueue {
+public:
+  SegmentationJobQueue(unsigned int numJobs, const SegmentationServerFunc &_func)
+  : func(_func), stopping(false)
+  {
+    for ( int i = 0; i < (int)numJobs; i++ ) {
+      threads.push_back(thread(&SegmentationJobQueue::worker, this, i));
+    }
+  }
+
+  // Finish the queued jobs and join the workers
+
+  ~SegmentationJobQueue() {
+    {
+      lock_guard<mutex> lock(queueLock);
+      stopping = true;
+    }
+
+    queueCond.notify_all();
+
+    for ( thread &t : threads ) {
+      t.join();
+    }
+  }
+
+  // Queue a job and wait for a worker to run it
+
+  bool run(Mat &inputImg, const SegmentationRequestParams &params, Mat &tagsImg) {
+    SegmentationJob job;
+    job.inputImg = &inputImg;
+    job.params = &params;
+    job.tagsImg = &tagsImg;
+    job.worked = false;
+    job.done = false;
+
+    unique_lock<mutex> lock(queueLock);
+
+    pendingJobs.push_back(&job);
+    queueCond.notify_one();
+
+    while (!job.done) {
+      doneCond.wait(lock);
+    }
+
+    return job.worked;
+  }
+
+private:
+  const SegmentationServerFunc &func;
+
+  mutex queueLock;
+  condition_variable queueCond;
+  condition_variable doneCond;
+  deque<SegmentationJob*> pendingJobs;
+  bool stopping;
+
+  vector<thread> threads;
+
+  void worker(int workerIndex) {
+    while (1) {
+      SegmentationJob *job;
+
+      {
+        unique_lock<mutex> lock(queueLock);
+
+        while (pendingJobs.empty() && !stopping) {
+          queueCond.wait(lock);
+        }
+
+        if (pendingJobs.empty()) {
+          break;
+        }
+
+        job = pendingJobs.front();
+        pendingJobs.pop_front();
+      }
+
+      debugArtifactSetDirectory(job->params->debugDir);
+
+      bool worked = func(workerIndex, *job->inputImg, *job->params, *job->tagsImg);
+
+      debugArtifactSetDirectory("");
+      logFlush();
+
+      {
+        lock_guard<mutex> lock(queueLock);
+        job->worked = worked;
+        job->done = true;
+      }
+
+      doneCond.notify_all();
+    }
+  }
+};
+
+static vector<string> splitWords(const string &line)
+{
+  vector<string> words;
+  size_t start = 0;
+
+  while (start < line.size()) {
+    size_t end = line.find(' ', start);
+    if (end == string::npos) {
+      end = line.size();
+    }
+    if (end > start) {
+      words.push_back(line.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return words;
+}
+
+// Resolve a client path that must be inside root, root was already resolved
+// with realpath(). A relative path is relative to root. The parent directory
+// must exist and the last component must not be a symlink. Returns an error
+// message or "" and sets resolved.
+
+static string resolvePathInRoot(const string &root, const string &path, string &resolved)
+{
+  if (root.size() == 0) {
+    return "paths are not enabled, set CLUSTERING_SERVER_ROOT";
+  }
+
+  string fullPath = (path.size() > 0 && path[0] == '/') ? path : (root + "/" + path);
+
+  size_t slash = fullPath.rfind('/');
+  string dirname = (slash == 0) ? "/" : fullPath.substr(0, slash);
+  string filename = fullPath.substr(slash + 1);
+
+  if (filename.size() == 0 || filename == "." || filename == "..") {
+    return "invalid path " + path;
+  }
+
+  char resolvedDir[PATH_MAX];
+
+  if (realpath(dirname.c_str(), resolvedDir) == NULL) {
+    return "invalid path " + path;
+  }
+
+  string dir = resolvedDir;
+
+  if (dir != root && dir.compare(0, root.size() + 1, root + "/") != 0) {
+    return "path " + path + " is outside of the server root";
+  }
+
+  resolved = dir + "/" + filename;
+
+  struct stat st;
+
+  if (lstat(resolved.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+    return "path " + path + " is a symlink";
+  }
+
+  return "";
+}
+
+// Parse KEY=VALUE words starting at firstParam, returns an error message or "".
+// out= and debug= paths are resolved inside root.
+
+static string parseParams(const vector<string> &words, int firstParam, const string &root, SegmentationRequestParams &params)
+{
+  params.captureThreads = 0;
+  params.debugDir = "";
+  params.outputFilename = "";
+
+  unsigned int maxThreads = thread::hardware_concurrency();
+
+  for ( int i = firstParam; i < (int)words.size(); i++ ) {
+    const string &word = words[i];
+    size_t equals = word.find('=');
+
+    if (equals == string::npos) {
+      return "invalid parameter " + word;
+    }
+
+    string key = word.substr(0, equals);
+    string value = word.substr(equals + 1);
+
+    if (key == "threads") {
+      int threads = atoi(value.c_str());
+      if (threads < 0) {
+        return "invalid threads " + value;
+      }
+      params.captureThreads = (unsigned int) threads;
+      if (maxThreads > 0 && params.captureThreads > maxThreads) {
+        params.captureThreads = maxThreads;
+      }
+    } else if (key == "debug") {
+      string err = resolvePathInRoot(root, value, params.debugDir);
+      if (err.size() > 0) {
+        return err;
+      }
+    } else if (key == "out") {
+      string err = resolvePathInRoot(root, value, params.outputFilename);
+      if (err.size() > 0) {
+        return err;
+      }
+    } else {
+      return "unknown parameter " + key;
+    }
+  }
+
+  return "";
+}
+
+// Read the image for one request into buffers.inputImg, returns an error
+// message or "". An empty message with closeConnection set means the
+// connection was closed or the client asked to quit.
+
+static string readRequestImage(SegmentationConnection &conn,
+                               const vector<string> &words,
+                               const string &root,
+                               SegmentationConnectionBuffers &buffers,
+                               SegmentationRequestParams &params,
+                               bool &closeConnection)
+{
+  const string &command = words[0];
+
+  if (command == "RAW") {
+    if (words.size() < 3) {
+      closeConnection = true;
+      return "usage RAW WIDTH HEIGHT";
+    }
+
+    int width = atoi(words[1].c_str());
+    int height = atoi(words[2].c_str());
+
+    if (width <= 0 || height <= 0 || (size_t) width * height * 3 > segmentationServerMaxPayload) {
+      closeConnection = true;
+      return "invalid size";
+    }
+
+    string err = parseParams(words, 3, root, params);
+
+    // The payload is read even if the params are invalid so that the
+    // connection stays in sync with the client.
+
+    buffers.inputImg.create(height, width, CV_8UC3);
+
+    for ( int y = 0; y < height; y++ ) {
+      if (!conn.readExact(buffers.inputImg.ptr<uint8_t>(y), width * 3)) {
+        closeConnection = true;
+        return "";
+      }
+    }
+
+    return err;
+  } else if (command == "ENCODED") {
+    if (words.size() < 2) {
+      closeConnection = true;
+      return "usage ENCODED NBYTES";
+    }
+
+    long long numBytes = atoll(words[1].c_str());
+
+    if (numBytes <= 0 || numBytes > (long long) segmentationServerMaxPayload) {
+      closeConnection = true;
+      return "invalid size";
+    }
+
+    string err = parseParams(words, 2, root, params);
+
+    buffers.payload.resize((size_t) numBytes);
+
+    if (!conn.readExact(&buffers.payload[0], (size_t) numBytes)) {
+      closeConnection = true;
+      return "";
+    }
+
+    if (err.size() > 0) {
+      return err;
+    }
+
+    buffers.inputImg = imdecode(buffers.payload, CV_LOAD_IMAGE_COLOR);
+
+    if (buffers.inputImg.empty()) {
+      return "could not decode image data";
+    }
+
+    return "";
+  } else if (command == "PATH") {
+    if (words.size() < 2) {
+      return "usage PATH FILENAME";
+    }
+
+    string err = parseParams(words, 2, root, params);
+
+    if (err.size() > 0) {
+      return err;
+    }
+
+    string inputFilename;
+
+    err = resolvePathInRoot(root, words[1], inputFilename);
+
+    if (err.size() > 0) {
+      return err;
+    }
+
+    buffers.inputImg = imread(inputFilename, CV_LOAD_IMAGE_COLOR);
+
+    if (buffers.inputImg.empty()) {
+      return "could not read " + words[1] + " as image data";
+    }
+
+    return "";
+  } else if (command == "QUIT") {
+    closeConnection = true;
+    return "";
+  }
+
+  // The size of any payload is unknown, so the connection cannot continue
+
+  closeConnection = true;
+  return "unknown command " + command;
+}
+
+static void serveConnection(int fd, const string &root, SegmentationJobQueue &jobQueue)
+{
+  SegmentationConnection conn(fd);
+  SegmentationConnectionBuffers buffers;
+  string line;
+
+  while (conn.readLine(line)) {
+    vector<string> words = splitWords(line);
+
+    if (words.size() == 0) {
+      continue;
+    }
+
+    SegmentationRequestParams params;
+    bool closeConnection = false;
+
+    string err = readRequestImage(conn, words, root, buffers, params, closeConnection);
+
+    if (err.size() == 0 && closeConnection) {
+      break;
+    }
+
+    if (err.size() == 0) {
+      bool worked = jobQueue.run(buffers.inputImg, params, buffers.tagsImg);
+
+      if (!worked) {
+        err = "segmentation failed";
+      } else if (params.outputFilename.size() > 0 && !imwrite(params.outputFilename, buffers.tagsImg)) {
+        err = "could not write " + params.outputFilename;
+      }
+    }
+
+    if (err.size() > 0) {
+      LOG(LogModuleServer, LogLevelWarn) << "request \"" << words[0] << "\" failed : " << err;
+
+      if (!conn.writeString("ERR " + err + "\n") || closeConnection) {
+        break;
+      }
+      continue;
+    }
+
+    const Mat &tagsImg = buffers.tagsImg;
+    bool returnPixels = (params.outputFilename.size() == 0);
+    size_t numBytes = returnPixels ? (size_t) tagsImg.cols * tagsImg.rows * 3 : 0;
+
+    assert(tagsImg.type() == CV_8UC3);
+
+    char header[128];
+    snprintf(header, sizeof(header), "OK %d %d %lld\n", tagsImg.cols, tagsImg.rows, (long long) numBytes);
+
+    bool wrote = conn.writeString(header);
+
+    for ( int y = 0; wrote && returnPixels && y < tagsImg.rows; y++ ) {
+      wrote = conn.writeExact(tagsImg.ptr<uint8_t>(y), tagsImg.cols * 3);
+    }
+
+    if (!wrote) {
+      break;
+    }
+  }
+
+  close(fd);
+  logFlush();
+}
+
+int runSegmentationServer(const char *socketPath, const char *rootPath, unsigned int numJobs, const SegmentationServerFunc &func)
+{
+  string root;
+
+  if (rootPath != NULL) {
+    char resolvedRoot[PATH_MAX];
+
+    if (realpath(rootPath, resolvedRoot) == NULL) {
+      fprintf(stderr, "could not resolve root \"%s\" : %s\n", rootPath, strerror(errno));
+      return 1;
+    }
+
+    root = resolvedRoot;
+  }
+
+  if (numJobs == 0) {
+    numJobs = thread::hardware_concurrency();
+  }
+  if (numJobs == 0) {
+    numJobs = 1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path \"%s\" is too long\n", socketPath);
+    return 1;
+  }
+
+  strcpy(addr.sun_path, socketPath);
+
+  // Writes to a client that has gone away fail with EPIPE instead of a signal
+
+  signal(SIGPIPE, SIG_IGN);
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (listenFd < 0) {
+    fprintf(stderr, "could not create socket : %s\n", strerror(errno));
+    return 1;
+  }
+
+  // Only remove a socket left by an earlier server, never some other file
+
+  struct stat st;
+
+  if (lstat(socketPath, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "\"%s\" exists and is not a socket\n", socketPath);
+      close(listenFd);
+      return 1;
+    }
+
+    unlink(socketPath);
+  }
+
+  // Only the user running the server can connect, the umask makes sure the
+  // socket is never accessible to others before the chmod()
+
+  mode_t oldMask = umask(0077);
+  int bindResult = ::bind(listenFd, (struct sockaddr *) &addr, sizeof(addr));
+  umask(oldMask);
+
+  if (bindResult != 0 || chmod(socketPath, 0600) != 0 || listen(listenFd, 64) != 0) {
+    fprintf(stderr, "could not listen on \"%s\" : %s\n", socketPath, strerror(errno));
+    close(listenFd);
+    return 1;
+  }
+
+  fprintf(stdout, "listening on \"%s\" with %d jobs\n", socketPath, (int) numJobs);
+  fflush(stdout);
+
+  SegmentationJobQueue jobQueue(numJobs, func);
+
+  // Connection threads are detached, numConnections is used to wait for them
+
+  mutex connectionLock;
+  condition_variable connectionCond;
+  int numConnections = 0;
+
+  while (1) {
+    {
+      unique_lock<mutex> lock(connectionLock);
+
+      while (numConnections >= segmentationServerMaxConnections) {
+        connectionCond.wait(lock);
+      }
+    }
+
+    int fd = accept(listenFd, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      fprintf(stderr, "accept failed : %s\n", strerror(errno));
+      break;
+    }
+
+    {
+      lock_guard<mutex> lock(connectionLock);
+      numConnections += 1;
+    }
+
+    thread([&, fd]() {
+      serveConnection(fd, root, jobQueue);
+
+      lock_guard<mutex> lock(connectionLock);
+      numConnections -= 1;
+      connectionCond.notify_all();
+    }).detach();
+  }
+
+  // Finish the connections that were already accepted
+
+  {
+    unique_lock<mutex> lock(connectionLock);
+
+    while (numConnections > 0) {
+      connectionCond.wait(lock);
+    }
+  }
+
+  close(listenFd);
+
+  return 1;
+}
@@ -0,0 +1,60 @@
+//
+//  SegmentationServer.hpp
+//  ClusteringSegmentation
+//
+//  Serve segmentation requests on a local Unix domain socket so that a
+//  client pays process startup and OpenCV init only once. Each request is
+//  handled by one of a fixed pool of worker threads and each worker keeps its
+//  own context between requests. The socket can only be opened by the user
+//  running the server.
+//
+//  Each request is one header line followed by an optional payload:
+//
+//  RAW WIDTH HEIGHT ?KEY=VALUE ...?   followed by WIDTH*HEIGHT*3 bytes of BGR pixels
+//  ENCODED NBYTES ?KEY=VALUE ...?     followed by NBYTES of PNG, JPEG, ... data
+//  PATH FILENAME ?KEY=VALUE ...?      image read from FILENAME (no spaces)
+//  QUIT                               close the connection
+//
+//  Parameters:
+//
+//  threads=N   capture threads for this request, 0 (default) lets the server pick,
+//              at most one for each core
+//  debug=DIR   write debug images enabled by CLUSTERING_DEBUG_ARTIFACTS to DIR
+//  out=FILE    write the tags image to FILE instead of returning it
+//
+//  The PATH FILENAME, DIR and FILE must be inside the server root, a relative
+//  path is relative to the root. All are rejected when the server has no root.
+//
+//  A request is answered with "OK WIDTH HEIGHT NBYTES\n" followed by NBYTES of
+//  BGR tags pixels (0 when out= was given) or with "ERR MESSAGE\n". Any number
+//  of requests can be sent on one connection.
+
+#ifndef SegmentationServer_hpp
+#define SegmentationServer_hpp
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <string>
+
+using cv::Mat;
+
+typedef struct {
+  unsigned int captureThreads;
+  std::string debugDir;
+  std::string outputFilename;
+} SegmentationRequestParams;
+
+// Segment inputImg into tagsImg on the worker thread workerIndex, the index
+// is in the range [0, numJobs) and can be used to select a per worker context.
+
+typedef std::function<bool(int workerIndex, Mat &inputImg, const SegmentationRequestParams &params, Mat &tagsImg)> SegmentationServerFunc;
+
+// Listen on socketPath and handle requests with numJobs worker threads,
+// 0 means one thread for each core. rootPath is the directory that PATH input,
+// out= and debug= paths must be inside, NULL rejects all of them. This only returns, with a
+// non-zero result, when the socket cannot be opened or accept() fails.
+
+int runSegmentationServer(const char *socketPath, const char *rootPath, unsigned int numJobs, const SegmentationServerFunc &func);
+
+#endif // SegmentationServer_hpp
@@ -15,6 +15,8 @@
 
 #include "DivQuantHeader.h"
 
+#include "Trace.h"
+
 #include <assert.h>
 
 #define L2_SQR( X1, Y1, Z1, X2, Y2, Z2 )\
@@ -243,6 +245,8 @@ sort_color ( Pixel_Int *cmap, const int num_colors )
 void
 map_colors_mps ( const uint32_t *inPixelsPtr, uint32_t numPixels, uint32_t *outPixelsPtr, uint32_t *outColortablePtr, int colormapSize )
 {
+  TRACE_SPAN("map_colors_mps");
+  
   int ik, ic;
   int index;
   int low, high;
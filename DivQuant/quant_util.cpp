@@ -11,6 +11,8 @@
 
 #include "quant_util.h"
 
+#include "Trace.h"
+
 #include <unordered_map>
 
 using namespace std;
@@ -19,13 +21,10 @@ using namespace std;
 
 void quant_recurse ( uint32_t numPixels, const uint32_t *inPixelsPtr, uint32_t *outPixelsPtr, uint32_t *numClustersPtr, uint32_t *outColortablePtr, int allPixelsUnique )
 {
-  const int displayTimings = 1;
+  TRACE_SPAN("quant_recurse");
   
   const bool dumpDedupCmap = false;
   
-  clock_t t1, t2;
-  long elapsed;
-  
   //int num_colors = 256;
   
   int max_iters = 10;
@@ -45,10 +44,6 @@ void quant_recurse ( uint32_t numPixels, const uint32_t *inPixelsPtr, uint32_t *
   //  int dec_factor = 1;
   //  int num_bits = 6;
   
-  if (displayTimings) {
-    t1 = clock();
-  }
-  
   if ((0)) {
     // Determine adler32 for input pixels
     
@@ -57,20 +52,13 @@ void quant_recurse ( uint32_t numPixels, const uint32_t *inPixelsPtr, uint32_t *
     fprintf(stdout, "quant_varpart_fast() input pixels adler 0x%08X\n", (int)adlerSig);
   }
   
-  quant_varpart_fast( numPixels, inPixelsPtr, outPixelsPtr, 1, numPixels, numClustersPtr, outColortablePtr, num_bits, dec_factor, max_iters, allPixelsUnique);
-  
-  if (displayTimings) {
-    t2 = clock();
-    elapsed = timediff(t1, t2);
-    printf("quant_varpart_fast() elapsed: %ld ms aka %0.2f s\n", elapsed, elapsed/1000.0f);
+  {
+    TRACE_SPAN("quant_varpart_fast");
+    quant_varpart_fast( numPixels, inPixelsPtr, outPixelsPtr, 1, numPixels, numClustersPtr, outColortablePtr, num_bits, dec_factor, max_iters, allPixelsUnique);
   }
   
   int act_num_colors = *numClustersPtr;
   
-  if (displayTimings) {
-    t1 = clock();
-  }
-  
   // Dump cmap entries and dedup cmap in case of repeated values that resolve to same RGB entry.
   
   if (dumpDedupCmap) {
@@ -138,12 +126,6 @@ void quant_recurse ( uint32_t numPixels, const uint32_t *inPixelsPtr, uint32_t *
   
   map_colors_mps ( inPixelsPtr, numPixels, outPixelsPtr, outColortablePtr, act_num_colors );
   
-  if (displayTimings) {
-    t2 = clock();
-    elapsed = timediff(t1, t2);
-    printf("map_colors_mps() elapsed: %ld ms aka %0.2f s\n", elapsed, elapsed/1000.0f);
-  }
-  
   if ((0)) {
     // Check adler for quant table output as words
     
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "unionfind.h"
 #include "srm.h"
@@ -11,7 +12,7 @@
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
 #define index(i, j) (i) * srm->width + (j)
-#define offset(offset, idx, widthStep) {unsigned int _i = (idx) / srm->width; unsigned int _j = (idx) % srm->width; (offset) = _i * (widthStep) + srm->channels * _j;}
+#define labels_row(labels, widthStep, i) ((int32_t *) ((uint8_t *) (labels) + (size_t) (i) * (widthStep)))
 
 #define get_b(im, offset) (im)[(offset)    ]
 #define get_g(im, offset) (im)[(offset) + 1]
@@ -26,11 +27,17 @@ void segmentation(struct srm *srm);
 void finalize(struct srm *srm);
 void merge_small_regions(struct srm *srm);
 
-unsigned int diff(struct srm *srm, unsigned int idx1, unsigned int idx2);
 unsigned int merge_predicate(struct srm *srm, unsigned int reg1, unsigned int reg2);
 void bucket_sort(struct my_pair *pairs, struct my_pair *ordered_pairs, unsigned int size);
+static void parallel_bucket_sort(struct srm *srm, unsigned int threads);
 void merge_regions(struct srm *srm, unsigned int r1, unsigned int r2);
 
+static void sort_edges(struct srm *srm);
+static void merge_sorted_edges(struct srm *srm);
+static unsigned int drop_merged_edges(struct srm *srm);
+static unsigned int write_labels(struct srm *srm, int32_t *labels, size_t widthStep_labels, unsigned int *label_sizes, uint8_t *label_colors);
+static void bands_delete(struct srm_bands *bands);
+
 void SRM(double Q, unsigned int width, unsigned int height, unsigned int channels, uint8_t *in, uint8_t *out, unsigned int borders) {
   struct srm *srm = srm_new(Q, width, height, channels, borders);
   srm_run(srm, width * channels, in, width * channels, out);
@@ -47,6 +54,9 @@ struct srm* srm_new(double Q, unsigned int width, unsigned int height, unsigned
   srm->Q             = Q;
   srm->borders       = borders;
 
+  srm->threads       = 1;
+  srm->flags         = 0;
+
   srm->size          = width * height;
   srm->smallregion   = 0.001 * srm->size;
 
@@ -56,13 +66,41 @@ struct srm* srm_new(double Q, unsigned int width, unsigned int height, unsigned
 
   srm->uf            = unionfind_new(srm->size);
   srm->sizes         = malloc(srm->size * sizeof(unsigned int));
-  srm->pairs         = malloc(srm->n_pairs * sizeof(struct my_pair));
-  srm->ordered_pairs = malloc(srm->n_pairs * sizeof(struct my_pair));
+  srm->mean_r        = malloc(srm->size * sizeof(float));
+  srm->mean_g        = malloc(srm->size * sizeof(float));
+  srm->mean_b        = malloc(srm->size * sizeof(float));
+  srm->dev           = malloc(srm->size * sizeof(float));
+
+  srm->dev_table_size = min(srm->size + 1, SRM_DEV_TABLE_SIZE);
+  srm->dev_table     = malloc(srm->dev_table_size * sizeof(double));
+  srm->dev_table_Q   = 0.0;
+  srm->dev_table_logdelta = 0.0;
+
+  // Edge storage is allocated on the first run once the edge mode is known
+  srm->pairs         = NULL;
+  srm->ordered_pairs = NULL;
+  srm->edges         = NULL;
+
+  srm->root_labels   = NULL;
+  srm->reservations  = NULL;
+  srm->bands         = NULL;
 
   return srm;
 }
 
-void srm_run(struct srm *srm, unsigned int widthStep_in, uint8_t *in, unsigned int widthStep_out, uint8_t *out) {
+void srm_set_threads(struct srm *srm, unsigned int threads) {
+  srm->threads = (threads == 0) ? 1 : threads;
+}
+
+void srm_set_flags(struct srm *srm, unsigned int flags) {
+  srm->flags = flags;
+}
+
+void srm_reset(struct srm *srm, double Q) {
+  srm->Q = Q;
+}
+
+void srm_run(struct srm *srm, size_t widthStep_in, uint8_t *in, size_t widthStep_out, uint8_t *out) {
   srm->in  = in;
   srm->widthStep_in = widthStep_in;
   srm->out = out;
@@ -71,7 +109,186 @@ void srm_run(struct srm *srm, unsigned int widthStep_in, uint8_t *in, unsigned i
   initialize(srm);
   segmentation(srm);
   merge_small_regions(srm);
-  finalize(srm);
+
+  // When only labels are wanted the mean color image is not written
+  if (srm->out != NULL) {
+    finalize(srm);
+  }
+}
+
+// Switch to a new Q between merge sweeps. The deviation bound is inversely
+// proportional to Q so the table and the bound cached for each region are
+// rescaled instead of being recomputed.
+
+static void set_q(struct srm *srm, double Q) {
+  double scale = srm->Q / Q;
+
+  srm->Q = Q;
+
+  for (unsigned int i = 0; i < srm->dev_table_size; i++) {
+    srm->dev_table[i] *= scale;
+  }
+
+  // The rescaled table can differ from a computed one in the last bit, so
+  // the next run recomputes it
+  srm->dev_table_Q = 0.0;
+
+  for (unsigned int i = 0; i < srm->size; i++) {
+    srm->dev[i] = (float) (srm->dev[i] * scale);
+  }
+}
+
+// Small region merging for a label map, the regions are joined with the regions
+// of finer_labels (when not NULL) so that the result is nested inside the finer
+// segmentation, and then small regions are merged with the same scan order as
+// merge_small_regions(). The union-find is over labels instead of pixels so the
+// pixel level union-find state is left as is for the next sweep. The labels are
+// rewritten in place and the new number of labels is returned.
+
+static unsigned int merge_small_labels(struct srm *srm, int32_t *labels, size_t widthStep_labels, unsigned int num_labels, const int32_t *finer_labels, unsigned int num_finer_labels) {
+  struct unionfind *uf = unionfind_new(num_labels);
+  unsigned int *sizes = calloc(num_labels, sizeof(unsigned int));
+  int32_t *compact = malloc(num_labels * sizeof(int32_t));
+
+  for (unsigned int i = 0; i < srm->height; i++) {
+    int32_t *row = labels_row(labels, widthStep_labels, i);
+    for (unsigned int j = 0; j < srm->width; j++) {
+      sizes[row[j]]++;
+    }
+  }
+
+  if (finer_labels != NULL) {
+    int32_t *first = malloc(num_finer_labels * sizeof(int32_t));
+    for (unsigned int i = 0; i < num_finer_labels; i++) {
+      first[i] = -1;
+    }
+
+    for (unsigned int i = 0; i < srm->height; i++) {
+      int32_t *row = labels_row(labels, widthStep_labels, i);
+      const int32_t *finer_row = labels_row(finer_labels, widthStep_labels, i);
+
+      for (unsigned int j = 0; j < srm->width; j++) {
+        int32_t f = finer_row[j];
+
+        if (first[f] == -1) {
+          first[f] = row[j];
+        } else {
+          unsigned int l1 = unionfind_find(uf, first[f]);
+          unsigned int l2 = unionfind_find(uf, row[j]);
+
+          if (l1 != l2) {
+            unsigned int size = sizes[l1] + sizes[l2];
+            sizes[unionfind_union(uf, l1, l2)] = size;
+          }
+        }
+      }
+    }
+
+    free(first);
+  }
+
+  for (unsigned int i = 0; i < srm->height; i++) {
+    int32_t *row = labels_row(labels, widthStep_labels, i);
+
+    for (unsigned int j = 1; j < srm->width; j++) {
+      unsigned int l1 = unionfind_find(uf, row[j]);
+      unsigned int l2 = unionfind_find(uf, row[j - 1]);
+
+      if (l1 != l2) {
+        if ((sizes[l1] < srm->smallregion) || (sizes[l2] < srm->smallregion)) {
+          unsigned int size = sizes[l1] + sizes[l2];
+          sizes[unionfind_union(uf, l1, l2)] = size;
+        }
+      }
+    }
+  }
+
+  // Relabel so that labels are again consecutive in raster scan order
+
+  int32_t next_label = 0;
+
+  for (unsigned int i = 0; i < num_labels; i++) {
+    compact[i] = -1;
+  }
+
+  for (unsigned int i = 0; i < srm->height; i++) {
+    int32_t *row = labels_row(labels, widthStep_labels, i);
+
+    for (unsigned int j = 0; j < srm->width; j++) {
+      unsigned int root = unionfind_find(uf, row[j]);
+
+      if (compact[root] == -1) {
+        compact[root] = next_label++;
+      }
+
+      row[j] = compact[root];
+    }
+  }
+
+  unionfind_delete(uf);
+  free(sizes);
+  free(compact);
+
+  return (unsigned int) next_label;
+}
+
+void srm_run_multi(struct srm *srm, size_t widthStep_in, uint8_t *in, unsigned int num_q, const double *Qs, size_t widthStep_labels, int32_t **labels, unsigned int *num_labels) {
+  // The sweep starts from Qs[num_q - 1], with no Q there is nothing to segment
+
+  if (num_q == 0) {
+    return;
+  }
+
+  srm->in  = in;
+  srm->widthStep_in = widthStep_in;
+  srm->out = NULL;
+  srm->widthStep_out = 0;
+
+  for (unsigned int k = 1; k < num_q; k++) {
+    assert(Qs[k - 1] <= Qs[k]);
+  }
+
+  unsigned int *counts = malloc(num_q * sizeof(unsigned int));
+
+  // Start with the largest Q, which gives the most regions. Each smaller Q
+  // continues to merge from the union-find state of the previous sweep and
+  // only visits the edges that are still between two regions. The edges are
+  // generated and sorted only once for all of them.
+
+  const unsigned int all_pairs = srm->n_pairs;
+
+  srm->Q = Qs[num_q - 1];
+  initialize(srm);
+  sort_edges(srm);
+
+  for (unsigned int k = num_q; k-- > 0; ) {
+    if (Qs[k] != srm->Q) {
+      set_q(srm, Qs[k]);
+    }
+
+    merge_sorted_edges(srm);
+
+    if (k > 0) {
+      srm->n_pairs = drop_merged_edges(srm);
+    }
+
+    counts[k] = write_labels(srm, labels[k], widthStep_labels, NULL, NULL);
+
+    if (k == (num_q - 1)) {
+      counts[k] = merge_small_labels(srm, labels[k], widthStep_labels, counts[k], NULL, 0);
+    } else {
+      counts[k] = merge_small_labels(srm, labels[k], widthStep_labels, counts[k], labels[k + 1], counts[k + 1]);
+    }
+
+    if (num_labels != NULL) {
+      num_labels[k] = counts[k];
+    }
+  }
+
+  // The edge buffers are sized for all the edges of the next run
+  srm->n_pairs = all_pairs;
+
+  free(counts);
 }
 
 unsigned int srm_regions_count(struct srm *srm) {
@@ -89,136 +306,906 @@ unsigned int* srm_regions_sizes(struct srm *srm) {
 void srm_delete(struct srm *srm) {
   unionfind_delete(srm->uf);
   free(srm->sizes);
+  free(srm->mean_r);
+  free(srm->mean_g);
+  free(srm->mean_b);
+  free(srm->dev);
+  free(srm->dev_table);
   free(srm->pairs);
   free(srm->ordered_pairs);
+  free(srm->edges);
+  free(srm->root_labels);
+  free(srm->reservations);
+  bands_delete(srm->bands);
   free(srm);
 }
 
+// The statistical deviation bound for a region depends only on its size, so the
+// common small sizes are looked up in a table. The table is only filled in
+// again when Q or logdelta changed since the previous run.
+
+static double compute_dev(struct srm *srm, unsigned int size) {
+  double logreg = min(srm->g, size) * log(1.0 + size);
+  return (srm->g * srm->g) / (2.0 * srm->Q * size) * (logreg + srm->logdelta);
+}
+
+static inline float region_dev(struct srm *srm, unsigned int size) {
+  if (size < srm->dev_table_size) {
+    return (float) srm->dev_table[size];
+  } else {
+    return (float) compute_dev(srm, size);
+  }
+}
+
 void initialize(struct srm *srm) {
   unionfind_init(srm->uf);
 
-  memcpy(srm->out, srm->in, srm->channels * srm->size * sizeof(uint8_t));
-  for (unsigned int i = 0; i < srm->size; i++) {
-      unsigned int offset_in;
-      offset(offset_in, i, srm->widthStep_in);
+  if ((srm->dev_table_Q != srm->Q) || (srm->dev_table_logdelta != srm->logdelta)) {
+    srm->dev_table[0] = 0.0;
+    for (unsigned int i = 1; i < srm->dev_table_size; i++) {
+      srm->dev_table[i] = compute_dev(srm, i);
+    }
+
+    srm->dev_table_Q = srm->Q;
+    srm->dev_table_logdelta = srm->logdelta;
+  }
+
+  // Each pixel starts out as a region of size 1 with the pixel as its mean
 
-      unsigned int offset_out;
-      offset(offset_out, i, srm->widthStep_out);
-      set_r(srm->out, offset_out, get_r(srm->in, offset_in));
-      set_g(srm->out, offset_out, get_g(srm->in, offset_in));
-      set_b(srm->out, offset_out, get_b(srm->in, offset_in));
+  const float dev1 = region_dev(srm, 1);
 
-    srm->sizes[i] = 1;
+  for (unsigned int i = 0; i < srm->height; i++) {
+    const uint8_t *in_row = srm->in + i * srm->widthStep_in;
+    unsigned int index = index(i, 0);
+
+    for (unsigned int j = 0; j < srm->width; j++, index++) {
+      unsigned int offset = srm->channels * j;
+      srm->mean_r[index] = get_r(in_row, offset);
+      srm->mean_g[index] = get_g(in_row, offset);
+      srm->mean_b[index] = get_b(in_row, offset);
+      srm->sizes[index] = 1;
+      srm->dev[index] = dev1;
+    }
   }
 }
 
-inline unsigned int diff(struct srm *srm, unsigned int idx1, unsigned int idx2) {
-  unsigned int offset1;
-  offset(offset1, idx1, srm->widthStep_in);
-  unsigned char r1 = get_r(srm->in, offset1);
-  unsigned char g1 = get_g(srm->in, offset1);
-  unsigned char b1 = get_b(srm->in, offset1);
+// Invoke f once for each band in [0, num_bands), bands other than zero are
+// run on their own thread and band zero is run on the calling thread.
 
-  unsigned int offset2;
-  offset(offset2, idx2, srm->widthStep_in);
-  unsigned char r2 = get_r(srm->in, offset2);
-  unsigned char g2 = get_g(srm->in, offset2);
-  unsigned char b2 = get_b(srm->in, offset2);
+typedef void (*band_func)(void *ctx, unsigned int band, unsigned int num_bands);
 
-  unsigned int diff_r = r2 > r1 ? r2 - r1 : r1 - r2;
-  unsigned int diff_g = g2 > g1 ? g2 - g1 : g1 - g2;
-  unsigned int diff_b = b2 > b1 ? b2 - b1 : b1 - b2;
+typedef struct {
+  band_func f;
+  void *ctx;
+  unsigned int band;
+  unsigned int num_bands;
+} band_thread_arg;
 
-  return max(diff_r, max(diff_g, diff_b));
+static void* band_thread_main(void *arg) {
+  band_thread_arg *bta = (band_thread_arg *) arg;
+  bta->f(bta->ctx, bta->band, bta->num_bands);
+  return NULL;
 }
 
-void segmentation(struct srm *srm) {
-  // Consider C4-connectivity here
+// The band threads and the scratch each band needs are allocated the first
+// time bands are run and kept for later runs, like the edge buffers. There is
+// room for srm->threads bands, a larger thread count allocates them again.
+
+struct srm_bands {
+  unsigned int capacity;
+  pthread_t *threads;
+  band_thread_arg *args;
+  unsigned int *started;
+  // 256 bucket counts for each of the up to 2 * capacity + 1 pieces of edges
+  unsigned int (*counts)[256];
+  // Right and below diffs of one row for each band, 2 * width bytes each
+  uint8_t *diffs;
+  // First label of each band
+  unsigned int *labels;
+  // Small region candidates found by each band, the arrays only grow
+  uint32_t **candidates;
+  unsigned int *candidates_capacity;
+  unsigned int *num_candidates;
+  // Parallel merge window, allocated on the first parallel merge, and the
+  // edges each thread kept and merged in a round
+  uint32_t *pending_r1;
+  uint32_t *pending_r2;
+  uint8_t *pending_state;
+  unsigned int *kept;
+  unsigned int *merged;
+};
+
+static void bands_delete(struct srm_bands *bands) {
+  if (bands == NULL) {
+    return;
+  }
+
+  for (unsigned int b = 0; b < bands->capacity; b++) {
+    free(bands->candidates[b]);
+  }
+
+  free(bands->threads);
+  free(bands->args);
+  free(bands->started);
+  free(bands->counts);
+  free(bands->diffs);
+  free(bands->labels);
+  free(bands->candidates);
+  free(bands->candidates_capacity);
+  free(bands->num_candidates);
+  free(bands->pending_r1);
+  free(bands->pending_r2);
+  free(bands->pending_state);
+  free(bands->kept);
+  free(bands->merged);
+  free(bands);
+}
+
+static struct srm_bands* srm_bands(struct srm *srm) {
+  if ((srm->bands != NULL) && (srm->bands->capacity >= srm->threads)) {
+    return srm->bands;
+  }
+
+  bands_delete(srm->bands);
+
+  unsigned int capacity = srm->threads;
+  struct srm_bands *bands = malloc(sizeof(struct srm_bands));
+
+  bands->capacity = capacity;
+  bands->threads = malloc(capacity * sizeof(pthread_t));
+  bands->args = malloc(capacity * sizeof(band_thread_arg));
+  bands->started = malloc(capacity * sizeof(unsigned int));
+  bands->counts = malloc((2 * capacity + 1) * sizeof(unsigned int[256]));
+  bands->diffs = malloc((size_t) capacity * 2 * srm->width * sizeof(uint8_t));
+  bands->labels = malloc(capacity * sizeof(unsigned int));
+  bands->candidates = calloc(capacity, sizeof(uint32_t *));
+  bands->candidates_capacity = calloc(capacity, sizeof(unsigned int));
+  bands->num_candidates = malloc(capacity * sizeof(unsigned int));
+  bands->pending_r1 = NULL;
+  bands->pending_r2 = NULL;
+  bands->pending_state = NULL;
+  bands->kept = malloc(capacity * sizeof(unsigned int));
+  bands->merged = malloc(capacity * sizeof(unsigned int));
+
+  srm->bands = bands;
+  return bands;
+}
+
+static void run_bands(struct srm *srm, band_func f, void *ctx, unsigned int num_bands) {
+  if (num_bands <= 1) {
+    f(ctx, 0, 1);
+    return;
+  }
+
+  struct srm_bands *bands = srm_bands(srm);
+  assert(num_bands <= bands->capacity);
+
+  pthread_t *threads = bands->threads;
+  band_thread_arg *args = bands->args;
+  unsigned int *started = bands->started;
+
+  for (unsigned int b = 0; b < num_bands; b++) {
+    args[b].f = f;
+    args[b].ctx = ctx;
+    args[b].band = b;
+    args[b].num_bands = num_bands;
+  }
+
+  for (unsigned int b = 1; b < num_bands; b++) {
+    started[b] = (pthread_create(&threads[b], NULL, band_thread_main, &args[b]) == 0);
+    if (!started[b]) {
+      // Could not create a thread, run the band on this thread instead
+      f(ctx, b, num_bands);
+    }
+  }
+
+  f(ctx, 0, num_bands);
+
+  for (unsigned int b = 1; b < num_bands; b++) {
+    if (started[b]) {
+      pthread_join(threads[b], NULL);
+    }
+  }
+}
+
+// Split [0, n) into num_bands contiguous ranges and return the range for band
+
+static void band_range(unsigned int n, unsigned int band, unsigned int num_bands, unsigned int *start, unsigned int *end) {
+  unsigned long long n64 = n;
+  *start = (unsigned int) ((n64 * band) / num_bands);
+  *end = (unsigned int) ((n64 * (band + 1)) / num_bands);
+}
+
+// Fill in the pairs for a band of rows. The pair index of each edge is a function
+// of its (i, j) location so that bands can be filled in any order and the
+// result is identical to a serial scan.
+//
+// [0, 2 * (W-1) * (H-1))             : C4 left and below for each row above the last
+// [2 * (W-1) * (H-1), + (H-1))        : below for the last column
+// [2 * (W-1) * (H-1) + (H-1), + (W-1)) : left for the last row
+
+static void build_pairs_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  struct srm *srm = (struct srm *) ctx;
+
+  unsigned int row_start, row_end;
+  band_range(srm->height - 1, band, num_bands, &row_start, &row_end);
+
+  const unsigned int border_col_base = 2 * (srm->width - 1) * (srm->height - 1);
+  const unsigned int border_row_base = border_col_base + (srm->height - 1);
+
+  // Diffs for one row are generated at a time by walking the rows directly
+
+  uint8_t *right_diffs = srm_bands(srm)->diffs + (size_t) band * 2 * srm->width;
+  uint8_t *below_diffs = right_diffs + srm->width;
 
   unsigned int index;
-  unsigned int pair_index = 0;
-  for (unsigned int i = 0; i < srm->height - 1; i++) {
-    for (unsigned int j = 0; j < srm->width - 1; j++) {
-      index = index(i, j);
+  for (unsigned int i = row_start; i < row_end; i++) {
+    const uint8_t *row = srm->in + i * srm->widthStep_in;
+    srm_row_diffs(row, row + srm->widthStep_in, srm->width, srm->channels, right_diffs, below_diffs);
 
+    unsigned int pair_index = 2 * (srm->width - 1) * i;
+    index = index(i, 0);
+
+    for (unsigned int j = 0; j < srm->width - 1; j++, index++) {
       // C4 left
       srm->pairs[pair_index].r1 = index;
       srm->pairs[pair_index].r2 = index + 1;
-      srm->pairs[pair_index].diff = diff(srm, index, index + 1);
+      srm->pairs[pair_index].diff = right_diffs[j];
       pair_index++;
 
       // C4 below
       srm->pairs[pair_index].r1 = index;
       srm->pairs[pair_index].r2 = index + srm->width;
-      srm->pairs[pair_index].diff = diff(srm, index, index + srm->width);
+      srm->pairs[pair_index].diff = below_diffs[j];
       pair_index++;
     }
-  }
 
-  // The two border lines
-  for (unsigned int i = 0; i < srm->height - 1; i++) {
+    // The right border line
     index = index(i, srm->width - 1);
 
-    srm->pairs[pair_index].r1 = index;
-    srm->pairs[pair_index].r2 = index + srm->width;
-    srm->pairs[pair_index].diff = diff(srm, index, index + srm->width);
-    pair_index++;
+    srm->pairs[border_col_base + i].r1 = index;
+    srm->pairs[border_col_base + i].r2 = index + srm->width;
+    srm->pairs[border_col_base + i].diff = below_diffs[srm->width - 1];
   }
-  for (unsigned int j = 0; j < srm->width - 1; j++) {
-    index = index(srm->height - 1,  j);
 
-    srm->pairs[pair_index].r1 = index;
-    srm->pairs[pair_index].r2 = index + 1;
-    srm->pairs[pair_index].diff = diff(srm, index, index + 1);
-    pair_index++;
+  // The bottom border line is handled by the last band
+
+  if (band == (num_bands - 1)) {
+    const uint8_t *row = srm->in + (srm->height - 1) * srm->widthStep_in;
+    srm_row_diffs(row, NULL, srm->width, srm->channels, right_diffs, NULL);
+
+    index = index(srm->height - 1, 0);
+
+    for (unsigned int j = 0; j < srm->width - 1; j++, index++) {
+      srm->pairs[border_row_base + j].r1 = index;
+      srm->pairs[border_row_base + j].r2 = index + 1;
+      srm->pairs[border_row_base + j].diff = right_diffs[j];
+    }
+  }
+
+}
+
+// Compact edges are stored as a single 32 bit value, the pixel index of the
+// first pixel shifted left by 1 with the low bit set for the C4 below neighbor
+// and clear for the C4 right neighbor. The diff is implied by the bucket the
+// edge is sorted into so it is never stored.
+
+#define EDGE_BELOW 0x1
+#define edge_encode(index, below) (((index) << 1) | (below))
+#define edge_r1(edge) ((edge) >> 1)
+#define edge_r2(edge) (((edge) & EDGE_BELOW) ? edge_r1(edge) + srm->width : edge_r1(edge) + 1)
+
+// Each row band emits edges as 3 pieces, the edges in its main rows, the
+// edges in its part of the right border line and (last band only) the edges
+// in the bottom border line. The pieces in serial scan order are all main
+// pieces, then all right border pieces, then the bottom border piece.
+
+typedef struct {
+  struct srm *srm;
+  unsigned int num_bands;
+  unsigned int (*nbe)[256];
+  unsigned int scatter;
+} compact_edges_ctx;
+
+static inline void compact_edge(compact_edges_ctx *cec, unsigned int *nbe, uint32_t edge, uint8_t diff) {
+  if (cec->scatter) {
+    cec->srm->edges[nbe[diff]++] = edge;
+  } else {
+    nbe[diff]++;
+  }
+}
+
+static void compact_edges_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  compact_edges_ctx *cec = (compact_edges_ctx *) ctx;
+  struct srm *srm = cec->srm;
+
+  unsigned int *main_nbe = cec->nbe[band];
+  unsigned int *border_col_nbe = cec->nbe[num_bands + band];
+  unsigned int *border_row_nbe = cec->nbe[2 * num_bands];
+
+  if (!cec->scatter) {
+    memset(main_nbe, 0, sizeof(unsigned int[256]));
+    memset(border_col_nbe, 0, sizeof(unsigned int[256]));
+    if (band == (num_bands - 1)) {
+      memset(border_row_nbe, 0, sizeof(unsigned int[256]));
+    }
+  }
+
+  unsigned int row_start, row_end;
+  band_range(srm->height - 1, band, num_bands, &row_start, &row_end);
+
+  uint8_t *right_diffs = srm_bands(srm)->diffs + (size_t) band * 2 * srm->width;
+  uint8_t *below_diffs = right_diffs + srm->width;
+
+  unsigned int index;
+  for (unsigned int i = row_start; i < row_end; i++) {
+    const uint8_t *row = srm->in + i * srm->widthStep_in;
+    srm_row_diffs(row, row + srm->widthStep_in, srm->width, srm->channels, right_diffs, below_diffs);
+
+    index = index(i, 0);
+
+    for (unsigned int j = 0; j < srm->width - 1; j++, index++) {
+      compact_edge(cec, main_nbe, edge_encode(index, 0), right_diffs[j]);
+      compact_edge(cec, main_nbe, edge_encode(index, EDGE_BELOW), below_diffs[j]);
+    }
+
+    compact_edge(cec, border_col_nbe, edge_encode(index, EDGE_BELOW), below_diffs[srm->width - 1]);
   }
 
+  if (band == (num_bands - 1)) {
+    const uint8_t *row = srm->in + (srm->height - 1) * srm->widthStep_in;
+    srm_row_diffs(row, NULL, srm->width, srm->channels, right_diffs, NULL);
+
+    index = index(srm->height - 1, 0);
+
+    for (unsigned int j = 0; j < srm->width - 1; j++, index++) {
+      compact_edge(cec, border_row_nbe, edge_encode(index, 0), right_diffs[j]);
+    }
+  }
+
+}
+
+// Bucket the compact edges directly by diff. The diffs are generated twice,
+// once to count each bucket and once to place the edges, so that no unsorted
+// copy of the edges is ever stored.
+
+static void build_compact_edges(struct srm *srm, unsigned int num_bands) {
+  compact_edges_ctx cec;
+  unsigned int num_pieces = 2 * num_bands + 1;
+
+  cec.srm = srm;
+  cec.num_bands = num_bands;
+  cec.nbe = srm_bands(srm)->counts;
+
+  cec.scatter = 0;
+  run_bands(srm, compact_edges_band, &cec, num_bands);
+
+  unsigned int offset = 0;
+  for (unsigned int i = 0; i < 256; i++) {
+    for (unsigned int p = 0; p < num_pieces; p++) {
+      unsigned int count = cec.nbe[p][i];
+      cec.nbe[p][i] = offset;
+      offset += count;
+    }
+  }
+  assert(offset == srm->n_pairs);
+
+  cec.scatter = 1;
+  run_bands(srm, compact_edges_band, &cec, num_bands);
+}
+
+// Find the root of a region without path compression, so the parents are only read
+
+static inline unsigned int find_root(const unsigned int *parents, unsigned int id) {
+  while (parents[id] != id) {
+    id = parents[id];
+  }
+  return id;
+}
+
+// Update the statistics of the region reg that reg1 and reg2 were joined into
+
+static inline void merged_region(struct srm *srm, unsigned int reg, unsigned int reg1, unsigned int reg2) {
+  unsigned int size1 = srm->sizes[reg1];
+  unsigned int size2 = srm->sizes[reg2];
+  unsigned int new_size = size1 + size2;
+  double r_avg = ((double)size1 * srm->mean_r[reg1] + (double)size2 * srm->mean_r[reg2]) / new_size;
+  double g_avg = ((double)size1 * srm->mean_g[reg1] + (double)size2 * srm->mean_g[reg2]) / new_size;
+  double b_avg = ((double)size1 * srm->mean_b[reg1] + (double)size2 * srm->mean_b[reg2]) / new_size;
+
+  srm->sizes[reg] = new_size;
+  assert(srm->sizes[reg] != 0);
+  srm->mean_r[reg] = (float)r_avg;
+  srm->mean_g[reg] = (float)g_avg;
+  srm->mean_b[reg] = (float)b_avg;
+  srm->dev[reg] = region_dev(srm, new_size);
+}
+
+// Merge two regions
+void merge_regions(struct srm *srm, unsigned int reg1, unsigned int reg2) {
+  unsigned int reg = unionfind_union(srm->uf, reg1, reg2);
+
+  assert(reg1 < srm->size);
+  assert(reg2 < srm->size);
+  merged_region(srm, reg, reg1, reg2);
+}
+
+static inline void merge_pair(struct srm *srm, unsigned int reg1, unsigned int reg2) {
+  reg1 = unionfind_find(srm->uf, reg1);
+  reg2 = unionfind_find(srm->uf, reg2);
+
+  if ((reg1 != reg2) && (merge_predicate(srm, reg1, reg2)))
+    merge_regions(srm, reg1, reg2);
+}
+
+// Generate the C4 edges and sort them by the maximum color channel difference
+
+static void sort_edges(struct srm *srm) {
+  // Consider C4-connectivity here
+
+  unsigned int num_bands = srm->threads;
+  if (num_bands > (srm->height - 1)) {
+    num_bands = srm->height - 1;
+  }
+  if (num_bands == 0) {
+    num_bands = 1;
+  }
+
+  if (srm->flags & SRM_COMPACT_EDGES) {
+    assert(srm->size <= (UINT32_MAX >> 1));
+
+    if (srm->edges == NULL) {
+      srm->edges = malloc(srm->n_pairs * sizeof(uint32_t));
+    }
+
+    build_compact_edges(srm, num_bands);
+    return;
+  }
+
+  if (srm->pairs == NULL) {
+    srm->pairs         = malloc(srm->n_pairs * sizeof(struct my_pair));
+    srm->ordered_pairs = malloc(srm->n_pairs * sizeof(struct my_pair));
+  }
+
+  run_bands(srm, build_pairs_band, srm, num_bands);
+
   // Sorting the edges according to the maximum color channel difference
-  bucket_sort(srm->pairs, srm->ordered_pairs, srm->n_pairs);
+  if (srm->threads > 1) {
+    parallel_bucket_sort(srm, srm->threads);
+  } else {
+    bucket_sort(srm->pairs, srm->ordered_pairs, srm->n_pairs);
+  }
+}
 
-  // Merging similar regions
-  unsigned int reg1, reg2;
-  for (unsigned int i = 0; i < srm->n_pairs; i++) {
-    reg1 = srm->ordered_pairs[i].r1;
-    reg1 = unionfind_find(srm->uf, reg1);
+// Parallel merge of the sorted edges with deterministic reservations. The
+// edges are taken in windows and each window is processed in rounds:
+//
+// reserve : each pending edge finds the roots of its two regions without
+//           path compression and writes its position in the window to the
+//           reservation of both roots with an atomic min
+// commit  : an edge that holds both reservations has no earlier pending edge
+//           touching its regions, so it sees the same regions as the serial
+//           merge would and it is merged (or dropped) on its own thread
+// reset   : the reservations are cleared and the edges that lost are kept in
+//           order for the next round
+//
+// Rounds continue while they make progress and the rest of the window is
+// merged serially when they do not, for example along a run of edges that all
+// touch one growing region. Both are the same as merging the remaining edges
+// in order, so the result does not depend on the thread count.
+
+#define MERGE_WINDOW_SIZE 65536
+#define MERGE_RESERVATION_NONE UINT32_MAX
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  unsigned int count;
+  unsigned int waiting;
+  unsigned int generation;
+} merge_barrier;
+
+static void merge_barrier_wait(merge_barrier *mb) {
+  pthread_mutex_lock(&mb->mutex);
+
+  unsigned int generation = mb->generation;
+
+  if (++mb->waiting == mb->count) {
+    mb->waiting = 0;
+    mb->generation++;
+    pthread_cond_broadcast(&mb->cond);
+  } else {
+    while (generation == mb->generation) {
+      pthread_cond_wait(&mb->cond, &mb->mutex);
+    }
+  }
 
-    reg2 = srm->ordered_pairs[i].r2;
-    reg2 = unionfind_find(srm->uf, reg2);
+  pthread_mutex_unlock(&mb->mutex);
+}
 
-    if ((reg1 != reg2) && (merge_predicate(srm, reg1, reg2)))
-      merge_regions(srm, reg1, reg2);
+enum {
+  MERGE_EDGE_RETIRED,
+  MERGE_EDGE_RESERVED,
+  MERGE_EDGE_COMMITTED
+};
+
+typedef struct {
+  struct srm *srm;
+  unsigned int deterministic;
+  unsigned int num_threads;
+  merge_barrier barrier;
+  // Workers wait here until the number of threads is known
+  unsigned int started;
+  // Edges of the current window in sorted order
+  unsigned int window_start;
+  unsigned int window_size;
+  unsigned int window_fresh;
+  unsigned int num_pending;
+  unsigned int more_rounds;
+  uint32_t *pending_r1;
+  uint32_t *pending_r2;
+  uint8_t *pending_state;
+  unsigned int *kept;
+  unsigned int *merged;
+} parallel_merge_ctx;
+
+static inline void reserve(uint32_t *reservation, uint32_t k) {
+  uint32_t current = __atomic_load_n(reservation, __ATOMIC_RELAXED);
+
+  while (k < current) {
+    if (__atomic_compare_exchange_n(reservation, &current, k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
   }
 }
 
-unsigned int merge_predicate(struct srm *srm, unsigned int reg1, unsigned int reg2) {
-  double dR, dG, dB;
-  double logreg1, logreg2;
-  double dev1, dev2, dev;
+static void parallel_merge_reserve(parallel_merge_ctx *pmc, unsigned int start, unsigned int end) {
+  struct srm *srm = pmc->srm;
+  const unsigned int *parents = srm->uf->parents;
+
+  for (unsigned int k = start; k < end; k++) {
+    unsigned int r1, r2;
+
+    if (pmc->window_fresh) {
+      unsigned int i = pmc->window_start + k;
+      if (srm->flags & SRM_COMPACT_EDGES) {
+        uint32_t edge = srm->edges[i];
+        r1 = edge_r1(edge);
+        r2 = edge_r2(edge);
+      } else {
+        r1 = srm->ordered_pairs[i].r1;
+        r2 = srm->ordered_pairs[i].r2;
+      }
+    } else {
+      r1 = pmc->pending_r1[k];
+      r2 = pmc->pending_r2[k];
+    }
 
-  unsigned int offset1;
-  offset(offset1, reg1, srm->widthStep_out);
-  unsigned int offset2;
-  offset(offset2, reg2, srm->widthStep_out);
+    // Keeping the roots shortens the next search like path compression would
 
-  dR = (double)get_r(srm->out, offset1) - (double)get_r(srm->out, offset2);
-  dR *= dR;
+    r1 = find_root(parents, r1);
+    r2 = find_root(parents, r2);
+    pmc->pending_r1[k] = r1;
+    pmc->pending_r2[k] = r2;
 
-  dG = (double)get_g(srm->out, offset1) - (double)get_g(srm->out, offset2);
-  dG *= dG;
+    // Regions that are already joined stay joined, and in the approximate
+    // mode an edge that fails the predicate now is dropped right away
 
-  dB = (double)get_b(srm->out, offset1) - (double)get_b(srm->out, offset2);
-  dB *= dB;
+    if ((r1 == r2) || (!pmc->deterministic && !merge_predicate(srm, r1, r2))) {
+      pmc->pending_state[k] = MERGE_EDGE_RETIRED;
+      continue;
+    }
+
+    pmc->pending_state[k] = MERGE_EDGE_RESERVED;
+    reserve(&srm->reservations[r1], k);
+    reserve(&srm->reservations[r2], k);
+  }
+}
+
+static unsigned int parallel_merge_commit(parallel_merge_ctx *pmc, unsigned int start, unsigned int end) {
+  struct srm *srm = pmc->srm;
+  struct unionfind *uf = srm->uf;
+  unsigned int merged = 0;
+
+  for (unsigned int k = start; k < end; k++) {
+    if (pmc->pending_state[k] != MERGE_EDGE_RESERVED) {
+      continue;
+    }
+
+    unsigned int r1 = pmc->pending_r1[k];
+    unsigned int r2 = pmc->pending_r2[k];
+
+    if ((__atomic_load_n(&srm->reservations[r1], __ATOMIC_RELAXED) != k) ||
+        (__atomic_load_n(&srm->reservations[r2], __ATOMIC_RELAXED) != k)) {
+      continue;
+    }
+
+    pmc->pending_state[k] = MERGE_EDGE_COMMITTED;
+
+    if (pmc->deterministic && !merge_predicate(srm, r1, r2)) {
+      continue;
+    }
+
+    // Same linking as unionfind_union(), the region count is updated once
+    // the round is done
+
+    unsigned int reg = r1;
+    unsigned int child = r2;
+    if (uf->weights[r2] > uf->weights[r1]) {
+      reg = r2;
+      child = r1;
+    }
+    uf->weights[reg] += uf->weights[child];
+    uf->parents[child] = reg;
+
+    merged_region(srm, reg, r1, r2);
+    merged++;
+  }
+
+  return merged;
+}
+
+// Clear the reservations and move the edges that lost to the front of
+// the range, returns the number of edges kept
+
+static unsigned int parallel_merge_reset(parallel_merge_ctx *pmc, unsigned int start, unsigned int end) {
+  struct srm *srm = pmc->srm;
+  unsigned int kept = start;
+
+  for (unsigned int k = start; k < end; k++) {
+    unsigned int state = pmc->pending_state[k];
+
+    if (state == MERGE_EDGE_RETIRED) {
+      continue;
+    }
+
+    __atomic_store_n(&srm->reservations[pmc->pending_r1[k]], MERGE_RESERVATION_NONE, __ATOMIC_RELAXED);
+    __atomic_store_n(&srm->reservations[pmc->pending_r2[k]], MERGE_RESERVATION_NONE, __ATOMIC_RELAXED);
+
+    if (state == MERGE_EDGE_RESERVED) {
+      pmc->pending_r1[kept] = pmc->pending_r1[k];
+      pmc->pending_r2[kept] = pmc->pending_r2[k];
+      kept++;
+    }
+  }
+
+  return kept - start;
+}
+
+// Serial step between rounds, run by thread 0 while the others wait
+
+static void parallel_merge_round_done(parallel_merge_ctx *pmc) {
+  struct srm *srm = pmc->srm;
+  unsigned int num_threads = pmc->num_threads;
+  unsigned int num_pending = pmc->num_pending;
+  unsigned int num_kept = 0;
+
+  for (unsigned int t = 0; t < num_threads; t++) {
+    unsigned int start, end;
+    band_range(num_pending, t, num_threads, &start, &end);
+
+    if (num_kept != start) {
+      memmove(&pmc->pending_r1[num_kept], &pmc->pending_r1[start], pmc->kept[t] * sizeof(uint32_t));
+      memmove(&pmc->pending_r2[num_kept], &pmc->pending_r2[start], pmc->kept[t] * sizeof(uint32_t));
+    }
+    num_kept += pmc->kept[t];
+
+    srm->uf->count -= pmc->merged[t];
+  }
+
+  pmc->window_fresh = 0;
+
+  // Finish the window serially when less than a quarter of the edges were
+  // done in this round, or after the first round in the approximate mode
+
+  if ((num_kept > 0) && (!pmc->deterministic || (num_kept > (num_pending - num_pending / 4)))) {
+    for (unsigned int k = 0; k < num_kept; k++) {
+      merge_pair(srm, pmc->pending_r1[k], pmc->pending_r2[k]);
+    }
+    num_kept = 0;
+  }
+
+  pmc->num_pending = num_kept;
+  pmc->more_rounds = (num_kept > 0);
+}
+
+// The workers share the band threads and use the band as the thread index
+
+static void* parallel_merge_main(void *arg) {
+  band_thread_arg *bta = (band_thread_arg *) arg;
+  parallel_merge_ctx *pmc = (parallel_merge_ctx *) bta->ctx;
+  unsigned int t = bta->band;
+
+  pthread_mutex_lock(&pmc->barrier.mutex);
+  while (!pmc->started) {
+    pthread_cond_wait(&pmc->barrier.cond, &pmc->barrier.mutex);
+  }
+  pthread_mutex_unlock(&pmc->barrier.mutex);
+
+  while (1) {
+    if (t == 0) {
+      unsigned int n_pairs = pmc->srm->n_pairs;
+      pmc->window_start += pmc->window_size;
+      pmc->window_size = min(MERGE_WINDOW_SIZE, n_pairs - pmc->window_start);
+      pmc->window_fresh = 1;
+      pmc->num_pending = pmc->window_size;
+    }
+
+    merge_barrier_wait(&pmc->barrier);
+
+    if (pmc->window_size == 0) {
+      break;
+    }
+
+    // more_rounds is only written by thread 0 between the last two barriers
+    // of a round so every thread reads the same value
+
+    do {
+      unsigned int start, end;
+      band_range(pmc->num_pending, t, pmc->num_threads, &start, &end);
+
+      parallel_merge_reserve(pmc, start, end);
+      merge_barrier_wait(&pmc->barrier);
+
+      pmc->merged[t] = parallel_merge_commit(pmc, start, end);
+      merge_barrier_wait(&pmc->barrier);
+
+      pmc->kept[t] = parallel_merge_reset(pmc, start, end);
+      merge_barrier_wait(&pmc->barrier);
+
+      if (t == 0) {
+        parallel_merge_round_done(pmc);
+      }
+      merge_barrier_wait(&pmc->barrier);
+    } while (pmc->more_rounds);
+  }
+
+  return NULL;
+}
+
+static void parallel_merge_sorted_edges(struct srm *srm) {
+  parallel_merge_ctx pmc;
+  unsigned int num_threads = srm->threads;
+  struct srm_bands *bands = srm_bands(srm);
+
+  if (srm->reservations == NULL) {
+    srm->reservations = malloc(srm->size * sizeof(uint32_t));
+    for (unsigned int i = 0; i < srm->size; i++) {
+      srm->reservations[i] = MERGE_RESERVATION_NONE;
+    }
+  }
+
+  pmc.srm = srm;
+  pmc.deterministic = (srm->flags & SRM_DETERMINISTIC_MERGE) != 0;
+  pmc.started = 0;
+  pmc.window_start = 0;
+  pmc.window_size = 0;
+  pmc.num_pending = 0;
+  pmc.more_rounds = 0;
+
+  if (bands->pending_r1 == NULL) {
+    bands->pending_r1 = malloc(MERGE_WINDOW_SIZE * sizeof(uint32_t));
+    bands->pending_r2 = malloc(MERGE_WINDOW_SIZE * sizeof(uint32_t));
+    bands->pending_state = malloc(MERGE_WINDOW_SIZE * sizeof(uint8_t));
+  }
+
+  pmc.pending_r1 = bands->pending_r1;
+  pmc.pending_r2 = bands->pending_r2;
+  pmc.pending_state = bands->pending_state;
+  pmc.kept = bands->kept;
+  pmc.merged = bands->merged;
+
+  pthread_mutex_init(&pmc.barrier.mutex, NULL);
+  pthread_cond_init(&pmc.barrier.cond, NULL);
+  pmc.barrier.waiting = 0;
+  pmc.barrier.generation = 0;
+
+  pthread_t *threads = bands->threads;
+  band_thread_arg *args = bands->args;
+
+  // Every worker takes part in every barrier, so the thread count is only
+  // fixed once it is known how many threads could be created
+
+  unsigned int t;
+  for (t = 0; t < num_threads; t++) {
+    args[t].f = NULL;
+    args[t].ctx = &pmc;
+    args[t].band = t;
+    args[t].num_bands = num_threads;
+    if ((t > 0) && (pthread_create(&threads[t], NULL, parallel_merge_main, &args[t]) != 0)) {
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&pmc.barrier.mutex);
+  pmc.num_threads = t;
+  pmc.barrier.count = t;
+  pmc.started = 1;
+  pthread_cond_broadcast(&pmc.barrier.cond);
+  pthread_mutex_unlock(&pmc.barrier.mutex);
+
+  parallel_merge_main(&args[0]);
+
+  for (unsigned int w = 1; w < pmc.num_threads; w++) {
+    pthread_join(threads[w], NULL);
+  }
+
+  pthread_mutex_destroy(&pmc.barrier.mutex);
+  pthread_cond_destroy(&pmc.barrier.cond);
+
+}
+
+// Merging similar regions in sorted edge order
+
+static void merge_sorted_edges(struct srm *srm) {
+  if ((srm->flags & SRM_PARALLEL_MERGE) && (srm->threads > 1)) {
+    parallel_merge_sorted_edges(srm);
+  } else if (srm->flags & SRM_COMPACT_EDGES) {
+    for (unsigned int i = 0; i < srm->n_pairs; i++) {
+      uint32_t edge = srm->edges[i];
+      merge_pair(srm, edge_r1(edge), edge_r2(edge));
+    }
+  } else {
+    for (unsigned int i = 0; i < srm->n_pairs; i++) {
+      merge_pair(srm, srm->ordered_pairs[i].r1, srm->ordered_pairs[i].r2);
+    }
+  }
+}
+
+void segmentation(struct srm *srm) {
+  sort_edges(srm);
+  merge_sorted_edges(srm);
+}
+
+// Drop the sorted edges whose two pixels are already in the same region and
+// keep the rest in order. Regions only grow as Q gets smaller, so a dropped
+// edge could never merge again and the next sweep only visits the edges that
+// are still between regions. The pairs keep their current roots, which
+// shortens the finds in the next sweep. Returns the number of edges kept.
+
+static unsigned int drop_merged_edges(struct srm *srm) {
+  unsigned int kept = 0;
+
+  if (srm->flags & SRM_COMPACT_EDGES) {
+    for (unsigned int i = 0; i < srm->n_pairs; i++) {
+      uint32_t edge = srm->edges[i];
+      if (unionfind_find(srm->uf, edge_r1(edge)) != unionfind_find(srm->uf, edge_r2(edge))) {
+        srm->edges[kept++] = edge;
+      }
+    }
+  } else {
+    for (unsigned int i = 0; i < srm->n_pairs; i++) {
+      unsigned int r1 = unionfind_find(srm->uf, srm->ordered_pairs[i].r1);
+      unsigned int r2 = unionfind_find(srm->uf, srm->ordered_pairs[i].r2);
+      if (r1 != r2) {
+        srm->ordered_pairs[kept].r1 = r1;
+        srm->ordered_pairs[kept].r2 = r2;
+        srm->ordered_pairs[kept].diff = srm->ordered_pairs[i].diff;
+        kept++;
+      }
+    }
+  }
+
+  return kept;
+}
+
+unsigned int merge_predicate(struct srm *srm, unsigned int reg1, unsigned int reg2) {
+  float dR, dG, dB;
+  float dev;
 
   assert(reg1 < srm->size);
-  /* printf("%i %i %i\n", reg1, srm->size, srm->sizes[reg1]); */
   assert(srm->sizes[reg1] != 0);
-  logreg1 = min(srm->g, srm->sizes[reg1]) * log(1.0 + srm->sizes[reg1]);
-  logreg2 = min(srm->g, srm->sizes[reg2]) * log(1.0 + srm->sizes[reg2]);
 
-  dev1 = (srm->g * srm->g) / (2.0 * srm->Q * srm->sizes[reg1]) * (logreg1 + srm->logdelta);
-  dev2 = (srm->g * srm->g) / (2.0 * srm->Q * srm->sizes[reg2]) * (logreg2 + srm->logdelta);
+  dR = srm->mean_r[reg1] - srm->mean_r[reg2];
+  dR *= dR;
+
+  dG = srm->mean_g[reg1] - srm->mean_g[reg2];
+  dG *= dG;
 
-  dev = dev1 + dev2;
+  dB = srm->mean_b[reg1] - srm->mean_b[reg2];
+  dB *= dB;
+
+  dev = srm->dev[reg1] + srm->dev[reg2];
 
   return ((dR < dev) && (dG < dev) && (dB < dev));
 }
@@ -245,40 +1232,181 @@ void bucket_sort(struct my_pair *pairs, struct my_pair *ordered_pairs, unsigned
   }
 }
 
-// Merge two regions
-void merge_regions(struct srm *srm, unsigned int reg1, unsigned int reg2) {
-  unsigned int reg = unionfind_union(srm->uf, reg1, reg2);
+// Parallel version of bucket_sort(), each band counts the diff values in a
+// contiguous range of pairs and then the per band histograms are combined
+// so that each band knows where its elements go. The output order is exactly
+// the same as the stable output of bucket_sort().
 
-  unsigned int offset1;
-  offset(offset1, reg1, srm->widthStep_out);
-  unsigned int offset2;
-  offset(offset2, reg2, srm->widthStep_out);
-  unsigned int offset;
-  offset(offset, reg, srm->widthStep_out);
+typedef struct {
+  struct my_pair *pairs;
+  struct my_pair *ordered_pairs;
+  unsigned int size;
+  unsigned int (*nbe)[256];
+} parallel_sort_ctx;
 
-  assert(reg1 < srm->size);
-  assert(reg2 < srm->size);
-  unsigned int new_size = srm->sizes[reg1] + srm->sizes[reg2];
-  /* printf("tutu %i %i %i\n", new_size, srm->sizes[reg1], srm->sizes[reg2]); */
-  double r_avg = (srm->sizes[reg1] * get_r(srm->out, offset1) + srm->sizes[reg2] * get_r(srm->out, offset2)) / new_size;
-  double g_avg = (srm->sizes[reg1] * get_g(srm->out, offset1) + srm->sizes[reg2] * get_g(srm->out, offset2)) / new_size;
-  double b_avg = (srm->sizes[reg1] * get_b(srm->out, offset1) + srm->sizes[reg2] * get_b(srm->out, offset2)) / new_size;
-  /* printf("titi\n"); */
+static void bucket_count_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  parallel_sort_ctx *psc = (parallel_sort_ctx *) ctx;
+  unsigned int *nbe = psc->nbe[band];
 
-  srm->sizes[reg] = new_size;
-  assert(srm->sizes[reg] != 0);
-  set_r(srm->out, offset, (unsigned char)r_avg);
-  set_g(srm->out, offset, (unsigned char)g_avg);
-  set_b(srm->out, offset, (unsigned char)b_avg);
+  unsigned int start, end;
+  band_range(psc->size, band, num_bands, &start, &end);
+
+  for (unsigned int i = 0; i < 256; i++)
+    nbe[i] = 0;
+
+  for (unsigned int i = start; i < end; i++)
+    nbe[psc->pairs[i].diff]++;
+}
+
+static void bucket_allocate_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  parallel_sort_ctx *psc = (parallel_sort_ctx *) ctx;
+  unsigned int *cnbe = psc->nbe[band];
+
+  unsigned int start, end;
+  band_range(psc->size, band, num_bands, &start, &end);
+
+  for (unsigned int i = start; i < end; i++) {
+    psc->ordered_pairs[cnbe[psc->pairs[i].diff]++] = psc->pairs[i];
+  }
+}
+
+static void parallel_bucket_sort(struct srm *srm, unsigned int threads) {
+  parallel_sort_ctx psc;
+
+  psc.pairs = srm->pairs;
+  psc.ordered_pairs = srm->ordered_pairs;
+  psc.size = srm->n_pairs;
+  psc.nbe = srm_bands(srm)->counts;
+
+  // class all elements according to their family, per band
+
+  run_bands(srm, bucket_count_band, &psc, threads);
+
+  // cumulative histogram, the first element of category i in band b comes after
+  // all elements of smaller categories and the category i elements of bands < b
+
+  unsigned int offset = 0;
+  for (unsigned int i = 0; i < 256; i++) {
+    for (unsigned int b = 0; b < threads; b++) {
+      unsigned int count = psc.nbe[b][i];
+      psc.nbe[b][i] = offset;
+      offset += count;
+    }
+  }
+
+  // allocation
+
+  run_bands(srm, bucket_allocate_band, &psc, threads);
+}
+
+// Number of row bands to split a pass over the pixels into
+
+static unsigned int pixel_bands(struct srm *srm) {
+  unsigned int num_bands = srm->threads;
+  if (num_bands > srm->height) {
+    num_bands = srm->height;
+  }
+  if (num_bands == 0) {
+    num_bands = 1;
+  }
+  return num_bands;
+}
+
+// Point every pixel directly at its region root. The roots are found without
+// path compression into root_labels while the parents are only read, and
+// then copied back, so the bands never write memory another band reads.
+
+static void flatten_roots_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  struct srm *srm = (struct srm *) ctx;
+  const unsigned int *parents = srm->uf->parents;
+
+  unsigned int start, end;
+  band_range(srm->size, band, num_bands, &start, &end);
+
+  for (unsigned int i = start; i < end; i++) {
+    srm->root_labels[i] = (int32_t) find_root(parents, i);
+  }
+}
+
+static void flatten_store_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  struct srm *srm = (struct srm *) ctx;
+
+  unsigned int start, end;
+  band_range(srm->size, band, num_bands, &start, &end);
+
+  for (unsigned int i = start; i < end; i++) {
+    srm->uf->parents[i] = (unsigned int) srm->root_labels[i];
+  }
+}
+
+static void flatten_regions(struct srm *srm) {
+  if (srm->root_labels == NULL) {
+    srm->root_labels = malloc(srm->size * sizeof(int32_t));
+  }
+
+  unsigned int num_bands = pixel_bands(srm);
+  run_bands(srm, flatten_roots_band, srm, num_bands);
+  run_bands(srm, flatten_store_band, srm, num_bands);
+}
+
+// Small region merging is done in two phases. Sizes only grow and regions only
+// join, so a C4 left pair can only be merged by the serial scan when the roots
+// differ and one of the sizes is small before the scan starts. These candidates
+// are found for each row band in parallel and then replayed serially in raster
+// order with the same test as the serial scan, which gives the same result.
+
+static void small_region_candidates_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  struct srm *srm = (struct srm *) ctx;
+  struct srm_bands *bands = srm_bands(srm);
+  const unsigned int *parents = srm->uf->parents;
+
+  unsigned int row_start, row_end;
+  band_range(srm->height, band, num_bands, &row_start, &row_end);
+
+  unsigned int capacity = bands->candidates_capacity[band];
+  unsigned int count = 0;
+  uint32_t *candidates = bands->candidates[band];
+
+  if (capacity == 0) {
+    capacity = 256;
+    candidates = malloc(capacity * sizeof(uint32_t));
+  }
+
+  for (unsigned int i = row_start; i < row_end; i++) {
+    unsigned int index = index(i, 1);
+
+    for (unsigned int j = 1; j < srm->width; j++, index++) {
+      unsigned int reg1 = parents[index];
+      unsigned int reg2 = parents[index - 1];
+
+      if ((reg1 != reg2) && ((srm->sizes[reg1] < srm->smallregion) || (srm->sizes[reg2] < srm->smallregion))) {
+        if (count == capacity) {
+          capacity *= 2;
+          candidates = realloc(candidates, capacity * sizeof(uint32_t));
+        }
+        candidates[count++] = index;
+      }
+    }
+  }
+
+  bands->candidates[band] = candidates;
+  bands->candidates_capacity[band] = capacity;
+  bands->num_candidates[band] = count;
 }
 
 void merge_small_regions(struct srm *srm) {
   unsigned int reg1, reg2;
 
-  unsigned int index;
-  for (unsigned int i = 0; i < srm->height; i++) {
-    for (unsigned int j = 1; j < srm->width; j++) {
-      index = index(i, j);
+  flatten_regions(srm);
+
+  unsigned int num_bands = pixel_bands(srm);
+  struct srm_bands *bands = srm_bands(srm);
+
+  run_bands(srm, small_region_candidates_band, srm, num_bands);
+
+  for (unsigned int b = 0; b < num_bands; b++) {
+    for (unsigned int k = 0; k < bands->num_candidates[b]; k++) {
+      unsigned int index = bands->candidates[b][k];
 
       reg1 = unionfind_find(srm->uf, index);
       reg2 = unionfind_find(srm->uf, index - 1);
@@ -293,26 +1421,213 @@ void merge_small_regions(struct srm *srm) {
 
 #include <stdio.h>
 
-void finalize(struct srm *srm) {
+// Round a region mean to the nearest 8 bit value
+
+static inline uint8_t mean_to_byte(float mean) {
+  return (uint8_t) (mean + 0.5f);
+}
+
+// Write a label for each pixel, labels are consecutive from zero in the
+// order the regions are first seen in a raster scan. When label_sizes and
+// label_colors are not NULL the size and the rounded BGR mean of each
+// label are also written. Returns the number of labels.
+//
+// After the regions are flattened the row bands are labeled in parallel. The
+// first pixel of each region is found with an atomic min of the pixel index,
+// each band counts the first pixels it holds to find its first label, and
+// then every pixel copies the label given to the first pixel of its region.
+
+typedef struct {
+  struct srm *srm;
+  int32_t *labels;
+  size_t widthStep_labels;
+  unsigned int *label_sizes;
+  uint8_t *label_colors;
+  unsigned int *band_labels;
+  unsigned int phase;
+} write_labels_ctx;
+
+enum {
+  WRITE_LABELS_FIRST_PIXEL,
+  WRITE_LABELS_COUNT,
+  WRITE_LABELS_FIRST_LABEL,
+  WRITE_LABELS_ROOT_LABEL,
+  WRITE_LABELS_ALL
+};
+
+static void write_labels_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  write_labels_ctx *wlc = (write_labels_ctx *) ctx;
+  struct srm *srm = wlc->srm;
+  const unsigned int *parents = srm->uf->parents;
+  int32_t *root_labels = srm->root_labels;
+
+  unsigned int row_start, row_end;
+  band_range(srm->height, band, num_bands, &row_start, &row_end);
+
+  unsigned int start = index(row_start, 0);
+  unsigned int end = index(row_end, 0);
+
+  switch (wlc->phase) {
+    case WRITE_LABELS_FIRST_PIXEL: {
+      // root_labels was set to INT32_MAX for each pixel in this band
+      for (unsigned int i = start; i < end; i++) {
+        unsigned int root = parents[i];
+        int32_t first = root_labels[root];
+
+        while (first > (int32_t) i) {
+          int32_t prev = __sync_val_compare_and_swap(&root_labels[root], first, (int32_t) i);
+          if (prev == first) {
+            break;
+          }
+          first = prev;
+        }
+      }
+      break;
+    }
+    case WRITE_LABELS_COUNT: {
+      unsigned int count = 0;
+      for (unsigned int i = start; i < end; i++) {
+        if (root_labels[parents[i]] == (int32_t) i) {
+          count++;
+        }
+      }
+      wlc->band_labels[band] = count;
+      break;
+    }
+    case WRITE_LABELS_FIRST_LABEL: {
+      // Only the first pixel of each region is written
+      int32_t next_label = (int32_t) wlc->band_labels[band];
+      unsigned int index = start;
+
+      for (unsigned int i = row_start; i < row_end; i++) {
+        int32_t *labels_row = labels_row(wlc->labels, wlc->widthStep_labels, i);
+
+        for (unsigned int j = 0; j < srm->width; j++, index++) {
+          unsigned int root = parents[index];
+
+          if (root_labels[root] != (int32_t) index) {
+            continue;
+          }
+
+          if (wlc->label_sizes != NULL) {
+            wlc->label_sizes[next_label] = srm->sizes[root];
+          }
+
+          if (wlc->label_colors != NULL) {
+            unsigned int offset = 3 * next_label;
+            set_r(wlc->label_colors, offset, mean_to_byte(srm->mean_r[root]));
+            set_g(wlc->label_colors, offset, mean_to_byte(srm->mean_g[root]));
+            set_b(wlc->label_colors, offset, mean_to_byte(srm->mean_b[root]));
+          }
+
+          labels_row[j] = next_label++;
+        }
+      }
+      break;
+    }
+    case WRITE_LABELS_ROOT_LABEL: {
+      // Replace the first pixel index of each root in this band with its label
+      for (unsigned int i = start; i < end; i++) {
+        if (parents[i] == i) {
+          unsigned int first = (unsigned int) root_labels[i];
+          root_labels[i] = labels_row(wlc->labels, wlc->widthStep_labels, first / srm->width)[first % srm->width];
+        }
+      }
+      break;
+    }
+    case WRITE_LABELS_ALL: {
+      unsigned int index = start;
+
+      for (unsigned int i = row_start; i < row_end; i++) {
+        int32_t *labels_row = labels_row(wlc->labels, wlc->widthStep_labels, i);
+
+        for (unsigned int j = 0; j < srm->width; j++, index++) {
+          labels_row[j] = root_labels[parents[index]];
+        }
+      }
+      break;
+    }
+  }
+}
+
+static unsigned int write_labels(struct srm *srm, int32_t *labels, size_t widthStep_labels, unsigned int *label_sizes, uint8_t *label_colors) {
+  write_labels_ctx wlc;
+
+  flatten_regions(srm);
+
+  for (unsigned int i = 0; i < srm->size; i++) {
+    srm->root_labels[i] = INT32_MAX;
+  }
+
+  unsigned int num_bands = pixel_bands(srm);
+
+  wlc.srm = srm;
+  wlc.labels = labels;
+  wlc.widthStep_labels = widthStep_labels;
+  wlc.label_sizes = label_sizes;
+  wlc.label_colors = label_colors;
+  wlc.band_labels = srm_bands(srm)->labels;
+
+  wlc.phase = WRITE_LABELS_FIRST_PIXEL;
+  run_bands(srm, write_labels_band, &wlc, num_bands);
+
+  wlc.phase = WRITE_LABELS_COUNT;
+  run_bands(srm, write_labels_band, &wlc, num_bands);
+
+  unsigned int num_labels = 0;
+  for (unsigned int b = 0; b < num_bands; b++) {
+    unsigned int count = wlc.band_labels[b];
+    wlc.band_labels[b] = num_labels;
+    num_labels += count;
+  }
+
+  wlc.phase = WRITE_LABELS_FIRST_LABEL;
+  run_bands(srm, write_labels_band, &wlc, num_bands);
+
+  wlc.phase = WRITE_LABELS_ROOT_LABEL;
+  run_bands(srm, write_labels_band, &wlc, num_bands);
+
+  wlc.phase = WRITE_LABELS_ALL;
+  run_bands(srm, write_labels_band, &wlc, num_bands);
+
+  return num_labels;
+}
+
+unsigned int srm_labels(struct srm *srm, int32_t *labels, size_t widthStep_labels, unsigned int *label_sizes, uint8_t *label_colors) {
+  return write_labels(srm, labels, widthStep_labels, label_sizes, label_colors);
+}
+
+// Write the mean color of each region for a band of rows, the regions must
+// be flattened first so that the parent of each pixel is its root.
+
+static void finalize_band(void *ctx, unsigned int band, unsigned int num_bands) {
+  struct srm *srm = (struct srm *) ctx;
+  const unsigned int *parents = srm->uf->parents;
   unsigned int index, root;
 
-  for (unsigned int i = 0; i < srm->height; i++) {
-    for (unsigned int j = 0; j < srm->width; j++) {
-      index = index(i, j);
-      root = unionfind_find(srm->uf, index);
-      unsigned int root_offset;
-      offset(root_offset, root, srm->widthStep_out);
-
-      unsigned int offset;
-      offset(offset, index, srm->widthStep_out);
-      set_r(srm->out, offset, get_r(srm->out, root_offset));
-      set_g(srm->out, offset, get_g(srm->out, root_offset));
-      set_b(srm->out, offset, get_b(srm->out, root_offset));
+  unsigned int row_start, row_end;
+  band_range(srm->height, band, num_bands, &row_start, &row_end);
+
+  for (unsigned int i = row_start; i < row_end; i++) {
+    uint8_t *out_row = srm->out + i * srm->widthStep_out;
+    index = index(i, 0);
+
+    for (unsigned int j = 0; j < srm->width; j++, index++) {
+      root = parents[index];
+
+      unsigned int offset = srm->channels * j;
+      set_r(out_row, offset, mean_to_byte(srm->mean_r[root]));
+      set_g(out_row, offset, mean_to_byte(srm->mean_g[root]));
+      set_b(out_row, offset, mean_to_byte(srm->mean_b[root]));
       
       if ((0)) {
-        fprintf(stdout, "index %5d = 0x%02X%02X%02X\n", index, get_r(srm->out, root_offset), get_g(srm->out, root_offset) ,get_b(srm->out, root_offset));
+        fprintf(stdout, "index %5d = 0x%02X%02X%02X\n", index, get_r(out_row, offset), get_g(out_row, offset), get_b(out_row, offset));
       }
     }
   }
 }
 
+void finalize(struct srm *srm) {
+  flatten_regions(srm);
+  run_bands(srm, finalize_band, srm, pixel_bands(srm));
+}
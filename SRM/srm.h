@@ -1,7 +1,30 @@
+#ifndef SRM_H
+#define SRM_H
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Store each edge as a 32 bit pixel index and direction bit bucketed by diff
+// instead of a 12 byte my_pair, this cuts edge memory from 24 to 4 bytes per
+// edge since no unsorted copy is kept. Images must have less than 2^31 pixels.
+
+#define SRM_COMPACT_EDGES (1 << 0)
+
+// Merge the sorted edges on all threads, a window of edges is processed in
+// rounds where each edge reserves both of its regions and only edges that
+// hold both reservations are merged. With SRM_DETERMINISTIC_MERGE the result
+// is exactly the same as the serial merge. Without it the merge predicate is
+// only tested when reserving and the edges that lose a reservation are merged
+// serially afterwards, which is faster but can give slightly different regions.
+
+#define SRM_PARALLEL_MERGE (1 << 1)
+#define SRM_DETERMINISTIC_MERGE (1 << 2)
+
+// Region sizes below this value look up the deviation bound in a table
+
+#define SRM_DEV_TABLE_SIZE 65536
+
 struct my_pair {
   unsigned int r1;
   unsigned int r2;
@@ -16,6 +39,14 @@ struct srm {
   uint8_t *in;
   uint8_t *out;
   unsigned int *sizes;
+  float *mean_r;
+  float *mean_g;
+  float *mean_b;
+  float *dev;
+  double *dev_table;
+  unsigned int dev_table_size;
+  double dev_table_Q;
+  double dev_table_logdelta;
   double logdelta;
   unsigned int smallregion;
   double g;
@@ -25,19 +56,71 @@ struct srm {
   struct my_pair *pairs;
   unsigned int n_pairs;
   struct my_pair *ordered_pairs;
-  unsigned int widthStep_in;
-  unsigned int widthStep_out;
+  uint32_t *edges;
+  uint32_t *reservations;
+  int32_t *root_labels;
+  // Band threads and scratch, kept between runs
+  struct srm_bands *bands;
+  size_t widthStep_in;
+  size_t widthStep_out;
+  unsigned int threads;
+  unsigned int flags;
 };
 
 struct srm* srm_new(double Q, unsigned int width, unsigned int height, unsigned int channels, unsigned int borders);
-void srm_run(struct srm *srm, unsigned int widthStep_in, uint8_t *in, unsigned int widthStep_out, uint8_t *out);
+void srm_set_threads(struct srm *srm, unsigned int threads);
+void srm_set_flags(struct srm *srm, unsigned int flags);
+void srm_run(struct srm *srm, size_t widthStep_in, uint8_t *in, size_t widthStep_out, uint8_t *out);
+
+// Prepare a srm for another srm_run() on a frame of the same size, possibly
+// with a different Q. All buffers from the previous run are kept, so running
+// a series of same sized frames does not allocate after the first frame.
+
+void srm_reset(struct srm *srm, double Q);
+
+// Segment once for each of the num_q values in Qs, which must be sorted in
+// increasing order. The edges are generated and sorted once and the merge
+// sweeps run from the largest Q to the smallest, each sweep continues from the
+// regions of the previous one and only visits the edges that are still between
+// two regions. Small regions are merged into
+// each label map without changing the state carried to the next sweep and each
+// segmentation is nested inside the one for the next larger Q. labels[k] receives one int32
+// label per pixel for Qs[k] (widthStep_labels is in bytes) and num_labels[k]
+// the number of labels, which are consecutive from zero. Nothing is done when
+// num_q is zero.
+
+void srm_run_multi(struct srm *srm, size_t widthStep_in, uint8_t *in, unsigned int num_q, const double *Qs, size_t widthStep_labels, int32_t **labels, unsigned int *num_labels);
+
+// Segment an image that is too large for srm_run() as a grid of tile_size
+// square tiles (0 for the default) that overlap by overlap pixels, using up to
+// threads tiles at a time. Regions are joined across tile seams and labels
+// receives one int32 label per pixel (widthStep_labels is in bytes) that is
+// consecutive from zero. Returns the number of labels.
+
+unsigned int srm_run_tiled(double Q, unsigned int width, unsigned int height, unsigned int channels, size_t widthStep_in, uint8_t *in, size_t widthStep_labels, int32_t *labels, unsigned int tile_size, unsigned int overlap, unsigned int threads);
+
 unsigned int srm_regions_count(struct srm *srm);
+
+// After srm_run() (out may be NULL when only labels are needed) write a
+// consecutive int32 label for each pixel in raster first seen order, the
+// widthStep_labels is in bytes. When not NULL label_sizes receives the pixel
+// count and label_colors the rounded BGR mean (3 bytes) for each label, both
+// must have room for srm_regions_count() entries. Returns the number of labels.
+
+unsigned int srm_labels(struct srm *srm, int32_t *labels, size_t widthStep_labels, unsigned int *label_sizes, uint8_t *label_colors);
 unsigned int* srm_regions(struct srm *srm);
 unsigned int* srm_regions_sizes(struct srm *srm);
 void srm_delete(struct srm *srm);
 
+// Max channel difference between each pixel in row and its C4 neighbor to the right
+// (width - 1 values) and below in next_row (width values, skipped when NULL).
+
+void srm_row_diffs(const uint8_t *row, const uint8_t *next_row, unsigned int width, unsigned int channels, uint8_t *right_diffs, uint8_t *below_diffs);
+
 void SRM(double Q, unsigned int width, unsigned int height, unsigned int channels, uint8_t *in, uint8_t *out, unsigned int borders);
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif // SRM_H
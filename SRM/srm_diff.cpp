@@ -0,0 +1,84 @@
+//
+//  srm_diff.cpp
+//
+//  Row based kernel that computes the SRM max channel difference between
+//  each pixel and its C4 neighbors to the right and below. Rows are walked
+//  directly so that no pixel index to offset divide is needed and 3 channel
+//  BGR pixels are processed 16 at a time with the OpenCV universal intrinsics
+//  (SSE2 on x86, NEON on ARM). A scalar loop handles the row tail and builds
+//  that have no 128 bit SIMD support.
+
+#include <stdint.h>
+
+#include "opencv2/core/hal/intrin.hpp"
+
+#include "srm.h"
+
+static inline
+uint8_t max_channel_diff(const uint8_t *p1, const uint8_t *p2, unsigned int channels)
+{
+  unsigned int maxDiff = 0;
+
+  for (unsigned int c = 0; c < channels; c++) {
+    unsigned int v1 = p1[c];
+    unsigned int v2 = p2[c];
+    unsigned int d = (v2 > v1) ? (v2 - v1) : (v1 - v2);
+    if (d > maxDiff) {
+      maxDiff = d;
+    }
+  }
+
+  return (uint8_t) maxDiff;
+}
+
+extern "C"
+void srm_row_diffs(const uint8_t *row,
+                   const uint8_t *next_row,
+                   unsigned int width,
+                   unsigned int channels,
+                   uint8_t *right_diffs,
+                   uint8_t *below_diffs)
+{
+  unsigned int j = 0;
+
+#if CV_SIMD128
+  if (channels == 3) {
+    using namespace cv;
+
+    // Each iteration reads 17 pixels from row so that the right neighbor
+    // of the 16th pixel is available.
+
+    for ( ; (j + 16) < width; j += 16) {
+      v_uint8x16 b1, g1, r1;
+      v_uint8x16 b2, g2, r2;
+
+      v_load_deinterleave(row + 3 * j, b1, g1, r1);
+      v_load_deinterleave(row + 3 * (j + 1), b2, g2, r2);
+
+      v_uint8x16 d = v_max(v_absdiff(b1, b2), v_max(v_absdiff(g1, g2), v_absdiff(r1, r2)));
+      v_store(right_diffs + j, d);
+
+      if (next_row != NULL) {
+        v_load_deinterleave(next_row + 3 * j, b2, g2, r2);
+
+        d = v_max(v_absdiff(b1, b2), v_max(v_absdiff(g1, g2), v_absdiff(r1, r2)));
+        v_store(below_diffs + j, d);
+      }
+    }
+  }
+#endif // CV_SIMD128
+
+  // Scalar tail, or the whole row when SIMD is not available
+
+  for ( ; j < width; j++) {
+    const uint8_t *p = row + channels * j;
+
+    if ((j + 1) < width) {
+      right_diffs[j] = max_channel_diff(p, p + channels, channels);
+    }
+
+    if (next_row != NULL) {
+      below_diffs[j] = max_channel_diff(p, next_row + channels * j, channels);
+    }
+  }
+}
@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "unionfind.h"
+#include "srm.h"
+
+// Tiled SRM for images that are too large to segment in one piece. The image
+// is cut into a grid of core tiles and each tile is segmented on its own with
+// a margin of overlap pixels around the core, so memory use depends on the
+// tile size and the number of worker threads and not on the image size.
+//
+// Each pixel takes the label from the tile whose core contains it. Along each
+// seam a tile also keeps its labels for the ring of pixels just outside its
+// core. Two pixels on either side of a seam are joined in a union-find over
+// all tile labels when both tiles put them in the same region, and a final
+// pass relabels the image with consecutive labels. Tile labels are connected
+// within the core and joins are only made between neighbors, so like the
+// untiled labels every output region is 4 connected.
+
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define labels_row(labels, widthStep, i) ((int32_t *) ((uint8_t *) (labels) + (size_t) (i) * (widthStep)))
+
+#define SRM_TILE_SIZE_DEFAULT 2048
+
+typedef struct {
+  // Core pixels owned by this tile
+  unsigned int x0, y0, x1, y1;
+  // Segmented area including the overlap margin
+  unsigned int ex0, ey0, ex1, ey1;
+  unsigned int num_labels;
+  unsigned int label_base;
+  // Tile local labels for the pixels just outside each side of the core,
+  // -1 for a pixel that is not in the same region as the core pixel next to
+  // it and NULL when that side is on the image border
+  int32_t *ring_left;
+  int32_t *ring_right;
+  int32_t *ring_top;
+  int32_t *ring_bottom;
+} srm_tile;
+
+typedef struct {
+  double Q;
+  double logdelta;
+  unsigned int smallregion;
+  unsigned int width;
+  unsigned int height;
+  unsigned int channels;
+  size_t widthStep_in;
+  uint8_t *in;
+  size_t widthStep_labels;
+  int32_t *labels;
+  srm_tile *tiles;
+  unsigned int num_tiles;
+  // Global label for each tile local label after seams are reconciled
+  int32_t *final_labels;
+  // Next tile to process, shared by the workers
+  unsigned int next_tile;
+} srm_tiled_ctx;
+
+typedef void (*tile_func)(srm_tiled_ctx *ctx, srm_tile *tile);
+
+typedef struct {
+  srm_tiled_ctx *ctx;
+  tile_func f;
+} tile_worker_arg;
+
+static void* tile_worker_main(void *arg) {
+  tile_worker_arg *twa = (tile_worker_arg *) arg;
+  srm_tiled_ctx *ctx = twa->ctx;
+
+  while (1) {
+    unsigned int t = __sync_fetch_and_add(&ctx->next_tile, 1);
+    if (t >= ctx->num_tiles) {
+      break;
+    }
+    twa->f(ctx, &ctx->tiles[t]);
+  }
+
+  return NULL;
+}
+
+// Invoke f once for each tile, tiles are handed out to threads workers in
+// raster order.
+
+static void run_tiles(srm_tiled_ctx *ctx, tile_func f, unsigned int threads) {
+  tile_worker_arg twa;
+  twa.ctx = ctx;
+  twa.f = f;
+
+  ctx->next_tile = 0;
+
+  threads = min(threads, ctx->num_tiles);
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  unsigned int *started = calloc(threads, sizeof(unsigned int));
+
+  for (unsigned int w = 1; w < threads; w++) {
+    started[w] = (pthread_create(&workers[w], NULL, tile_worker_main, &twa) == 0);
+  }
+
+  // The calling thread is also a worker, so all tiles are done even when
+  // no thread could be created
+  tile_worker_main(&twa);
+
+  for (unsigned int w = 1; w < threads; w++) {
+    if (started[w]) {
+      pthread_join(workers[w], NULL);
+    }
+  }
+
+  free(workers);
+  free(started);
+}
+
+// Segment the tile area, copy the core labels into the output and save the
+// labels of the ring around the core. Labels are tile local at this point. A
+// region can reach the core in pieces that are only connected through the
+// margin, so the core is numbered by the 4 connected components of the tile
+// labels and each piece gets its own label. A ring pixel holds the label of
+// the core pixel next to it when both are in the same region and -1 when they
+// are not. The label buffers are sized for this tile, which is small next to
+// the SRM buffers.
+
+static void segment_tile(srm_tiled_ctx *ctx, srm_tile *tile) {
+  unsigned int ew = tile->ex1 - tile->ex0;
+  unsigned int eh = tile->ey1 - tile->ey0;
+  size_t widthStep_tile = (size_t) ew * sizeof(int32_t);
+
+  int32_t *tile_labels = malloc((size_t) ew * eh * sizeof(int32_t));
+  int32_t *core_labels = malloc((size_t) ew * eh * sizeof(int32_t));
+
+  uint8_t *tile_in = ctx->in + (size_t) tile->ey0 * ctx->widthStep_in + (size_t) tile->ex0 * ctx->channels;
+
+  struct srm *srm = srm_new(ctx->Q, ew, eh, ctx->channels, 0);
+  srm_set_flags(srm, SRM_COMPACT_EDGES);
+
+  // Use the merge bound and small region size for the whole image so that
+  // regions inside a tile merge the same way they would without tiling
+  srm->logdelta = ctx->logdelta;
+  srm->smallregion = ctx->smallregion;
+
+  srm_run(srm, ctx->widthStep_in, tile_in, 0, NULL);
+  srm_labels(srm, tile_labels, widthStep_tile, NULL, NULL);
+  srm_delete(srm);
+
+  // Offset of the core inside the tile area
+
+  unsigned int cx = tile->x0 - tile->ex0;
+  unsigned int cy = tile->y0 - tile->ey0;
+  unsigned int cw = tile->x1 - tile->x0;
+  unsigned int ch = tile->y1 - tile->y0;
+
+  // Join C4 neighbors in the core that have the same tile label
+
+  struct unionfind *uf = unionfind_new(cw * ch);
+
+  for (unsigned int i = 0; i < ch; i++) {
+    const int32_t *tile_row = labels_row(tile_labels, widthStep_tile, cy + i) + cx;
+    const int32_t *prev_row = (i > 0) ? labels_row(tile_labels, widthStep_tile, cy + i - 1) + cx : NULL;
+
+    for (unsigned int j = 0; j < cw; j++) {
+      unsigned int p = i * cw + j;
+
+      if (j > 0 && tile_row[j - 1] == tile_row[j]) {
+        unsigned int r1 = unionfind_find(uf, p - 1);
+        unsigned int r2 = unionfind_find(uf, p);
+        if (r1 != r2) {
+          unionfind_union(uf, r1, r2);
+        }
+      }
+
+      if (i > 0 && prev_row[j] == tile_row[j]) {
+        unsigned int r1 = unionfind_find(uf, p - cw);
+        unsigned int r2 = unionfind_find(uf, p);
+        if (r1 != r2) {
+          unionfind_union(uf, r1, r2);
+        }
+      }
+    }
+  }
+
+  // Number the core components in raster order, core_labels maps a
+  // component root to its label
+
+  for (unsigned int p = 0; p < cw * ch; p++) {
+    core_labels[p] = -1;
+  }
+
+  int32_t next_label = 0;
+
+  for (unsigned int i = 0; i < ch; i++) {
+    int32_t *out_row = labels_row(ctx->labels, ctx->widthStep_labels, tile->y0 + i) + tile->x0;
+
+    for (unsigned int j = 0; j < cw; j++) {
+      unsigned int root = unionfind_find(uf, i * cw + j);
+      if (core_labels[root] == -1) {
+        core_labels[root] = next_label++;
+      }
+      out_row[j] = core_labels[root];
+    }
+  }
+
+  unionfind_delete(uf);
+
+  tile->num_labels = (unsigned int) next_label;
+
+  for (unsigned int i = 0; i < ch; i++) {
+    const int32_t *tile_row = labels_row(tile_labels, widthStep_tile, cy + i);
+    const int32_t *out_row = labels_row(ctx->labels, ctx->widthStep_labels, tile->y0 + i);
+
+    if (tile->ring_left != NULL) {
+      tile->ring_left[i] = (tile_row[cx - 1] == tile_row[cx]) ? out_row[tile->x0] : -1;
+    }
+    if (tile->ring_right != NULL) {
+      tile->ring_right[i] = (tile_row[cx + cw] == tile_row[cx + cw - 1]) ? out_row[tile->x1 - 1] : -1;
+    }
+  }
+
+  for (unsigned int j = 0; j < cw; j++) {
+    if (tile->ring_top != NULL) {
+      const int32_t *out_row = labels_row(ctx->labels, ctx->widthStep_labels, tile->y0);
+      int32_t outside = labels_row(tile_labels, widthStep_tile, cy - 1)[cx + j];
+      int32_t inside = labels_row(tile_labels, widthStep_tile, cy)[cx + j];
+      tile->ring_top[j] = (outside == inside) ? out_row[tile->x0 + j] : -1;
+    }
+    if (tile->ring_bottom != NULL) {
+      const int32_t *out_row = labels_row(ctx->labels, ctx->widthStep_labels, tile->y1 - 1);
+      int32_t outside = labels_row(tile_labels, widthStep_tile, cy + ch)[cx + j];
+      int32_t inside = labels_row(tile_labels, widthStep_tile, cy + ch - 1)[cx + j];
+      tile->ring_bottom[j] = (outside == inside) ? out_row[tile->x0 + j] : -1;
+    }
+  }
+
+  free(tile_labels);
+  free(core_labels);
+}
+
+// Join the regions on either side of a seam when both tiles agree. The pairs
+// (a[k], b[k]) are C4 neighbors with a[k] in tile ta and b[k] in tile tb,
+// ring_a[k] is the label of a[k] when tile ta puts b[k] in the same region
+// and ring_b[k] is the label of b[k] when tile tb puts a[k] in the same region.
+
+static void join_seam(struct unionfind *uf, const srm_tile *ta, const srm_tile *tb,
+                      const int32_t *a, size_t a_step, const int32_t *b, size_t b_step,
+                      const int32_t *ring_a, const int32_t *ring_b, unsigned int n) {
+  for (unsigned int k = 0; k < n; k++) {
+    int32_t la = a[k * a_step];
+    int32_t lb = b[k * b_step];
+
+    if (la == ring_a[k] && lb == ring_b[k]) {
+      unsigned int r1 = unionfind_find(uf, ta->label_base + la);
+      unsigned int r2 = unionfind_find(uf, tb->label_base + lb);
+      if (r1 != r2) {
+        unionfind_union(uf, r1, r2);
+      }
+    }
+  }
+}
+
+// Replace the tile local labels in the core with the global labels
+
+static void relabel_tile(srm_tiled_ctx *ctx, srm_tile *tile) {
+  const int32_t *final_labels = ctx->final_labels + tile->label_base;
+
+  for (unsigned int i = tile->y0; i < tile->y1; i++) {
+    int32_t *out_row = labels_row(ctx->labels, ctx->widthStep_labels, i);
+
+    for (unsigned int j = tile->x0; j < tile->x1; j++) {
+      out_row[j] = final_labels[out_row[j]];
+    }
+  }
+}
+
+unsigned int srm_run_tiled(double Q, unsigned int width, unsigned int height, unsigned int channels,
+                           size_t widthStep_in, uint8_t *in, size_t widthStep_labels, int32_t *labels,
+                           unsigned int tile_size, unsigned int overlap, unsigned int threads) {
+  srm_tiled_ctx ctx;
+
+  if (tile_size == 0) {
+    tile_size = SRM_TILE_SIZE_DEFAULT;
+  }
+
+  // A margin of at least one pixel is needed to compare labels across a seam
+  if (overlap == 0) {
+    overlap = 1;
+  }
+
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+  unsigned int tiles_y = (height + tile_size - 1) / tile_size;
+
+  ctx.Q = Q;
+  ctx.logdelta = 2.0 * log(6.0 * (double) width * (double) height);
+  ctx.smallregion = (unsigned int) (0.001 * (double) width * (double) height);
+  ctx.width = width;
+  ctx.height = height;
+  ctx.channels = channels;
+  ctx.widthStep_in = widthStep_in;
+  ctx.in = in;
+  ctx.widthStep_labels = widthStep_labels;
+  ctx.labels = labels;
+  ctx.num_tiles = tiles_x * tiles_y;
+  ctx.tiles = calloc(ctx.num_tiles, sizeof(srm_tile));
+
+  for (unsigned int ty = 0; ty < tiles_y; ty++) {
+    for (unsigned int tx = 0; tx < tiles_x; tx++) {
+      srm_tile *tile = &ctx.tiles[ty * tiles_x + tx];
+
+      tile->x0 = tx * tile_size;
+      tile->y0 = ty * tile_size;
+      tile->x1 = min(tile->x0 + tile_size, width);
+      tile->y1 = min(tile->y0 + tile_size, height);
+
+      tile->ex0 = (tile->x0 > overlap) ? (tile->x0 - overlap) : 0;
+      tile->ey0 = (tile->y0 > overlap) ? (tile->y0 - overlap) : 0;
+      tile->ex1 = min(tile->x1 + overlap, width);
+      tile->ey1 = min(tile->y1 + overlap, height);
+
+      unsigned int cw = tile->x1 - tile->x0;
+      unsigned int ch = tile->y1 - tile->y0;
+
+      tile->ring_left   = (tile->x0 > 0)      ? malloc(ch * sizeof(int32_t)) : NULL;
+      tile->ring_right  = (tile->x1 < width)  ? malloc(ch * sizeof(int32_t)) : NULL;
+      tile->ring_top    = (tile->y0 > 0)      ? malloc(cw * sizeof(int32_t)) : NULL;
+      tile->ring_bottom = (tile->y1 < height) ? malloc(cw * sizeof(int32_t)) : NULL;
+    }
+  }
+
+  // Segment each tile
+
+  run_tiles(&ctx, segment_tile, threads);
+
+  // Tile local labels become global by adding the number of labels in the
+  // tiles before it in raster order
+
+  unsigned int total_labels = 0;
+
+  for (unsigned int t = 0; t < ctx.num_tiles; t++) {
+    ctx.tiles[t].label_base = total_labels;
+    total_labels += ctx.tiles[t].num_labels;
+  }
+
+  // Reconcile regions along the seams, the union-find is over labels and
+  // not pixels so it stays small
+
+  struct unionfind *uf = unionfind_new(total_labels);
+
+  for (unsigned int ty = 0; ty < tiles_y; ty++) {
+    for (unsigned int tx = 0; tx < tiles_x; tx++) {
+      const srm_tile *ta = &ctx.tiles[ty * tiles_x + tx];
+
+      if (tx + 1 < tiles_x) {
+        const srm_tile *tb = &ctx.tiles[ty * tiles_x + tx + 1];
+        const int32_t *a = labels_row(labels, widthStep_labels, ta->y0) + (ta->x1 - 1);
+        const int32_t *b = labels_row(labels, widthStep_labels, tb->y0) + tb->x0;
+        size_t step = widthStep_labels / sizeof(int32_t);
+        join_seam(uf, ta, tb, a, step, b, step, ta->ring_right, tb->ring_left, ta->y1 - ta->y0);
+      }
+
+      if (ty + 1 < tiles_y) {
+        const srm_tile *tb = &ctx.tiles[(ty + 1) * tiles_x + tx];
+        const int32_t *a = labels_row(labels, widthStep_labels, ta->y1 - 1) + ta->x0;
+        const int32_t *b = labels_row(labels, widthStep_labels, tb->y0) + tb->x0;
+        join_seam(uf, ta, tb, a, 1, b, 1, ta->ring_bottom, tb->ring_top, ta->x1 - ta->x0);
+      }
+    }
+  }
+
+  // Number the joined regions in order of first global label, this only
+  // depends on the tile grid and not on the order tiles were processed in
+
+  int32_t *root_labels = malloc(total_labels * sizeof(int32_t));
+  ctx.final_labels = malloc(total_labels * sizeof(int32_t));
+  int32_t next_label = 0;
+
+  for (unsigned int i = 0; i < total_labels; i++) {
+    root_labels[i] = -1;
+  }
+
+  for (unsigned int i = 0; i < total_labels; i++) {
+    unsigned int root = unionfind_find(uf, i);
+    if (root_labels[root] == -1) {
+      root_labels[root] = next_label++;
+    }
+    ctx.final_labels[i] = root_labels[root];
+  }
+
+  free(root_labels);
+  unionfind_delete(uf);
+
+  run_tiles(&ctx, relabel_tile, threads);
+
+  for (unsigned int t = 0; t < ctx.num_tiles; t++) {
+    free(ctx.tiles[t].ring_left);
+    free(ctx.tiles[t].ring_right);
+    free(ctx.tiles[t].ring_top);
+    free(ctx.tiles[t].ring_bottom);
+  }
+
+  free(ctx.tiles);
+  free(ctx.final_labels);
+
+  return (unsigned int) next_label;
+}
@@ -17,6 +17,8 @@ struct unionfind* unionfind_new(unsigned int size) {
 }
 
 void unionfind_init(struct unionfind *uf) {
+  uf->count = uf->size;
+
   for (unsigned int i = 0; i < uf->size; i++) {
     uf->weights[i] = 1;
     uf->parents[i] = i;
@@ -0,0 +1,147 @@
+//
+//  ConnectedComponentsTest.mm
+//
+//  Test connectedTagComponents() defined in OpenCVUtil.h, this labels each
+//  connected region of same tag pixels in a tags image.
+
+#include <opencv2/opencv.hpp> // Include OpenCV before any Foundation headers
+
+#import <Foundation/Foundation.h>
+
+#include "Util.h"
+#include "OpenCVUtil.h"
+
+#import <XCTest/XCTest.h>
+
+@interface ConnectedComponentsTest : XCTestCase
+
+@end
+
+@implementation ConnectedComponentsTest
+
++ (void) fillImageWithPixels:(NSArray*)pixelNums img:(Mat&)img
+{
+  uint32_t offset = 0;
+
+  for( int y = 0; y < img.rows; y++ ) {
+    for( int x = 0; x < img.cols; x++ ) {
+      uint32_t pixel = [[pixelNums objectAtIndex:offset] unsignedIntValue];
+      offset += 1;
+
+      img.at<Vec3b>(y, x) = PixelToVec3b(pixel);
+    }
+  }
+
+  return;
+}
+
++ (NSArray*) labelsAsArray:(Mat&)labelsImg
+{
+  NSMutableArray *mArr = [NSMutableArray array];
+
+  for( int y = 0; y < labelsImg.rows; y++ ) {
+    for( int x = 0; x < labelsImg.cols; x++ ) {
+      [mArr addObject:@(labelsImg.at<int32_t>(y, x))];
+    }
+  }
+
+  return mArr;
+}
+
+// Tag 1 is used by two regions that are not connected
+
+- (void) testSplitDisconnectedTag
+{
+  NSArray *pixelsArr = @[
+                         @(1), @(1), @(2), @(1),
+                         @(1), @(2), @(2), @(1),
+                         @(3), @(3), @(2), @(1),
+                         ];
+
+  Mat tagsImg(3, 4, CV_8UC3);
+
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+
+  Mat labelsImg;
+
+  int numLabels = connectedTagComponents(tagsImg, labelsImg, 8);
+
+  XCTAssert(numLabels == 4, @"numLabels");
+
+  NSArray *expectedArr = @[
+                           @(0), @(0), @(1), @(2),
+                           @(0), @(1), @(1), @(2),
+                           @(3), @(3), @(1), @(2),
+                           ];
+
+  XCTAssert([[self.class labelsAsArray:labelsImg] isEqualToArray:expectedArr], @"labels");
+}
+
+// Diagonal neighbors are only connected with 8 connectivity
+
+- (void) testDiagonalConnectivity
+{
+  NSArray *pixelsArr = @[
+                         @(1), @(2), @(1),
+                         @(2), @(1), @(2),
+                         ];
+
+  Mat tagsImg(2, 3, CV_8UC3);
+
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+
+  Mat labelsImg;
+
+  int numLabels = connectedTagComponents(tagsImg, labelsImg, 8);
+
+  XCTAssert(numLabels == 2, @"numLabels");
+
+  NSArray *expected8Arr = @[
+                            @(0), @(1), @(0),
+                            @(1), @(0), @(1),
+                            ];
+
+  XCTAssert([[self.class labelsAsArray:labelsImg] isEqualToArray:expected8Arr], @"labels");
+
+  numLabels = connectedTagComponents(tagsImg, labelsImg, 4);
+
+  XCTAssert(numLabels == 6, @"numLabels");
+
+  NSArray *expected4Arr = @[
+                            @(0), @(1), @(2),
+                            @(3), @(4), @(5),
+                            ];
+
+  XCTAssert([[self.class labelsAsArray:labelsImg] isEqualToArray:expected4Arr], @"labels");
+}
+
+// A U shape is joined by the second pass when both arms are found first
+
+- (void) testJoinedArms
+{
+  NSArray *pixelsArr = @[
+                         @(5), @(0), @(5),
+                         @(5), @(0), @(5),
+                         @(5), @(5), @(5),
+                         ];
+
+  Mat tagsImg(3, 3, CV_8UC3);
+
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+
+  Mat labelsImg;
+
+  int numLabels = connectedTagComponents(tagsImg, labelsImg, 8);
+
+  XCTAssert(numLabels == 2, @"numLabels");
+
+  NSArray *expectedArr = @[
+                           @(0), @(1), @(0),
+                           @(0), @(1), @(0),
+                           @(0), @(0), @(0),
+                           ];
+
+  XCTAssert([[self.class labelsAsArray:labelsImg] isEqualToArray:expectedArr], @"labels");
+}
+
+@end
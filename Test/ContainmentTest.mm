@@ -387,4 +387,55 @@
   }
 }
 
+// Three levels of nesting, (2+1) is inside (1+1) which is inside (0+1).
+// The inside out order must list each tag after all the tags it contains.
+
+- (void)testParse6x6NestedInsideOut {
+  
+  NSArray *pixelsArr = @[
+                         @(0), @(0), @(0), @(0), @(0), @(0),
+                         @(0), @(1), @(1), @(1), @(1), @(0),
+                         @(0), @(1), @(2), @(2), @(1), @(0),
+                         @(0), @(1), @(2), @(2), @(1), @(0),
+                         @(0), @(1), @(1), @(1), @(1), @(0),
+                         @(0), @(0), @(0), @(0), @(0), @(0),
+                         ];
+  
+  Mat tagsImg(6, 6, CV_MAKETYPE(CV_8U, 3));
+  
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+  
+  SuperpixelImage spImage;
+  
+  bool worked = SuperpixelImage::parse(tagsImg, spImage);
+  XCTAssert(worked, @"SuperpixelImage parse");
+  
+  SuperpixelContainmentTree containsTree;
+  
+  buildSuperpixelContainmentTree(spImage, tagsImg, containsTree);
+  
+  XCTAssert(containsTree.tags.size() == 3, @"tags");
+  XCTAssert(containsTree.roots.size() == 1, @"roots");
+  XCTAssert(containsTree.tags[containsTree.roots[0]] == 1, @"roots");
+  
+  for ( int i = 0; i < 3; i++ ) {
+    int32_t tag = containsTree.tags[i];
+    int32_t numChildren = containsTree.numChildren[i];
+    
+    if (tag == 3) {
+      XCTAssert(numChildren == 0, @"children");
+    } else {
+      XCTAssert(numChildren == 1, @"children");
+      XCTAssert(containsTree.tags[containsTree.children[containsTree.childOffsets[i]]] == tag + 1, @"children");
+    }
+  }
+  
+  vector<int32_t> insideOutOrder = superpixelContainmentInsideOutOrder(containsTree);
+  
+  XCTAssert(insideOutOrder.size() == 3, @"order");
+  XCTAssert(insideOutOrder[0] == 3, @"order");
+  XCTAssert(insideOutOrder[1] == 2, @"order");
+  XCTAssert(insideOutOrder[2] == 1, @"order");
+}
+
 @end
@@ -315,6 +315,200 @@
 }
 
 
+// Parse stores each superpixel as row spans, check the spans and the coords
+// view for an L shaped region and then copy its pixels out and back in.
+
+- (void)testParseRowSpans {
+  
+  NSArray *pixelsArr = @[
+                         @(0), @(0), @(1), @(1),
+                         @(0), @(1), @(1), @(1),
+                         @(0), @(0), @(0), @(1),
+                         ];
+  
+  Mat tagsImg(3, 4, CV_MAKETYPE(CV_8U, 3));
+  
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+  
+  SuperpixelImage spImage;
+  
+  bool worked = SuperpixelImage::parse(tagsImg, spImage);
+  XCTAssert(worked, @"SuperpixelImage parse");
+  
+  Superpixel *spPtr = spImage.getSuperpixelPtr(0+1);
+  
+  const vector<CoordSpan> &spans = spPtr->coords.getSpans();
+  XCTAssert(spans.size() == 3, @"num spans");
+  
+  XCTAssert(spans[0].y == 0 && spans[0].x0 == 0 && spans[0].x1 == 1, @"span");
+  XCTAssert(spans[1].y == 1 && spans[1].x0 == 0 && spans[1].x1 == 0, @"span");
+  XCTAssert(spans[2].y == 2 && spans[2].x0 == 0 && spans[2].x1 == 2, @"span");
+  
+  XCTAssert(spPtr->coords.size() == 6, @"num coords");
+  
+  {
+    NSArray *result = [self.class formatSuperpixelCoords:spPtr];
+    
+    NSArray *expected = @[
+                          @[@(0), @(0)],
+                          @[@(1), @(0)],
+                          @[@(0), @(1)],
+                          @[@(0), @(2)],
+                          @[@(1), @(2)],
+                          @[@(2), @(2)]
+                          ];
+    
+    XCTAssert([result isEqualToArray:expected], @"coords");
+  }
+  
+  int32_t originX, originY, width, height;
+  spPtr->bbox(originX, originY, width, height);
+  
+  XCTAssert(originX == 0 && originY == 0 && width == 3 && height == 3, @"bbox");
+  
+  Mat regionPixels;
+  spPtr->fillMatrixFromCoords(tagsImg, spPtr->tag, regionPixels);
+  XCTAssert(regionPixels.cols == 6, @"num pixels");
+  
+  Mat outImg(3, 4, CV_MAKETYPE(CV_8U, 3), Scalar(0xFF, 0xFF, 0xFF));
+  spPtr->reverseFillMatrixFromCoords(regionPixels, false, spPtr->tag, outImg);
+  
+  XCTAssert(outImg.at<Vec3b>(1, 0) == tagsImg.at<Vec3b>(1, 0), @"pixel");
+  XCTAssert(outImg.at<Vec3b>(2, 2) == tagsImg.at<Vec3b>(2, 2), @"pixel");
+  XCTAssert(outImg.at<Vec3b>(1, 1) == Vec3b(0xFF, 0xFF, 0xFF), @"pixel");
+}
+
+// Superpixels are at dense indexes in tag order, a merged away superpixel
+// keeps its index but can no longer be looked up.
+
+- (void)testArenaIndexes {
+  
+  NSArray *pixelsArr = @[
+                         @(9), @(9), @(4),
+                         @(9), @(9), @(4),
+                         @(7), @(7), @(7),
+                         ];
+  
+  Mat tagsImg(3, 3, CV_MAKETYPE(CV_8U, 3));
+  
+  [self.class fillImageWithPixels:pixelsArr img:tagsImg];
+  
+  SuperpixelImage spImage;
+  
+  bool worked = SuperpixelImage::parse(tagsImg, spImage);
+  XCTAssert(worked, @"SuperpixelImage parse");
+  
+  SuperpixelArena &arena = spImage.superpixelArena;
+  
+  XCTAssert(arena.size() == 3, @"num superpixels");
+  XCTAssert(arena.numIndexes() == 3, @"num indexes");
+  
+  XCTAssert(arena.indexOf(4+1) == 0, @"index");
+  XCTAssert(arena.indexOf(7+1) == 1, @"index");
+  XCTAssert(arena.indexOf(9+1) == 2, @"index");
+  XCTAssert(arena.indexOf(1) == -1, @"index");
+  XCTAssert(arena.indexOf(0xFFFFFF) == -1, @"index");
+  
+  SuperpixelSideArray<int> sideArray(arena, 0);
+  sideArray[4+1] = 4;
+  sideArray[9+1] = 9;
+  
+  SuperpixelEdge edge(4+1, 9+1);
+  spImage.mergeEdge(edge);
+  
+  XCTAssert(arena.size() == 2, @"num superpixels");
+  XCTAssert(arena.numIndexes() == 3, @"num indexes");
+  
+  XCTAssert(spImage.getSuperpixelPtr(4+1) == NULL, @"merged");
+  XCTAssert(spImage.getSuperpixelPtr(9+1)->coords.size() == 6, @"num coords");
+  XCTAssert(arena.indexOf(9+1) == 2, @"index");
+  
+  XCTAssert(sideArray[9+1] == 9, @"side value");
+  XCTAssert(sideArray.atIndex(0) == 4, @"side value");
+}
+
+// Stats computed from the input image at parse time are merged along with
+// the superpixels.
+
+- (void)testParseStats {
+  
+  NSArray *tagsArr = @[
+                       @(1), @(1), @(2),
+                       @(1), @(1), @(2),
+                       @(3), @(3), @(3),
+                       ];
+  
+  NSArray *pixelsArr = @[
+                         @(0x0A0B0C), @(0x0A0B0C), @(0x101010),
+                         @(0x0A0B0C), @(0x0A0B0C), @(0x303030),
+                         @(0x0A0B0C), @(0x0A0B0C), @(0x0A0B0C),
+                         ];
+  
+  Mat tagsImg(3, 3, CV_MAKETYPE(CV_8U, 3));
+  Mat inputImg(3, 3, CV_MAKETYPE(CV_8U, 3));
+  
+  [self.class fillImageWithPixels:tagsArr img:tagsImg];
+  [self.class fillImageWithPixels:pixelsArr img:inputImg];
+  
+  SuperpixelImage spImage;
+  
+  bool worked = SuperpixelImage::parse(tagsImg, inputImg, spImage);
+  XCTAssert(worked, @"SuperpixelImage parse");
+  
+  XCTAssert(spImage.hasStats(), @"stats");
+  
+  Superpixel *sp1Ptr = spImage.getSuperpixelPtr(1+1);
+  Superpixel *sp2Ptr = spImage.getSuperpixelPtr(2+1);
+  Superpixel *sp3Ptr = spImage.getSuperpixelPtr(3+1);
+  
+  XCTAssert(sp1Ptr->statsAllSame(), @"all same");
+  XCTAssert(sp2Ptr->statsAllSame() == false, @"not all same");
+  XCTAssert(sp3Ptr->statsAllSame(), @"all same");
+  
+  XCTAssert(sp2Ptr->stats.sum[0] == 0x40, @"sum");
+  XCTAssert(sp2Ptr->stats.sumSquares[0] == (0x10 * 0x10 + 0x30 * 0x30), @"sum of squares");
+  XCTAssert(sp2Ptr->stats.minValue[1] == 0x10, @"min");
+  XCTAssert(sp2Ptr->stats.maxValue[1] == 0x30, @"max");
+  
+  float mean[3], variance[3];
+  sp2Ptr->statsMeanAndVariance(mean, variance);
+  XCTAssert(mean[2] == 32.0f, @"mean");
+  XCTAssert(variance[2] == 256.0f, @"variance");
+  
+  XCTAssert(spImage.isAllSamePixels(inputImg, 1+1), @"all same");
+  XCTAssert(spImage.isAllSamePixels(inputImg, 2+1) == false, @"not all same");
+  
+  sp1Ptr->setAllSame();
+  XCTAssert(spImage.isAllSamePixels(inputImg, sp1Ptr, 3+1), @"same as neighbor");
+  
+  // Merge 1 and 3, the stats of the result cover 6 pixels with the same value
+  
+  SuperpixelEdge edge(1+1, 3+1);
+  spImage.mergeEdge(edge);
+  
+  Superpixel *mergedPtr = spImage.getSuperpixelPtr(1+1);
+  
+  XCTAssert(mergedPtr->coords.size() == 7, @"num coords");
+  XCTAssert(mergedPtr->statsAllSame(), @"all same");
+  XCTAssert(mergedPtr->stats.sum[2] == 7 * 0x0A, @"sum");
+  
+  int32_t originX, originY, width, height;
+  mergedPtr->bbox(originX, originY, width, height);
+  XCTAssert(originX == 0 && originY == 0 && width == 3 && height == 3, @"bbox");
+  
+  spImage.invalidateStats();
+  XCTAssert(spImage.hasStats() == false, @"stats");
+  
+  // Without stats the pixels are read, the merged superpixel is still all the same
+  
+  XCTAssert(spImage.isAllSamePixels(inputImg, 1+1), @"all same");
+  XCTAssert(spImage.isAllSamePixels(inputImg, 2+1) == false, @"not all same");
+  
+  spImage.computeStats(inputImg);
+  XCTAssert(spImage.hasStats(), @"stats");
+  XCTAssert(spImage.getSuperpixelPtr(1+1)->stats.sum[2] == 7 * 0x0A, @"sum");
+}
+
 - (void)testParse3x3TwoEdges {
   
   NSArray *pixelsArr = @[
@@ -544,11 +738,11 @@
   // result based on the number of pixels in the superpixel.
   // In this case, there is a tie and the smaller UID is used.
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 2, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 2, @"sumperpixel UID table");
   
   spImage.mergeEdge(edges[0]);
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 1, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 1, @"sumperpixel UID table");
   
   superpixels = spImage.getSuperpixelsVec();
   XCTAssert(superpixels.size() == 1, @"num sumperpixels");
@@ -630,11 +824,11 @@
   // result based on the number of pixels in the superpixel.
   // In this case, there is a tie and the smaller UID is used.
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 2, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 2, @"sumperpixel UID table");
   
   spImage.mergeEdge(edges[0]);
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 1, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 1, @"sumperpixel UID table");
   
   superpixels = spImage.getSuperpixelsVec();
   XCTAssert(superpixels.size() == 1, @"num sumperpixels");
@@ -758,13 +952,13 @@
   // result based on the number of pixels in the superpixel.
   // In this case, there is a tie and the smaller UID is used.
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 3, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 3, @"sumperpixel UID table");
   
   // Merge superpixels (0 1) together
   
   spImage.mergeEdge(edges[0]);
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 2, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 2, @"sumperpixel UID table");
   
   superpixels = spImage.getSuperpixelsVec();
   XCTAssert(superpixels.size() == 2, @"num sumperpixels");
@@ -946,7 +1140,7 @@
   // result based on the number of pixels in the superpixel.
   // In this case, there is a tie and the smaller UID is used.
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == superpixels.size(), @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == superpixels.size(), @"sumperpixel UID table");
   
   // Merge superpixels (0 2) aka (1 3) together
   // Pre merged
@@ -957,7 +1151,7 @@
   
   spImage.mergeEdge(edges[1]);
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 3, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 3, @"sumperpixel UID table");
   
   superpixels = spImage.getSuperpixelsVec();
   XCTAssert(superpixels.size() == 3, @"num sumperpixels");
@@ -1188,13 +1382,13 @@
   // result based on the number of pixels in the superpixel.
   // In this case, there is a tie and the smaller UID is used.
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == superpixels.size(), @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == superpixels.size(), @"sumperpixel UID table");
   
   // Merge superpixels (1 2) together
   
   spImage.mergeEdge(edges[2]);
   
-  XCTAssert(spImage.tagToSuperpixelMap.size() == 4, @"sumperpixel UID table");
+  XCTAssert(spImage.superpixelArena.size() == 4, @"sumperpixel UID table");
   
   superpixels = spImage.getSuperpixelsVec();
   XCTAssert(superpixels.size() == 4, @"num sumperpixels");
@@ -0,0 +1,119 @@
+//
+//  EdgeTableTest.mm
+//
+//  Test the flat neighbor lists of the edge table as nodes are merged and
+//  the table is compacted.
+
+#include <opencv2/opencv.hpp> // Include OpenCV before any Foundation headers
+
+#import <Foundation/Foundation.h>
+
+#include "SuperpixelEdge.h"
+#include "SuperpixelEdgeTable.h"
+
+#import <XCTest/XCTest.h>
+
+@interface EdgeTableTest : XCTestCase
+
+@end
+
+@implementation EdgeTableTest
+
++ (vector<int32_t>) neighbors:(SuperpixelEdgeTable&)edgeTable tag:(int32_t)tag
+{
+  SuperpixelNeighbors neighbors = edgeTable.getNeighborsSpan(tag);
+  return vector<int32_t>(neighbors.begin(), neighbors.end());
+}
+
+// A chain 1 - 2 - 3 - 4 with a 5 connected to 1 and 3
+
+- (void)testBuildAndMerge {
+  vector<int32_t> tags = { 1, 2, 3, 4, 5 };
+
+  vector<pair<int32_t, int32_t> > edges = {
+    { 1, 2 }, { 2, 3 }, { 3, 4 }, { 1, 5 }, { 5, 3 }, { 2, 1 }, { 3, 5 }
+  };
+
+  SuperpixelEdgeTable edgeTable;
+  edgeTable.build(tags, edges);
+
+  XCTAssert(edgeTable.size() == 5);
+
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:1] == vector<int32_t>({ 2, 5 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:2] == vector<int32_t>({ 1, 3 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:3] == vector<int32_t>({ 2, 4, 5 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:4] == vector<int32_t>({ 3 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:5] == vector<int32_t>({ 1, 3 }));
+
+  XCTAssert(edgeTable.getAllEdges().size() == 5);
+
+  // Merge 2 into 5, 1 and 3 already have 5 as a neighbor
+
+  edgeTable.mergeNeighbors(2, 5);
+
+  XCTAssert(edgeTable.size() == 4);
+
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:1] == vector<int32_t>({ 5 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:3] == vector<int32_t>({ 4, 5 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:5] == vector<int32_t>({ 1, 3 }));
+
+  // Merge 5 into 4, 4 gains 1 and 1 gets 4 in place of 5
+
+  edgeTable.mergeNeighbors(5, 4);
+
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:1] == vector<int32_t>({ 4 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:3] == vector<int32_t>({ 4 }));
+  XCTAssert([EdgeTableTest neighbors:edgeTable tag:4] == vector<int32_t>({ 1, 3 }));
+
+  XCTAssert(edgeTable.getAllTagsInNeighborsTable() == vector<int32_t>({ 1, 3, 4 }));
+
+  XCTAssert(edgeTable.getNeighborAfter(4, -1) == 1);
+  XCTAssert(edgeTable.getNeighborAfter(4, 1) == 3);
+  XCTAssert(edgeTable.getNeighborAfter(4, 3) == -1);
+}
+
+// Merge every node of a large grid graph into one node so that spans are
+// moved and the table is compacted many times.
+
+- (void)testMergeGridIntoOne {
+  const int dim = 64;
+
+  vector<int32_t> tags;
+  vector<pair<int32_t, int32_t> > edges;
+
+  for ( int y = 0; y < dim; y++ ) {
+    for ( int x = 0; x < dim; x++ ) {
+      int32_t tag = 1 + y * dim + x;
+      tags.push_back(tag);
+
+      if (x + 1 < dim) {
+        edges.push_back(make_pair(tag, tag + 1));
+      }
+      if (y + 1 < dim) {
+        edges.push_back(make_pair(tag, tag + dim));
+      }
+    }
+  }
+
+  SuperpixelEdgeTable edgeTable;
+  edgeTable.build(tags, edges);
+
+  // Repeatedly merge the first neighbor of the corner into the corner
+
+  int32_t rootTag = 1;
+
+  for ( int i = 1; i < dim * dim; i++ ) {
+    int32_t neighborTag = edgeTable.getNeighborAfter(rootTag, -1);
+    XCTAssert(neighborTag != -1);
+    edgeTable.mergeNeighbors(neighborTag, rootTag);
+
+    for ( int32_t otherTag : edgeTable.getNeighborsSpan(rootTag) ) {
+      XCTAssert(edgeTable.getNeighborsSpan(otherTag).count(rootTag) == 1);
+    }
+  }
+
+  XCTAssert(edgeTable.size() == 1);
+  XCTAssert(edgeTable.getNeighborsSpan(rootTag).size() == 0);
+}
+
+@end
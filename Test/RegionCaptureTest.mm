@@ -0,0 +1,120 @@
+//
+//  RegionCaptureTest.mm
+//
+//  Test captureRegionMasks() defined in RegionCaptureScheduler.hpp, regions
+//  captured on more than one thread must be merged into exactly the same
+//  result as a serial capture.
+
+#include <opencv2/opencv.hpp> // Include OpenCV before any Foundation headers
+
+#import <Foundation/Foundation.h>
+
+#include "Superpixel.h"
+#include "SuperpixelImage.h"
+
+#include "Util.h"
+#include "OpenCVUtil.h"
+
+#include "ClusteringSegmentation.hpp"
+#include "RegionCaptureScheduler.hpp"
+#include "RegionRemerger.hpp"
+
+#import <XCTest/XCTest.h>
+
+@interface RegionCaptureTest : XCTestCase
+
+@end
+
+@implementation RegionCaptureTest
+
+// Fill a 3x3 grid of 16x16 squares on a background, the first square also
+// contains an 8x8 square so that one task has to wait for another.
+
++ (void) fillSquares:(Mat&)inputImg tags:(Mat&)tagsImg
+{
+  inputImg = Scalar(0x20, 0x20, 0x20);
+  tagsImg = (Scalar) 0;
+
+  uint32_t tag = 1;
+
+  for ( int row = 0; row < 3; row++ ) {
+    for ( int col = 0; col < 3; col++ ) {
+      Rect squareRect(8 + (col * 32), 8 + (row * 32), 16, 16);
+
+      tag += 1;
+      inputImg(squareRect) = Scalar(0x10 * tag, 0xFF - (0x10 * tag), 0x80);
+      tagsImg(squareRect) = PixelToVec3b(tag);
+    }
+  }
+
+  Rect innerRect(12, 12, 8, 8);
+
+  tag += 1;
+  inputImg(innerRect) = Scalar(0xFF, 0xFF, 0xFF);
+  tagsImg(innerRect) = PixelToVec3b(tag);
+}
+
+// Parse the tags and capture every region with numThreads threads
+
++ (void) captureSquares:(unsigned int)numThreads mergeMat:(Mat&)mergeMat mergedTag:(int32_t&)mergedTag
+{
+  const int superpixelDim = 4;
+
+  Mat inputImg(96, 96, CV_8UC3);
+  Mat tagsImg(96, 96, CV_8UC3);
+
+  [self fillSquares:inputImg tags:tagsImg];
+
+  int blockWidth = inputImg.cols / superpixelDim;
+  int blockHeight = inputImg.rows / superpixelDim;
+
+  SuperpixelImage spImage;
+
+  bool worked = SuperpixelImage::parse(tagsImg, spImage);
+  assert(worked);
+
+  spImage.fillMatrixWithSuperpixelTags(tagsImg);
+
+  SuperpixelContainmentTree containsTree;
+
+  buildSuperpixelContainmentTree(spImage, tagsImg, containsTree);
+
+  vector<int32_t> insideOutOrder = superpixelContainmentInsideOutOrder(containsTree);
+
+  unordered_map<Coord, HistogramForBlock> coordToBlockHistogramMap;
+
+  Mat blockBasedQuantMat = genHistogramsForBlocks(inputImg, coordToBlockHistogramMap, blockWidth, blockHeight, superpixelDim);
+
+  RegionRemerger remerger(inputImg);
+
+  captureRegionMasks(spImage, inputImg, tagsImg, insideOutOrder, blockWidth, blockHeight, superpixelDim, blockBasedQuantMat, remerger, numThreads);
+
+  mergeMat = remerger.mergeMat;
+  mergedTag = remerger.mergedTag;
+}
+
+- (void) testThreadedCaptureMatchesSerial
+{
+  Mat serialMergeMat;
+  int32_t serialMergedTag;
+
+  [self.class captureSquares:1 mergeMat:serialMergeMat mergedTag:serialMergedTag];
+
+  XCTAssert(serialMergedTag > 1, @"mergedTag");
+
+  for ( unsigned int numThreads = 2; numThreads <= 4; numThreads++ ) {
+    Mat threadedMergeMat;
+    int32_t threadedMergedTag;
+
+    [self.class captureSquares:numThreads mergeMat:threadedMergeMat mergedTag:threadedMergedTag];
+
+    XCTAssert(threadedMergedTag == serialMergedTag, @"mergedTag");
+
+    Mat diffMat;
+    absdiff(serialMergeMat, threadedMergeMat, diffMat);
+
+    XCTAssert(countNonZero(diffMat.reshape(1)) == 0, @"mergeMat");
+  }
+}
+
+@end
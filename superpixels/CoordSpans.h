@@ -0,0 +1,260 @@
+//
+//  CoordSpans.h
+//
+//  Run length encoded coordinates, each span is a run of pixels on one row
+//  stored as (Y, X0, X1) where both X values are inclusive. A region with
+//  smooth borders needs a span per row instead of a coord per pixel, so a
+//  large region takes a small fraction of the memory of a vector of coords
+//  and scanning it reads memory in order.
+//
+//  Code that works a row at a time should loop over getSpans(). Legacy code
+//  can iterate over the coords one at a time with begin() and end(), coords
+//  are visited in the order they were appended.
+
+#ifndef __Superpixel__CoordSpans__
+#define __Superpixel__CoordSpans__
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "Coord.h"
+
+using namespace std;
+
+typedef struct {
+  uint16_t y;
+  uint16_t x0;
+  uint16_t x1;
+} CoordSpan;
+
+class CoordSpans {
+public:
+
+  // Iterates over every coord covered by the spans
+
+  class const_iterator : public std::iterator<std::forward_iterator_tag, Coord, ptrdiff_t, const Coord*, const Coord&> {
+  public:
+    const_iterator(const CoordSpan *_span, const CoordSpan *_spansEnd)
+    : span(_span), spansEnd(_spansEnd)
+    {
+      if (span != spansEnd) {
+        current = Coord(span->x0, span->y);
+      }
+    }
+
+    const Coord& operator*() const {
+      return current;
+    }
+
+    const Coord* operator->() const {
+      return &current;
+    }
+
+    const_iterator& operator++() {
+      if (current.x < span->x1) {
+        current.x += 1;
+      } else {
+        span += 1;
+        current = (span != spansEnd) ? Coord(span->x0, span->y) : Coord();
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator prev = *this;
+      ++(*this);
+      return prev;
+    }
+
+    bool operator==(const const_iterator &other) const {
+      return span == other.span && current.x == other.current.x;
+    }
+
+    bool operator!=(const const_iterator &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    const CoordSpan *span;
+    const CoordSpan *spansEnd;
+    Coord current;
+  };
+
+  typedef const_iterator iterator;
+
+  CoordSpans()
+  : numCoords(0)
+  {
+    resetBbox();
+  }
+
+  // Number of coords, not spans
+
+  size_t size() const {
+    return numCoords;
+  }
+
+  bool empty() const {
+    return numCoords == 0;
+  }
+
+  const_iterator begin() const {
+    return const_iterator(spans.data(), spans.data() + spans.size());
+  }
+
+  const_iterator end() const {
+    return const_iterator(spans.data() + spans.size(), spans.data() + spans.size());
+  }
+
+  Coord front() const {
+    assert(spans.size() > 0);
+    return Coord(spans[0].x0, spans[0].y);
+  }
+
+  const vector<CoordSpan>& getSpans() const {
+    return spans;
+  }
+
+  // Bounding box of the coords, kept up to date as spans are appended so
+  // that it never needs a scan. The coords must not be empty.
+
+  void bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height) const {
+    assert(numCoords > 0);
+    originX = minX;
+    originY = minY;
+    width = (maxX - minX) + 1;
+    height = (maxY - minY) + 1;
+  }
+
+  // Append one coord, this extends the last span when the coord is just to
+  // the right of it.
+
+  void push_back(Coord c) {
+    appendSpan(c.y, c.x, c.x);
+  }
+
+  void appendSpan(int32_t y, int32_t x0, int32_t x1) {
+    assert(x0 <= x1);
+    assert(y >= 0 && y <= 0xFFFF);
+    assert(x0 >= 0 && x1 <= 0xFFFF);
+
+    if (spans.size() > 0) {
+      CoordSpan &last = spans.back();
+
+      if (last.y == y && (int32_t) last.x1 + 1 == x0) {
+        last.x1 = (uint16_t) x1;
+        numCoords += x1 - x0 + 1;
+        addToBbox(last);
+        return;
+      }
+    }
+
+    CoordSpan span;
+    span.y = (uint16_t) y;
+    span.x0 = (uint16_t) x0;
+    span.x1 = (uint16_t) x1;
+    spans.push_back(span);
+
+    numCoords += x1 - x0 + 1;
+    addToBbox(span);
+  }
+
+  // Append all the coords in other after the coords in this
+
+  void append(const CoordSpans &other) {
+    if (other.spans.size() == 0) {
+      return;
+    }
+
+    const CoordSpan &first = other.spans[0];
+    appendSpan(first.y, first.x0, first.x1);
+
+    spans.insert(spans.end(), other.spans.begin() + 1, other.spans.end());
+    numCoords += other.numCoords - (first.x1 - first.x0 + 1);
+
+    minX = min(minX, other.minX);
+    minY = min(minY, other.minY);
+    maxX = max(maxX, other.maxX);
+    maxY = max(maxY, other.maxY);
+  }
+
+  void clear() {
+    spans.clear();
+    numCoords = 0;
+    resetBbox();
+  }
+
+  // Release the span storage as well as clearing
+
+  void release() {
+    vector<CoordSpan>().swap(spans);
+    numCoords = 0;
+    resetBbox();
+  }
+
+  void reserveSpans(size_t n) {
+    spans.reserve(n);
+  }
+
+  // Write access for code that fills a known number of spans directly, call
+  // recount() once all the spans have been written to update the count and bbox.
+
+  void resizeSpans(size_t n) {
+    spans.resize(n);
+  }
+
+  CoordSpan& spanAt(size_t i) {
+    return spans[i];
+  }
+
+  void recount() {
+    numCoords = 0;
+    resetBbox();
+    for ( const CoordSpan &span : spans ) {
+      numCoords += span.x1 - span.x0 + 1;
+      addToBbox(span);
+    }
+  }
+
+  // Copy of all the coords for legacy code that needs a vector
+
+  vector<Coord> toVector() const {
+    vector<Coord> coords;
+    coords.reserve(numCoords);
+    for ( const CoordSpan &span : spans ) {
+      for ( int32_t x = span.x0; x <= span.x1; x++ ) {
+        coords.push_back(Coord((uint16_t) x, span.y));
+      }
+    }
+    return coords;
+  }
+
+private:
+  vector<CoordSpan> spans;
+  size_t numCoords;
+
+  uint16_t minX;
+  uint16_t minY;
+  uint16_t maxX;
+  uint16_t maxY;
+
+  void resetBbox() {
+    minX = 0xFFFF;
+    minY = 0xFFFF;
+    maxX = 0;
+    maxY = 0;
+  }
+
+  void addToBbox(const CoordSpan &span) {
+    minX = min(minX, span.x0);
+    minY = min(minY, span.y);
+    maxX = max(maxX, span.x1);
+    maxY = max(maxY, span.y);
+  }
+};
+
+#endif /* defined(__Superpixel__CoordSpans__) */
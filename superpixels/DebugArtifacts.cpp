@@ -0,0 +1,249 @@
+// Debug image categories and the background writer thread
+
+#include "DebugArtifacts.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+
+// Max number of images waiting to be written
+
+static const size_t debugArtifactMaxQueued = 8;
+
+static const char *debugArtifactNames[DebugArtifactNumCategories] = {
+  "srm",
+  "blocks",
+  "capture",
+  "insideoutside",
+  "shape",
+  "merge"
+};
+
+static atomic<unsigned int> debugArtifactEnabledBits(0);
+
+// Each thread has its own output directory, stored as a string pointer
+
+static pthread_key_t debugArtifactDirectoryKey;
+static pthread_once_t debugArtifactDirectoryKeyOnce = PTHREAD_ONCE_INIT;
+
+static void debugArtifactDirectoryDestructor(void *ptr)
+{
+  delete (string *) ptr;
+}
+
+static void debugArtifactDirectoryKeyInit()
+{
+  pthread_key_create(&debugArtifactDirectoryKey, debugArtifactDirectoryDestructor);
+}
+
+typedef struct {
+  string filename;
+  Mat mat;
+} DebugArtifact;
+
+// The writer thread is started by the first write and joined at exit
+
+class DebugArtifactWriter {
+public:
+  DebugArtifactWriter()
+  : numWriting(0), exiting(false)
+  {
+  }
+
+  ~DebugArtifactWriter()
+  {
+    {
+      unique_lock<mutex> lock(queueLock);
+      exiting = true;
+    }
+    queueCond.notify_all();
+
+    if (writerThread.joinable()) {
+      writerThread.join();
+    }
+  }
+
+  void push(const string &filename, const Mat &mat) {
+    unique_lock<mutex> lock(queueLock);
+
+    if (!writerThread.joinable()) {
+      writerThread = thread(&DebugArtifactWriter::run, this);
+    }
+
+    while (queue.size() >= debugArtifactMaxQueued) {
+      doneCond.wait(lock);
+    }
+
+    DebugArtifact artifact;
+    artifact.filename = filename;
+    artifact.mat = mat.clone();
+    queue.push_back(artifact);
+
+    queueCond.notify_one();
+  }
+
+  void flush() {
+    unique_lock<mutex> lock(queueLock);
+
+    while (queue.size() > 0 || numWriting > 0) {
+      doneCond.wait(lock);
+    }
+  }
+
+private:
+  thread writerThread;
+  mutex queueLock;
+  condition_variable queueCond;
+  condition_variable doneCond;
+  deque<DebugArtifact> queue;
+  int numWriting;
+  bool exiting;
+
+  void run() {
+    unique_lock<mutex> lock(queueLock);
+
+    while (1) {
+      while (queue.size() == 0 && !exiting) {
+        queueCond.wait(lock);
+      }
+
+      if (queue.size() == 0) {
+        break;
+      }
+
+      DebugArtifact artifact = queue.front();
+      queue.pop_front();
+      numWriting += 1;
+
+      lock.unlock();
+      imwrite(artifact.filename, artifact.mat);
+      lock.lock();
+
+      numWriting -= 1;
+      doneCond.notify_all();
+    }
+  }
+};
+
+static DebugArtifactWriter debugArtifactWriter;
+
+bool debugArtifactEnabled(DebugArtifactCategory category)
+{
+  return (debugArtifactEnabledBits.load(memory_order_relaxed) & (1 << category)) != 0;
+}
+
+void debugArtifactSetEnabled(DebugArtifactCategory category, bool enabled)
+{
+  if (enabled) {
+    debugArtifactEnabledBits |= (1 << category);
+  } else {
+    debugArtifactEnabledBits &= ~(1 << category);
+  }
+}
+
+bool debugArtifactEnableNames(const char *names)
+{
+  if (names == NULL) {
+    return true;
+  }
+
+  string namesStr(names);
+  bool allKnown = true;
+  size_t start = 0;
+
+  while (start <= namesStr.size()) {
+    size_t end = namesStr.find(',', start);
+    if (end == string::npos) {
+      end = namesStr.size();
+    }
+
+    string name = namesStr.substr(start, end - start);
+    start = end + 1;
+
+    if (name.size() == 0) {
+      continue;
+    }
+
+    if (name == "all") {
+      for (int i = 0; i < DebugArtifactNumCategories; i++) {
+        debugArtifactSetEnabled((DebugArtifactCategory) i, true);
+      }
+      continue;
+    }
+
+    bool found = false;
+
+    for (int i = 0; i < DebugArtifactNumCategories; i++) {
+      if (name == debugArtifactNames[i]) {
+        debugArtifactSetEnabled((DebugArtifactCategory) i, true);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      cerr << "unknown debug artifact category \"" << name << "\"" << endl;
+      allKnown = false;
+    }
+  }
+
+  return allKnown;
+}
+
+void debugArtifactSetDirectory(const string &dirname)
+{
+  pthread_once(&debugArtifactDirectoryKeyOnce, debugArtifactDirectoryKeyInit);
+
+  string *dirPtr = (string *) pthread_getspecific(debugArtifactDirectoryKey);
+
+  if (dirPtr == NULL) {
+    dirPtr = new string();
+    pthread_setspecific(debugArtifactDirectoryKey, dirPtr);
+  }
+
+  *dirPtr = dirname;
+}
+
+string debugArtifactDirectory()
+{
+  pthread_once(&debugArtifactDirectoryKeyOnce, debugArtifactDirectoryKeyInit);
+
+  string *dirPtr = (string *) pthread_getspecific(debugArtifactDirectoryKey);
+
+  if (dirPtr == NULL) {
+    return "";
+  }
+
+  return *dirPtr;
+}
+
+string debugArtifactPath(const string &filename)
+{
+  string dirname = debugArtifactDirectory();
+
+  if (dirname.size() == 0 || filename[0] == '/') {
+    return filename;
+  } else {
+    return dirname + "/" + filename;
+  }
+}
+
+void debugArtifactWrite(DebugArtifactCategory category, const string &filename, const Mat &mat)
+{
+  if (!debugArtifactEnabled(category)) {
+    return;
+  }
+
+  debugArtifactWriter.push(debugArtifactPath(filename), mat);
+}
+
+void debugArtifactFlush()
+{
+  debugArtifactWriter.flush();
+}
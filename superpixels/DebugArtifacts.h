@@ -0,0 +1,64 @@
+// Debug images are grouped into categories that are enabled at runtime. Code that
+// renders a debug image checks debugArtifactEnabled() first so that nothing is
+// allocated or drawn when the category is off. Enabled images are encoded and
+// written by a background thread so that debug runs do not block on imwrite().
+
+#ifndef DEBUG_ARTIFACTS_H
+#define	DEBUG_ARTIFACTS_H
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+typedef enum {
+  // SRM segmentation and quant tables
+  DebugArtifactSRM = 0,
+  // Block histograms and morphed block regions
+  DebugArtifactBlocks,
+  // Region capture, cluster estimates and contract or expand steps
+  DebugArtifactCapture,
+  // Inside or outside tests and flood fills
+  DebugArtifactInsideOutside,
+  // Contours, hulls, normals and shape scans
+  DebugArtifactShape,
+  // Merged tag images written by the main loop
+  DebugArtifactMerge,
+  DebugArtifactNumCategories
+} DebugArtifactCategory;
+
+// Returns true when images in category should be rendered and written
+
+bool debugArtifactEnabled(DebugArtifactCategory category);
+
+void debugArtifactSetEnabled(DebugArtifactCategory category, bool enabled);
+
+// Enable the categories named in a comma separated list, "all" enables every
+// category and NULL or "" leaves all categories disabled. Returns false when a
+// name is not known.
+
+bool debugArtifactEnableNames(const char *names);
+
+// Queue mat to be written to filename if category is enabled. The mat is copied
+// so the caller can modify it after this returns. When the queue is full this
+// waits for the writer thread, so memory used by pending images is bounded.
+
+void debugArtifactWrite(DebugArtifactCategory category, const std::string &filename, const cv::Mat &mat);
+
+// Set the directory that images written by the calling thread are placed in,
+// the default "" means the current directory. Threads that do work for another
+// thread should copy its directory with debugArtifactDirectory().
+
+void debugArtifactSetDirectory(const std::string &dirname);
+
+std::string debugArtifactDirectory();
+
+// Path of filename in the calling thread's directory, used for debug output
+// that is not an image.
+
+std::string debugArtifactPath(const std::string &filename);
+
+// Wait until all queued images have been written
+
+void debugArtifactFlush();
+
+#endif // DEBUG_ARTIFACTS_H
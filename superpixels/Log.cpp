@@ -0,0 +1,201 @@
+// Per module log levels and per thread output buffers
+
+#include "Log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// A thread buffer is written once it holds this many bytes
+
+static const size_t logBufferFlushSize = 64 * 1024;
+
+static const char *logModuleNames[LogModuleNumModules] = {
+  "srm",
+  "containment",
+  "merge",
+  "capture",
+  "insideoutside",
+  "server"
+};
+
+static const char *logLevelNames[] = {
+  "error",
+  "warn",
+  "info",
+  "debug",
+  "trace"
+};
+
+uint8_t logModuleLevels[LogModuleNumModules] = {
+  LogLevelInfo,
+  LogLevelInfo,
+  LogLevelInfo,
+  LogLevelInfo,
+  LogLevelInfo,
+  LogLevelInfo
+};
+
+// Serializes writes from different thread buffers so that lines are not split
+
+static mutex logWriteLock;
+
+static pthread_key_t logBufferKey;
+static pthread_once_t logBufferKeyOnce = PTHREAD_ONCE_INIT;
+
+static void logWrite(string &buffer)
+{
+  if (buffer.size() == 0) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(logWriteLock);
+    cout << flush;
+    fwrite(buffer.data(), 1, buffer.size(), stdout);
+    fflush(stdout);
+  }
+
+  buffer.clear();
+}
+
+static void logBufferDestructor(void *ptr)
+{
+  string *buffer = (string *) ptr;
+  logWrite(*buffer);
+  delete buffer;
+}
+
+// The main thread does not run key destructors, flush its buffer at exit
+
+static void logFlushAtExit()
+{
+  logFlush();
+}
+
+static void logBufferKeyInit()
+{
+  pthread_key_create(&logBufferKey, logBufferDestructor);
+  atexit(logFlushAtExit);
+}
+
+static string& logBuffer()
+{
+  pthread_once(&logBufferKeyOnce, logBufferKeyInit);
+
+  string *buffer = (string *) pthread_getspecific(logBufferKey);
+
+  if (buffer == NULL) {
+    buffer = new string();
+    buffer->reserve(logBufferFlushSize);
+    pthread_setspecific(logBufferKey, buffer);
+  }
+
+  return *buffer;
+}
+
+static void logAppend(const char *str, size_t len)
+{
+  string &buffer = logBuffer();
+  buffer.append(str, len);
+
+  if (buffer.size() >= logBufferFlushSize) {
+    logWrite(buffer);
+  }
+}
+
+void logSetLevel(LogModule module, LogLevel level)
+{
+  logModuleLevels[module] = (uint8_t) level;
+}
+
+bool logSetLevels(const char *levels)
+{
+  if (levels == NULL) {
+    return true;
+  }
+
+  string levelsStr(levels);
+  bool allKnown = true;
+  size_t start = 0;
+
+  while (start <= levelsStr.size()) {
+    size_t end = levelsStr.find(',', start);
+    if (end == string::npos) {
+      end = levelsStr.size();
+    }
+
+    string entry = levelsStr.substr(start, end - start);
+    start = end + 1;
+
+    if (entry.size() == 0) {
+      continue;
+    }
+
+    size_t equals = entry.find('=');
+    string moduleName = entry.substr(0, equals);
+    string levelName = (equals == string::npos) ? "" : entry.substr(equals + 1);
+
+    int level = -1;
+
+    for (int i = 0; i <= LogLevelTrace; i++) {
+      if (levelName == logLevelNames[i]) {
+        level = i;
+      }
+    }
+
+    bool found = false;
+
+    for (int i = 0; i < LogModuleNumModules && level != -1; i++) {
+      if (moduleName == "all" || moduleName == logModuleNames[i]) {
+        logSetLevel((LogModule) i, (LogLevel) level);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      cerr << "unknown log level \"" << entry << "\"" << endl;
+      allKnown = false;
+    }
+  }
+
+  return allKnown;
+}
+
+void logPrintf(const char *format, ...)
+{
+  char buffer[1024];
+
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+
+  if (len < 0) {
+    return;
+  }
+  if (len >= (int) sizeof(buffer)) {
+    len = (int) sizeof(buffer) - 1;
+  }
+
+  logAppend(buffer, len);
+}
+
+void logFlush()
+{
+  logWrite(logBuffer());
+}
+
+LogLine::~LogLine()
+{
+  stream << '\n';
+  string str = stream.str();
+  logAppend(str.data(), str.size());
+}
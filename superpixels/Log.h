@@ -0,0 +1,75 @@
+// Leveled logging with a level for each module. Callers check logEnabled()
+// before formatting anything, so a disabled message costs one branch on a
+// byte that is only written at startup. Enabled messages are appended to a
+// buffer owned by the calling thread and written to stdout in large chunks.
+
+#ifndef LOG_H
+#define	LOG_H
+
+#include <sstream>
+#include <stdint.h>
+
+typedef enum {
+  LogLevelError = 0,
+  LogLevelWarn,
+  LogLevelInfo,
+  LogLevelDebug,
+  // Output for each neighbor, pixel or table entry in a loop
+  LogLevelTrace
+} LogLevel;
+
+typedef enum {
+  LogModuleSRM = 0,
+  LogModuleContainment,
+  LogModuleMerge,
+  LogModuleCapture,
+  LogModuleInsideOutside,
+  LogModuleServer,
+  LogModuleNumModules
+} LogModule;
+
+extern uint8_t logModuleLevels[LogModuleNumModules];
+
+static inline
+bool logEnabled(LogModule module, LogLevel level) {
+  return level <= logModuleLevels[module];
+}
+
+void logSetLevel(LogModule module, LogLevel level);
+
+// Parse a comma separated list like "merge=debug,containment=trace" where the
+// module "all" sets every module. Returns false when a name is not known.
+
+bool logSetLevels(const char *levels);
+
+// Append a printf style message to this thread's buffer, the caller must
+// check logEnabled() first.
+
+void logPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Write this thread's buffer to stdout. Buffers are also written when they
+// get large, when a thread exits and at process exit.
+
+void logFlush();
+
+// Stream one line into this thread's buffer, the newline is added when the
+// line is destroyed. Use via LOG() so that nothing is formatted when the
+// level is disabled.
+
+class LogLine {
+public:
+  ~LogLine();
+  
+  template <typename T>
+  LogLine& operator<<(const T &value) {
+    stream << value;
+    return *this;
+  }
+  
+private:
+  std::ostringstream stream;
+};
+
+#define LOG(module, level) if (!logEnabled(module, level)) ; else LogLine()
+
+#endif // LOG_H
@@ -0,0 +1,287 @@
+// Counting Mat allocator, process resident size and the memory stage table
+
+#include "MemoryStats.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+bool memoryStatsIsEnabled = false;
+
+bool memoryLowModeIsEnabled = false;
+
+static atomic<int64_t> memoryMatBytesNow(0);
+static atomic<int64_t> memoryMatBytesPeak(0);
+
+static void atomicMax(atomic<int64_t> &value, int64_t newValue)
+{
+  int64_t oldValue = value.load(memory_order_relaxed);
+
+  while (oldValue < newValue && !value.compare_exchange_weak(oldValue, newValue, memory_order_relaxed)) {
+  }
+}
+
+// Every stage that is active on any thread, each one keeps its own peak so
+// that stages on different threads do not reset each other's peak.
+
+static mutex memoryActiveStagesLock;
+static MemoryStage *memoryActiveStages = NULL;
+
+void memoryStagesUpdatePeak(int64_t bytes)
+{
+  lock_guard<mutex> lock(memoryActiveStagesLock);
+
+  for ( MemoryStage *stage = memoryActiveStages; stage != NULL; stage = stage->nextStage ) {
+    stage->peakBytes = max(stage->peakBytes, bytes);
+  }
+}
+
+static void memoryMatBytesAdd(int64_t delta)
+{
+  int64_t bytes = (memoryMatBytesNow += delta);
+
+  if (delta > 0) {
+    atomicMax(memoryMatBytesPeak, bytes);
+    memoryStagesUpdatePeak(bytes);
+  }
+}
+
+// Wraps the standard allocator. Buffers it allocates are given this allocator
+// as their current allocator so that they are released through it as well.
+// Buffers that wrap user data are not counted.
+
+class CountingMatAllocator : public MatAllocator {
+public:
+  CountingMatAllocator(MatAllocator *_stdAllocator)
+  : stdAllocator(_stdAllocator)
+  {
+  }
+
+  UMatData* allocate(int dims, const int* sizes, int type,
+                     void* data, size_t* step, int flags, UMatUsageFlags usageFlags) const {
+    UMatData *u = stdAllocator->allocate(dims, sizes, type, data, step, flags, usageFlags);
+
+    if (u != NULL) {
+      u->currAllocator = this;
+      u->prevAllocator = this;
+
+      if (!(u->flags & UMatData::USER_ALLOCATED)) {
+        memoryMatBytesAdd((int64_t) u->size);
+      }
+    }
+
+    return u;
+  }
+
+  bool allocate(UMatData* u, int accessFlags, UMatUsageFlags usageFlags) const {
+    return stdAllocator->allocate(u, accessFlags, usageFlags);
+  }
+
+  void deallocate(UMatData* u) const {
+    if (u == NULL) {
+      return;
+    }
+
+    if (!(u->flags & UMatData::USER_ALLOCATED)) {
+      memoryMatBytesAdd(-(int64_t) u->size);
+    }
+
+    stdAllocator->deallocate(u);
+  }
+
+private:
+  MatAllocator *stdAllocator;
+};
+
+typedef struct {
+  int64_t count;
+  int64_t maxPeakBytes;
+  int64_t maxGrowthBytes;
+  int64_t maxResidentBytes;
+} MemoryStageSummary;
+
+static mutex memoryStagesLock;
+static unordered_map<string, MemoryStageSummary> memoryStages;
+static vector<string> memoryStageOrder;
+
+static void memoryStatsWriteAtExit()
+{
+  memoryStatsWrite();
+}
+
+void memoryStatsEnable()
+{
+  if (memoryStatsIsEnabled) {
+    return;
+  }
+
+  // The allocator is never deleted since Mats can be released after exit
+
+  Mat::setDefaultAllocator(new CountingMatAllocator(Mat::getStdAllocator()));
+
+  memoryStatsIsEnabled = true;
+  atexit(memoryStatsWriteAtExit);
+}
+
+int64_t memoryMatBytes()
+{
+  return memoryMatBytesNow.load();
+}
+
+int64_t memoryMatPeakBytes()
+{
+  return memoryMatBytesPeak.load();
+}
+
+int64_t memoryResidentBytes()
+{
+#if defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+
+  return (int64_t) info.resident_size;
+#else
+  FILE *fp = fopen("/proc/self/statm", "r");
+
+  if (fp == NULL) {
+    return 0;
+  }
+
+  long long totalPages = 0;
+  long long residentPages = 0;
+
+  if (fscanf(fp, "%lld %lld", &totalPages, &residentPages) != 2) {
+    residentPages = 0;
+  }
+
+  fclose(fp);
+
+  return (int64_t) residentPages * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int64_t memoryPeakResidentBytes()
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  // ru_maxrss is in bytes on macOS and in kilobytes on Linux
+
+#if defined(__APPLE__)
+  return (int64_t) usage.ru_maxrss;
+#else
+  return (int64_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+void memorySetLowMode(bool enabled)
+{
+  memoryLowModeIsEnabled = enabled;
+}
+
+// A stage starts its peak at the current size and is in the active list
+// until it ends, enclosing stages are in the list too so they see the same
+// allocations.
+
+void MemoryStage::begin()
+{
+  lock_guard<mutex> lock(memoryActiveStagesLock);
+
+  startBytes = memoryMatBytesNow.load();
+  peakBytes = startBytes;
+
+  prevStage = NULL;
+  nextStage = memoryActiveStages;
+  if (nextStage != NULL) {
+    nextStage->prevStage = this;
+  }
+  memoryActiveStages = this;
+}
+
+void MemoryStage::end()
+{
+  {
+    lock_guard<mutex> lock(memoryActiveStagesLock);
+
+    if (prevStage != NULL) {
+      prevStage->nextStage = nextStage;
+    } else {
+      memoryActiveStages = nextStage;
+    }
+    if (nextStage != NULL) {
+      nextStage->prevStage = prevStage;
+    }
+  }
+
+  int64_t residentBytes = memoryResidentBytes();
+
+  lock_guard<mutex> lock(memoryStagesLock);
+
+  auto it = memoryStages.find(name);
+
+  if (it == memoryStages.end()) {
+    MemoryStageSummary summary = { 0, 0, 0, 0 };
+    it = memoryStages.insert(make_pair(string(name), summary)).first;
+    memoryStageOrder.push_back(name);
+  }
+
+  MemoryStageSummary &summary = it->second;
+  summary.count += 1;
+  summary.maxPeakBytes = max(summary.maxPeakBytes, peakBytes);
+  summary.maxGrowthBytes = max(summary.maxGrowthBytes, peakBytes - startBytes);
+  summary.maxResidentBytes = max(summary.maxResidentBytes, residentBytes);
+}
+
+void memoryStatsWrite()
+{
+  if (!memoryStatsIsEnabled) {
+    return;
+  }
+
+  lock_guard<mutex> lock(memoryStagesLock);
+
+  const double MB = 1024.0 * 1024.0;
+
+  // Stages are listed in the order they first ended, so inner stages come
+  // before the stages that contain them.
+
+  fprintf(stderr, "%-32s %8s %12s %12s %12s\n", "stage", "count", "mat peak MB", "mat grow MB", "rss MB");
+
+  for ( const string &name : memoryStageOrder ) {
+    MemoryStageSummary &summary = memoryStages[name];
+    fprintf(stderr, "%-32s %8lld %12.1f %12.1f %12.1f\n",
+            name.c_str(),
+            (long long) summary.count,
+            summary.maxPeakBytes / MB,
+            summary.maxGrowthBytes / MB,
+            summary.maxResidentBytes / MB);
+  }
+
+  fprintf(stderr, "mat peak %.1f MB, process peak rss %.1f MB\n",
+          memoryMatPeakBytes() / MB,
+          memoryPeakResidentBytes() / MB);
+}
@@ -0,0 +1,105 @@
+// Memory accounting for Mat buffers and the process. When enabled every Mat
+// buffer is allocated through a counting allocator so that the bytes held by
+// Mats and their high water mark are known at any time. A memory stage records
+// the Mat high water mark while it is active and the process resident size when
+// it ends, at exit a table with the largest values seen for each stage is
+// printed. Stages measure the whole process, so stages that run at the same
+// time on different threads include each other's buffers.
+//
+// The low memory mode trades speed for a smaller peak, see memorySetLowMode().
+
+#ifndef MEMORY_STATS_H
+#define	MEMORY_STATS_H
+
+#include <stdint.h>
+
+extern bool memoryStatsIsEnabled;
+
+static inline
+bool memoryStatsEnabled() {
+  return memoryStatsIsEnabled;
+}
+
+// Install the counting Mat allocator and print the stage table at exit. Call
+// this before creating threads, Mats allocated before this are not counted.
+
+void memoryStatsEnable();
+
+// Bytes currently held by counted Mats and the most ever held at once
+
+int64_t memoryMatBytes();
+
+int64_t memoryMatPeakBytes();
+
+// Resident size of the process now and the most it has ever been, 0 if the
+// platform does not report it
+
+int64_t memoryResidentBytes();
+
+int64_t memoryPeakResidentBytes();
+
+// Print the stage table now, this is also done at exit
+
+void memoryStatsWrite();
+
+extern bool memoryLowModeIsEnabled;
+
+static inline
+bool memoryLowMode() {
+  return memoryLowModeIsEnabled;
+}
+
+// In low memory mode buffers that are kept between images for speed are
+// released after each use and region capture runs on one thread so that only
+// one set of ROI sized capture masks is held at a time.
+
+void memorySetLowMode(bool enabled);
+
+class MemoryStage {
+public:
+  // name must be a string literal
+
+  MemoryStage(const char *_name)
+  : name(_name), active(memoryStatsEnabled())
+  {
+    if (active) {
+      begin();
+    }
+  }
+
+  ~MemoryStage()
+  {
+    if (active) {
+      end();
+    }
+  }
+
+private:
+  const char *name;
+  bool active;
+  int64_t startBytes;
+
+  // High water mark since this stage began, updated for allocations on any
+  // thread while the stage is in the list of active stages
+
+  int64_t peakBytes;
+  MemoryStage *prevStage;
+  MemoryStage *nextStage;
+
+  friend void memoryStagesUpdatePeak(int64_t bytes);
+
+  void begin();
+  void end();
+
+  MemoryStage(const MemoryStage &);
+  MemoryStage& operator=(const MemoryStage &);
+};
+
+#define MEMORY_STAGE_CONCAT2(a, b) a ## b
+#define MEMORY_STAGE_CONCAT(a, b) MEMORY_STAGE_CONCAT2(a, b)
+
+// Measure from this line to the end of the enclosing scope
+
+#define MEMORY_STAGE(name) MemoryStage MEMORY_STAGE_CONCAT(memoryStage, __LINE__)(name)
+
+#endif // MEMORY_STATS_H
@@ -118,7 +118,15 @@ MergeSuperpixelImage::compareNeighborSuperpixels(Mat &inputImg,
     results.erase (results.begin(), results.end());
   }
   
-  for ( int32_t neighborTag : edgeTable.getNeighborsSet(tag) ) {
+  // When stats show that this superpixel is all one value then a neighbor that
+  // is all the same value has an identical histogram, so the compare is known
+  // to return 0.0 without reading any neighbor pixels.
+  
+  Superpixel *srcSpPtr = getSuperpixelPtr(tag);
+  
+  bool srcIsAllSame = hasStats() && srcSpPtr->statsAllSame();
+  
+  for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
     // Generate histogram for the neighbor and then compare to neighbor
     
     if (lockedTablePtr && (lockedTablePtr->count(neighborTag) != 0)) {
@@ -132,6 +140,17 @@ MergeSuperpixelImage::compareNeighborSuperpixels(Mat &inputImg,
       continue;
     }
     
+    if (srcIsAllSame) {
+      Superpixel *neighborSpPtr = getSuperpixelPtr(neighborTag);
+      
+      if (neighborSpPtr->statsAllSame() &&
+          memcmp(neighborSpPtr->stats.minValue, srcSpPtr->stats.minValue, sizeof(srcSpPtr->stats.minValue)) == 0) {
+        CompareNeighborTuple tuple = make_tuple(0.0, (int32_t) neighborSpPtr->coords.size(), neighborTag);
+        results.push_back(tuple);
+        continue;
+      }
+    }
+    
     Mat neighborSuperpixelMat;
     Mat neighborSuperpixelHist;
     Mat neighborBackProjection;
@@ -253,7 +272,7 @@ MergeSuperpixelImage::backprojectNeighborSuperpixels(SuperpixelImage &spImage,
   
   bool allNeighborsLocked = true;
   
-  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSpan(tag) ) {
     if (lockedTablePtr->count(neighborTag) != 0) {
       // Neighbor is locked
     } else {
@@ -332,7 +351,7 @@ MergeSuperpixelImage::backprojectNeighborSuperpixels(SuperpixelImage &spImage,
     spImage.reverseFillMatrixFromCoords(srcSuperpixelGreen, false, tag, srcSuperpixelBackProjection);
   }
   
-  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSpan(tag) ) {
     // Do back projection on neighbor pixels using histogram from biggest superpixel
     
     if (lockedTablePtr && (lockedTablePtr->count(neighborTag) != 0)) {
@@ -565,7 +584,7 @@ MergeSuperpixelImage::backprojectDepthFirstRecurseIntoNeighbors(Mat &inputImg,
   
   bool allNeighborsLocked = true;
   
-  for ( int32_t neighborTag : edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
     if (lockedTablePtr->count(neighborTag) != 0) {
       // Neighbor is locked
     } else {
@@ -646,7 +665,7 @@ MergeSuperpixelImage::backprojectDepthFirstRecurseIntoNeighbors(Mat &inputImg,
 
   // Table of superpixels already seen via DFS as compared to src superpixel.
   
-  unordered_map<int32_t, bool> seenTable;
+  SuperpixelSideArray<uint8_t> seenTable(superpixelArena, false);
   
   seenTable[tag] = true;
   
@@ -654,7 +673,7 @@ MergeSuperpixelImage::backprojectDepthFirstRecurseIntoNeighbors(Mat &inputImg,
   
   vector<int32_t> queue;
   
-  for ( int32_t neighborTag : edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
     queue.push_back(neighborTag);
     seenTable[neighborTag] = true;
   }
@@ -801,11 +820,11 @@ MergeSuperpixelImage::backprojectDepthFirstRecurseIntoNeighbors(Mat &inputImg,
         // Iterate over all neighbors of this neighbor and insert at the front of the queue
         
         if (debug) {
-          cout << "cheking " << edgeTable.getNeighborsSet(neighborTag).size()  << " possible neighbors for addition to DFS queue" << endl;
+          cout << "cheking " << edgeTable.getNeighborsSpan(neighborTag).size()  << " possible neighbors for addition to DFS queue" << endl;
         }
         
-        for ( int32_t neighborTag : edgeTable.getNeighborsSet(neighborTag) ) {
-          if (seenTable.count(neighborTag) == 0) {
+        for ( int32_t neighborTag : edgeTable.getNeighborsSpan(neighborTag) ) {
+          if (!seenTable[neighborTag]) {
             seenTable[neighborTag] = true;
             
             if (debug) {
@@ -938,6 +957,13 @@ void MergeSuperpixelImage::mergeAlikeSuperpixels(Mat &inputImg)
   unordered_map<int32_t, bool> locked;
   unordered_map<int32_t, vector<float>> histWeights;
   
+  // compareNeighborSuperpixels() uses the stats to skip the histogram of a
+  // neighbor with the same uniform color
+  
+  if (!hasStats()) {
+    computeStats(inputImg);
+  }
+  
   while (!allLocked) {
     
     int maxThisIter = -1;
@@ -2444,7 +2470,7 @@ void MergeSuperpixelImage::filterOutVeryLargeNeighbors(int32_t tag, vector<int32
 
   vector<CompareNeighborTuple> tuples;
   
-  for ( int32_t neighborTag : edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
     Superpixel *spPtr = getSuperpixelPtr(neighborTag);
     assert(spPtr);
     
@@ -2587,6 +2613,12 @@ int MergeSuperpixelImage::mergeSmallSuperpixels(Mat &inputImg, int colorspace, i
   
   int mergeStep = startStep;
   
+  // Stats for compareNeighborSuperpixels(), see mergeAlikeSuperpixels()
+  
+  if (!hasStats()) {
+    computeStats(inputImg);
+  }
+  
   vector<int32_t> smallSuperpixels;
   
   // First, scan for very small superpixels and treat them as edges automatically so that
@@ -2801,7 +2833,7 @@ int MergeSuperpixelImage::mergeEdgySuperpixels(Mat &inputImg, int colorspace, in
       continue;
     }
     
-    set<int32_t> &neighbors = edgeTable.getNeighborsSet(tag);
+    SuperpixelNeighbors neighbors = edgeTable.getNeighborsSpan(tag);
     
     // FIXME: might be better to remove this contained in one superpixel check.
     
@@ -2970,7 +3002,7 @@ int MergeSuperpixelImage::mergeEdgySuperpixels(Mat &inputImg, int colorspace, in
     
     unordered_map<int32_t, bool> lockedNeighbors;
     
-    for ( int32_t neighborTag : edgeTable.getNeighborsSet(tag) ) {
+    for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
       if (edgySuperpixelsTable.count(neighborTag) == 0) {
         // Not an edgy superpixel
         lockedNeighbors[neighborTag] = true;
@@ -68,7 +68,7 @@ void appendCoordsInRangeOnContour(int startIdx,
 
 void findContourOutline(const cv::Mat &binMat, vector<Point2i> &contour, bool simplify) {
   const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
     cout << "findContourOutline" << endl;
@@ -284,7 +284,7 @@ clockwiseScanOfHullCoords(
                           const vector<Coord> &regionCoords)
 {
   const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
     cout << "clockwiseScanOfHullCoords " << tag << endl;
@@ -305,7 +305,7 @@ clockwiseScanOfHullCoords(
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_contour_detect" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -368,7 +368,7 @@ clockwiseScanOfHullContour(CvSize size,
                            const vector<Point2i> &contour)
 {
   const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
 
   vector<vector<Point2i> > contours;
   
@@ -387,7 +387,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_contour" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -431,7 +431,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_contour_order" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -525,7 +525,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defectpoints" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -535,7 +535,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_render" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, colorMat);
+    debugArtifactWrite(DebugArtifactShape, fname, colorMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -611,7 +611,7 @@ clockwiseScanOfHullContour(CvSize size,
       fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_" << cDefIt << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, colorMat2);
+      debugArtifactWrite(DebugArtifactShape, fname, colorMat2);
       cout << "wrote " << fname << endl;
       cout << "" << endl;
     }
@@ -736,7 +736,7 @@ clockwiseScanOfHullContour(CvSize size,
       fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_" << cDefIt << "_angle_" << angleBetweenStartAndDefectDegrees << "_and_" << angleBetweenEndAndDefectDegrees << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, colorMat2);
+      debugArtifactWrite(DebugArtifactShape, fname, colorMat2);
       cout << "wrote " << fname << endl;
       cout << "" << endl;
     }
@@ -807,7 +807,7 @@ clockwiseScanOfHullContour(CvSize size,
         fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_" << cDefIt << "_only_line" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, roiMat);
+        debugArtifactWrite(DebugArtifactShape, fname, roiMat);
         cout << "wrote " << fname << endl;
         cout << "" << endl;
       }
@@ -876,7 +876,7 @@ clockwiseScanOfHullContour(CvSize size,
         fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_" << cDefIt << "_not_on_line" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, binMat2);
+        debugArtifactWrite(DebugArtifactShape, fname, binMat2);
         cout << "wrote " << fname << endl;
         cout << "" << endl;
       }
@@ -902,7 +902,7 @@ clockwiseScanOfHullContour(CvSize size,
         fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_defect_" << cDefIt << "_combined_line_defect" << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, colorMat);
+        debugArtifactWrite(DebugArtifactShape, fname, colorMat);
         cout << "wrote " << fname << endl;
         cout << "" << endl;
       }
@@ -1242,7 +1242,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_type" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1272,7 +1272,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_segments" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, colorMat);
+    debugArtifactWrite(DebugArtifactShape, fname, colorMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1296,7 +1296,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_lines_segments" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, colorMat);
+    debugArtifactWrite(DebugArtifactShape, fname, colorMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1421,7 +1421,7 @@ clockwiseScanOfHullContour(CvSize size,
         fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_lines_segment_" << i << "_angle_" << angleDeg << (mergeLineSegments ? "_merged" : "_notmerged" ) << ".png";
         string fname = fnameStream.str();
         
-        imwrite(fname, colorMat);
+        debugArtifactWrite(DebugArtifactShape, fname, colorMat);
         cout << "wrote " << fname << endl;
         cout << "" << endl;
       }
@@ -1514,7 +1514,7 @@ clockwiseScanOfHullContour(CvSize size,
     fnameStream << HULL_DUMP_IMAGE_PREFIX << tag << "_hull_lines_combined_segments" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, colorMat);
+    debugArtifactWrite(DebugArtifactShape, fname, colorMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1542,7 +1542,7 @@ vector<HullLineOrCurveSegment>
 splitContourIntoLinesSegments(int32_t tag, CvSize size, CvRect roi, const vector<Point2i> &contour, double epsilon)
 {
   const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
   if (debug) {
     cout << "splitContourIntoLinesSegments" << endl;
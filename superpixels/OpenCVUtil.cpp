@@ -8,6 +8,8 @@
 
 #include "OpenCVIter.hpp"
 
+#include "Log.h"
+
 // Print SSIM for two images to cout
 
 int printSSIM(Mat inImage1, Mat inImage2)
@@ -204,7 +206,7 @@ int printSSIM(Mat inImage1, Mat inImage2)
 Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
 {
   const bool debug = true;
-  const bool debugDumpAllImages = true;
+  const bool debugDumpAllImages = debugArtifactEnabled(DebugArtifactShape);
   
   assert(binMat.channels() == 1);
   
@@ -247,7 +249,7 @@ Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
     const char *filename = str.c_str();
     
     cout << "write " << filename << " ( " << regionMat.cols << " x " << regionMat.rows << " )" << endl;
-    imwrite(filename, regionMat);
+    debugArtifactWrite(DebugArtifactShape, filename, regionMat);
   }
   
   // Run distance transform
@@ -293,7 +295,7 @@ Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
     const char *filename = str.c_str();
     
     cout << "write " << filename << " ( " << distMat.cols << " x " << distMat.rows << " )" << endl;
-    imwrite(filename, distMat);
+    debugArtifactWrite(DebugArtifactShape, filename, distMat);
   }
   
   // Check the distance transform matrix here, the number of non-zero values must
@@ -342,7 +344,7 @@ Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
     const char *filename = str.c_str();
     
     cout << "write " << filename << " ( " << distMat.cols << " x " << distMat.rows << " )" << endl;
-    imwrite(filename, distMat);
+    debugArtifactWrite(DebugArtifactShape, filename, distMat);
   }
   
   // Threshold so that only those pixels with the value 255 are left and save into regionMat
@@ -358,7 +360,7 @@ Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
     const char *filename = str.c_str();
     
     cout << "write " << filename << " ( " << regionMat.cols << " x " << regionMat.rows << " )" << endl;
-    imwrite(filename, regionMat);
+    debugArtifactWrite(DebugArtifactShape, filename, regionMat);
   }
   
   // If the distance transform returns more than 1 pixel with the maximum
@@ -590,7 +592,7 @@ Coord findRegionCenter(Mat &binMat, cv::Rect roi, Mat &outDistMat, int tag)
     const char *filename = str.c_str();
     
     cout << "write " << filename << " ( " << colorMat.cols << " x " << colorMat.rows << " )" << endl;
-    imwrite(filename, colorMat);
+    debugArtifactWrite(DebugArtifactShape, filename, colorMat);
   }
   
   // Copy the dist values back into distMat taking the border into account
@@ -666,36 +668,33 @@ Mat decreaseWhiteInRegion(const Mat &binMat, int decreaseNumPixelsSize, int tag)
 // quickly morphed with minimal CPU and memory usage.
 
 Mat expandBlockRegion(int32_t tag,
-                      const vector<Coord> &coords,
+                      const CoordSpans &coords,
                       int expandNum,
                       int blockWidth, int blockHeight,
                       int superpixelDim)
 {
   const bool debug = false;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactBlocks);
   
   Mat morphBlockMat = Mat(blockHeight, blockWidth, CV_8UC1);
   morphBlockMat = (Scalar) 0;
   
-  // Iterate over input coords and calcualte block coord to activate
-  
-//  int lastOffset = -1;
+  // Iterate over input row spans and activate the range of blocks each span covers
   
-  for ( Coord c : coords ) {
+  for ( const CoordSpan &span : coords.getSpans() ) {
     // Convert (X,Y) to block (X,Y)
     
-    int blockX = c.x / superpixelDim;
-    int blockY = c.y / superpixelDim;
+    int blockY = span.y / superpixelDim;
+    int minBlockX = span.x0 / superpixelDim;
+    int maxBlockX = span.x1 / superpixelDim;
     
     if (debug) {
-      cout << "block with tag " << tag << " cooresponds to (X,Y) (" << c.x << "," << c.y << ")" << endl;
-      cout << "maps to block (X,Y) (" << blockX << "," << blockY << ")" << endl;
+      cout << "block with tag " << tag << " cooresponds to span (" << span.x0 << "," << span.x1 << ") at Y " << span.y << endl;
+      cout << "maps to blocks (" << minBlockX << "," << maxBlockX << ") at block Y " << blockY << endl;
     }
     
-    // FIXME: optimize for case where (X,Y) is exactly the same as in the previous iteration and avoid
-    // writing to the Mat in that case. This shift is cheap.
-    
-    morphBlockMat.at<uint8_t>(blockY, blockX) = 0xFF;
+    uint8_t *blockRowPtr = morphBlockMat.ptr<uint8_t>(blockY);
+    memset(blockRowPtr + minBlockX, 0xFF, maxBlockX - minBlockX + 1);
   }
   
   Mat expandedBlockMat;
@@ -721,7 +720,7 @@ Mat expandBlockRegion(int32_t tag,
       fnameStream << "srm" << "_tag_" << tag << "_morph_block_" << expandStep << ".png";
       string fname = fnameStream.str();
       
-      imwrite(fname, expandedBlockMat);
+      debugArtifactWrite(DebugArtifactBlocks, fname, expandedBlockMat);
       cout << "wrote " << fname << endl;
     }
     
@@ -1293,18 +1292,15 @@ vector<Point2f> generateFloatPointsOnLine(const Point2f & startP, const Point2f
 
 int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int connectivity)
 {
-  const bool debug = true;
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactInsideOutside);
   
   assert(inBinMask.size() == outBinMask.size());
   assert(connectivity == 4 || connectivity == 8);
   
-  if (debug) {
-    cout << "input dimensions " << inBinMask.cols << " x " << inBinMask.rows << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "input dimensions " << inBinMask.cols << " x " << inBinMask.rows;
   
   if (debugDumpImages) {
-    imwrite("flood_bin_mask_input.png", inBinMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_bin_mask_input.png", inBinMask);
   }
   
   Mat expandedMask(inBinMask.rows+2, inBinMask.cols+2, CV_8UC1);
@@ -1334,7 +1330,7 @@ int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int conne
   inBinMask.copyTo(croppedMask);
   
   if (debugDumpImages) {
-    imwrite("flood_bin_mask_input_with_border.png", expandedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_bin_mask_input_with_border.png", expandedMask);
   }
   
   Mat copyOfInBinMask = inBinMask.clone();
@@ -1348,9 +1344,7 @@ int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int conne
   seed.x = startPoint.x;
   seed.y = startPoint.y;
   
-  if (debug) {
-    cout << "seed (" << seed.x << "," << seed.y << ") " << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "seed (" << seed.x << "," << seed.y << ") ";
   
   // Verify that the seed point is a non-zero value in mask taking
   // into account the (+1, +1) ROI delta
@@ -1359,9 +1353,7 @@ int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int conne
     int maskX = maskROI.x + seed.x;
     int maskY = maskROI.y + seed.y;
     
-    if (debug) {
-      cout << "seed in mask (" << maskX << "," << maskY << ") " << endl;
-    }
+    LOG(LogModuleCapture, LogLevelDebug) << "seed in mask (" << maskX << "," << maskY << ") ";
     
     uint8_t bVal = expandedMask.at<uint8_t>(maskY, maskX);
     assert(bVal != 0);
@@ -1372,24 +1364,22 @@ int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int conne
   }
 
   if (debugDumpImages) {
-    imwrite("flood_fill_input.png", inBinMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_fill_input.png", inBinMask);
   }
   
   if (debugDumpImages) {
-    imwrite("flood_fill_mask_expanded_input.png", expandedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_fill_mask_expanded_input.png", expandedMask);
   }
   
   int numFilled = floodFill(inBinMask, expandedMask, seed, maskFillColor, &filledRect, scalarZero, scalarZero, flags);
 
-  if (debug) {
-    cout << "numFilled " << numFilled << endl;
-    cout << "flood fill bbox (" << filledRect.x << "," << filledRect.y << ") " << filledRect.width << " x " << filledRect.height << endl;
-  }
+  LOG(LogModuleCapture, LogLevelDebug) << "numFilled " << numFilled;
+  LOG(LogModuleCapture, LogLevelDebug) << "flood fill bbox (" << filledRect.x << "," << filledRect.y << ") " << filledRect.width << " x " << filledRect.height;
   
   if (debugDumpImages) {
-    imwrite("flood_fill_output.png", inBinMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_fill_output.png", inBinMask);
     
-    imwrite("flood_fill_mask_expanded_output.png", expandedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_fill_mask_expanded_output.png", expandedMask);
   }
   
   // Fill must have at least filled 1 pixel
@@ -1417,14 +1407,14 @@ int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int conne
   croppedMask.at<uint8_t>(seed.y, seed.x) = 0xFF;
   
   if (debugDumpImages) {
-    imwrite("flood_mask_output.png", expandedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_mask_output.png", expandedMask);
   }
   
   // The filledRect identified pixels are now in terms of the cropped mask image
   
   if (debugDumpImages) {
-    imwrite("flood_mask_not_cropped.png", expandedMask);
-    imwrite("flood_mask_cropped.png", croppedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_mask_not_cropped.png", expandedMask);
+    debugArtifactWrite(DebugArtifactInsideOutside, "flood_mask_cropped.png", croppedMask);
   }
   
   outBinMask = Scalar(0);
@@ -1617,7 +1607,7 @@ void NormalizeLetter(Mat & inputarray, Mat & outputarray) {
 }
 
 void skelReduce(Mat &binMat) {
-  const bool debugDumpImages = true;
+  const bool debugDumpImages = debugArtifactEnabled(DebugArtifactShape);
   
 #if defined(DEBUG)
   assert(binMat.channels() == 1);
@@ -1632,7 +1622,7 @@ void skelReduce(Mat &binMat) {
     fnameStream << "skel_" << "input" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1688,7 +1678,7 @@ void skelReduce(Mat &binMat) {
     fnameStream << "skel_" << "output" << ".png";
     string fname = fnameStream.str();
     
-    imwrite(fname, binMat);
+    debugArtifactWrite(DebugArtifactShape, fname, binMat);
     cout << "wrote " << fname << endl;
     cout << "" << endl;
   }
@@ -1696,6 +1686,140 @@ void skelReduce(Mat &binMat) {
   return;
 }
 
+// Find the root of a provisional component label, with path halving
+
+static inline
+int32_t componentRoot(vector<int32_t> &parents, int32_t label) {
+  while (parents[label] != label) {
+    parents[label] = parents[parents[label]];
+    label = parents[label];
+  }
+  return label;
+}
+
+// Join two provisional component labels. The smaller label is always the root
+// so that the root of a component is the label of its first pixel.
+
+static inline
+int32_t componentUnion(vector<int32_t> &parents, int32_t label1, int32_t label2) {
+  label1 = componentRoot(parents, label1);
+  label2 = componentRoot(parents, label2);
+  
+  if (label1 < label2) {
+    parents[label2] = label1;
+    return label1;
+  } else {
+    parents[label1] = label2;
+    return label2;
+  }
+}
+
+template <typename T>
+static
+int connectedTagComponentsImpl(const Mat &tagsMat, Mat &labelsMat, int connectivity)
+{
+  const int width = tagsMat.cols;
+  const int height = tagsMat.rows;
+  
+  vector<int32_t> parents;
+  
+  // First pass, each pixel takes the label of an already scanned neighbor
+  // (L, UL, U, UR) with the same tag and any other such neighbor labels are
+  // recorded as equal.
+  
+  for ( int y = 0; y < height; y++ ) {
+    const T *tagsRow = tagsMat.ptr<T>(y);
+    const T *prevTagsRow = (y > 0) ? tagsMat.ptr<T>(y-1) : NULL;
+    int32_t *labelsRow = labelsMat.ptr<int32_t>(y);
+    const int32_t *prevLabelsRow = (y > 0) ? labelsMat.ptr<int32_t>(y-1) : NULL;
+    
+    for ( int x = 0; x < width; x++ ) {
+      const T tag = tagsRow[x];
+      int32_t label = -1;
+      
+      if (x > 0 && tagsRow[x-1] == tag) {
+        label = labelsRow[x-1];
+      }
+      
+      if (prevTagsRow != NULL) {
+        int32_t neighborLabels[3];
+        int numNeighborLabels = 0;
+        
+        if (prevTagsRow[x] == tag) {
+          neighborLabels[numNeighborLabels++] = prevLabelsRow[x];
+        }
+        
+        if (connectivity == 8) {
+          if (x > 0 && prevTagsRow[x-1] == tag) {
+            neighborLabels[numNeighborLabels++] = prevLabelsRow[x-1];
+          }
+          if (x+1 < width && prevTagsRow[x+1] == tag) {
+            neighborLabels[numNeighborLabels++] = prevLabelsRow[x+1];
+          }
+        }
+        
+        for ( int i = 0; i < numNeighborLabels; i++ ) {
+          if (label == -1) {
+            label = neighborLabels[i];
+          } else if (label != neighborLabels[i]) {
+            label = componentUnion(parents, label, neighborLabels[i]);
+          }
+        }
+      }
+      
+      if (label == -1) {
+        label = (int32_t) parents.size();
+        parents.push_back(label);
+      }
+      
+      labelsRow[x] = label;
+    }
+  }
+  
+  // Roots are the smallest label in a component, so walking the labels in
+  // order numbers the components in the order their first pixel was seen.
+  
+  const int32_t numProvisional = (int32_t) parents.size();
+  vector<int32_t> compact(numProvisional);
+  int32_t numLabels = 0;
+  
+  for ( int32_t i = 0; i < numProvisional; i++ ) {
+    int32_t root = componentRoot(parents, i);
+    if (root == i) {
+      compact[i] = numLabels++;
+    } else {
+      compact[i] = compact[root];
+    }
+  }
+  
+  // Second pass writes the final label for each pixel
+  
+  for ( int y = 0; y < height; y++ ) {
+    int32_t *labelsRow = labelsMat.ptr<int32_t>(y);
+    for ( int x = 0; x < width; x++ ) {
+      labelsRow[x] = compact[labelsRow[x]];
+    }
+  }
+  
+  return numLabels;
+}
+
+int connectedTagComponents(const Mat &tagsMat, Mat &labelsMat, int connectivity)
+{
+  assert(connectivity == 4 || connectivity == 8);
+  
+  labelsMat.create(tagsMat.size(), CV_32SC1);
+  
+  if (tagsMat.type() == CV_8UC3) {
+    return connectedTagComponentsImpl<Vec3b>(tagsMat, labelsMat, connectivity);
+  } else if (tagsMat.type() == CV_32SC1) {
+    return connectedTagComponentsImpl<int32_t>(tagsMat, labelsMat, connectivity);
+  } else {
+    assert(0);
+    return 0;
+  }
+}
+
 // Like cv::drawContours() except that this simplified method
 // renders just one contour.
 
@@ -1896,6 +2020,12 @@ bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height, const
   return;
 }
 
+void
+bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height, const CoordSpans &coords)
+{
+  coords.bbox(originX, originY, width, height);
+}
+
 // bbox with optional +-N around the bbox
 
 cv::Rect bboxPlusN(const vector<Coord> &coords, CvSize imgSize, int numPixels) {
@@ -10,6 +10,8 @@ using namespace std;
 using namespace cv;
 
 #include "Coord.h"
+#include "CoordSpans.h"
+#include "DebugArtifacts.h"
 
 // Convert a vector of 3 bytes into a signed 32bit integer.
 // The values range for a 3 byte tag is 0 -> 0x00FFFFFF and
@@ -155,7 +157,7 @@ Mat decreaseWhiteInRegion(const Mat &binMat, int decreaseNumPixelsSize, int tag)
 // quickly morphed with minimal CPU and memory usage.
 
 Mat expandBlockRegion(int32_t tag,
-                      const vector<Coord> &coords,
+                      const CoordSpans &coords,
                       int expandNum,
                       int blockWidth, int blockHeight,
                       int superpixelDim);
@@ -239,6 +241,14 @@ vector<Point2i> filterPointsOutsideROI(const vector<Point2i> &points, CvRect roi
 
 int floodFillMask(Mat &inBinMask, Mat &outBinMask, Point2i startPoint, int connectivity);
 
+// Label connected components in a CV_8UC3 or CV_32SC1 tags image with a two pass
+// union-find scan. Pixels are in the same component when they have the same tag and
+// are 4 or 8 connected, so a tag used by disconnected regions gets a label for each
+// region. Labels are written to the CV_32SC1 labelsMat and are consecutive from 0 in
+// the order first seen in a raster scan. Returns the number of labels.
+
+int connectedTagComponents(const Mat &tagsMat, Mat &labelsMat, int connectivity);
+
 // Like cv::drawContours() except that this simplified method
 // renders just one contour.
 
@@ -267,11 +277,14 @@ void drawLine(
               int thickness,
               int lineType );
 
-// Write image Mat and dump filename and dimensions to stdout
+// Queue a shape debug image Mat to be written and dump filename and dimensions to stdout
 
 static inline
 void writeWroteImg(string filename, cv::Mat mat) {
-  cv::imwrite(filename.c_str(), mat);
+  if (!debugArtifactEnabled(DebugArtifactShape)) {
+    return;
+  }
+  debugArtifactWrite(DebugArtifactShape, filename, mat);
   char buffer[1024];
   snprintf(buffer, sizeof(buffer), "wrote %s : %d x %d\n", filename.c_str(), mat.cols, mat.rows);
   std::cout << buffer << endl;
@@ -359,6 +372,11 @@ void round(Point2f &p) {
 void
 bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height, const vector<Coord> &coords);
 
+// Calculate bbox from row spans, the spans keep their bbox up to date so this does not scan
+
+void
+bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height, const CoordSpans &coords);
+
 // bbox with optional +-N around the bbox
 
 cv::Rect bboxPlusN(const vector<Coord> &coords, CvSize imgSize, int numPixels);
@@ -16,6 +16,7 @@
 
 #include "OpenCVUtil.h"
 #include "OpenCVIter.hpp"
+#include "Log.h"
 
 using cv::Mat;
 using std::string;
@@ -31,9 +32,15 @@ using std::vector;
 class RegionRemerger {
 public:
   CvSize size;
-  Mat maskMat;
+  
   Mat mergeMat;
   
+  // 0xFF for each pixel that has already been assigned a tag in mergeMat.
+  // This mask is updated as each region is merged so that it never needs
+  // to be regenerated from mergeMat.
+  
+  Mat mergedMask;
+  
   // tag that should be used next. This tag increases in value
   // each time a new set of pixels is merged in.
   
@@ -46,99 +53,91 @@ public:
     mergeMat = _tagsImg.clone();
     mergeMat = Scalar(0,0,0);
     size = _tagsImg.size();
-    maskMat = Mat(size, CV_8UC1, Scalar(0));
+    mergedMask = Mat(size, CV_8UC1, Scalar(0));
   }
   
-  // Reset the state of maskMat to be 0xFF for each pixel that is non-zero in mergeMat
+  // Release the mask once no more regions will be merged, only mergeMat is
+  // needed after that.
   
-  void mergeMatToMask() {
-
-    for_each_byte_const_bgr(maskMat, mergeMat, [](uint8_t *maskBPtr, uint8_t B, uint8_t G, uint8_t R) {
-      if (B == 0 && G == 0 && R == 0) {
-        *maskBPtr = 0;
-      } else {
-        *maskBPtr = 0xFF;
-      }
-    });
-    
-    return;
+  void releaseMasks() {
+    mergedMask.release();
   }
-
-  // When maskMat is written then scan for non-zero values in maskMat and then generate a new
-  // tag and set each corresponding pixel in mergeMat.
   
-  void mergeFromMask() {
-    vector<Point> locations;
-    findNonZero(maskMat, locations);
+  // Scan for non-zero values in a mask the size of roi and then generate a new
+  // tag and set each corresponding pixel in mergeMat. The pixels written to
+  // mergeMat and mergedMask are limited to roi.
+  
+  void mergeFromMask(const Mat &roiMask, const cv::Rect &roi) {
+    assert(roiMask.rows == roi.height);
+    assert(roiMask.cols == roi.width);
     
-    assert(locations.size() > 0);
+    Vec3b mergedVec = PixelToVec3b(mergedTag);
     
-    Vec3b mergedVec = Vec3BToUID(mergedTag);
+    int numMerged = 0;
     
-    for ( Point p : locations ) {
-      int x = p.x;
-      int y = p.y;
-      
-      Vec3b vec = mergeMat.at<Vec3b>(y, x);
+    for ( int y = roi.y; y < (roi.y + roi.height); y++ ) {
+      const uint8_t *maskRowPtr = roiMask.ptr<uint8_t>(y - roi.y);
+      uint8_t *mergedRowPtr = mergedMask.ptr<uint8_t>(y);
+      Vec3b *mergeRowPtr = mergeMat.ptr<Vec3b>(y);
       
-      if (vec[0] == 0x0 && vec[1] == 0x0 && vec[2] == 0x0) {
-        // This pixel has not been seen before, define new merge tag value
-        
-        if (false) {
-          printf("set merge mat (%5d, %5d) = 0x%08X aka %d\n", x, y, mergedTag, mergedTag);
+      for ( int x = roi.x; x < (roi.x + roi.width); x++ ) {
+        if (maskRowPtr[x - roi.x] == 0) {
+          continue;
         }
         
-        mergeMat.at<Vec3b>(y, x) = mergedVec;
-      } else {
-        // A region must not attempt to include pixels from a previously merged region ever!
-        
-        uint32_t alreadySetTag = Vec3BToUID(vec);
+        if (mergedRowPtr[x] != 0) {
+          // A region must not attempt to include pixels from a previously merged region ever!
+          
+          uint32_t alreadySetTag = Vec3BToUID(mergeRowPtr[x]);
+          
+          printf("coord (%5d, %5d) = attempted remerge when tag already set to 0x%08X aka %d\n", x, y, alreadySetTag, alreadySetTag);
+          assert(0);
+        }
         
-        printf("coord (%5d, %5d) = attempted remerge when tag already set to 0x%08X aka %d\n", x, y, alreadySetTag, alreadySetTag);
-        assert(0);
+        mergeRowPtr[x] = mergedVec;
+        mergedRowPtr[x] = 0xFF;
+        numMerged += 1;
       }
-    } // foreach locations
+    }
+    
+    assert(numMerged > 0);
     
     // Update merge tag after setting all pixel values
     mergedTag += 1;
   }
   
-  // FIXME: no need to pass tagMat, simply merge using next uid
+  // Gather any remaining tags that have not been merged and add these as new
+  // sets of pixels. This is done in one raster pass, each unmerged srm tag is
+  // assigned the next merge tag the first time it is seen.
   
   void mergeLeftovers(const Mat &tagMat) {
-    // Gather any remaining tags that have not been merged
-    // and add these as new sets of pixels.
-    
-    unordered_map<uint32_t, vector<Coord>> mergeTagsToCoords;
+    unordered_map<uint32_t, int32_t> srmTagToMergeTag;
     
     for ( int y = 0; y < mergeMat.rows; y++ ) {
+      const Vec3b *tagRowPtr = tagMat.ptr<Vec3b>(y);
+      uint8_t *mergedRowPtr = mergedMask.ptr<uint8_t>(y);
+      Vec3b *mergeRowPtr = mergeMat.ptr<Vec3b>(y);
+      
       for ( int x = 0; x < mergeMat.cols; x++ ) {
-        Vec3b vec = mergeMat.at<Vec3b>(y, x);
-        
-        if (vec[0] == 0x0 && vec[1] == 0x0 && vec[2] == 0x0) {
-          vec = tagMat.at<Vec3b>(y, x);
-          uint32_t srmTag = Vec3BToUID(vec);
-          
-          vector<Coord> &vecRef = mergeTagsToCoords[srmTag];
-          vecRef.push_back(Coord(x, y));
+        if (mergedRowPtr[x] != 0) {
+          continue;
         }
-      }
-    }
-    
-    for ( auto & pair : mergeTagsToCoords ) {
-      vector<Coord> &vecRef = pair.second;
-      
-      for ( Coord c : vecRef ) {
-        Vec3b mergedVec = Vec3BToUID(mergedTag); // FIXME: do outside loop
-        mergeMat.at<Vec3b>(c.y, c.x) = mergedVec;
         
-        if (true) {
-          fprintf(stdout, "merge unmerged srm tag at (%5d, %5d) = 0X%08X\n", c.x, c.y, mergedTag);
+        uint32_t srmTag = Vec3BToUID(tagRowPtr[x]);
+        
+        auto it = srmTagToMergeTag.find(srmTag);
+        
+        if (it == srmTagToMergeTag.end()) {
+          it = srmTagToMergeTag.insert(std::make_pair(srmTag, mergedTag)).first;
+          mergedTag += 1;
         }
+        
+        mergeRowPtr[x] = PixelToVec3b(it->second);
+        mergedRowPtr[x] = 0xFF;
       }
-      
-      mergedTag += 1;
     }
+    
+    LOG(LogModuleMerge, LogLevelDebug) << "merged " << srmTagToMergeTag.size() << " unmerged srm tags";
 
     return;
   }
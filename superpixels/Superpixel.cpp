@@ -10,41 +10,16 @@
 #include "OpenCVUtil.h"
 
 Superpixel::Superpixel()
-:tag(0), assocDataPtr(NULL), flags(0)
+:tag(0), flags(0)
 {
-  ;
+  resetStats();
 }
 
 Superpixel::Superpixel(int32_t tag)
 {
   this->tag = tag;
-  this->assocDataPtr = NULL;
   this->flags = 0;
-}
-
-Superpixel::~Superpixel()
-{
-#if defined(ENABLE_SUPERPIXEL_ASSOC_DATA)
-  if (this->assocDataPtr) {
-    // Release any pointers inside this map assuming that each object
-    // has been allocated with delete.
-    
-    for ( auto iter = assocDataPtr->begin(); iter != assocDataPtr->end(); ++iter) {
-      //uint32_t key = iter->first;
-      void *valueObj = iter->second;
-      if (valueObj) {
-        // Note that this delete will release the memory but it should not
-        // be used with objects that require special destruction since the
-        // destrutor might not be called.
-        //delete [] valueObj;
-        ::operator delete(valueObj);
-      }
-    }
-    
-    delete assocDataPtr;
-    assocDataPtr = NULL;
-  }
-#endif // ENABLE_SUPERPIXEL_ASSOC_DATA
+  resetStats();
 }
 
 void Superpixel::appendCoord(int x, int y)
@@ -54,8 +29,7 @@ void Superpixel::appendCoord(int x, int y)
   assert(y >= 0);
 #endif // DEBUG
   
-  Coord coord(x, y);
-  coords.push_back(coord);
+  coords.appendSpan(y, x, x);
 }
 
 // Read RGB values from larger input image and create a matrix that is the width
@@ -110,6 +84,26 @@ void Superpixel::fillMatrixFromCoords(Mat &input, vector<Coord> &coords, Mat &ou
   }
 }
 
+// Gather pixels one span at a time, each span is a contiguous run of pixels in a row
+// of the input so it is copied with a single memcpy().
+
+void Superpixel::fillMatrixFromCoords(Mat &input, const CoordSpans &coords, Mat &output) {
+  int numCoords = (int) coords.size();
+  
+  assert(input.type() == CV_8UC3);
+  
+  output.create(1, numCoords, CV_8UC(3));
+  
+  Vec3b *outPtr = output.ptr<Vec3b>(0);
+  
+  for ( const CoordSpan &span : coords.getSpans() ) {
+    const Vec3b *inRowPtr = input.ptr<Vec3b>(span.y);
+    int numPixels = span.x1 - span.x0 + 1;
+    memcpy(outPtr, inRowPtr + span.x0, numPixels * sizeof(Vec3b));
+    outPtr += numPixels;
+  }
+}
+
 // This method is the inverse of fillMatrixFromCoords(), it reads pixel values from a matrix
 // and writes them back to the corresponding X,Y values location in an image. This method is
 // very useful when running an image operation on all the pixels in a superpixel but without
@@ -185,6 +179,49 @@ void Superpixel::reverseFillMatrixFromCoords(Mat &input, bool isGray, vector<Coo
   }
 }
 
+// Scatter pixels back to the output one span at a time
+
+void Superpixel::reverseFillMatrixFromCoords(Mat &input, bool isGray, const CoordSpans &coords, Mat &output) {
+  int numCoords = (int) coords.size();
+  
+  assert(input.rows == 1);
+  assert(input.cols == numCoords);
+  
+  int numChannels = output.channels();
+  bool writeGrayscale = (numChannels == 1);
+  
+  if (writeGrayscale) {
+    assert(isGray);
+  }
+  
+  int i = 0;
+  
+  for ( const CoordSpan &span : coords.getSpans() ) {
+    int numPixels = span.x1 - span.x0 + 1;
+    
+    if (isGray && writeGrayscale) {
+      memcpy(output.ptr<uint8_t>(span.y) + span.x0, input.ptr<uint8_t>(0) + i, numPixels);
+    } else if (isGray) {
+      const uint8_t *inPtr = input.ptr<uint8_t>(0) + i;
+      Vec3b *outRowPtr = output.ptr<Vec3b>(span.y) + span.x0;
+      for ( int j = 0; j < numPixels; j++ ) {
+        uint8_t gray = inPtr[j];
+        outRowPtr[j] = Vec3b(gray, gray, gray);
+      }
+    } else if (writeGrayscale) {
+      const Vec3b *inPtr = input.ptr<Vec3b>(0) + i;
+      uint8_t *outRowPtr = output.ptr<uint8_t>(span.y) + span.x0;
+      for ( int j = 0; j < numPixels; j++ ) {
+        outRowPtr[j] = inPtr[j][0];
+      }
+    } else {
+      memcpy(output.ptr<Vec3b>(span.y) + span.x0, input.ptr<Vec3b>(0) + i, numPixels * sizeof(Vec3b));
+    }
+    
+    i += numPixels;
+  }
+}
+
 // Find bounding box of a superpixel. This is the (X,Y) of the upper right corner and the width and height.
 
 void
@@ -457,264 +494,90 @@ Superpixel::filterEdgeCoords(Superpixel *superpixe1Ptr,
   return;
 }
 
-// This logic executes the heavy process of scanning the initial input tags to remove splay
-// pixels Seeds generated superpixels. This process is really just a workaround for what
-// appears to be a buggy edge case in the Seeds algo.
+// This logic scans a tags image to remove splay pixels, where one tag is used by
+// pixels that are not 8 connected. This was first a workaround for a buggy edge case
+// in the Seeds algo and is now needed for the leftover pieces of regions after a
+// remerge. A single connected components pass finds each connected region, the
+// first region seen for a tag keeps the tag and any other region gets a new tag.
+// Returns false and leaves the image unchanged when the new tags would not fit
+// below 0xFFFFFF, which parse() does not accept as a tag.
 
-void Superpixel::splitSplayPixels(Mat &inOutTagImg)
+bool Superpixel::splitSplayPixels(Mat &inOutTagImg)
 {
   const bool debug = false;
-
-  Mat mask(inOutTagImg.rows+2, inOutTagImg.cols+2, CV_8UC1);
-  Mat croppedMask(inOutTagImg.rows, inOutTagImg.cols, CV_8UC1);
-  
-  Rect filledRect;
-
-  Rect borderRect(0, 0, inOutTagImg.cols+2, inOutTagImg.rows+2);
-  Rect maskROI(1, 1, inOutTagImg.cols, inOutTagImg.rows);
-
-  Scalar scalarZero(0);
-  Scalar maskFillColor(255);
-  
-  int connectivity = 8;
   
-  int flags = connectivity | FLOODFILL_FIXED_RANGE | FLOODFILL_MASK_ONLY;
+  Mat componentLabels;
   
-  Point seed(0, 0);
+  int numComponents = connectedTagComponents(inOutTagImg, componentLabels, 8);
   
-  // Neighbor iter
-  
-  int32_t neighborOffsetsArr[] = {
-    -1, -1, // UL
-    0, -1, // U
-    1, -1, // UR
-    -1,  0, // L
-    1,  0, // R
-    -1,  1, // DL
-    0,  1, // D
-    1,  1  // DR
-  };
+  // Components are labeled in raster order, so the tag of each component is
+  // read from its first pixel as the labels appear in increasing order.
   
-  vector<pair<int32_t, int32_t> > neighborOffsets;
+  vector<int32_t> componentTags(numComponents);
+  int32_t nextComponent = 0;
+  int32_t maxTag = 0;
   
-  for (int i = 0; i < sizeof(neighborOffsetsArr)/sizeof(int32_t); i += 2) {
-    pair<int32_t,int32_t> p(neighborOffsetsArr[i], neighborOffsetsArr[i+1]);
-    neighborOffsets.push_back(p);
+  for( int y = 0; y < inOutTagImg.rows && nextComponent < numComponents; y++ ) {
+    const int32_t *labelsRow = componentLabels.ptr<int32_t>(y);
+    
+    for( int x = 0; x < inOutTagImg.cols; x++ ) {
+      if (labelsRow[x] == nextComponent) {
+        int32_t tag = Vec3BToUID(inOutTagImg.at<Vec3b>(y, x));
+        componentTags[nextComponent++] = tag;
+        if (tag > maxTag) {
+          maxTag = tag;
+        }
+      }
+    }
   }
   
-  assert(neighborOffsets.size() == 8);
-  
   // The seen table will contain an entry for each superpixel tag that has already been
-  // processed. When a new superpixel tag is seen, all neighbor pixels will be flood filled
-  // and as a result any duplicate pixels seen later on should have been processed by
-  // the flood fill.
+  // assigned to a component.
   
   unordered_map<int32_t,bool> seen;
+  vector<bool> retagged(numComponents, false);
+  bool anyRetagged = false;
+  
+  for ( int32_t label = 0; label < numComponents; label++ ) {
+    int32_t tag = componentTags[label];
+    
+    if (seen.count(tag) == 0) {
+      seen[tag] = true;
+      continue;
+    }
+    
+    maxTag += 1;
+    
+    if (maxTag >= 0x00FFFFFF) {
+      return false;
+    }
+    
+    if (debug) {
+      cout << "split component " << label << " with tag " << tag << " as tag " << maxTag << endl;
+    }
+    
+    componentTags[label] = maxTag;
+    retagged[label] = true;
+    anyRetagged = true;
+  }
+  
+  if (!anyRetagged) {
+    return true;
+  }
   
   for( int y = 0; y < inOutTagImg.rows; y++ ) {
+    const int32_t *labelsRow = componentLabels.ptr<int32_t>(y);
+    Vec3b *tagsRow = inOutTagImg.ptr<Vec3b>(y);
+    
     for( int x = 0; x < inOutTagImg.cols; x++ ) {
-      Vec3b tagVec = inOutTagImg.at<Vec3b>(y, x);
-      
-      int32_t centerTag = Vec3BToUID(tagVec);
-      
-      if (debug) {
-        cout << "center (" << x << "," << y << ") with tag " << centerTag << endl;
-      }
-      
-      // If this specific superpixel has not been processed yet then do a BFS
-      // to find the bounds of the superpixel.
-      
-      if (seen.count(centerTag) > 0) {
-        if (debug) {
-          cout << "tag already processed " << centerTag << endl;
-        }
-        
-        // Already seen so skip rest of processing
-        continue;
-      }
-      
-      // Flood fill into mask and determine which pixels are non-zero.
-      
-      mask = Scalar::all(0);
-      rectangle(mask, borderRect, maskFillColor);
-      
-      seed.x = x;
-      seed.y = y;
-      
-      if (debug) {
-        cout << "seed (" << seed.x << "," << seed.y << ") " << endl;
-      }
-      
-      if (debug) {
-      imwrite("flood_tags_input.png", inOutTagImg);
-      imwrite("flood_mask_input.png", mask);
-      }
-      
-      int numFilled = floodFill(inOutTagImg, mask, seed, maskFillColor, &filledRect, scalarZero, scalarZero, flags);
-      
-      mask *= 255.0;
-      
-      // Fill must have at least filled 1 pixel
-      
-      assert(filledRect.width > 0);
-      assert(filledRect.height > 0);
-
-      if (debug) {
-        cout << "flood fill bbox (" << filledRect.x << "," << filledRect.y << ") " << filledRect.width << " x " << filledRect.height << endl;
-        cout << "numFilled " << numFilled << endl;
-      }
-      
-      // Create an initial cropped ROI that does not include the 1 pixel border
-      
-      Mat croppedMask = mask(maskROI);
-      
-      // The filledRect identified pixels are now in terms of the cropped mask image
-      
-      if (debug) {
-      Mat tagsCopy = inOutTagImg.clone();
-      rectangle(tagsCopy, filledRect, Scalar(255,255,255));
-      imwrite("flood_tags_rectangle_over.png", tagsCopy);
-      
-      tagsCopy = Scalar(0, 0, 0);
-      rectangle(tagsCopy, filledRect, Scalar(255,255,255));
-      imwrite("flood_rectangle_over.png", tagsCopy);
-      
-      imwrite("flood_tags.png", inOutTagImg);
-      imwrite("flood_mask2.png", mask);
-      imwrite("flood_mask.png", croppedMask);
-      }
-      
-      // Iteration is defined in terms of checking for non-zero pixels in the range of the containing rect
-
-      int maxY = filledRect.y + filledRect.height;
-      int maxX = filledRect.x + filledRect.width;
-      
-      int countNonZero = 0;
-      
-      vector<pair<int32_t, int32_t> > likelyLineCoords;
-
-      for( int32_t rY = filledRect.y; rY < maxY; rY++ ) {
-        for( int32_t rX = filledRect.x; rX < maxX; rX++ ) {
-          uint8_t bVal = croppedMask.at<uint8_t>(rY, rX);
-          
-          if (bVal == 0) {
-            continue;
-          }
-          
-          if (debug) {
-            cout << "found non-zero pixel " << (int)bVal << " at " << "(" << rX << "," << rY << ")" << endl;
-          }
-          
-          countNonZero += 1;
-          
-          uint8_t neighborsArr[9] =
-          {
-            0, 0, 0,
-            0, 0, 0,
-            0, 0, 0
-          };
-          int32_t neighborsArrOffset = 0;
-          
-          // Record any pixels that have just 2 non-zero neighbors. These will typically be straight lines.
-          
-          int numNeighbors = 0;
-          
-          // Loop over each neighbor around (X,Y) and lookup tag
-          
-          for (auto pairIter = neighborOffsets.begin() ; pairIter != neighborOffsets.end(); ++pairIter) {
-            int dX = pairIter->first;
-            int dY = pairIter->second;
-            
-            uint8_t neighborVal = 0;
-            
-            int nX = rX + dX;
-            int nY = rY + dY;
-            
-            if (nX < 0 || nX >= maxX) {
-              //neighborVal = 0;
-            } else if (nY < 0 || nY >= maxY) {
-              //neighborVal = 0;
-            } else {
-              neighborVal = croppedMask.at<uint8_t>(nY, nX);
-            }
-            
-            neighborsArr[neighborsArrOffset++] = neighborVal;
-            
-            if (neighborsArrOffset == 4) {
-              neighborsArrOffset++; // skip center
-            }
-            
-            if (neighborVal != 0) {
-              numNeighbors += 1;
-              
-              if (debug) {
-                cout << "neighbor on  at (" << nX << "," << nY << ")" << endl;
-              }
-            } else {
-              if (debug) {
-                cout << "neighbor off at (" << nX << "," << nY << ")" << endl;
-              }
-            }
-          } // end neighbor loop
-          
-          if (debug) {
-            cout << "num neighbors for (" << rX << "," << rY << ") is " << numNeighbors << endl;
-          }
-          
-          if (numFilled == 1) {
-            assert(numNeighbors == 0);
-          } else {
-            assert(numNeighbors > 0);
-          }
-          
-          assert(neighborsArr[4] == 0);
-          
-          // Detect a coord that is most likely to be either a horizontal or vertical line
-          // by looking for N=2 neighbors and (LEFT and RIGHT) or (UP AND DOWN)
-          
-          if (numNeighbors == 2) {
-            
-            bool leftAndRight = false;
-            bool upAndDown = false;
-            
-            if (neighborsArr[3] != 0 && neighborsArr[5] != 0) {
-              leftAndRight = true;
-            } else if (neighborsArr[1] != 0 && neighborsArr[7] != 0) {
-              upAndDown = true;
-            }
-            
-            if (leftAndRight || upAndDown) {
-              pair<int32_t, int32_t> coord(rX, rY);
-              likelyLineCoords.push_back(coord);
-            }
-          }
-          
-        }
-      } // end rect iter loop
-      
-      if (debug) {
-        cout << "countNonZero " << countNonZero << endl;
-      }
-      
-      if (debug) {
-        cout << "done iter looking for likely line coords" << endl;
-        cout << "found " << likelyLineCoords.size() << endl;
+      int32_t label = labelsRow[x];
+      if (retagged[label]) {
+        tagsRow[x] = PixelToVec3b(componentTags[label]);
       }
-      
-      // Long straight lines typically that SEEDS is running along a simple gradient.
-      // Detect only the case of vertical or horizontal long connected lines and then
-      // modify the original tags data to add a new tag to replace each pixel that is
-      // currently in the straight line.
-      
-      // The coords were scanned by row and then col so the first one will be the
-      // closest to the top left.
-      
-      seen[centerTag] = true;
     }
   }
   
-  
-  return;
+  return true;
 }
 
 // Return true if edge should be merged based on known edge weights
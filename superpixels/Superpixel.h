@@ -6,35 +6,41 @@
 
 #include "OpenCVUtil.h"
 #include "Coord.h"
+#include "CoordSpans.h"
 #include "SuperpixelEdge.h"
 
 using namespace std;
 using namespace cv;
 
-#include <unordered_map>
-
-// Define this to add a table of associated objects to the superpixel object.
-// This can be a handy way to store data that code will access later, but
-// it adds 32 or 64 bits to each Superpixel.
-
-#define ENABLE_SUPERPIXEL_ASSOC_DATA
-
 typedef enum {
   SuperpixelFlagsNotAllSame = (1 << 0),
   SuperpixelFlagsAllSame = (1 << 1),
 } SuperpixelFlags;
 
+// Per channel pixel statistics for a superpixel. These are only valid when the
+// SuperpixelImage that holds the superpixel computed them from an input image,
+// merging two superpixels merges their stats without reading any pixels.
+
+typedef struct {
+  uint64_t sum[3];
+  uint64_t sumSquares[3];
+  uint8_t minValue[3];
+  uint8_t maxValue[3];
+} SuperpixelStats;
+
 class Superpixel {
   
   public:
 
   Superpixel();
   Superpixel(int32_t tag);
-  ~Superpixel();
 
   int32_t tag;
   
-  vector<Coord> coords;
+  // Pixels in the superpixel stored as row spans, iterating over coords
+  // visits each (X,Y) in the order the pixels were appended.
+  
+  CoordSpans coords;
 
   // This vector stores superpixel edges that have been successfully merged.
   
@@ -48,6 +54,57 @@ class Superpixel {
   // Flags that apply to all pixels in the superpixel grouping, 0 when no flags set.
   uint32_t flags;
   
+  SuperpixelStats stats;
+  
+  void resetStats() {
+    for (int c = 0; c < 3; c++) {
+      stats.sum[c] = 0;
+      stats.sumSquares[c] = 0;
+      stats.minValue[c] = 0xFF;
+      stats.maxValue[c] = 0;
+    }
+  }
+  
+  void addPixelsToStats(const Vec3b *pixels, int numPixels) {
+    for (int i = 0; i < numPixels; i++) {
+      for (int c = 0; c < 3; c++) {
+        uint8_t value = pixels[i][c];
+        stats.sum[c] += value;
+        stats.sumSquares[c] += (uint32_t) value * value;
+        stats.minValue[c] = min(stats.minValue[c], value);
+        stats.maxValue[c] = max(stats.maxValue[c], value);
+      }
+    }
+  }
+  
+  void mergeStats(const Superpixel &other) {
+    for (int c = 0; c < 3; c++) {
+      stats.sum[c] += other.stats.sum[c];
+      stats.sumSquares[c] += other.stats.sumSquares[c];
+      stats.minValue[c] = min(stats.minValue[c], other.stats.minValue[c]);
+      stats.maxValue[c] = max(stats.maxValue[c], other.stats.maxValue[c]);
+    }
+  }
+  
+  // true when the stats show that every pixel has the same value
+  
+  bool statsAllSame() const {
+    return (stats.minValue[0] == stats.maxValue[0] &&
+            stats.minValue[1] == stats.maxValue[1] &&
+            stats.minValue[2] == stats.maxValue[2]);
+  }
+  
+  // Mean and variance of each channel
+  
+  void statsMeanAndVariance(float mean[3], float variance[3]) const {
+    double N = (double) coords.size();
+    for (int c = 0; c < 3; c++) {
+      double m = stats.sum[c] / N;
+      mean[c] = (float) m;
+      variance[c] = (float) max(0.0, (stats.sumSquares[c] / N) - (m * m));
+    }
+  }
+  
   void setAllSame() {
     this->flags = SuperpixelFlagsAllSame;
   }
@@ -64,23 +121,8 @@ class Superpixel {
     return (this->flags == SuperpixelFlagsNotAllSame);
   }
   
-#if defined(ENABLE_SUPERPIXEL_ASSOC_DATA)
-  
-  // A user of this Superpixel class may have specific data that should be
-  // associated with a specific superpixel, this member is typically NULL
-  // but can initialized as needed to point to a table that maps UID
-  // integers to a generic pointer of any type.
-  
-  unordered_map<uint32_t, void*> *assocDataPtr;
-  
-  unordered_map<uint32_t, void*>& getAssocData() {
-    if (assocDataPtr == NULL) {
-      assocDataPtr = new unordered_map<uint32_t, void*>();
-    }
-    return *assocDataPtr;
-  }
-  
-#endif // ENABLE_SUPERPIXEL_ASSOC_DATA
+  // Data that code associates with a superpixel is not stored here, it is
+  // kept in a SuperpixelSideArray indexed by the dense index of the superpixel.
   
   void appendCoord(int x, int y);
   
@@ -94,6 +136,9 @@ class Superpixel {
   static
   void fillMatrixFromCoords(Mat &input, vector<Coord> &coords, Mat &output);
   
+  static
+  void fillMatrixFromCoords(Mat &input, const CoordSpans &coords, Mat &output);
+  
   // This method is the inverse of fillMatrixFromCoords(), it reads pixel values from a matrix
   // and writes them back to the corresponding X,Y values location in an image. This method is
   // very useful when running an image operation on all the pixels in a superpixel but without
@@ -107,6 +152,9 @@ class Superpixel {
   static
   void reverseFillMatrixFromCoords(Mat &input, bool isGray, vector<Coord> &coords, Mat &output);
   
+  static
+  void reverseFillMatrixFromCoords(Mat &input, bool isGray, const CoordSpans &coords, Mat &output);
+  
   // Filter the coords and return a vector that contains only the coordinates that share
   // an edge with the other superpixel.
   
@@ -120,7 +168,7 @@ class Superpixel {
   
   void bbox(int32_t &originX, int32_t &originY, int32_t &width, int32_t &height);
   
-  static void splitSplayPixels(Mat &inOutTagImg);
+  static bool splitSplayPixels(Mat &inOutTagImg);
   
   bool shouldMergeEdge(float edgeWeight);
 };
@@ -135,4 +183,16 @@ cv::Rect Superpixel_opencv_bbox(Superpixel *spPtr)
   return cv::Rect(originX, originY, width, height);
 }
 
+// Write value to each pixel covered by the spans, T must match the pixel type of output.
+
+template <typename T>
+static inline
+void Superpixel_fillSpans(Mat &output, const CoordSpans &coords, const T value)
+{
+  for ( const CoordSpan &span : coords.getSpans() ) {
+    T *rowPtr = output.ptr<T>(span.y);
+    std::fill(rowPtr + span.x0, rowPtr + span.x1 + 1, value);
+  }
+}
+
 #endif // SUPERPIXEL_H
@@ -0,0 +1,58 @@
+// Contiguous storage for the superpixels of an image, see SuperpixelArena.h
+
+#include "SuperpixelArena.h"
+
+SuperpixelArena::SuperpixelArena()
+: numLive(0)
+{
+}
+
+void SuperpixelArena::reset(const vector<int32_t> &sortedTags)
+{
+  clear();
+
+  int32_t numTags = (int32_t) sortedTags.size();
+
+  if (numTags == 0) {
+    return;
+  }
+
+  assert(sortedTags[0] > 0);
+
+  tagRanks.reset(sortedTags);
+
+  storage.resize(numTags);
+
+  for ( int32_t i = 0; i < numTags; i++ ) {
+    storage[i].tag = sortedTags[i];
+  }
+
+  numLive = numTags;
+}
+
+void SuperpixelArena::clear()
+{
+  vector<Superpixel>().swap(storage);
+  tagRanks.clear();
+
+  numLive = 0;
+}
+
+void SuperpixelArena::remove(int32_t tag)
+{
+  int32_t index = indexOf(tag);
+
+  if (index == -1) {
+    return;
+  }
+
+  Superpixel &sp = storage[index];
+
+  sp.tag = 0;
+  sp.flags = 0;
+  sp.coords.release();
+  vector<float>().swap(sp.mergedEdgeWeights);
+  vector<float>().swap(sp.unmergedEdgeWeights);
+
+  numLive -= 1;
+}
@@ -0,0 +1,125 @@
+// A superpixel arena holds every Superpixel of an image in one contiguous
+// array. Each superpixel has a dense index that is the rank of its tag among
+// all the tags parsed, so indexes are in tag order and looking up a tag is a
+// bitmap rank instead of a hash lookup. A merged away superpixel keeps its
+// slot but is marked dead with the tag 0, so an index never changes while
+// the arena lives. Data that code wants to associate with each superpixel
+// is kept in a SuperpixelSideArray indexed the same way.
+
+#ifndef SUPERPIXEL_ARENA_H
+#define	SUPERPIXEL_ARENA_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "Superpixel.h"
+#include "SuperpixelTagRanks.h"
+
+using namespace std;
+
+class SuperpixelArena {
+
+  public:
+
+  SuperpixelArena();
+
+  // Replace the contents with one empty superpixel for each tag, the tags
+  // must be in increasing order and larger than zero. The superpixel for
+  // sortedTags[i] has the index i.
+
+  void reset(const vector<int32_t> &sortedTags);
+
+  // Free all superpixels and the index at once
+
+  void clear();
+
+  // Dense index of a live superpixel or -1 when the tag is not in the arena
+
+  int32_t indexOf(int32_t tag) const {
+    int32_t index = tagRanks.rank(tag);
+
+    if (index == -1 || storage[index].tag != tag) {
+      return -1;
+    }
+
+    return index;
+  }
+
+  Superpixel* find(int32_t tag) {
+    int32_t index = indexOf(tag);
+    return (index == -1) ? NULL : &storage[index];
+  }
+
+  size_t count(int32_t tag) const {
+    return (indexOf(tag) == -1) ? 0 : 1;
+  }
+
+  // Superpixel at a dense index, dead superpixels have the tag 0
+
+  Superpixel& atIndex(int32_t index) {
+    return storage[index];
+  }
+
+  // Number of dense indexes including dead ones, this is the size of a side array
+
+  int32_t numIndexes() const {
+    return (int32_t) storage.size();
+  }
+
+  // Number of live superpixels
+
+  size_t size() const {
+    return numLive;
+  }
+
+  // Mark the superpixel as dead and release its coords and edge weights
+
+  void remove(int32_t tag);
+
+  private:
+
+  vector<Superpixel> storage;
+
+  // The index of a tag is its rank among all the tags in the arena
+
+  SuperpixelTagRanks tagRanks;
+
+  size_t numLive;
+};
+
+// A value of type T for each dense index in an arena. Values stay with their
+// superpixel as other superpixels are merged away, so this replaces tables
+// keyed by tag in code that runs while superpixels are merged.
+
+template <typename T>
+class SuperpixelSideArray {
+
+  public:
+
+  SuperpixelSideArray(const SuperpixelArena &_arena, const T &initialValue)
+  : arena(_arena), values(_arena.numIndexes(), initialValue)
+  {
+  }
+
+  // The tag must be a live superpixel in the arena
+
+  T& operator[](int32_t tag) {
+    int32_t index = arena.indexOf(tag);
+    assert(index != -1);
+    return values[index];
+  }
+
+  T& atIndex(int32_t index) {
+    return values[index];
+  }
+
+  private:
+
+  const SuperpixelArena &arena;
+
+  vector<T> values;
+};
+
+#endif // SUPERPIXEL_ARENA_H
@@ -147,7 +147,7 @@ SuperpixelEdgeFuncs::compareNeighborEdges(SuperpixelImage &spImage,
   Superpixel *srcSpPtr = spImage.getSuperpixelPtr(tag);
   assert(srcSpPtr);
   
-  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSet(tag) ) {
+  for ( int32_t neighborTag : spImage.edgeTable.getNeighborsSpan(tag) ) {
     if (lockedTablePtr && (lockedTablePtr->count(neighborTag) != 0)) {
       // If a locked down table is provided then do not consider a neighbor that appears
       // in the locked table.
@@ -5,8 +5,80 @@
 
 #include "SuperpixelEdgeTable.h"
 
+#include <string.h>
+
+// Compaction is not worth it for a small array
+
+static const size_t minCompactSlots = 1024;
+
 SuperpixelEdgeTable::SuperpixelEdgeTable()
+: numLiveNodes(0), numDeadSlots(0)
+{
+}
+
+void SuperpixelEdgeTable::build(const vector<int32_t> &tags, vector<pair<int32_t, int32_t> > &edges)
 {
+  SuperpixelTagRanks ranks;
+  ranks.reset(tags);
+
+  for ( auto &edge : edges ) {
+    edge.first = ranks.rank(edge.first);
+    edge.second = ranks.rank(edge.second);
+    assert(edge.first != -1 && edge.second != -1);
+  }
+
+  buildWithNodeIndexes(tags, edges);
+}
+
+// Count the degree of each node, place each list in one pass over the edges
+// and then sort and dedup every list in place. The slots freed by the dedup
+// are kept as free capacity for later merges.
+
+void SuperpixelEdgeTable::buildWithNodeIndexes(const vector<int32_t> &tags, const vector<pair<int32_t, int32_t> > &nodeEdges)
+{
+  int32_t numNodes = (int32_t) tags.size();
+
+  adjacency.clear();
+  nodeTags = tags;
+  nodeOffsets.assign(numNodes, 0);
+  nodeSizes.assign(numNodes, 0);
+  nodeCapacities.assign(numNodes, 0);
+  tagRanks.reset(tags);
+  numLiveNodes = numNodes;
+  numDeadSlots = 0;
+
+  for ( auto &edge : nodeEdges ) {
+    int32_t nodeA = edge.first;
+    int32_t nodeB = edge.second;
+    assert(nodeA >= 0 && nodeA < (int32_t)tags.size());
+    assert(nodeB >= 0 && nodeB < (int32_t)tags.size());
+    assert(nodeA != nodeB);
+    nodeCapacities[nodeA] += 1;
+    nodeCapacities[nodeB] += 1;
+  }
+
+  int32_t offset = 0;
+
+  for ( int32_t node = 0; node < (int32_t)nodeTags.size(); node++ ) {
+    nodeOffsets[node] = offset;
+    offset += nodeCapacities[node];
+  }
+
+  adjacency.resize(offset);
+
+  for ( auto &edge : nodeEdges ) {
+    int32_t nodeA = edge.first;
+    int32_t nodeB = edge.second;
+    adjacency[nodeOffsets[nodeA] + nodeSizes[nodeA]++] = nodeTags[nodeB];
+    adjacency[nodeOffsets[nodeB] + nodeSizes[nodeB]++] = nodeTags[nodeA];
+  }
+
+  for ( int32_t node = 0; node < (int32_t)nodeTags.size(); node++ ) {
+    int32_t *first = adjacency.data() + nodeOffsets[node];
+    int32_t *last = first + nodeSizes[node];
+    sort(first, last);
+    nodeSizes[node] = (int32_t) (unique(first, last) - first);
+  }
 }
 
 // This implementation iterates over all the edges in the graph and it is not fast
@@ -15,64 +87,71 @@ SuperpixelEdgeTable::SuperpixelEdgeTable()
 vector<SuperpixelEdge> SuperpixelEdgeTable::getAllEdges()
 {
   const bool debug = false;
-  
+
   // Walk over all superpixels and get each neighbor, then create an edge only when the UID
   // of a superpixel is smaller than the UID of the edge. This basically does a dedup of
   // all the edges without creating and checking for dups.
-  
+
   vector<SuperpixelEdge> allEdges;
-  
+
   vector<int32_t> allSuperpixles = getAllTagsInNeighborsTable();
-  
+
   for (auto it = allSuperpixles.begin(); it != allSuperpixles.end(); ++it ) {
     int32_t tag = *it;
-    
+
     if (debug) {
       cout << "for superpixel " << tag << " neighbors:" << endl;
     }
-    
-    for ( int32_t neighborTag : getNeighborsSet(tag) ) {
+
+    for ( int32_t neighborTag : getNeighborsSpan(tag) ) {
       if (debug) {
         cout << neighborTag << endl;
       }
-      
+
       if (tag <= neighborTag) {
         SuperpixelEdge edge(tag, neighborTag);
         allEdges.push_back(edge);
-        
+
         if (debug) {
           cout << "added edge (" << edge.A << "," << edge.B << ")" << endl;
         }
       } else {
         if (debug) {
           SuperpixelEdge edge(tag, neighborTag);
-          
+
           cout << "ignored dup edge (" << edge.A << "," << edge.B << ")" << endl;
         }
       }
     }
   }
-  
+
   return allEdges;
 }
 
-// A neighbor iterator supports fast access to the neighbors list
-// in sorted order. The caller must take care to not hold an
-// iterator during a merge since that can change the neighbor list.
+// The span is valid until the next change to the table
 
-set<int32_t>&
-SuperpixelEdgeTable::getNeighborsSet(int32_t tag)
+SuperpixelNeighbors
+SuperpixelEdgeTable::getNeighborsSpan(int32_t tag) const
 {
-  auto iter = neighbors.find(tag);
-  
-  if (iter == neighbors.end()) {
-    // Neighbors key must be defined for this tag
-    assert(0);
+  int32_t node = findNode(tag);
+
+  // Neighbors key must be defined for this tag
+  assert(node != -1);
+
+  const int32_t *first = adjacency.data() + nodeOffsets[node];
+  return SuperpixelNeighbors(first, first + nodeSizes[node]);
+}
+
+int32_t SuperpixelEdgeTable::getNeighborAfter(int32_t tag, int32_t neighborTag) const
+{
+  SuperpixelNeighbors neighbors = getNeighborsSpan(tag);
+
+  auto it = upper_bound(neighbors.begin(), neighbors.end(), neighborTag);
+
+  if (it == neighbors.end()) {
+    return -1;
   } else {
-    // Otherwise the key exists in the table, return ref to vector in table
-    // with the assumption that the caller will not change it.
-    
-    return iter->second;
+    return *it;
   }
 }
 
@@ -80,66 +159,221 @@ SuperpixelEdgeTable::getNeighborsSet(int32_t tag)
 
 vector<int32_t> SuperpixelEdgeTable::getNeighbors(int32_t tag)
 {
-  auto it = neighbors.find(tag);
-  if ( it == neighbors.end()) {
+  int32_t node = findNode(tag);
+  if (node == -1) {
     return vector<int32_t>();
   }
-  auto &neighborsSet = it->second;
-  vector<int32_t> neighborVec;
-  neighborVec.reserve(neighborsSet.size());
-  for ( int32_t neighborTag : neighborsSet ) {
-    neighborVec.push_back(neighborTag);
-  }
-  return neighborVec;
+  SuperpixelNeighbors neighbors = getNeighborsSpan(tag);
+  return vector<int32_t>(neighbors.begin(), neighbors.end());
 }
 
 // Set initial list of neighbors for a superpixel or rest the list after making
-// changes. The neighbor values are sorted only to make the results easier to
-// read, there should not be much impact on performance since the list of neighbors
-// is typically small.
+// changes. Only the list of this one node is changed, the caller must keep
+// the lists of the neighbors consistent.
 
 void SuperpixelEdgeTable::setNeighbors(int32_t tag, vector<int32_t> neighborUIDsVec)
 {
-  set<int32_t> neighborsSet;
-  
-  for ( int32_t tag : neighborUIDsVec ) {
-    neighborsSet.insert(tag);
-  }
-  // FIXME: use faster impl of insert
-  //neighborsSet.insert(neighbors.begin(), neighbors.end);
-  
-  //sort (neighborsUIDsVec.begin(), neighborsUIDsVec.end());
-  
-  neighbors[tag] = neighborsSet;
-}
+  sort(neighborUIDsVec.begin(), neighborUIDsVec.end());
+  auto last = unique(neighborUIDsVec.begin(), neighborUIDsVec.end());
+  neighborUIDsVec.erase(last, neighborUIDsVec.end());
 
-// Set initial list of neighbors for a superpixel or rest the list after making
-// changes. The neighbor values are sorted only to make the results easier to
-// read, there should not be much impact on performance since the list of neighbors
-// is typically small.
+  int32_t node = findNode(tag);
+
+  assert(node != -1);
+
+  assignNeighbors(node, neighborUIDsVec.data(), (int32_t) neighborUIDsVec.size());
+}
 
 void SuperpixelEdgeTable::setNeighbors(int32_t tag, set<int32_t> neighborsSet)
 {
-  neighbors[tag] = neighborsSet;
+  setNeighbors(tag, vector<int32_t>(neighborsSet.begin(), neighborsSet.end()));
+}
+
+// Merge src into dst. The union of the two sorted lists is built in the
+// merge buffer and copied back into the dst span, then each neighbor of src
+// has src replaced by dst.
+
+void SuperpixelEdgeTable::mergeNeighbors(int32_t srcTag, int32_t dstTag)
+{
+  int32_t srcNode = findNode(srcTag);
+  int32_t dstNode = findNode(dstTag);
+
+  assert(srcNode != -1 && dstNode != -1);
+  assert(srcNode != dstNode);
+
+  mergeBuffer.clear();
+
+  {
+    const int32_t *srcIt = adjacency.data() + nodeOffsets[srcNode];
+    const int32_t *srcEnd = srcIt + nodeSizes[srcNode];
+    const int32_t *dstIt = adjacency.data() + nodeOffsets[dstNode];
+    const int32_t *dstEnd = dstIt + nodeSizes[dstNode];
+
+    while (srcIt != srcEnd || dstIt != dstEnd) {
+      int32_t tag;
+
+      if (dstIt == dstEnd || (srcIt != srcEnd && *srcIt < *dstIt)) {
+        tag = *srcIt++;
+      } else if (srcIt == srcEnd || *dstIt < *srcIt) {
+        tag = *dstIt++;
+      } else {
+        tag = *dstIt++;
+        srcIt++;
+      }
+
+      if (tag != srcTag && tag != dstTag) {
+        mergeBuffer.push_back(tag);
+      }
+    }
+  }
+
+  // Neighbors of src other than dst now point at dst. Read the src list
+  // before dst is assigned since that can reallocate adjacency.
+
+  for ( int32_t i = 0; i < nodeSizes[srcNode]; i++ ) {
+    int32_t neighborTag = adjacency[nodeOffsets[srcNode] + i];
+
+    if (neighborTag != dstTag) {
+      replaceNeighbor(findNode(neighborTag), srcTag, dstTag);
+    }
+  }
+
+  assignNeighbors(dstNode, mergeBuffer.data(), (int32_t) mergeBuffer.size());
+
+  killNode(srcNode);
+
+  compactIfNeeded();
 }
 
 // When deleting a node, remove the neighbor entries
 
 void SuperpixelEdgeTable::removeNeighbors(int32_t tag)
 {
-  neighbors.erase(tag);
+  int32_t node = findNode(tag);
+
+  if (node != -1) {
+    killNode(node);
+    compactIfNeeded();
+  }
 }
 
-// Return a vector of tags that have an entry in the neighbors table.
+// Return a vector of tags that have an entry in the neighbors table, nodes
+// are in tag order so the tags are sorted.
 // Even if the vector contains zero elements, this method is not fast.
 
 vector<int32_t> SuperpixelEdgeTable::getAllTagsInNeighborsTable()
 {
   vector<int32_t> vec;
-  for ( auto it = neighbors.begin(); it != neighbors.end(); ++it ) {
-    int32_t tag = it->first;
-    vec.push_back(tag);
+  vec.reserve(numLiveNodes);
+  for ( int32_t tag : nodeTags ) {
+    if (tag != -1) {
+      vec.push_back(tag);
+    }
   }
-  sort (vec.begin(), vec.end());
   return vec;
 }
+
+int32_t SuperpixelEdgeTable::findNode(int32_t tag) const
+{
+  int32_t node = tagRanks.rank(tag);
+
+  if (node == -1 || nodeTags[node] != tag) {
+    return -1;
+  }
+
+  return node;
+}
+
+void SuperpixelEdgeTable::assignNeighbors(int32_t node, const int32_t *sortedTags, int32_t numTags)
+{
+  if (numTags > nodeCapacities[node]) {
+    // Leave room to grow since a merged node is likely to be merged again
+
+    int32_t capacity = numTags + numTags / 2;
+
+    numDeadSlots += nodeCapacities[node];
+
+    nodeOffsets[node] = (int32_t) adjacency.size();
+    nodeCapacities[node] = capacity;
+    adjacency.resize(adjacency.size() + capacity);
+  }
+
+  if (numTags > 0) {
+    memmove(&adjacency[nodeOffsets[node]], sortedTags, numTags * sizeof(int32_t));
+  }
+  nodeSizes[node] = numTags;
+}
+
+void SuperpixelEdgeTable::replaceNeighbor(int32_t node, int32_t oldTag, int32_t newTag)
+{
+  assert(node != -1);
+
+  int32_t *first = &adjacency[nodeOffsets[node]];
+  int32_t *last = first + nodeSizes[node];
+
+  int32_t *oldIt = lower_bound(first, last, oldTag);
+  assert(oldIt != last && *oldIt == oldTag);
+
+  int32_t *newIt = lower_bound(first, last, newTag);
+
+  if (newIt != last && *newIt == newTag) {
+    // Already a neighbor, remove oldTag
+
+    memmove(oldIt, oldIt + 1, (last - oldIt - 1) * sizeof(int32_t));
+    nodeSizes[node] -= 1;
+  } else if (newIt > oldIt) {
+    // Shift the tags between the two positions down by one
+
+    memmove(oldIt, oldIt + 1, (newIt - oldIt - 1) * sizeof(int32_t));
+    *(newIt - 1) = newTag;
+  } else {
+    // Shift the tags between the two positions up by one
+
+    memmove(newIt + 1, newIt, (oldIt - newIt) * sizeof(int32_t));
+    *newIt = newTag;
+  }
+}
+
+void SuperpixelEdgeTable::killNode(int32_t node)
+{
+  numLiveNodes -= 1;
+
+  numDeadSlots += nodeCapacities[node];
+
+  nodeTags[node] = -1;
+  nodeSizes[node] = 0;
+  nodeCapacities[node] = 0;
+}
+
+void SuperpixelEdgeTable::compactIfNeeded()
+{
+  if (numDeadSlots > minCompactSlots && numDeadSlots * 2 > adjacency.size()) {
+    compact();
+  }
+}
+
+// Nodes keep their index and each span is copied without free capacity, so
+// the next merge into a node moves its span to the end. Dead nodes own no
+// slots so they are skipped.
+
+void SuperpixelEdgeTable::compact()
+{
+  vector<int32_t> compactAdjacency;
+  compactAdjacency.reserve(adjacency.size() - numDeadSlots);
+
+  for ( int32_t node = 0; node < (int32_t)nodeTags.size(); node++ ) {
+    int32_t offset = (int32_t) compactAdjacency.size();
+    int32_t numTags = nodeSizes[node];
+
+    compactAdjacency.insert(compactAdjacency.end(),
+                            adjacency.begin() + nodeOffsets[node],
+                            adjacency.begin() + nodeOffsets[node] + numTags);
+
+    nodeOffsets[node] = offset;
+    nodeCapacities[node] = numTags;
+  }
+
+  adjacency.swap(compactAdjacency);
+
+  numDeadSlots = 0;
+}
@@ -1,74 +1,184 @@
 // An edge table represents edges in a graph using a list of neighbor nodes
-// for each node. This implementation is very simple and provides fast
-// access to graph components in linear time.
+// for each node. The neighbor lists of all nodes are stored in one flat
+// array (CSR) where each node owns a sorted span, so iterating over the
+// neighbors of a node reads contiguous memory. A merge rewrites the spans
+// in place when they fit and otherwise moves the merged span to the end of
+// the array, a merged away node is marked dead and the unused slots are
+// reclaimed by a periodic compaction. The node of a tag is the rank of the
+// tag among the tags the table was built with, the same dense index the
+// SuperpixelArena uses, and a node keeps its index after it is dead.
 
 #ifndef SUPERPIXEL_EDGE_TABLE_H
 #define	SUPERPIXEL_EDGE_TABLE_H
 
 #include <unordered_map>
+#include <vector>
 #include <set>
+#include <algorithm>
 
 #include "SuperpixelEdge.h"
+#include "SuperpixelTagRanks.h"
 
 using namespace std;
 using namespace cv;
 
+// The neighbors of one node in sorted order. This is a view into the edge
+// table, so it must not be held across a change to the table like a merge.
+
+class SuperpixelNeighbors {
+
+  public:
+
+  SuperpixelNeighbors(const int32_t *_first, const int32_t *_last)
+  : first(_first), last(_last)
+  {
+  }
+
+  const int32_t* begin() const {
+    return first;
+  }
+
+  const int32_t* end() const {
+    return last;
+  }
+
+  size_t size() const {
+    return last - first;
+  }
+
+  bool empty() const {
+    return first == last;
+  }
+
+  size_t count(int32_t tag) const {
+    return binary_search(first, last, tag) ? 1 : 0;
+  }
+
+  private:
+
+  const int32_t *first;
+  const int32_t *last;
+};
+
 class SuperpixelEdgeTable {
-  
+
   public:
-  
+
   SuperpixelEdgeTable();
-  
+
   // Edge strength map holds float edge weights given an edge key.
   // This table is useful because it contains a value that is the same
   // for an edge that can be used by both superpixels that the edge
   // applies to.
-  
+
   unordered_map<SuperpixelEdge, float> edgeStrengthMap;
-    
+
+  // Replace the contents of the table with a node for each tag and the
+  // undirected edges in edges. The tags must be in increasing order. An edge
+  // can appear more than once and in either direction. The edges vector is
+  // used as scratch space.
+
+  void build(const vector<int32_t> &tags, vector<pair<int32_t, int32_t> > &edges);
+
+  // Same as build() except that each edge holds two indexes into tags
+  // instead of two tags, so no tag lookup is needed.
+
+  void buildWithNodeIndexes(const vector<int32_t> &tags, const vector<pair<int32_t, int32_t> > &nodeEdges);
+
   // Return the neighbors of a superpixel UID as a vector of int32_t
-  
+
   vector<int32_t> getNeighbors(int32_t tag);
-  
-  // A neighbor iterator supports fast access to the neighbors list
-  // in sorted order. The caller must take care to not hold an
-  // iterator during a merge since that can change the neighbor list.
-  
-  set<int32_t>&
-  getNeighborsSet(int32_t tag);
-  
-  // Set list of neighbor nodes for a given superpixel UID.
-  // This method is typically called when initializing the
-  // graph.
-  
+
+  // Neighbors of a superpixel UID in sorted order, the tag must be a node
+  // in the table. The view is not valid after the table is changed.
+
+  SuperpixelNeighbors
+  getNeighborsSpan(int32_t tag) const;
+
+  // Return the smallest neighbor of tag that is larger than neighborTag or
+  // -1 when there is none, pass -1 to get the first neighbor. A loop that
+  // merges neighbors into tag can use this to continue from the next
+  // neighbor since a merge into tag never removes another neighbor.
+
+  int32_t getNeighborAfter(int32_t tag, int32_t neighborTag) const;
+
+  // Set list of neighbor nodes for a given superpixel UID, the tag must be
+  // one of the tags the table was built with.
+
   void setNeighbors(int32_t tag, vector<int32_t> neighborUIDsVec);
-  
+
   void setNeighbors(int32_t tag, set<int32_t> neighborsSet);
 
+  // Merge the node srcTag into dstTag. The neighbors of dst become the union
+  // of both lists without src and dst, each neighbor of src gets dst as a
+  // neighbor in place of src and then src is removed.
+
+  void mergeNeighbors(int32_t srcTag, int32_t dstTag);
+
   // When deleting a node, remove the neighbor entries with this method
-  
+
   void removeNeighbors(int32_t tag);
-  
+
   // Return all edges as a flat list of SuperpixelEdge objects, this is useful
   // for inspection purposes but should not be called in real code since
   // the entire graphs is iterated over.
-  
+
   vector<SuperpixelEdge> getAllEdges();
-  
+
   vector<int32_t> getAllTagsInNeighborsTable();
 
-  // Accessor for neighbors member
-  
-  inline
-  unordered_map <int32_t, set<int32_t> > &getNeighborsRef()
-  {
-    return neighbors;
+  // Number of live nodes in the table
+
+  size_t size() const {
+    return numLiveNodes;
   }
-  
+
   private:
-  
-  unordered_map <int32_t, set<int32_t> > neighbors;
-  
+
+  // Flat neighbor array, node i owns the slots starting at nodeOffsets[i].
+  // The first nodeSizes[i] slots hold the sorted neighbor tags and the rest
+  // up to nodeCapacities[i] are free. A dead node has the tag -1 and no slots.
+
+  vector<int32_t> adjacency;
+
+  vector<int32_t> nodeTags;
+  vector<int32_t> nodeOffsets;
+  vector<int32_t> nodeSizes;
+  vector<int32_t> nodeCapacities;
+
+  SuperpixelTagRanks tagRanks;
+
+  size_t numLiveNodes;
+
+  // Slots in adjacency that no live node owns
+
+  size_t numDeadSlots;
+
+  // Scratch list used when merging
+
+  vector<int32_t> mergeBuffer;
+
+  int32_t findNode(int32_t tag) const;
+
+  // Copy a sorted list into the span of node, moving the span to the end of
+  // adjacency when it does not fit.
+
+  void assignNeighbors(int32_t node, const int32_t *sortedTags, int32_t numTags);
+
+  // In the sorted list of node replace oldTag with newTag, or just remove
+  // oldTag when newTag is already in the list.
+
+  void replaceNeighbor(int32_t node, int32_t oldTag, int32_t newTag);
+
+  void killNode(int32_t node);
+
+  // Rewrite adjacency without unused slots once more than half of the array
+  // is unused.
+
+  void compactIfNeeded();
+
+  void compact();
+
 };
 
 #endif // SUPERPIXEL_EDGE_TABLE_H
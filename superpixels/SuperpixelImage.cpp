@@ -15,7 +15,11 @@
 
 #include "OpenCVUtil.h"
 
+#include "Trace.h"
+
 #include <iomanip>      // setprecision
+#include <atomic>
+#include <thread>
 
 const int MaxSmallNumPixelsVal = 10;
 
@@ -76,24 +80,130 @@ ForwardIterator binary_search_iter (ForwardIterator first, ForwardIterator last,
   }
 }
 
-bool SuperpixelImage::parse(Mat &tags, SuperpixelImage &spImage) {
+// Tags are at most 24 bits, so the tags found in an image can be recorded in
+// a bitmap with a bit for each possible tag. The dense index of a tag is its
+// rank in the bitmap, the number of set bits in the words before it plus the
+// set bits below it in its own word, so dense indexes are in tag order. This
+// is the same rank as SuperpixelTagRanks except that tags can be marked from
+// any number of threads.
+
+class ConcurrentTagRanks {
+public:
+  ConcurrentTagRanks()
+  : words(numWords), wordRanks(numWords, 0)
+  {
+  }
+  
+  // Safe to call from any number of threads at once
+  
+  void mark(int32_t tag) {
+    atomic<uint64_t> &word = words[tag >> 6];
+    uint64_t bit = (uint64_t)1 << (tag & 63);
+    
+    if ((word.load(memory_order_relaxed) & bit) == 0) {
+      word.fetch_or(bit, memory_order_relaxed);
+    }
+  }
+  
+  // Compute ranks once all tags are marked and return the tags in dense order
+  
+  void finish(vector<int32_t> &denseTags) {
+    int32_t rank = 0;
+    
+    for ( int32_t i = 0; i < numWords; i++ ) {
+      uint64_t word = words[i].load(memory_order_relaxed);
+      wordRanks[i] = rank;
+      
+      while (word != 0) {
+        int bitOffset = __builtin_ctzll(word);
+        denseTags.push_back((i << 6) + bitOffset);
+        word &= word - 1;
+        rank += 1;
+      }
+    }
+  }
+  
+  int32_t rank(int32_t tag) const {
+    uint64_t word = words[tag >> 6].load(memory_order_relaxed);
+    uint64_t below = word & (((uint64_t)1 << (tag & 63)) - 1);
+    return wordRanks[tag >> 6] + __builtin_popcountll(below);
+  }
+  
+private:
+  static const int32_t numWords = (0x00FFFFFF + 1) / 64;
+  
+  vector<atomic<uint64_t> > words;
+  vector<int32_t> wordRanks;
+};
+
+// Run func(band, startRow, endRow) for each band of rows, the first band runs
+// on the calling thread. Any range of indexes can be split into bands this way.
+
+template <typename F>
+static void superpixelParseRowBands(int numRows, int numBands, const F &func)
+{
+  vector<thread> threads;
+  
+  for ( int band = 1; band < numBands; band++ ) {
+    int startRow = (int) ((int64_t) numRows * band / numBands);
+    int endRow = (int) ((int64_t) numRows * (band + 1) / numBands);
+    threads.push_back(thread([&func, band, startRow, endRow]() {
+      func(band, startRow, endRow);
+    }));
+  }
+  
+  func(0, 0, (int) ((int64_t) numRows / numBands));
+  
+  for ( thread &t : threads ) {
+    t.join();
+  }
+}
+
+// Parse in three passes over row bands. The first pass adds 1 to each tag and
+// marks it in the rank bitmap, the second counts the row spans of each dense
+// index in each band and the third writes spans into arrays that already
+// have their final size and collects the neighbor pairs. Each band writes
+// its spans after those of the bands above it, so coords are in the same
+// row major order as a serial scan.
+
+bool SuperpixelImage::parse(Mat &tags, SuperpixelImage &spImage, unsigned int numThreads) {
+  TRACE_SPAN("SuperpixelImage::parse");
+  
   const bool debug = false;
   
   assert(tags.channels() == 3);
   
-  TagToSuperpixelMap &tagToSuperpixelMap = spImage.tagToSuperpixelMap;
+  SuperpixelArena &superpixelArena = spImage.superpixelArena;
   
   auto &superpixels = spImage.superpixels;
   
-  for( int y = 0; y < tags.rows; y++ ) {
-    for( int x = 0; x < tags.cols; x++ ) {
-      Vec3b tagVec = tags.at<Vec3b>(y, x);
-      int32_t tag = Vec3BToUID(tagVec);
-      
-      // Note that each tag value is modified here so that no superpixel
-      // will have the tag zero.
+  assert(superpixelArena.size() == 0);
+  
+  // Bands smaller than this are not worth a thread
+  
+  const int minRowsPerBand = 32;
+  
+  if (numThreads == 0) {
+    numThreads = thread::hardware_concurrency();
+  }
+  
+  int numBands = mini((int) numThreads, tags.rows / minRowsPerBand);
+  
+  if (numBands < 1) {
+    numBands = 1;
+  }
+  
+  ConcurrentTagRanks tagRanks;
+  
+  atomic<bool> invalidTag(false);
+  
+  superpixelParseRowBands(tags.rows, numBands, [&](int band, int startRow, int endRow) {
+    for( int y = startRow; y < endRow; y++ ) {
+      Vec3b *rowPtr = tags.ptr<Vec3b>(y);
       
-      if (1) {
+      for( int x = 0; x < tags.cols; x++ ) {
+        int32_t tag = Vec3BToUID(rowPtr[x]);
+        
         // Note that an input tag value must always be smaller than 0x00FFFFFF
         // since this logic will implicitly add 1 to each pixel value to make
         // sure that zero is not used as a valid tag value while processing.
@@ -102,46 +212,180 @@ bool SuperpixelImage::parse(Mat &tags, SuperpixelImage &spImage) {
         // can be used.
         
         if (tag == 0xFFFFFF) {
-          cerr << "error : tag pixel has the value 0xFFFFFF which is not supported" << endl;
-          return false;
+          invalidTag = true;
+          continue;
         }
-        assert(tag < 0x00FFFFFF);
+        
         tag += 1;
+        
+        Vec3b &tagVec = rowPtr[x];
         tagVec[0] = tag & 0xFF;
         tagVec[1] = (tag >> 8) & 0xFF;
         tagVec[2] = (tag >> 16) & 0xFF;
-        tags.at<Vec3b>(y, x) = tagVec;
+        
+        tagRanks.mark(tag);
       }
+    }
+  });
+  
+  if (invalidTag) {
+    cerr << "error : tag pixel has the value 0xFFFFFF which is not supported" << endl;
+    return false;
+  }
+  
+  vector<int32_t> denseTags;
+  
+  tagRanks.finish(denseTags);
+  
+  int32_t numLabels = (int32_t) denseTags.size();
+  
+  // Row span counts for each dense index in each band, these become the
+  // offset each band starts writing spans at. A span begins wherever the tag
+  // differs from the pixel to the left.
+  
+  vector<vector<int32_t> > bandOffsets(numBands);
+  
+  superpixelParseRowBands(tags.rows, numBands, [&](int band, int startRow, int endRow) {
+    vector<int32_t> &counts = bandOffsets[band];
+    counts.resize(numLabels, 0);
+    
+    for( int y = startRow; y < endRow; y++ ) {
+      const Vec3b *rowPtr = tags.ptr<Vec3b>(y);
       
-      auto iter = tagToSuperpixelMap.find(tag);
+      for( int x = 0; x < tags.cols; x++ ) {
+        if (x == 0 || rowPtr[x] != rowPtr[x - 1]) {
+          counts[tagRanks.rank(Vec3BToUID(rowPtr[x]))] += 1;
+        }
+      }
+    }
+  });
+  
+  // Dense indexes in the arena are the same as the dense indexes used here
+  
+  superpixelArena.reset(denseTags);
+  
+  vector<Superpixel*> spPtrs(numLabels);
+  
+  for ( int32_t label = 0; label < numLabels; label++ ) {
+    int32_t numSpans = 0;
+    
+    for ( int band = 0; band < numBands; band++ ) {
+      int32_t count = bandOffsets[band][label];
+      bandOffsets[band][label] = numSpans;
+      numSpans += count;
+    }
+    
+    int32_t tag = denseTags[label];
+    
+    Superpixel *spPtr = &superpixelArena.atIndex(label);
+    spPtr->coords.resizeSpans(numSpans);
+    spPtrs[label] = spPtr;
+    
+    superpixels.insert(superpixels.end(), tag);
+  }
+  
+  // Two pixels are neighbors when one is in the 8 pixels around the other.
+  // Since this is symmetric only the 4 offsets that come later in scan order
+  // need to be checked, each pair found is added in both directions by the
+  // edge table. A pair that is the same as the last pair found at the same
+  // offset is skipped since region borders produce long runs of the same pair.
+  
+  vector<vector<pair<int32_t, int32_t> > > bandEdges(numBands);
+  
+  superpixelParseRowBands(tags.rows, numBands, [&](int band, int startRow, int endRow) {
+    vector<int32_t> &offsets = bandOffsets[band];
+    vector<pair<int32_t, int32_t> > &edges = bandEdges[band];
+    
+    const int numOffsets = 4;
+    
+    pair<int32_t, int32_t> lastPairs[numOffsets];
+    
+    for (int i = 0; i < numOffsets; i++) {
+      lastPairs[i] = make_pair(-1, -1);
+    }
+    
+    auto addEdge = [&](int i, int32_t labelA, int32_t labelB) {
+      if (labelA != labelB) {
+        pair<int32_t, int32_t> p(labelA, labelB);
+        if (p != lastPairs[i]) {
+          lastPairs[i] = p;
+          edges.push_back(p);
+        }
+      }
+    };
+    
+    // Dense indexes of the current row and the row below it
+    
+    vector<int32_t> rowLabels(tags.cols);
+    vector<int32_t> nextRowLabels(tags.cols);
+    
+    auto labelRow = [&](int y, vector<int32_t> &labels) {
+      const Vec3b *rowPtr = tags.ptr<Vec3b>(y);
+      for( int x = 0; x < tags.cols; x++ ) {
+        labels[x] = tagRanks.rank(Vec3BToUID(rowPtr[x]));
+      }
+    };
+    
+    if (startRow < endRow) {
+      labelRow(startRow, rowLabels);
+    }
+    
+    for( int y = startRow; y < endRow; y++ ) {
+      bool hasNextRow = (y + 1 < tags.rows);
+      
+      if (hasNextRow) {
+        labelRow(y + 1, nextRowLabels);
+      }
+      
+      CoordSpan *spanPtr = NULL;
       
-      if (iter == tagToSuperpixelMap.end()) {
-        // A Superpixel has not been created for this UID since no key
-        // exists in the table. Create a superpixel and wrap into a
-        // unique smart pointer so that the table contains the only
-        // live object reference to the Superpixel object.
+      for( int x = 0; x < tags.cols; x++ ) {
+        int32_t label = rowLabels[x];
         
-        if (debug) {
-          cout << "create Superpixel for UID " << tag << endl;
+        if (x == 0 || label != rowLabels[x - 1]) {
+          spanPtr = &spPtrs[label]->coords.spanAt(offsets[label]++);
+          spanPtr->y = y;
+          spanPtr->x0 = x;
         }
+        spanPtr->x1 = x;
         
-        Superpixel *spPtr = new Superpixel(tag);
-        iter = tagToSuperpixelMap.insert(iter, make_pair(tag, spPtr));
-        superpixels.insert(tag);
-      } else {
-        if (debug) {
-          cout << "exists  Superpixel for UID " << tag << endl;
+        if (x + 1 < tags.cols) {
+          addEdge(0, label, rowLabels[x + 1]);
+        }
+        
+        if (hasNextRow) {
+          if (x > 0) {
+            addEdge(1, label, nextRowLabels[x - 1]);
+          }
+          addEdge(2, label, nextRowLabels[x]);
+          if (x + 1 < tags.cols) {
+            addEdge(3, label, nextRowLabels[x + 1]);
+          }
         }
       }
-
-      Superpixel *spPtr = iter->second;
-      assert(spPtr->tag == tag);
       
-      spPtr->appendCoord(x, y);
+      rowLabels.swap(nextRowLabels);
     }
+  });
+  
+  for ( Superpixel *spPtr : spPtrs ) {
+    spPtr->coords.recount();
   }
-
-  assert(superpixels.size() == tagToSuperpixelMap.size());
+  
+  // Join the band edges into the first band
+  
+  {
+    vector<pair<int32_t, int32_t> > &edges = bandEdges[0];
+    
+    for ( int band = 1; band < numBands; band++ ) {
+      append_to_vector(edges, bandEdges[band]);
+      vector<pair<int32_t, int32_t> >().swap(bandEdges[band]);
+    }
+    
+    spImage.edgeTable.buildWithNodeIndexes(denseTags, edges);
+  }
+  
+  assert(superpixels.size() == superpixelArena.size());
   
   // Print superpixel info
   
@@ -151,8 +395,8 @@ bool SuperpixelImage::parse(Mat &tags, SuperpixelImage &spImage) {
     for (auto it = superpixels.begin(); it != superpixels.end(); ++it) {
       int32_t tag = *it;
       
-      assert(tagToSuperpixelMap.count(tag) > 0);
-      Superpixel *spPtr = tagToSuperpixelMap[tag];
+      assert(superpixelArena.count(tag) > 0);
+      Superpixel *spPtr = superpixelArena.find(tag);
       
       cout << "superpixel UID = " << tag << " contains " << spPtr->coords.size() << " coords" << endl;
       
@@ -164,189 +408,82 @@ bool SuperpixelImage::parse(Mat &tags, SuperpixelImage &spImage) {
     }
   }
   
-  // Generate edges for each superpixel by looking at superpixel UID's around a given X,Y coordinate
-  // and determining the other superpixels that are connected to each superpixel.
+#if defined(DEBUG)
+  
+  // Every superpixel must have at least 1 neighbor or the input is invalid, unless there
+  // is only 1 superpixel to begin with which could happen if all input was same pixel.
   
-  bool worked = SuperpixelImage::parseSuperpixelEdges(tags, spImage);
+  assert(spImage.edgeTable.size() == superpixels.size());
   
-  if (!worked) {
-    return false;
+  if (superpixels.size() > 1) {
+    for ( int32_t tag : superpixels ) {
+      SuperpixelNeighbors neighborsOfNeighborSet = spImage.edgeTable.getNeighborsSpan(tag);
+      assert(neighborsOfNeighborSet.size() > 0);
+    }
   }
   
-  // Deallocate original input tags image since it could be quite large
+  if (debug) {
+    cout << "created " << spImage.edgeTable.getAllEdges().size() << " edges in edge table" << endl;
+  }
   
-  //tags.release();
+#endif // DEBUG
   
   return true;
 }
 
-// Examine superpixels in an image and parse edges from the superpixel coords
+// Parse and then compute superpixel stats from the input pixels
 
-bool SuperpixelImage::parseSuperpixelEdges(Mat &tags, SuperpixelImage &spImage) {
-  const bool debug = false;
-  
-#if defined(DEBUG)
-  auto &superpixels = spImage.superpixels;
-#endif // DEBUG
+bool SuperpixelImage::parse(Mat &tags, const Mat &inputImg, SuperpixelImage &spImage, unsigned int numThreads) {
+  if (!parse(tags, spImage, numThreads)) {
+    return false;
+  }
   
-  SuperpixelEdgeTable &edgeTable = spImage.edgeTable;
+  spImage.computeStats(inputImg, numThreads);
   
-  // For each (X,Y) tag value find all the other tags defined in suppounding 8 pixels
-  // and dedup the list of neighbor tags for each superpixel.
+  return true;
+}
 
-  int32_t neighborOffsetsArr[] = {
-    -1, -1, // UL
-     0, -1, // U
-     1, -1, // UR
-    -1,  0, // L
-     1,  0, // R
-    -1,  1, // DL
-     0,  1, // D
-     1,  1  // DR
-  };
+// Each band of dense indexes is handled by one thread so that each superpixel is
+// only written by one thread, the spans of a superpixel are read in row order.
+
+void SuperpixelImage::computeStats(const Mat &inputImg, unsigned int numThreads) {
+  TRACE_SPAN("SuperpixelImage::computeStats");
   
-  vector<pair<int32_t, int32_t> > neighborOffsets;
+  assert(inputImg.type() == CV_8UC3);
   
-  for (int i = 0; i < sizeof(neighborOffsetsArr)/sizeof(int32_t); i += 2) {
-    pair<int32_t,int32_t> p(neighborOffsetsArr[i], neighborOffsetsArr[i+1]);
-    neighborOffsets.push_back(p);
-  }
+  // Bands smaller than this are not worth a thread
   
-  assert(neighborOffsets.size() == 8);
+  const int minIndexesPerBand = 256;
   
-  unordered_map<int32_t, set<int32_t> > &tagToNeighborMap = edgeTable.getNeighborsRef();
-
-  for( int y = 0; y < tags.rows; y++ ) {
-    for( int x = 0; x < tags.cols; x++ ) {
-      Vec3b tagVec = tags.at<Vec3b>(y, x);
-      
-      int32_t centerTag = Vec3BToUID(tagVec);
-      
-      if (debug) {
-      cout << "center (" << x << "," << y << ") with tag " << centerTag << endl;
-      }
-      
-      auto iter = tagToNeighborMap.find(centerTag);
-      
-      if (iter == tagToNeighborMap.end()) {
-        // A Superpixel has not been created for this UID since no key
-        // exists in the table.
-        
-        if (debug) {
-          cout << "create neighbor vector for UID " << centerTag << endl;
-        }
-        
-        set<int32_t> neighbors;
-        iter = tagToNeighborMap.insert(iter, make_pair(centerTag, neighbors));
-      } else {
-        if (debug) {
-          cout << "exits  neighbor vector for UID " << centerTag << endl;
-        }
-      }
-      
-      set<int32_t> &neighborUIDsSet = iter->second;
-
-      // Loop over each neighbor around (X,Y) and lookup tag
-      
-      for (auto pairIter = neighborOffsets.begin() ; pairIter != neighborOffsets.end(); ++pairIter) {
-        int dX = pairIter->first;
-        int dY = pairIter->second;
-        
-        int foundNeighborUID;
-        
-        int nX = x + dX;
-        int nY = y + dY;
-        
-        if (nX < 0 || nX >= tags.cols) {
-          foundNeighborUID = -1;
-        } else if (nY < 0 || nY >= tags.rows) {
-          foundNeighborUID = -1;
-        } else {
-          Vec3b neighborTagVec = tags.at<Vec3b>(nY, nX);
-          foundNeighborUID = Vec3BToUID(neighborTagVec);
-        }
-
-        if (foundNeighborUID == -1 || foundNeighborUID == centerTag) {
-          if (debug) {
-            cout << "ignoring (" << nX << "," << nY << ") with tag " << foundNeighborUID << " since invalid or identity" << endl;
-          }
-        } else {
-          if (debug) {
-            cout << "checking (" << nX << "," << nY << ") with tag " << foundNeighborUID << " to see if known neighbor" << endl;
-          }
-          
-          // if (!found) add_to_set()
-          
-          auto findIter = neighborUIDsSet.find(foundNeighborUID);
-          
-          if (findIter == neighborUIDsSet.end()) {
-            neighborUIDsSet.insert(findIter, foundNeighborUID);
-            
-            if (debug) {
-            cout << "added new neighbor tag " << foundNeighborUID << endl;
-            }
-          }
-        }
-      }
-      
-      if (debug) {
-        cout << "after searching all neighbors of (" << x << "," << y << ") the neighbors array (len " << neighborUIDsSet.size() << ") is:" << endl;
-        
-        for ( int32_t knownNeighborUID : neighborUIDsSet ) {
-          cout << knownNeighborUID << endl;
-        }
-      }
-      
-    }
+  if (numThreads == 0) {
+    numThreads = thread::hardware_concurrency();
   }
   
-#if defined(DEBUG)
+  int32_t numIndexes = superpixelArena.numIndexes();
   
-  // Each superpixel now has a vector of values for each neighbor. Create unique list of edges by
-  // iterating over the superpixels and only creating an edge object when a pair (A, B) is
-  // found where A < B.
+  int numBands = mini((int) numThreads, numIndexes / minIndexesPerBand);
   
-  for (auto it = superpixels.begin(); it != superpixels.end(); ++it) {
-    int32_t tag = *it;
-    
-    // Foreach superpixel, collect all the connected neighbors and generate edges
-    
-    assert(tagToNeighborMap.count(tag) > 0);
-    
-    auto &neighborUIDsSet = tagToNeighborMap[tag];
-
-    if (debug) {
-    cout << "superpixel UID = " << tag << " neighbors len = " << neighborUIDsSet.size() << endl;
-    }
-    
-    // Every superpixel must have at least 1 neighbor or the input is invalid, unless there
-    // is only 1 superpixel to begin with which could happen if all input was same pixel.
-    
-    if (superpixels.size() > 1) {
-      assert(neighborUIDsSet.size() > 0);
-    }
-    
-    // edgeTable.setNeighbors(tag, neighborUIDsSet);
-  }
-  
-  if (debug) {
-    cout << "created " << edgeTable.getAllEdges().size() << " edges in edge table" << endl;
+  if (numBands < 1) {
+    numBands = 1;
   }
   
-#endif // DEBUG
-
-  // Final verification
-  
-#if defined(DEBUG)
-  if (superpixels.size() > 1) {
-    for ( int32_t tag : superpixels ) {
-      set<int32_t> &neighborsOfNeighborSet = spImage.edgeTable.getNeighborsSet(tag);
-      assert(neighborsOfNeighborSet.size() > 0);
+  superpixelParseRowBands(numIndexes, numBands, [&](int band, int startIndex, int endIndex) {
+    for ( int32_t index = startIndex; index < endIndex; index++ ) {
+      Superpixel &sp = superpixelArena.atIndex(index);
+      
+      sp.resetStats();
+      
+      if (sp.tag == 0) {
+        continue;
+      }
+      
+      for ( const CoordSpan &span : sp.coords.getSpans() ) {
+        sp.addPixelsToStats(inputImg.ptr<Vec3b>(span.y) + span.x0, span.x1 - span.x0 + 1);
+      }
     }
-  }
-#endif // DEBUG
+  });
   
-  return true;
+  statsValid = true;
 }
 
 void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
@@ -406,8 +543,12 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
     cout << "will merge " << srcPtr->coords.size() << " coords from smaller into larger superpixel" << endl;
   }
 
-  append_to_vector(dstPtr->coords, srcPtr->coords);
-  srcPtr->coords.resize(0);
+  if (statsValid) {
+    dstPtr->mergeStats(*srcPtr);
+  }
+  
+  dstPtr->coords.append(srcPtr->coords);
+  srcPtr->coords.release();
   
   // This logic assumes that the superpixels list is in increasing int order since the
   // parse logic explicitly sorts the generated tags. As superpixels are merged the
@@ -433,9 +574,6 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
   assert (numErased == 1);
 
   bool hasEdgeStrengthMap;
-  int numRemoved;
-  
-  // Remove edge between src and dst by removing src from dst neighbors set
 
   hasEdgeStrengthMap = (edgeTable.edgeStrengthMap.size() > 0);
   
@@ -445,150 +583,42 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
     edgeTable.edgeStrengthMap.erase(cachedKey);
   }
   
-  set<int32_t> &neighborsOfDst = edgeTable.getNeighborsSet(dstPtr->tag);
-  
-  if (debug) {
-    cout << "initial dst neighbor set :" << endl;
-    for ( int32_t neighborTag : neighborsOfDst ) {
-      cout << neighborTag << endl;
-    }
-  }
-  
 #if defined(DEBUG)
   {
-  // Verify that src is a neighbor of dst
+  // Verify that src is a neighbor of dst and dst is a neighbor of src
   assert(srcPtr->tag > 0);
+  assert(dstPtr->tag > 0);
   
-  bool found = false;
-  for ( int32_t neighborOfDstTag : neighborsOfDst ) {
-    if (neighborOfDstTag == srcPtr->tag) {
-      found = true;
-    }
-  }
-  assert(found);
-  }
-#endif // DEBUG
-  
-  // Remove src tag from neighbors of dst set
-  
-  numRemoved = (int) neighborsOfDst.erase(srcPtr->tag);
-  assert(numRemoved == 1);
-  
-#if defined(DEBUG)
-  if (superpixels.size() > 1) {
-    assert(neighborsOfDst.size() > 0);
+  assert(edgeTable.getNeighborsSpan(dstPtr->tag).count(srcPtr->tag) == 1);
+  assert(edgeTable.getNeighborsSpan(srcPtr->tag).count(dstPtr->tag) == 1);
   }
 #endif // DEBUG
   
-  if (debug) {
-    cout << "final dst neighbor set :" << endl;
-    for ( int32_t neighborTag : neighborsOfDst ) {
-      cout << neighborTag << endl;
-    }
-  }
-  
-  // Update neighbors of src by adding dst as a neighbor.
-  // In the case where dst is already a neighbor,
-  // the duplicate entry in the set is ignored.
-  
   if (hasEdgeStrengthMap) {
     // Clear edge strength cache of src->dst edge
     SuperpixelEdge cachedKey(srcPtr->tag, dstPtr->tag);
     edgeTable.edgeStrengthMap.erase(cachedKey);
   }
   
-  set<int32_t> &neighborsOfSrc = edgeTable.getNeighborsSet(srcPtr->tag);
+  // Neighbors of src become neighbors of dst, each neighbor of src gets dst
+  // as a neighbor in place of src and the src node is removed.
   
-  if (debug) {
-    cout << "all neighbors of src = " << srcPtr->tag << endl;
-    for ( int32_t neighborTag : neighborsOfSrc ) {
-      cout << neighborTag << endl;
-    }
-  }
+  edgeTable.mergeNeighbors(srcPtr->tag, dstPtr->tag);
   
 #if defined(DEBUG)
-  {
-  // Verify that dst is a neighbor of src
-  assert(dstPtr->tag > 0);
-  
-  bool found = false;
-  for ( int32_t neighborOfSrcTag : neighborsOfSrc ) {
-    if (neighborOfSrcTag == dstPtr->tag) {
-      found = true;
-    }
-  }
-  assert(found);
+  if (superpixels.size() > 1) {
+    assert(edgeTable.getNeighborsSpan(dstPtr->tag).size() > 0);
   }
 #endif // DEBUG
   
-  for ( int32_t neighborOfSrcTag : neighborsOfSrc ) {
-    if (debug) {
-      cout << "iter neighbor of src = " << neighborOfSrcTag << endl;
-    }
-   
-    if (neighborOfSrcTag == dstPtr->tag) {
-      // Ignore dst so that src is deleted as a neighbor
-      
-      if (debug) {
-        cout << "ignore neighbor of src since it is the dst node" << endl;
-      }
-    } else {
-      set<int32_t> &neighbors = edgeTable.getNeighborsSet(neighborOfSrcTag);
-      
-      if (debug) {
-        cout << "update neighbor of src " << neighborOfSrcTag << endl;
-        cout << "initial neighbor of src neighbor set :" << endl;
-        for ( int32_t neighborTag : neighbors ) {
-          cout << neighborTag << endl;
-        }
-      }
-      
-      // Add edge between neighbor and dst (if it does not exist)
-      
-      neighbors.insert(dstPtr->tag);
-      
-      // Remove edge between neighbor and src
-      
-      numRemoved = (int) neighbors.erase(srcPtr->tag);
-      assert(numRemoved == 1);
-      
-#if defined(DEBUG)
-      assert(neighbors.size() > 0);
-#endif // DEBUG
-      
-      if (debug) {
-        cout << "final neighbor of src neighbor set :" << endl;
-        for ( int32_t neighborTag : neighbors ) {
-          cout << neighborTag << endl;
-        }
-      }
-      
-      // If this neighbor is not currently a neighbor of dst then
-      // add it now with an add that is a nop for duplicate entries
-      
-      neighborsOfDst.insert(neighborOfSrcTag);
-      
-      if (debug) {
-        cout << "final neighbors dst set :" << endl;
-        for ( int32_t neighborTag : neighborsOfDst ) {
-          cout << neighborTag << endl;
-        }
-      }
-    }
-  }
-  
   if (debug) {
     cout << "final edge results for merged UID " << dstPtr->tag << endl;
     
-    set<int32_t> &neighbors = edgeTable.getNeighborsSet(dstPtr->tag);
-    
     cout << "final dst neighbor set :" << endl;
-    for ( int32_t neighborTag : neighbors ) {
+    for ( int32_t neighborTag : edgeTable.getNeighborsSpan(dstPtr->tag) ) {
       cout << neighborTag << endl;
     }
   }
-    
-  edgeTable.removeNeighbors(srcPtr->tag);
   
   // Move edge weights from src to dst
   
@@ -600,11 +630,10 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
     append_to_vector(dstPtr->unmergedEdgeWeights, srcPtr->unmergedEdgeWeights);
   }
   
-  // Finally remove the Superpixel object from the lookup table and free the memory
+  // Finally mark the Superpixel object as dead in the arena and free its coords
   
   int32_t tagToRemove = srcPtr->tag;
-  tagToSuperpixelMap.erase(tagToRemove);
-  delete srcPtr;
+  superpixelArena.remove(tagToRemove);
   
 #if defined(DEBUG)
   // When compiled in DEBUG mode in Xcode enable additional runtime checks that
@@ -615,7 +644,7 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
   dstPtr = getSuperpixelPtr(dstPtr->tag);
   assert(dstPtr != NULL);
   
-  for ( int32_t neighborTag : edgeTable.getNeighborsSet(dstPtr->tag)) {
+  for ( int32_t neighborTag : edgeTable.getNeighborsSpan(dstPtr->tag)) {
     // Make sure that each neighbor of the merged superpixel also has the merged superpixel
     // as a neighbor.
     
@@ -624,7 +653,7 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
     
     bool found = false;
     
-    for ( int32_t nnTag : edgeTable.getNeighborsSet(neighborTag) ) {
+    for ( int32_t nnTag : edgeTable.getNeighborsSpan(neighborTag) ) {
       if (nnTag == dstPtr->tag) {
         found = true;
         break;
@@ -645,7 +674,7 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
     
     // Check that src is not a neighbor of any superpixel
     
-    set<int32_t> &neighbors = edgeTable.getNeighborsSet(tag);
+    SuperpixelNeighbors neighbors = edgeTable.getNeighborsSpan(tag);
     
     for ( int32_t neighborTag : neighbors ) {
       if (neighborTag == tagToRemove) {
@@ -658,26 +687,6 @@ void SuperpixelImage::mergeEdge(SuperpixelEdge &edgeToMerge) {
   return;
 }
 
-// Lookup Superpixel* given a UID, checks to make sure key is defined in table in DEBUG mode
-
-Superpixel* SuperpixelImage::getSuperpixelPtr(int32_t uid)
-{
-  TagToSuperpixelMap::iterator iter = tagToSuperpixelMap.find(uid);
-  
-  if (iter == tagToSuperpixelMap.end()) {
-    // In the event that a superpixel was merged into a neighbor during an iteration
-    // over a list of known superpixel then this method could be invoked with a uid
-    // that is no longer valid. Return NULL to make it possible to detect this case.
-    
-    return NULL;
-  } else {
-    // Otherwise the key exists in the table, return the cached pointer to
-    // avoid a second lookup because this method is invoked a lot.
-    
-    return iter->second;
-  }
-}
-
 // Scan superpixels looking for the case where all pixels in one superpixel exactly match all
 // the superpixels in a neighbor superpixel. This exact matching situation can happen in flat
 // image areas so removing the duplication can significantly simplify the graph before the
@@ -696,6 +705,13 @@ void SuperpixelImage::mergeIdenticalSuperpixels(Mat &inputImg) {
   vector<int32_t> identicalSuperpixels;
   identicalSuperpixels.reserve(4096);
   
+  // The all same pixel checks answer from the stats, so compute them once
+  // here unless the caller already did when parsing.
+  
+  if (!hasStats()) {
+    computeStats(inputImg);
+  }
+  
   for (auto it = superpixels.begin(); it != superpixels.end(); ++it) {
     int32_t tag = *it;
     
@@ -736,25 +752,24 @@ void SuperpixelImage::mergeIdenticalSuperpixels(Mat &inputImg) {
     
     // Iterate over all neighbor superpixels and verify that all those pixels match
     // the first pixel value from the known identical superpixel. This loop invokes
-    // merge during the loop so the list of neighbors needs to be a copy of the
-    // neighbors list since the neighbors list can be changed by the merge.
-    
-    auto &neighborsSet = edgeTable.getNeighborsSet(tag);
+    // merge during the loop and a merge changes the neighbors list, so the loop
+    // continues from the next neighbor tag instead of holding a span.
     
     if (debug) {
       cout << "found neighbors of known identical superpixel " << tag << endl;
       
-      for ( int32_t neighborTag : neighborsSet ) {
+      for ( int32_t neighborTag : edgeTable.getNeighborsSpan(tag) ) {
         cout << "neighbor " << neighborTag << endl;
       }
     }
     
     bool mergedNeighbor = false;
     
-    for ( auto neighborIter = neighborsSet.begin(); neighborIter != neighborsSet.end(); ) {
-      int32_t neighborTag = *neighborIter;
-      // Advance the iterator to the next neighbor before a possible merge
-      ++neighborIter;
+    int32_t nextNeighborTag;
+    
+    for ( int32_t neighborTag = edgeTable.getNeighborAfter(tag, -1); neighborTag != -1; neighborTag = nextNeighborTag ) {
+      // Find the next neighbor before a possible merge
+      nextNeighborTag = edgeTable.getNeighborAfter(tag, neighborTag);
 
       bool isAllSame = isAllSamePixels(inputImg, spPtr, neighborTag);
       
@@ -852,6 +867,12 @@ SuperpixelImage::checkPredicate(Mat &input, Superpixel *spPtr, int32_t otherTag)
 void SuperpixelImage::mergeSuperpixelsWithPredicate(Mat &inputImg) {
   const bool debug = true;
   
+  // isAllSamePixels() below reads the stats instead of the pixels
+  
+  if (!hasStats()) {
+    computeStats(inputImg);
+  }
+  
   // Do initial scan of all the superpixels looking for superpixels that
   // are known to be identical so that an optimal branch in the predicate
   // search logic need not scan every pixel in this special case.
@@ -902,22 +923,23 @@ void SuperpixelImage::mergeSuperpixelsWithPredicate(Mat &inputImg) {
     
     // Iterate over all neighbor superpixels and do merge based on criteria
     
-    auto &neighborsSet = edgeTable.getNeighborsSet(tag);
-    
     if (debug) {
-      cout << "found " << neighborsSet.size() << " neighbors of superpixel " << tag << endl;
+      SuperpixelNeighbors neighbors = edgeTable.getNeighborsSpan(tag);
       
-      for ( int32_t neighborTag : neighborsSet ) {
+      cout << "found " << neighbors.size() << " neighbors of superpixel " << tag << endl;
+      
+      for ( int32_t neighborTag : neighbors ) {
         cout << "neighbor " << neighborTag << endl;
       }
     }
     
     bool mergedNeighbor = false;
     
-    for ( auto neighborIter = neighborsSet.begin(); neighborIter != neighborsSet.end(); ) {
-      int32_t neighborTag = *neighborIter;
-      // Advance the iterator to the next neighbor before a possible merge
-      ++neighborIter;
+    int32_t nextNeighborTag;
+    
+    for ( int32_t neighborTag = edgeTable.getNeighborAfter(tag, -1); neighborTag != -1; neighborTag = nextNeighborTag ) {
+      // Find the next neighbor before a possible merge
+      nextNeighborTag = edgeTable.getNeighborAfter(tag, neighborTag);
       
       bool doMerge = checkPredicate(inputImg, spPtr, neighborTag);
       
@@ -973,17 +995,20 @@ SuperpixelImage::sortSuperpixelsBySize()
 {
   const bool debug = false;
   
-  vector<SuperpixelSortStruct> sortedSuperpixels;
+  // Sort (-N, tag) pairs in increasing order, this puts the largest superpixel
+  // first and breaks ties by increasing tag without following a pointer
+  // in each compare.
+  
+  vector<pair<int32_t, int32_t> > sortedSuperpixels;
   sortedSuperpixels.reserve(superpixels.size());
   
   for (auto it = superpixels.begin(); it != superpixels.end(); ++it) {
     int32_t tag = *it;
-    SuperpixelSortStruct ss;
-    ss.spPtr = getSuperpixelPtr(tag);
-    sortedSuperpixels.push_back(ss);
+    Superpixel *spPtr = getSuperpixelPtr(tag);
+    sortedSuperpixels.push_back(make_pair(-((int32_t) spPtr->coords.size()), tag));
   }
   
-  sort(sortedSuperpixels.begin(), sortedSuperpixels.end(), CompareSuperpixelSizeDecreasingFunc);
+  sort(sortedSuperpixels.begin(), sortedSuperpixels.end());
   
   assert(sortedSuperpixels.size() == superpixels.size());
   
@@ -993,13 +1018,12 @@ SuperpixelImage::sortSuperpixelsBySize()
   retVec.reserve(superpixels.size());
   
   for (auto it = sortedSuperpixels.begin(); it != sortedSuperpixels.end(); ++it, i++) {
-    SuperpixelSortStruct ss = *it;
-    int32_t tag = ss.spPtr->tag;
+    int32_t tag = it->second;
 
     retVec.push_back(tag);
     
     if (debug) {
-      cout << "sorted superpixel at offset " << i << " now has tag " << tag << " with N = " << ss.spPtr->coords.size() << endl;
+      cout << "sorted superpixel at offset " << i << " now has tag " << tag << " with N = " << -(it->first) << endl;
     }
   }
   
@@ -1453,15 +1477,7 @@ void SuperpixelImage::fillMatrixWithSuperpixelTags(Mat &outputTagsImg) {
     Superpixel *spPtr = getSuperpixelPtr(tag);
     assert(spPtr);
     
-    auto &coords = spPtr->coords;
-    
-    Vec3b tagVec = PixelToVec3b(tag);
-    
-    for ( Coord coord : coords ) {
-      int32_t X = coord.x;
-      int32_t Y = coord.y;
-      outputTagsImg.at<Vec3b>(Y, X) = tagVec;
-    }
+    Superpixel_fillSpans(outputTagsImg, spPtr->coords, PixelToVec3b(tag));
   }
 }
 
@@ -1473,6 +1489,10 @@ bool SuperpixelImage::isAllSamePixels(Mat &input, int32_t tag) {
   
   Superpixel *spPtr = getSuperpixelPtr(tag);
   
+  if (hasStats()) {
+    return spPtr->statsAllSame();
+  }
+  
   auto &coords = spPtr->coords;
   
   if (debug) {
@@ -1481,7 +1501,7 @@ bool SuperpixelImage::isAllSamePixels(Mat &input, int32_t tag) {
     cout << "checking for superpixel all same pixels for " << tag << " with coords N=" << numCoords << endl;
   }
   
-  Coord coord = coords[0];
+  Coord coord = coords.front();
   int32_t X = coord.x;
   int32_t Y = coord.y;
   Vec3b pixelVec = input.at<Vec3b>(Y, X);
@@ -1516,9 +1536,17 @@ bool SuperpixelImage::isAllSamePixels(Mat &input, Superpixel *spPtr, int32_t oth
     return false;
   }
   
+  // With stats the other superpixel matches when it is all one value and that
+  // value is the same as the value of all the pixels in this superpixel.
+  
+  if (hasStats()) {
+    return otherSpPtr->statsAllSame() &&
+      memcmp(otherSpPtr->stats.minValue, spPtr->stats.minValue, sizeof(spPtr->stats.minValue)) == 0;
+  }
+  
   // Get pixel value from first coord in first superpixel
   
-  Coord coord = spPtr->coords[0];
+  Coord coord = spPtr->coords.front();
   int32_t X = coord.x;
   int32_t Y = coord.y;
   Vec3b pixelVec = input.at<Vec3b>(Y, X);
@@ -1529,7 +1557,7 @@ bool SuperpixelImage::isAllSamePixels(Mat &input, Superpixel *spPtr, int32_t oth
   // against the first value in otherSpPtr->coords.
   
   if (otherSpPtr->isAllSame()) {
-    Coord coord = otherSpPtr->coords[0];
+    Coord coord = otherSpPtr->coords.front();
     int32_t X = coord.x;
     int32_t Y = coord.y;
     
@@ -1610,6 +1638,29 @@ bool SuperpixelImage::isAllSamePixels(Mat &input, uint32_t knownFirstPixel, vect
   return true;
 }
 
+// Compare each row span to the known pixel, pixels in a span are contiguous
+// in the row so the scan reads memory in order.
+
+bool SuperpixelImage::isAllSamePixels(Mat &input, uint32_t knownFirstPixel, const CoordSpans &coords) {
+  assert(coords.size() > 0);
+  
+  // FIXME: 32BPP support
+  
+  Vec3b knownVec = PixelToVec3b(knownFirstPixel);
+  
+  for ( const CoordSpan &span : coords.getSpans() ) {
+    const Vec3b *rowPtr = input.ptr<Vec3b>(span.y);
+    
+    for ( int x = span.x0; x <= span.x1; x++ ) {
+      if (rowPtr[x] != knownVec) {
+        return false;
+      }
+    }
+  }
+  
+  return true;
+}
+
 // Gen a static colortable of a fixed size that contains enough colors to support
 // the number of superpixels defined in the tags.
 
@@ -1657,22 +1708,15 @@ void writeTagsWithStaticColortable(SuperpixelImage &spImage, Mat &resultImg)
     Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
     assert(spPtr);
     
-    auto &coords = spPtr->coords;
+    uint32_t offset = staticTagToOffsetTable[tag];
+    uint32_t pixel = staticColortable[offset];
     
-    for (auto coordsIter = coords.begin(); coordsIter != coords.end(); ++coordsIter) {
-      Coord coord = *coordsIter;
-      int32_t X = coord.x;
-      int32_t Y = coord.y;
-      
-      uint32_t offset = staticTagToOffsetTable[tag];
-      uint32_t pixel = staticColortable[offset];
-      
-      Vec3b tagVec;
-      tagVec[0] = pixel & 0xFF;
-      tagVec[1] = (pixel >> 8) & 0xFF;
-      tagVec[2] = (pixel >> 16) & 0xFF;
-      resultImg.at<Vec3b>(Y, X) = tagVec;
-    }
+    Vec3b tagVec;
+    tagVec[0] = pixel & 0xFF;
+    tagVec[1] = (pixel >> 8) & 0xFF;
+    tagVec[2] = (pixel >> 16) & 0xFF;
+    
+    Superpixel_fillSpans(resultImg, spPtr->coords, tagVec);
   }
 }
 
@@ -1686,22 +1730,15 @@ void writeTagsWithDymanicColortable(SuperpixelImage &spImage, Mat &resultImg, un
     Superpixel *spPtr = spImage.getSuperpixelPtr(tag);
     assert(spPtr);
     
-    auto &coords = spPtr->coords;
+    assert(map.count(tag) > 0);
+    uint32_t pixel = (uint32_t) map[tag];
     
-    for (auto coordsIter = coords.begin(); coordsIter != coords.end(); ++coordsIter) {
-      Coord coord = *coordsIter;
-      int32_t X = coord.x;
-      int32_t Y = coord.y;
-      
-      assert(map.count(tag) > 0);
-      uint32_t pixel = (uint32_t) map[tag];
-      
-      Vec3b tagVec;
-      tagVec[0] = pixel & 0xFF;
-      tagVec[1] = (pixel >> 8) & 0xFF;
-      tagVec[2] = (pixel >> 16) & 0xFF;
-      resultImg.at<Vec3b>(Y, X) = tagVec;
-    }
+    Vec3b tagVec;
+    tagVec[0] = pixel & 0xFF;
+    tagVec[1] = (pixel >> 8) & 0xFF;
+    tagVec[2] = (pixel >> 16) & 0xFF;
+    
+    Superpixel_fillSpans(resultImg, spPtr->coords, tagVec);
   }
 }
 
@@ -1733,15 +1770,7 @@ void writeTagsWithGraytable(SuperpixelImage &spImage, Mat &origImg, Mat &resultI
     
     //cout << "N = " << (int)spPtr->coords.size() << endl;
     
-    auto &coords = spPtr->coords;
-    
-    for (auto coordsIter = coords.begin(); coordsIter != coords.end(); ++coordsIter) {
-      Coord coord = *coordsIter;
-      int32_t X = coord.x;
-      int32_t Y = coord.y;
-      
-      resultImg.at<uint8_t>(Y, X) = gray;
-    }
+    Superpixel_fillSpans(resultImg, spPtr->coords, (uint8_t) gray);
     
     gray++;
   }
@@ -1775,21 +1804,13 @@ void writeTagsWithMinColortable(SuperpixelImage &spImage, Mat &origImg, Mat &res
     
     //cout << "N[" << gray << "] = " << (int)spPtr->coords.size() << endl;
     
-    auto &coords = spPtr->coords;
+    uint8_t B = gray & 0xFF;
+    uint8_t G = (gray >> 8) & 0xFF;
+    uint8_t R = (gray >> 16) & 0xFF;
     
-    for (auto coordsIter = coords.begin(); coordsIter != coords.end(); ++coordsIter) {
-      Coord coord = *coordsIter;
-      int32_t X = coord.x;
-      int32_t Y = coord.y;
-      
-      uint8_t B = gray & 0xFF;
-      uint8_t G = (gray >> 8) & 0xFF;
-      uint8_t R = (gray >> 16) & 0xFF;
-      
-      Vec3b pixelVec(B,G,R);
-      
-      resultImg.at<Vec3b>(Y, X) = pixelVec;
-    }
+    Vec3b pixelVec(B,G,R);
+    
+    Superpixel_fillSpans(resultImg, spPtr->coords, pixelVec);
     
     gray++;
   }
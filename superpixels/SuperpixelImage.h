@@ -17,9 +17,9 @@ class Superpixel;
 class SuperpixelEdge;
 
 #include "Coord.h"
+#include "CoordSpans.h"
 #include "SuperpixelEdgeTable.h"
-
-typedef unordered_map<int32_t, Superpixel*> TagToSuperpixelMap;
+#include "SuperpixelArena.h"
 
 typedef tuple<double, int32_t, int32_t> CompareNeighborTuple;
 
@@ -27,9 +27,10 @@ class SuperpixelImage {
   
   public:
   
-  // This map contains the actual pointers to Superpixel objects.
+  // The arena contains the actual Superpixel objects, each one is at a
+  // dense index in one contiguous array.
   
-  TagToSuperpixelMap tagToSuperpixelMap;
+  SuperpixelArena superpixelArena;
   
   // The superpixels list contains the UIDs for superpixels
   // in UID sorted order.
@@ -41,27 +42,63 @@ class SuperpixelImage {
   
   SuperpixelEdgeTable edgeTable;
   
+  // true once computeStats() has filled the superpixel stats, cleared by
+  // invalidateStats().
+  
+  bool statsValid;
+  
   // This superpixel edge merge order list is only active in DEBUG.
 
 #if defined(DEBUG)
   vector<SuperpixelEdge> mergeOrder;
 #endif
   
-  // Lookup Superpixel* given a UID
+  SuperpixelImage()
+  : statsValid(false)
+  {
+  }
+  
+  // Lookup Superpixel* given a UID, returns NULL when the UID was merged away
 
-  Superpixel* getSuperpixelPtr(int32_t uid);
+  Superpixel* getSuperpixelPtr(int32_t uid) {
+    return superpixelArena.find(uid);
+  }
   
   // Return vector of all edges
   vector<SuperpixelEdge> getEdges();
   
   // Parse tags image and construct superpixels. Note that this method will modify the
-  // original tag values by adding 1 to each original tag value.
+  // original tag values by adding 1 to each original tag value. The image is
+  // scanned in row bands on numThreads threads, 0 means one for each core.
   
   static
-  bool parse(Mat &tags, SuperpixelImage &spImage);
-
+  bool parse(Mat &tags, SuperpixelImage &spImage, unsigned int numThreads = 0);
+  
+  // Parse and then compute the stats of each superpixel from the pixels in inputImg
+  
   static
-  bool parseSuperpixelEdges(Mat &tags, SuperpixelImage &spImage);
+  bool parse(Mat &tags, const Mat &inputImg, SuperpixelImage &spImage, unsigned int numThreads = 0);
+  
+  // Compute count, sums, sum of squares and min and max of each channel for
+  // every superpixel from the pixels in inputImg. Merges then keep the stats
+  // up to date without reading pixels.
+  
+  void computeStats(const Mat &inputImg, unsigned int numThreads = 0);
+  
+  // true when the superpixel stats are valid. The stats describe the image
+  // passed to computeStats(), every method that accepts an input image
+  // assumes it is that image.
+  
+  bool hasStats() const {
+    return statsValid;
+  }
+  
+  // Mark the stats as stale, a caller that writes to the pixels the stats
+  // were computed from or passes a different image must call this first.
+  
+  void invalidateStats() {
+    statsValid = false;
+  }
   
   // Merge superpixels defined by edge in this image container
   
@@ -106,6 +143,8 @@ class SuperpixelImage {
   bool isAllSamePixels(Mat &input, Superpixel *spPtr, int32_t otherTag);
   
   bool isAllSamePixels(Mat &input, uint32_t knownFirstPixel, vector<Coord> &coords);
+  
+  bool isAllSamePixels(Mat &input, uint32_t knownFirstPixel, const CoordSpans &coords);
 
   vector<int32_t> sortSuperpixelsBySize();
   
@@ -10,6 +10,7 @@
 #define SuperpixelMergeManager_hpp
 
 #include "SuperpixelImage.h"
+#include "Log.h"
 
 
 // An instance of SuperpixelMergeManager should extend this class and implement any
@@ -99,8 +100,6 @@ public:
 
 template <class T>
 int SuperpixelMergeManagerFunc(T & mergeManager) {
-  const bool debug = true;
-
   // Setup does one time init and cache logic
   
   mergeManager.setup();
@@ -119,9 +118,7 @@ int SuperpixelMergeManagerFunc(T & mergeManager) {
     int32_t tag = *it;
     
     if (mergeManager.checkProcessed(tag) == false) {
-      if (debug) {
-        cout << "superpixel " << tag << " is already processed" << endl;
-      }
+      LOG(LogModuleMerge, LogLevelTrace) << "superpixel " << tag << " is already processed";
       
       ++it;
       continue;
@@ -133,9 +130,7 @@ int SuperpixelMergeManagerFunc(T & mergeManager) {
       // Check for the edge case of this superpixel being merged into a neighbor as a result
       // of a previous iteration.
       
-      if (debug) {
-        cout << "superpixel " << tag << " was merged away already" << endl;
-      }
+      LOG(LogModuleMerge, LogLevelTrace) << "superpixel " << tag << " was merged away already";
       
       ++it;
       continue;
@@ -148,33 +143,33 @@ int SuperpixelMergeManagerFunc(T & mergeManager) {
     
     // Iterate over all neighbor superpixels and do merge based on criteria
     
-    auto &neighborsSet = mergeManager.spImage.edgeTable.getNeighborsSet(tag);
+    SuperpixelEdgeTable &edgeTable = mergeManager.spImage.edgeTable;
     
-    if (debug) {
-      cout << "found " << neighborsSet.size() << " neighbors of superpixel " << tag << endl;
+    if (logEnabled(LogModuleMerge, LogLevelTrace)) {
+      SuperpixelNeighbors neighbors = edgeTable.getNeighborsSpan(tag);
       
-      for ( int32_t neighborTag : neighborsSet ) {
-        cout << "neighbor " << neighborTag << endl;
+      LogLine() << "found " << neighbors.size() << " neighbors of superpixel " << tag;
+      
+      for ( int32_t neighborTag : neighbors ) {
+        LogLine() << "neighbor " << neighborTag;
       }
     }
     
     bool mergedNeighbor = false;
     
-    for ( auto neighborIter = neighborsSet.begin(); neighborIter != neighborsSet.end(); ) {
-      int32_t neighborTag = *neighborIter;
-      // Advance the iterator to the next neighbor before a possible merge
-      ++neighborIter;
+    int32_t nextNeighborTag;
+    
+    for ( int32_t neighborTag = edgeTable.getNeighborAfter(tag, -1); neighborTag != -1; neighborTag = nextNeighborTag ) {
+      // Find the next neighbor before a possible merge, a merge into tag
+      // changes the neighbors list
+      nextNeighborTag = edgeTable.getNeighborAfter(tag, neighborTag);
       
       bool doMerge = mergeManager.checkEdge(tag, neighborTag);
       
-      if (debug) {
-        cout << "neighbor " << neighborTag << " doMerge -> " << doMerge << endl;
-      }
+      LOG(LogModuleMerge, LogLevelTrace) << "neighbor " << neighborTag << " doMerge -> " << doMerge;
       
       if (doMerge) {
-        if (debug) {
-          cout << "found superpixels " << tag << " and " << neighborTag << " (merging)" << endl;
-        }
+        LOG(LogModuleMerge, LogLevelTrace) << "found superpixels " << tag << " and " << neighborTag << " (merging)";
 
         SuperpixelEdge edge(tag, neighborTag);
         mergeManager.mergeEdge(edge);
@@ -183,9 +178,7 @@ int SuperpixelMergeManagerFunc(T & mergeManager) {
           // In the case where the identical superpixel was merged into a neighbor then
           // the neighbors have changed and this iteration has to end.
           
-          if (debug) {
-            cout << "ending neighbors iteration since " << tag << " was merged into larger neighbor " << neighborTag << endl;
-          }
+          LOG(LogModuleMerge, LogLevelTrace) << "ending neighbors iteration since " << tag << " was merged into larger neighbor " << neighborTag;
           
           mergeManager.mergedInto(neighborTag);
           break;
@@ -198,13 +191,9 @@ int SuperpixelMergeManagerFunc(T & mergeManager) {
     } // end foreach neighbors loop
     
     if (mergedNeighbor) {
-      if (debug) {
-        cout << "repeating merge loop for superpixel " << tag << " since neighbor was merged" << endl;
-      }
+      LOG(LogModuleMerge, LogLevelTrace) << "repeating merge loop for superpixel " << tag << " since neighbor was merged";
     } else {
-      if (debug) {
-        cout << "advance iterator from superpixel " << tag << " since no neighbor was merged" << endl;
-      }
+      LOG(LogModuleMerge, LogLevelTrace) << "advance iterator from superpixel " << tag << " since no neighbor was merged";
 
       mergeManager.doneProcessing(tag);
       
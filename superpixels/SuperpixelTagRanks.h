@@ -0,0 +1,94 @@
+// The dense rank of each tag in a set of tags, that is the number of smaller
+// tags in the set. Looking up a rank is a bitmap popcount instead of a hash
+// lookup, so structures that keep one entry per tag in tag order can use the
+// rank as an index. SuperpixelArena and SuperpixelEdgeTable both index their
+// entries this way, so a tag has the same index in both.
+
+#ifndef SUPERPIXEL_TAG_RANKS_H
+#define	SUPERPIXEL_TAG_RANKS_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+using namespace std;
+
+class SuperpixelTagRanks {
+
+  public:
+
+  SuperpixelTagRanks()
+  : maxTag(-1)
+  {
+  }
+
+  // Replace the set with sortedTags, the tags must be in increasing order
+  // and not negative
+
+  void reset(const vector<int32_t> &sortedTags) {
+    clear();
+
+    int32_t numTags = (int32_t) sortedTags.size();
+
+    if (numTags == 0) {
+      return;
+    }
+
+    maxTag = sortedTags[numTags - 1];
+
+    int32_t numWords = (maxTag >> 6) + 1;
+
+    tagWords.resize(numWords, 0);
+    wordRanks.resize(numWords, 0);
+
+    for ( int32_t tag : sortedTags ) {
+      assert(tag >= 0);
+      tagWords[tag >> 6] |= (uint64_t)1 << (tag & 63);
+    }
+
+    int32_t rank = 0;
+
+    for ( int32_t i = 0; i < numWords; i++ ) {
+      wordRanks[i] = rank;
+      rank += __builtin_popcountll(tagWords[i]);
+    }
+
+    assert(rank == numTags);
+  }
+
+  void clear() {
+    vector<uint64_t>().swap(tagWords);
+    vector<int32_t>().swap(wordRanks);
+
+    maxTag = -1;
+  }
+
+  // Rank of the tag or -1 when the tag is not in the set
+
+  int32_t rank(int32_t tag) const {
+    if (tag < 0 || tag > maxTag) {
+      return -1;
+    }
+
+    uint64_t word = tagWords[tag >> 6];
+    uint64_t bit = (uint64_t)1 << (tag & 63);
+
+    if ((word & bit) == 0) {
+      return -1;
+    }
+
+    return wordRanks[tag >> 6] + __builtin_popcountll(word & (bit - 1));
+  }
+
+  private:
+
+  // Bit for each tag in the set and the number of tags in the words before each word
+
+  vector<uint64_t> tagWords;
+  vector<int32_t> wordRanks;
+
+  int32_t maxTag;
+};
+
+#endif // SUPERPIXEL_TAG_RANKS_H
@@ -0,0 +1,206 @@
+// Trace span buffers and the Chrome trace event JSON writer
+
+#include "Trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+bool traceIsEnabled = false;
+
+typedef struct {
+  const char *name;
+  int32_t tag;
+  int64_t startMicros;
+  int64_t durationMicros;
+} TraceEvent;
+
+typedef struct {
+  int threadId;
+  vector<TraceEvent> events;
+} TraceThreadBuffer;
+
+// Buffers are kept after their thread exits so that all spans can be written
+// at exit, each thread appends to its own buffer without locking.
+
+static mutex traceBuffersLock;
+static vector<TraceThreadBuffer*> traceBuffers;
+static string traceFilename;
+
+static pthread_key_t traceBufferKey;
+static pthread_once_t traceBufferKeyOnce = PTHREAD_ONCE_INIT;
+
+static void traceBufferKeyInit()
+{
+  pthread_key_create(&traceBufferKey, NULL);
+}
+
+static TraceThreadBuffer* traceBuffer()
+{
+  pthread_once(&traceBufferKeyOnce, traceBufferKeyInit);
+
+  TraceThreadBuffer *buffer = (TraceThreadBuffer *) pthread_getspecific(traceBufferKey);
+
+  if (buffer == NULL) {
+    buffer = new TraceThreadBuffer();
+    buffer->events.reserve(1024);
+
+    {
+      lock_guard<mutex> lock(traceBuffersLock);
+      buffer->threadId = (int) traceBuffers.size();
+      traceBuffers.push_back(buffer);
+    }
+
+    pthread_setspecific(traceBufferKey, buffer);
+  }
+
+  return buffer;
+}
+
+int64_t traceNowMicros()
+{
+  auto now = chrono::steady_clock::now().time_since_epoch();
+  return chrono::duration_cast<chrono::microseconds>(now).count();
+}
+
+void TraceSpan::end()
+{
+  TraceEvent event;
+  event.name = name;
+  event.tag = tag;
+  event.startMicros = startMicros;
+  event.durationMicros = traceNowMicros() - startMicros;
+  traceBuffer()->events.push_back(event);
+}
+
+static void traceWriteAtExit()
+{
+  traceWrite();
+}
+
+void traceEnable(const char *filename)
+{
+  if (filename == NULL || *filename == '\0') {
+    return;
+  }
+
+  traceFilename = filename;
+
+  if (!traceIsEnabled) {
+    traceIsEnabled = true;
+    atexit(traceWriteAtExit);
+  }
+}
+
+// Totals for one span name, these are keyed by the name string since the
+// same literal can have more than one address.
+
+struct TraceSummary {
+  int64_t count;
+  int64_t totalMicros;
+  int64_t maxMicros;
+};
+
+void traceWrite()
+{
+  if (!traceIsEnabled) {
+    return;
+  }
+
+  lock_guard<mutex> lock(traceBuffersLock);
+
+  FILE *fp = fopen(traceFilename.c_str(), "w");
+
+  if (fp == NULL) {
+    fprintf(stderr, "could not write trace to \"%s\"\n", traceFilename.c_str());
+  }
+
+  int64_t originMicros = -1;
+
+  for ( TraceThreadBuffer *buffer : traceBuffers ) {
+    for ( TraceEvent &event : buffer->events ) {
+      if (originMicros == -1 || event.startMicros < originMicros) {
+        originMicros = event.startMicros;
+      }
+    }
+  }
+
+  unordered_map<string, TraceSummary> summaries;
+  vector<string> summaryOrder;
+
+  if (fp != NULL) {
+    fprintf(fp, "{\"traceEvents\":[\n");
+  }
+
+  bool first = true;
+
+  for ( TraceThreadBuffer *buffer : traceBuffers ) {
+    for ( TraceEvent &event : buffer->events ) {
+      if (fp != NULL) {
+        fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                first ? "" : ",\n",
+                event.name,
+                buffer->threadId,
+                (long long) (event.startMicros - originMicros),
+                (long long) event.durationMicros);
+
+        if (event.tag != -1) {
+          fprintf(fp, ",\"args\":{\"tag\":%d}", event.tag);
+        }
+
+        fprintf(fp, "}");
+        first = false;
+      }
+
+      auto it = summaries.find(event.name);
+
+      if (it == summaries.end()) {
+        TraceSummary summary = { 0, 0, 0 };
+        it = summaries.insert(make_pair(string(event.name), summary)).first;
+        summaryOrder.push_back(event.name);
+      }
+
+      TraceSummary &summary = it->second;
+      summary.count += 1;
+      summary.totalMicros += event.durationMicros;
+      summary.maxMicros = max(summary.maxMicros, event.durationMicros);
+    }
+
+    buffer->events.clear();
+  }
+
+  if (fp != NULL) {
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    fprintf(stderr, "wrote trace \"%s\"\n", traceFilename.c_str());
+  }
+
+  // Summary table sorted by total time, nested spans are counted in each
+  // enclosing span as well.
+
+  sort(begin(summaryOrder), end(summaryOrder), [&](const string &a, const string &b) {
+    return summaries[a].totalMicros > summaries[b].totalMicros;
+  });
+
+  fprintf(stderr, "%-32s %8s %12s %12s %12s\n", "span", "count", "total ms", "mean ms", "max ms");
+
+  for ( const string &name : summaryOrder ) {
+    TraceSummary &summary = summaries[name];
+    fprintf(stderr, "%-32s %8lld %12.3f %12.3f %12.3f\n",
+            name.c_str(),
+            (long long) summary.count,
+            summary.totalMicros / 1000.0,
+            summary.totalMicros / 1000.0 / summary.count,
+            summary.maxMicros / 1000.0);
+  }
+}
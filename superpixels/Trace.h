@@ -0,0 +1,66 @@
+// Scoped wall clock trace spans. When tracing is enabled each span records its
+// start time, duration, thread and an optional tag into a buffer owned by the
+// calling thread. At exit all spans are written as Chrome trace event JSON
+// (load in chrome://tracing or Perfetto) and a table that sums the time spent
+// in each span name is printed. When tracing is disabled a span costs one branch.
+
+#ifndef TRACE_H
+#define	TRACE_H
+
+#include <stdint.h>
+
+extern bool traceIsEnabled;
+
+static inline
+bool traceEnabled() {
+  return traceIsEnabled;
+}
+
+// Enable tracing and write the trace JSON to filename at exit. Does nothing
+// when filename is NULL or "".
+
+void traceEnable(const char *filename);
+
+// Write the JSON and summary now, this is also done at exit
+
+void traceWrite();
+
+// Microseconds from a steady clock
+
+int64_t traceNowMicros();
+
+class TraceSpan {
+public:
+  // name must be a string literal, tag is -1 when the span is not for a tag
+  
+  TraceSpan(const char *_name, int32_t _tag = -1)
+  : name(_name), tag(_tag), startMicros(traceEnabled() ? traceNowMicros() : -1)
+  {
+  }
+  
+  ~TraceSpan()
+  {
+    if (startMicros >= 0) {
+      end();
+    }
+  }
+  
+private:
+  const char *name;
+  int32_t tag;
+  int64_t startMicros;
+  
+  void end();
+  
+  TraceSpan(const TraceSpan &);
+  TraceSpan& operator=(const TraceSpan &);
+};
+
+#define TRACE_SPAN_CONCAT2(a, b) a ## b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT2(a, b)
+
+// Trace from this line to the end of the enclosing scope
+
+#define TRACE_SPAN(...) TraceSpan TRACE_SPAN_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+
+#endif // TRACE_H